@@ -0,0 +1,1310 @@
+/**
+ * \file    grr.hpp
+ * \brief   Regexes compiled along with the program, for C++20.
+ *
+ * grr::static_regex parses its pattern while the program is being compiled and stores the resulting NFA as a
+ * constant table, so nothing is parsed or allocated at run time.  The grammar and the matching rules are the
+ * same as grrCompile's, grrMatch's, and grrSearch's.  An invalid pattern fails to compile.
+ *
+ * This header doesn't need the library to be linked in.
+ */
+
+#ifndef __GRR_ENGINE_GRR_HPP__
+#define __GRR_ENGINE_GRR_HPP__
+
+#if __cplusplus < 202002L
+#error "grr.hpp requires C++20."
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+extern "C" {
+#include "nfaCompiler.h"
+}
+
+namespace grr {
+
+/**
+ * \brief   A string literal which can be used as a template argument.
+ */
+template <std::size_t N>
+struct fixed_string {
+    char value[N] = {};
+
+    constexpr fixed_string(const char (&string)[N]) noexcept {
+        for (std::size_t k = 0; k < N; k++) {
+            value[k] = string[k];
+        }
+    }
+
+    constexpr std::string_view view() const noexcept {
+        return {value, N - 1};
+    }
+};
+
+/**
+ * \brief   The outcome of static_regex::search.
+ */
+struct search_result {
+    /// Whether a match was found.
+    bool found = false;
+    /// The index of the beginning of the longest match, if one was found.
+    std::size_t start = 0;
+    /// The index of the character after the end of the longest match, if one was found.
+    std::size_t end = 0;
+    /// The index of the character where the search stopped, as with grrSearch's cursor.
+    std::size_t cursor = 0;
+
+    constexpr explicit operator bool() const noexcept {
+        return found;
+    }
+};
+
+namespace detail {
+
+// These mirror the definitions in nfaInternals.h and nfaCompiler.c.
+inline constexpr unsigned char empty_flag = 0x01;
+inline constexpr unsigned char first_flag = 0x02;
+inline constexpr unsigned char last_flag = 0x04;
+inline constexpr unsigned char lookahead_flag = 0x08;
+
+inline constexpr int invalid_character = -1;
+inline constexpr int whitespace_code = 0x100;
+inline constexpr int wildcard_code = 0x101;
+inline constexpr int empty_code = 0x102;
+inline constexpr int first_char_code = 0x103;
+inline constexpr int last_char_code = 0x104;
+inline constexpr int digit_code = 0x105;
+
+inline constexpr unsigned int max_codepoint = 0x10ffff;
+
+struct transition {
+    int motion = 0;
+    unsigned char flags = 0;
+    std::uint64_t symbols[4] = {};
+
+    constexpr void add(unsigned int c) noexcept {
+        symbols[c / 64] |= std::uint64_t(1) << (c % 64);
+    }
+
+    constexpr void remove(unsigned int c) noexcept {
+        symbols[c / 64] &= ~(std::uint64_t(1) << (c % 64));
+    }
+
+    constexpr bool accepts(unsigned char c) const noexcept {
+        return (symbols[c / 64] >> (c % 64)) & 1;
+    }
+};
+
+struct node {
+    transition transitions[2] = {};
+    bool two_transitions = false;
+};
+
+using fragment = std::vector<node>;
+
+struct codepoint_range {
+    unsigned int low;
+    unsigned int high;
+};
+
+struct character_class {
+    transition bytes;
+    std::vector<codepoint_range> ranges;
+};
+
+// Deliberately never defined.  Reaching a call while a pattern is being compiled stops the build, and the
+// message shows up in the compiler's diagnostic.
+void
+invalid_pattern(const char *message);
+
+consteval void
+fold_case(transition &t) {
+    for (unsigned int c = 'a'; c <= 'z'; c++) {
+        unsigned int upper = c - 'a' + 'A';
+
+        if (t.accepts(c) || t.accepts(upper)) {
+            t.add(c);
+            t.add(upper);
+        }
+    }
+}
+
+consteval void
+set_symbol(transition &t, int c, unsigned int flags) {
+    switch (c) {
+    case whitespace_code:
+        t.add(' ');
+        t.add('\t');
+        break;
+
+    case wildcard_code:
+        for (auto &word : t.symbols) {
+            word = ~std::uint64_t(0);
+        }
+        t.remove('\r');
+        t.remove('\n');
+        break;
+
+    case empty_code: t.flags |= empty_flag; break;
+
+    case first_char_code: t.flags |= first_flag; break;
+
+    case last_char_code: t.flags |= last_flag; break;
+
+    case digit_code:
+        for (unsigned int k = '0'; k <= '9'; k++) {
+            t.add(k);
+        }
+        break;
+
+    default:
+        t.add(c);
+        if (flags & GRR_COMPILE_CASELESS) {
+            fold_case(t);
+        }
+        break;
+    }
+}
+
+consteval fragment
+character_fragment(int c, unsigned int flags) {
+    fragment nfa(1);
+
+    nfa[0].transitions[0].motion = 1;
+    set_symbol(nfa[0].transitions[0], c, flags);
+    if (c == first_char_code || c == last_char_code) {
+        set_symbol(nfa[0].transitions[0], empty_code, 0);
+    }
+    return nfa;
+}
+
+consteval fragment
+byte_range_fragment(unsigned char low, unsigned char high) {
+    fragment nfa = character_fragment(low, 0);
+
+    for (unsigned int c = low + 1; c <= high; c++) {
+        nfa[0].transitions[0].add(c);
+    }
+    return nfa;
+}
+
+consteval void
+concatenate(fragment &nfa1, const fragment &nfa2) {
+    nfa1.insert(nfa1.end(), nfa2.begin(), nfa2.end());
+}
+
+consteval void
+add_disjunction(fragment &nfa1, const fragment &nfa2) {
+    unsigned int len1 = nfa1.size(), len2 = nfa2.size();
+    node split;
+
+    for (unsigned int k = 0; k < len1; k++) {
+        for (unsigned int j = 0; j <= nfa1[k].two_transitions; j++) {
+            if (k + nfa1[k].transitions[j].motion == len1) {
+                nfa1[k].transitions[j].motion += len2;
+            }
+        }
+    }
+
+    split.two_transitions = true;
+    for (auto &t : split.transitions) {
+        set_symbol(t, empty_code, 0);
+    }
+    split.transitions[0].motion = 1;
+    split.transitions[1].motion = len1 + 1;
+
+    nfa1.insert(nfa1.begin(), split);
+    concatenate(nfa1, nfa2);
+}
+
+consteval std::size_t
+resolve_braces(fragment &nfa, std::string_view pattern, std::size_t idx) {
+    std::size_t end, numNodes;
+    long value = 0;
+
+    for (end = idx + 1; end < pattern.size() && pattern[end] != '}'; end++) {
+        if (pattern[end] < '0' || pattern[end] > '9') {
+            invalid_pattern("Expected digit inside braces");
+        }
+    }
+    if (end == pattern.size()) {
+        invalid_pattern("Unclosed brace");
+    }
+    if (end == idx + 1) {
+        invalid_pattern("Empty braces");
+    }
+
+    for (std::size_t k = idx + 1; k < end; k++) {
+        value = value * 10 + (pattern[k] - '0');
+        if (value > 0x7fffffff) {
+            invalid_pattern("Invalid quantifier inside braces");
+        }
+    }
+
+    if (value == 0) {
+        nfa.clear();
+    } else {
+        numNodes = nfa.size();
+        for (long k = 1; k < value; k++) {
+            nfa.insert(nfa.end(), nfa.begin(), nfa.begin() + numNodes);
+        }
+    }
+    return end;
+}
+
+/*
+ * Applies the quantifier, if any, which follows idx.  Returns the index of the quantifier's last character or
+ * idx if there isn't one.
+ */
+consteval std::size_t
+apply_quantifier(fragment &nfa, std::string_view pattern, std::size_t idx) {
+    bool question = false, plus = false;
+
+    if (idx + 1 == pattern.size()) {
+        return idx;
+    }
+
+    switch (pattern[idx + 1]) {
+    case '?': question = true; break;
+
+    case '+': plus = true; break;
+
+    case '*': question = plus = true; break;
+
+    case '{': return resolve_braces(nfa, pattern, idx + 1);
+
+    default: return idx;
+    }
+
+    if (plus) {
+        node loop;
+
+        loop.two_transitions = true;
+        for (auto &t : loop.transitions) {
+            set_symbol(t, empty_code, 0);
+        }
+        loop.transitions[0].motion = -static_cast<int>(nfa.size());
+        loop.transitions[1].motion = 1;
+        nfa.push_back(loop);
+    }
+
+    if (question && !nfa.empty()) {
+        // The skip can only be added to the first node if nothing else transitions back to it (other than the
+        // loop added for a '+').
+        if (nfa[0].two_transitions || nfa.size() > (plus ? 2U : 1U)) {
+            node skip;
+
+            skip.two_transitions = true;
+            for (auto &t : skip.transitions) {
+                set_symbol(t, empty_code, 0);
+            }
+            skip.transitions[0].motion = 1;
+            skip.transitions[1].motion = nfa.size() + 1;
+            nfa.insert(nfa.begin(), skip);
+        } else {
+            nfa[0].transitions[1] = transition();
+            set_symbol(nfa[0].transitions[1], empty_code, 0);
+            nfa[0].transitions[1].motion = nfa.size();
+            nfa[0].two_transitions = true;
+        }
+    }
+
+    return idx + 1;
+}
+
+consteval int
+parse_hex_byte(std::string_view pattern, std::size_t idx) {
+    int value = 0;
+
+    if (idx + 2 > pattern.size()) {
+        return invalid_character;
+    }
+
+    for (std::size_t k = idx; k < idx + 2; k++) {
+        char c = pattern[k];
+
+        if (c >= '0' && c <= '9') {
+            value = value * 16 + (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value = value * 16 + (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            value = value * 16 + (c - 'A' + 10);
+        } else {
+            return invalid_character;
+        }
+    }
+    return value;
+}
+
+consteval int
+resolve_escape(std::string_view pattern, std::size_t &idx) {
+    int value;
+
+    if (idx + 1 == pattern.size()) {
+        return invalid_character;
+    }
+
+    switch (pattern[++idx]) {
+    case 't': return '\t';
+
+    case 'n': return '\n';
+
+    case 'r': return '\r';
+
+    case 'x':
+        value = parse_hex_byte(pattern, idx + 1);
+        if (value >= 0) {
+            idx += 2;
+        }
+        return value;
+
+    case '\\':
+    case '/':
+    case '(':
+    case ')':
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+    case '.':
+    case '*':
+    case '+':
+    case '?':
+    case '^':
+    case '$':
+    case '|': return static_cast<unsigned char>(pattern[idx]);
+
+    case 's': return whitespace_code;
+
+    case 'd': return digit_code;
+
+    default: return invalid_character;
+    }
+}
+
+/*
+ * Returns the length of the multibyte UTF-8 sequence starting at idx or 0 if there isn't a valid one.
+ */
+consteval unsigned int
+decode_utf8(std::string_view pattern, std::size_t idx, unsigned int &codepoint) {
+    unsigned int seqLen, value, minimum;
+    unsigned char c = pattern[idx];
+
+    if (c >= 0xc2 && c <= 0xdf) {
+        seqLen = 2;
+        value = c & 0x1f;
+        minimum = 0x80;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        seqLen = 3;
+        value = c & 0x0f;
+        minimum = 0x800;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        seqLen = 4;
+        value = c & 0x07;
+        minimum = 0x10000;
+    } else {
+        return 0;
+    }
+
+    if (idx + seqLen > pattern.size()) {
+        return 0;
+    }
+
+    for (unsigned int k = 1; k < seqLen; k++) {
+        c = pattern[idx + k];
+        if ((c & 0xc0) != 0x80) {
+            return 0;
+        }
+        value = (value << 6) | (c & 0x3f);
+    }
+
+    if (value < minimum || value > max_codepoint || (value >= 0xd800 && value <= 0xdfff)) {
+        return 0;
+    }
+
+    codepoint = value;
+    return seqLen;
+}
+
+consteval unsigned int
+encode_utf8(unsigned int codepoint, unsigned char *buffer) {
+    if (codepoint < 0x80) {
+        buffer[0] = codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        buffer[0] = 0xc0 | (codepoint >> 6);
+        buffer[1] = 0x80 | (codepoint & 0x3f);
+        return 2;
+    } else if (codepoint < 0x10000) {
+        buffer[0] = 0xe0 | (codepoint >> 12);
+        buffer[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        buffer[2] = 0x80 | (codepoint & 0x3f);
+        return 3;
+    } else {
+        buffer[0] = 0xf0 | (codepoint >> 18);
+        buffer[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+        buffer[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+        buffer[3] = 0x80 | (codepoint & 0x3f);
+        return 4;
+    }
+}
+
+consteval void
+add_codepoint_range(character_class &cls, unsigned int low, unsigned int high) {
+    for (; low < 0x80 && low <= high; low++) {
+        cls.bytes.add(low);
+    }
+    if (low <= high) {
+        cls.ranges.push_back({low, high});
+    }
+}
+
+consteval void
+merge_codepoint_ranges(character_class &cls) {
+    std::size_t length = 0;
+
+    if (cls.ranges.empty()) {
+        return;
+    }
+
+    std::sort(cls.ranges.begin(), cls.ranges.end(),
+              [](const codepoint_range &range1, const codepoint_range &range2) { return range1.low < range2.low; });
+    for (std::size_t k = 1; k < cls.ranges.size(); k++) {
+        if (cls.ranges[k].low <= cls.ranges[length].high + 1) {
+            cls.ranges[length].high = std::max(cls.ranges[length].high, cls.ranges[k].high);
+        } else {
+            cls.ranges[++length] = cls.ranges[k];
+        }
+    }
+    cls.ranges.resize(length + 1);
+}
+
+consteval void
+negate_codepoint_ranges(character_class &cls) {
+    unsigned int low = 0x80;
+    std::vector<codepoint_range> ranges;
+
+    merge_codepoint_ranges(cls);
+    ranges.swap(cls.ranges);
+    for (const auto &range : ranges) {
+        if (range.low > low) {
+            add_codepoint_range(cls, low, range.low - 1);
+        }
+        low = range.high + 1;
+    }
+    if (low <= max_codepoint) {
+        add_codepoint_range(cls, low, max_codepoint);
+    }
+}
+
+/*
+ * Adds the UTF-8 encodings of a range of codepoints to an NFA as alternatives.  The range is split until each
+ * piece can be expressed as a sequence of byte ranges.
+ */
+consteval void
+add_utf8_range(fragment &nfa, unsigned int low, unsigned int high) {
+    constexpr unsigned int boundaries[] = {0x7f, 0x7ff, 0xffff};
+    unsigned int seqLen;
+    unsigned char lowBytes[4] = {}, highBytes[4] = {};
+    fragment sequence;
+
+    if (low <= 0xdfff && high >= 0xd800) {
+        // Surrogates can't be encoded.
+        if (low < 0xd800) {
+            add_utf8_range(nfa, low, 0xd7ff);
+        }
+        if (high > 0xdfff) {
+            add_utf8_range(nfa, 0xe000, high);
+        }
+        return;
+    }
+
+    for (unsigned int boundary : boundaries) {
+        if (low <= boundary && high > boundary) {
+            add_utf8_range(nfa, low, boundary);
+            add_utf8_range(nfa, boundary + 1, high);
+            return;
+        }
+    }
+
+    for (unsigned int k = 1; k < 4; k++) {
+        unsigned int mask = (1U << (6 * k)) - 1;
+
+        if ((low & ~mask) != (high & ~mask)) {
+            if ((low & mask) != 0) {
+                add_utf8_range(nfa, low, low | mask);
+                add_utf8_range(nfa, (low | mask) + 1, high);
+                return;
+            }
+            if ((high & mask) != mask) {
+                add_utf8_range(nfa, low, (high & ~mask) - 1);
+                add_utf8_range(nfa, high & ~mask, high);
+                return;
+            }
+        }
+    }
+
+    seqLen = encode_utf8(low, lowBytes);
+    encode_utf8(high, highBytes);
+
+    sequence = byte_range_fragment(lowBytes[0], highBytes[0]);
+    for (unsigned int k = 1; k < seqLen; k++) {
+        concatenate(sequence, byte_range_fragment(lowBytes[k], highBytes[k]));
+    }
+    add_disjunction(nfa, sequence);
+}
+
+/*
+ * Reads a single character out of a character class.  A multibyte UTF-8 sequence is read as a codepoint while
+ * everything else is read as a single byte.
+ */
+consteval void
+read_class_member(std::string_view pattern, std::size_t &idx, unsigned int &value, bool &is_codepoint) {
+    unsigned int seqLen;
+    int character = invalid_character;
+
+    is_codepoint = false;
+
+    if (pattern[idx] == '\\') {
+        if (idx + 1 == pattern.size()) {
+            invalid_pattern("Unclosed character class");
+        }
+
+        switch (pattern[idx + 1]) {
+        case '[':
+        case ']':
+        case '\\':
+        case '-':
+        case '^': character = static_cast<unsigned char>(pattern[idx + 1]); break;
+
+        case 't': character = '\t'; break;
+
+        case 'n': character = '\n'; break;
+
+        case 'r': character = '\r'; break;
+
+        case 'x':
+            character = parse_hex_byte(pattern, idx + 2);
+            if (character != invalid_character) {
+                idx += 2;
+                break;
+            }
+            invalid_pattern("Invalid character escape");
+            break;
+
+        default: invalid_pattern("Invalid character escape"); break;
+        }
+
+        idx += 2;
+        value = character;
+        return;
+    }
+
+    seqLen = decode_utf8(pattern, idx, value);
+    if (seqLen > 0) {
+        is_codepoint = true;
+        idx += seqLen;
+    } else {
+        value = static_cast<unsigned char>(pattern[idx]);
+        idx++;
+    }
+}
+
+/*
+ * idx starts at the '[' and is left on the last character of the class or of its quantifier.
+ */
+consteval fragment
+resolve_character_class(std::string_view pattern, std::size_t &idx, unsigned int flags) {
+    std::size_t len = pattern.size();
+    bool negation;
+    character_class cls;
+    fragment nfa(1);
+
+    if (idx == len - 1) {
+        invalid_pattern("Unclosed character class");
+    }
+
+    if (pattern[idx + 1] == '^') {
+        negation = true;
+        idx += 2;
+    } else {
+        negation = false;
+        idx++;
+    }
+    if (idx < len && pattern[idx] == '-') {
+        cls.bytes.add('-');
+        idx++;
+    }
+    while (idx < len && pattern[idx] != ']') {
+        unsigned int low = 0, high = 0;
+        bool lowIsCodepoint = false, highIsCodepoint = false;
+
+        read_class_member(pattern, idx, low, lowIsCodepoint);
+        if (idx + 1 < len && pattern[idx] == '-' && pattern[idx + 1] != ']') {
+            idx++;
+            read_class_member(pattern, idx, high, highIsCodepoint);
+            if (high <= low || (low >= 0x80 && lowIsCodepoint != highIsCodepoint)) {
+                invalid_pattern("Invalid character class range");
+            }
+            lowIsCodepoint = highIsCodepoint;
+        } else {
+            high = low;
+        }
+
+        if (lowIsCodepoint) {
+            add_codepoint_range(cls, low, high);
+        } else {
+            for (unsigned int c = low; c <= high; c++) {
+                cls.bytes.add(c);
+            }
+        }
+    }
+
+    if (idx >= len) {
+        invalid_pattern("Unclosed character class");
+    }
+
+    if (flags & GRR_COMPILE_CASELESS) {
+        fold_case(cls.bytes);
+    }
+
+    if (negation) {
+        if (!cls.ranges.empty()) {
+            // A negated class with non-ASCII characters is negated over codepoints rather than bytes.
+            if (cls.bytes.symbols[2] || cls.bytes.symbols[3]) {
+                invalid_pattern("Negated character class mixes raw bytes with non-ASCII characters");
+            }
+            cls.bytes.symbols[0] = ~cls.bytes.symbols[0];
+            cls.bytes.symbols[1] = ~cls.bytes.symbols[1];
+            negate_codepoint_ranges(cls);
+        } else {
+            for (auto &word : cls.bytes.symbols) {
+                word = ~word;
+            }
+        }
+        cls.bytes.remove('\r');
+        cls.bytes.remove('\n');
+    } else {
+        merge_codepoint_ranges(cls);
+    }
+
+    nfa[0].transitions[0] = cls.bytes;
+    nfa[0].transitions[0].motion = 1;
+    for (const auto &range : cls.ranges) {
+        add_utf8_range(nfa, range.low, range.high);
+    }
+
+    idx = apply_quantifier(nfa, pattern, idx);
+    return nfa;
+}
+
+/*
+ * The same parse as grrCompileEx's, which keeps the NFAs' shapes identical.
+ */
+consteval fragment
+compile(std::string_view pattern, unsigned int flags) {
+    struct frame {
+        fragment nfa;
+        char reason;
+    };
+
+    std::size_t len = pattern.size();
+    std::vector<frame> stack;
+    fragment current;
+
+    if (len == 0) {
+        invalid_pattern("The pattern is empty");
+    }
+    if (flags & ~GRR_COMPILE_ALL_FLAGS) {
+        invalid_pattern("Unknown compilation flags");
+    }
+
+    for (std::size_t idx = 0; idx < len; idx++) {
+        int character = static_cast<unsigned char>(pattern[idx]);
+        unsigned int seqLen, codepoint = 0;
+        std::size_t open;
+        fragment temp;
+
+        switch (character) {
+        case '(':
+        case '|':
+            stack.push_back({std::move(current), static_cast<char>(character)});
+            current = fragment();
+            continue;
+
+        case ')':
+            for (open = stack.size(); open > 0 && stack[open - 1].reason != '('; open--) {}
+            if (open == 0) {
+                invalid_pattern("Closing parenthesis not matched by preceding opening parenthesis");
+            }
+            open--;
+
+            if (open < stack.size() - 1) {
+                temp = std::move(stack[open + 1].nfa);
+                for (std::size_t k = open + 2; k < stack.size(); k++) {
+                    add_disjunction(temp, stack[k].nfa);
+                }
+                add_disjunction(temp, current);
+                current = std::move(temp);
+            }
+
+            idx = apply_quantifier(current, pattern, idx);
+            concatenate(stack[open].nfa, current);
+            current = std::move(stack[open].nfa);
+            stack.resize(open);
+            continue;
+
+        case '[':
+            concatenate(current, resolve_character_class(pattern, idx, flags));
+            continue;
+
+        case ']': invalid_pattern("Unmatched bracket"); continue;
+
+        case '*':
+        case '+':
+        case '?': invalid_pattern("Invalid use of quantifier"); continue;
+
+        case '{': invalid_pattern("Invalid use of curly brace"); continue;
+
+        case '}': invalid_pattern("Unmatched curly brace"); continue;
+
+        case '\\':
+            character = resolve_escape(pattern, idx);
+            if (character == invalid_character) {
+                invalid_pattern("Invalid character escape");
+            }
+            temp = character_fragment(character, flags);
+            break;
+
+        case '.': temp = character_fragment(wildcard_code, flags); break;
+
+        case '^':
+            if (!current.empty()) {
+                invalid_pattern("'^' impossible to match");
+            }
+            temp = character_fragment(first_char_code, flags);
+            break;
+
+        case '$': temp = character_fragment(last_char_code, flags); break;
+
+        case '/':
+            if (++idx == len) {
+                invalid_pattern("Expecting character class following '/'");
+            }
+
+            if (pattern[idx] == '[') {
+                temp = resolve_character_class(pattern, idx, flags);
+                if (temp.size() != 1 || temp[0].two_transitions) {
+                    invalid_pattern("Lookahead must be a single-byte character class");
+                }
+            } else if (pattern[idx] == '\\') {
+                character = resolve_escape(pattern, idx);
+                if (character == invalid_character) {
+                    invalid_pattern("Invalid character escape");
+                }
+                temp = character_fragment(character, flags);
+            } else {
+                if (decode_utf8(pattern, idx, codepoint) > 0) {
+                    invalid_pattern("Lookahead must be a single byte");
+                }
+                temp = character_fragment(static_cast<unsigned char>(pattern[idx]), flags);
+            }
+            temp[0].transitions[0].flags |= lookahead_flag;
+            temp[0].transitions[0].flags &= ~empty_flag;
+
+            if (idx != len - 1) {
+                invalid_pattern("Unexpected text following ending bar");
+            }
+            concatenate(current, temp);
+            continue;
+
+        default:
+            seqLen = decode_utf8(pattern, idx, codepoint);
+            if (seqLen > 0) {
+                // A multibyte UTF-8 character is a single atom as far as quantifiers are concerned.
+                for (unsigned int k = 0; k < seqLen; k++) {
+                    concatenate(temp, character_fragment(static_cast<unsigned char>(pattern[idx + k]), 0));
+                }
+                idx += seqLen - 1;
+            } else {
+                temp = character_fragment(character, flags);
+            }
+            break;
+        }
+
+        idx = apply_quantifier(temp, pattern, idx);
+        concatenate(current, temp);
+    }
+
+    for (std::size_t k = stack.size(); k-- > 0;) {
+        if (stack[k].reason == '(') {
+            invalid_pattern("Unclosed open parenthesis");
+        }
+        add_disjunction(stack[k].nfa, current);
+        current = std::move(stack[k].nfa);
+    }
+
+    return current;
+}
+
+consteval std::size_t
+count_nodes(std::string_view pattern, unsigned int flags) {
+    return compile(pattern, flags).size();
+}
+
+template <std::size_t Length>
+consteval std::array<node, Length>
+freeze(std::string_view pattern, unsigned int flags) {
+    fragment nfa = compile(pattern, flags);
+    std::array<node, Length> frozen = {};
+
+    for (std::size_t k = 0; k < Length; k++) {
+        frozen[k] = nfa[k];
+    }
+    return frozen;
+}
+
+// The most entries a one-pass table may have, which is the same limit as grrCompile's.
+inline constexpr std::size_t max_one_pass_entries = 16 * 1024;
+
+/*
+ * A regex is one-pass if, once the empty transitions have been followed, at most one state can be reached on
+ * any given character.  match then follows a single state through a table with a row for each state which can
+ * be entered by consuming a character and a column for each class of characters, as nfaOnePass.c does.  Row 0
+ * is a dead state.  Entries are the offsets of the rows.
+ */
+template <std::size_t Rows, std::size_t Classes>
+struct one_pass {
+    unsigned int start = 0;
+    std::array<unsigned char, 256> classes = {};
+    std::array<unsigned int, Rows * Classes> next = {};
+    std::array<bool, Rows> accepting = {};
+
+    constexpr bool
+    match(std::string_view string) const noexcept {
+        unsigned int offset = start;
+
+        for (char c : string) {
+            offset = next[offset + classes[static_cast<unsigned char>(c)]];
+            if (offset == 0) {
+                return false;
+            }
+        }
+        return accepting[offset / Classes];
+    }
+};
+
+struct one_pass_shape {
+    std::size_t rows = 0;
+    std::size_t classes = 0;
+};
+
+/*
+ * Builds the one-pass table, if the regex is one-pass and the table isn't too big.  Otherwise, rows is left
+ * empty.
+ */
+template <std::size_t Length>
+consteval void
+build_one_pass(const std::array<node, Length> &nodes, std::vector<unsigned int> &rows,
+               std::array<unsigned char, 256> &classes, std::size_t &num_classes, std::vector<unsigned int> &next,
+               std::vector<bool> &accepting) {
+    constexpr unsigned int none = ~0U;
+    std::size_t numRows = 1;
+    std::vector<unsigned int> stack;
+    std::vector<bool> seen;
+
+    rows.assign(Length + 1, none);
+    rows[0] = numRows++;
+    for (std::size_t k = 0; k < Length; k++) {
+        for (unsigned int j = 0; j <= nodes[k].two_transitions; j++) {
+            unsigned int target = k + nodes[k].transitions[j].motion;
+
+            if (nodes[k].transitions[j].flags == 0 && rows[target] == none) {
+                rows[target] = numRows++;
+            }
+        }
+    }
+
+    // Split the bytes into classes which no consuming transition can tell apart.
+    classes.fill(0);
+    num_classes = 1;
+    for (const node &n : nodes) {
+        for (unsigned int j = 0; j <= n.two_transitions; j++) {
+            int newIds[512];
+            std::size_t nextClass = 0;
+
+            if (n.transitions[j].flags != 0) {
+                continue;
+            }
+            for (std::size_t i = 0; i < 2 * num_classes; i++) {
+                newIds[i] = -1;
+            }
+            for (unsigned int c = 0; c < 256; c++) {
+                unsigned int key = 2 * classes[c] + n.transitions[j].accepts(c);
+
+                if (newIds[key] < 0) {
+                    newIds[key] = nextClass++;
+                }
+                classes[c] = newIds[key];
+            }
+            num_classes = nextClass;
+        }
+    }
+
+    if (numRows * num_classes > max_one_pass_entries) {
+        rows.clear();
+        return;
+    }
+    next.assign(numRows * num_classes, 0);
+    accepting.assign(numRows, false);
+
+    for (std::size_t state = 0; state <= Length; state++) {
+        if (rows[state] == none) {
+            continue;
+        }
+
+        // In the middle of the string, grrMatch only crosses a lookahead which accepts the null character.
+        seen.assign(Length + 1, false);
+        seen[state] = true;
+        stack.assign(1, state);
+        while (!stack.empty()) {
+            unsigned int current = stack.back();
+
+            stack.pop_back();
+            if (current == Length) {
+                continue;
+            }
+            for (unsigned int j = 0; j <= nodes[current].two_transitions; j++) {
+                const transition &t = nodes[current].transitions[j];
+                unsigned int target = current + t.motion;
+
+                if (t.flags == 0) {
+                    for (unsigned int c = 0; c < 256; c++) {
+                        unsigned int &entry = next[rows[state] * num_classes + classes[c]];
+
+                        if (!t.accepts(c)) {
+                            continue;
+                        }
+                        if (entry != 0 && entry != rows[target] * num_classes) {
+                            rows.clear();
+                            return;
+                        }
+                        entry = rows[target] * num_classes;
+                    }
+                } else if ((!(t.flags & lookahead_flag) || t.accepts(0)) && !seen[target]) {
+                    seen[target] = true;
+                    stack.push_back(target);
+                }
+            }
+        }
+
+        // At the end of the string, every lookahead is crossed.
+        seen.assign(Length + 1, false);
+        seen[state] = true;
+        stack.assign(1, state);
+        while (!stack.empty()) {
+            unsigned int current = stack.back();
+
+            stack.pop_back();
+            if (current == Length) {
+                accepting[rows[state]] = true;
+                break;
+            }
+            for (unsigned int j = 0; j <= nodes[current].two_transitions; j++) {
+                const transition &t = nodes[current].transitions[j];
+                unsigned int target = current + t.motion;
+
+                if (t.flags != 0 && !seen[target]) {
+                    seen[target] = true;
+                    stack.push_back(target);
+                }
+            }
+        }
+    }
+}
+
+template <std::size_t Length>
+consteval one_pass_shape
+shape_one_pass(const std::array<node, Length> &nodes) {
+    std::vector<unsigned int> rows, next;
+    std::vector<bool> accepting;
+    std::array<unsigned char, 256> classes;
+    std::size_t numClasses = 0;
+    one_pass_shape shape;
+
+    build_one_pass(nodes, rows, classes, numClasses, next, accepting);
+    if (!rows.empty()) {
+        shape.rows = accepting.size();
+        shape.classes = numClasses;
+    }
+    return shape;
+}
+
+template <std::size_t Rows, std::size_t Classes, std::size_t Length>
+consteval one_pass<Rows, Classes>
+freeze_one_pass(const std::array<node, Length> &nodes) {
+    std::vector<unsigned int> rows, next;
+    std::vector<bool> accepting;
+    std::size_t numClasses = 0;
+    one_pass<Rows, Classes> frozen;
+
+    if constexpr (Rows > 0) {
+        build_one_pass(nodes, rows, frozen.classes, numClasses, next, accepting);
+        frozen.start = rows[0] * Classes;
+        for (std::size_t k = 0; k < next.size(); k++) {
+            frozen.next[k] = next[k];
+        }
+        for (std::size_t k = 0; k < Rows; k++) {
+            frozen.accepting[k] = accepting[k];
+        }
+    }
+    return frozen;
+}
+
+/*
+ * A state set simulation like the one in nfaRuntime.c, with its storage sized for the regex and kept on the
+ * stack.  Each thread remembers where its match began.  When two threads reach the same state, the first one
+ * to get there began earlier and so is kept.
+ */
+template <std::size_t Length>
+class simulation {
+public:
+    constexpr explicit simulation(const std::array<node, Length> &nodes) noexcept : nodes(nodes) {
+        sets[0].length = sets[1].length = 0;
+    }
+
+    constexpr bool
+    match(std::string_view string) noexcept {
+        // grrMatch ignores the anchors and only honors a lookahead at the end of the string.
+        constexpr unsigned char flags = first_flag | last_flag;
+
+        next_generation();
+        add_state(*current, 0, 0, 0, flags | (string.empty() ? lookahead_flag : 0), 0);
+        for (std::size_t idx = 0; idx < string.size(); idx++) {
+            if (current->length == 0) {
+                return false;
+            }
+
+            next_generation();
+            next->length = 0;
+            step(string[idx], idx, flags | ((idx + 1 == string.size()) ? lookahead_flag : 0), 0);
+            std::swap(current, next);
+        }
+
+        return stamps[Length] == generation;
+    }
+
+    constexpr search_result
+    search(std::string_view string) noexcept {
+        search_result result;
+        std::size_t lineEnd = std::min(string.find('\n'), string.find('\r'));
+        unsigned char flags;
+        char character;
+
+        result.cursor = lineEnd = std::min(lineEnd, string.size());
+        if (lineEnd == 0) {
+            return result;
+        }
+
+        flags = position_flags(string, lineEnd, 0, character);
+        next_generation();
+        add_state(*current, 0, 0, 0, flags, character);
+        for (std::size_t idx = 0; idx < lineEnd; idx++) {
+            flags = position_flags(string, lineEnd, idx + 1, character);
+            next_generation();
+            next->length = 0;
+            step(string[idx], idx, flags, character);
+            if (idx + 1 < lineEnd) {
+                add_state(*next, 0, idx + 1, idx + 1, flags, character);
+            }
+            std::swap(current, next);
+        }
+
+        if (best_end > best_start) {
+            result.found = true;
+            result.start = best_start;
+            result.end = best_end;
+        }
+        return result;
+    }
+
+private:
+    struct thread {
+        unsigned int state;
+        std::size_t start;
+    };
+
+    struct state_set {
+        std::array<thread, Length> threads;
+        std::size_t length;
+    };
+
+    const std::array<node, Length> &nodes;
+    // Only the stamps need to start out cleared.
+    state_set sets[2];
+    state_set *current = &sets[0], *next = &sets[1];
+    std::array<std::size_t, Length + 1> stamps = {};
+    std::array<unsigned int, Length + 1> stack;
+    std::size_t generation = 0;
+    std::size_t best_start = 0, best_end = 0;
+
+    constexpr void
+    next_generation() noexcept {
+        generation++;
+    }
+
+    static constexpr unsigned char
+    position_flags(std::string_view string, std::size_t line_end, std::size_t idx, char &character) noexcept {
+        unsigned char flags = (idx == 0) ? first_flag : 0;
+
+        if (idx == line_end) {
+            flags |= last_flag | lookahead_flag;
+            character = 0;
+        } else {
+            character = string[idx];
+        }
+        return flags;
+    }
+
+    constexpr void
+    step(char character, std::size_t idx, unsigned char flags, char next_character) noexcept {
+        for (std::size_t k = 0; k < current->length; k++) {
+            const thread &t = current->threads[k];
+            const node &n = nodes[t.state];
+
+            for (unsigned int j = 0; j <= n.two_transitions; j++) {
+                if (n.transitions[j].flags == 0 && n.transitions[j].accepts(character)) {
+                    add_state(*next, t.state + n.transitions[j].motion, t.start, idx + 1, flags, next_character);
+                }
+            }
+        }
+    }
+
+    constexpr void
+    add_state(state_set &set, unsigned int state, std::size_t start, std::size_t end, unsigned char flags,
+              char character) noexcept {
+        std::size_t depth = 0;
+
+        if (stamps[state] == generation) {
+            return;
+        }
+        stamps[state] = generation;
+        stack[depth++] = state;
+
+        while (depth > 0) {
+            bool consumes = false;
+
+            state = stack[--depth];
+            if (state == Length) {
+                if (end - start > best_end - best_start) {
+                    best_start = start;
+                    best_end = end;
+                }
+                continue;
+            }
+
+            const node &n = nodes[state];
+            for (unsigned int j = 0; j <= n.two_transitions; j++) {
+                const transition &t = n.transitions[j];
+                unsigned int target = state + t.motion;
+
+                if (t.flags & empty_flag) {
+                    if (t.flags & (first_flag | last_flag) & ~flags) {
+                        continue;
+                    }
+                } else if (t.flags & lookahead_flag) {
+                    if (!(flags & lookahead_flag) && !t.accepts(character)) {
+                        continue;
+                    }
+                } else {
+                    consumes = true;
+                    continue;
+                }
+
+                if (stamps[target] != generation) {
+                    stamps[target] = generation;
+                    stack[depth++] = target;
+                }
+            }
+
+            if (consumes) {
+                set.threads[set.length++] = {state, start};
+            }
+        }
+    }
+};
+
+}  // namespace detail
+
+/**
+ * \brief   A regex which is compiled along with the program.
+ *
+ * The pattern is parsed by the C++ compiler with the same grammar as grrCompile, so an invalid pattern is a
+ * compilation error.  The resulting states are stored as a constant table.  Matching keeps its state sets on
+ * the stack and never allocates.  match and search are constexpr and so can also be used in static_assert.
+ *
+ * \tparam Pattern  The regex.
+ * \tparam Flags    A bitwise-OR of grrCompileFlags values.
+ */
+template <fixed_string Pattern, unsigned int Flags = 0>
+class static_regex {
+    static constexpr std::size_t length = detail::count_nodes(Pattern.view(), Flags);
+    static constexpr std::array<detail::node, length> nodes = detail::freeze<length>(Pattern.view(), Flags);
+    static constexpr detail::one_pass_shape shape = detail::shape_one_pass(nodes);
+    static constexpr auto table = detail::freeze_one_pass<shape.rows, shape.classes>(nodes);
+
+public:
+    /**
+     * \brief           Determines if the entire string matches the regex, as grrMatch does.
+     *
+     * \param string    The string.
+     *
+     * \return          Whether the string matched.
+     */
+    static constexpr bool
+    match(std::string_view string) noexcept {
+        if constexpr (shape.rows > 0) {
+            return table.match(string);
+        } else {
+            return detail::simulation<length>(nodes).match(string);
+        }
+    }
+
+    /**
+     * \brief           Finds the longest match in the first line of a string, as grrSearch does.
+     *
+     * \param string    The string.  The search stops at the first '\n' or '\r'.
+     *
+     * \return          The match, if any, and where the search stopped.
+     */
+    static constexpr search_result
+    search(std::string_view string) noexcept {
+        return detail::simulation<length>(nodes).search(string);
+    }
+
+    /**
+     * \brief   Returns the pattern which the regex was compiled from.
+     */
+    static constexpr std::string_view
+    pattern() noexcept {
+        return Pattern.view();
+    }
+
+    /**
+     * \brief   Returns the number of states in the regex's table.
+     */
+    static constexpr std::size_t
+    num_states() noexcept {
+        return length;
+    }
+};
+
+}  // namespace grr
+
+#endif  // __GRR_ENGINE_GRR_HPP__
@@ -6,14 +6,24 @@
 #ifndef __GRR_ENGINE_NFA_H__
 #define __GRR_ENGINE_NFA_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nfaCache.h"
 #include "nfaCompiler.h"
 #include "nfaDef.h"
+#include "nfaIndex.h"
+#include "nfaRuleSet.h"
 #include "nfaRuntime.h"
+#include "nfaScan.h"
+#include "nfaScratch.h"
+#include "nfaSet.h"
 
 /**
  * \brief           Frees a regex object.
  *
- * \note            Returns immediately if nfa is NULL.
+ * \note            Returns immediately if nfa is NULL.  If the regex object came from grrCacheCompile, then
+ *                  this only releases the caller's reference to it.
  *
  * \param nfa       A Grr regex object.
  */
@@ -33,4 +43,99 @@ grrFreeNfa(grrNfa nfa);
 const char *
 grrDescription(grrNfa nfa);
 
+/**
+ * \brief       Returns the number of capturing groups of a regex object.
+ *
+ * \param nfa   A Grr regex object.
+ *
+ * \return      The number of parenthesized groups if the regex was compiled with GRR_COMPILE_CAPTURES and 0
+ *              otherwise (or if nfa is NULL).
+ */
+unsigned int
+grrNumGroups(grrNfa nfa);
+
+/**
+ * \brief       Returns the number of bytes of memory held by a regex object.
+ *
+ * The count includes the regex's compiled program, its lazily-built DFA (which grows as lines are searched up
+ * to a fixed bound), and the other tables built at compile time.  It does not include allocator overhead.
+ *
+ * \param nfa   A Grr regex object.
+ *
+ * \return      The number of bytes or 0 if nfa is NULL.
+ */
+size_t
+grrNfaMemoryUsage(grrNfa nfa);
+
+/**
+ * \brief   How a compiled regex will be run and roughly what it will cost.
+ */
+typedef struct grrExplanation {
+    /// The engine used by grrMatch.
+    grrEngine match_engine;
+    /// The engine used by grrSearch, grrCount, and grrMatchingLines.
+    grrEngine search_engine;
+    /// The number of states of the NFA, not counting the accepting state.  Counted repeats are expanded.
+    unsigned int num_states;
+    /// The number of transitions between the states.
+    unsigned int num_transitions;
+    /// The number of states whose transitions all consume a character.
+    unsigned int num_consuming_states;
+    /// The number of distinct character classes stored by the compiled program.
+    unsigned int num_classes;
+    /// The length of the shortest match or UINT_MAX if nothing can match.
+    unsigned int min_length;
+    /// The length of the longest match or UINT_MAX if there's no limit.
+    unsigned int max_length;
+    /// Whether every match must begin at the beginning of the line.
+    bool anchored_start;
+    /// Whether every match must end at the end of the line.
+    bool anchored_end;
+    /// If the regex is a plain string, the string, which isn't null-terminated.  Otherwise, NULL.
+    const char *literal;
+    /// The length of literal.
+    size_t literal_length;
+    /// The number of byte values which can begin a match.  grrSearch skips positions holding any others.
+    unsigned int num_first_bytes;
+    /// Inputs shorter than this are walked depth-first instead of through the state sets (unless the engine
+    /// doesn't use the NFA).
+    size_t backtrack_limit;
+    /// Whether the DFA used by grrSearch has at most 16 states before its first match.  If so, it's built in
+    /// full at compile time and run from a shuffle table, one SSSE3 instruction per byte where available.
+    bool small_dfa;
+    /// The estimated number of transitions looked at per byte by grrMatch.  1 for the table-driven engines.
+    /// For the NFA, it's an upper bound which assumes that every transition accepts the string.
+    double match_cost;
+    /// The same for grrSearch on random bytes.  With the DFA, lines containing a match also go through the
+    /// NFA.
+    double search_cost;
+} grrExplanation;
+
+/**
+ * \brief               Reports the engines which were chosen for a regex along with what they were chosen
+ *                      from.
+ *
+ * The engines are chosen when the regex is compiled according to its anchoring, literal content, and
+ * whether it's one-pass.  The costs are rough estimates meant for comparing regexes with each other.
+ *
+ * \param nfa           A Grr regex object.
+ * \param explanation   A pointer to the explanation to be populated.
+ *
+ * \return              GRR_RET_OK if successful.
+ *                      GRR_RET_BAD_ARGS if nfa or explanation is NULL.
+ *                      GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrExplain(grrNfa nfa, grrExplanation *explanation);
+
+/**
+ * \brief           Returns the name of an engine (e.g., "one-pass").
+ *
+ * \param engine    The engine.
+ *
+ * \return          The name or "unknown" if the value isn't a grrEngine.
+ */
+const char *
+grrEngineName(grrEngine engine);
+
 #endif  // __GRR_ENGINE_NFA_H__
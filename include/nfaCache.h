@@ -0,0 +1,86 @@
+/**
+ * \file    nfaCache.h
+ * \brief   Share compiled regexes between callers which compile the same patterns.
+ *
+ * A cache maps a pattern's text and compilation options to a compiled regex object.  Every caller asking for
+ * the same pattern gets the same object, which is reference-counted and released with grrFreeNfa.  The cache
+ * keeps at most a fixed number of regexes and evicts the least recently used one when it is full.  An evicted
+ * regex stays valid until the last caller holding it frees it.  A cache can be used by several threads at
+ * once.
+ */
+
+#ifndef __GRR_ENGINE_CACHE_H__
+#define __GRR_ENGINE_CACHE_H__
+
+#include <sys/types.h>
+
+#include "nfaCompiler.h"
+#include "nfaDef.h"
+
+/**
+ * \brief   Counters describing how a cache has been used.
+ */
+typedef struct grrCacheStats {
+    /// The number of lookups which found a compiled regex.
+    unsigned long hits;
+    /// The number of lookups which had to compile the pattern.
+    unsigned long misses;
+    /// The number of regexes which were dropped to make room for others.
+    unsigned long evictions;
+    /// The number of regexes currently in the cache.
+    size_t size;
+} grrCacheStats;
+
+/**
+ * \brief           Creates a cache.
+ *
+ * \param capacity  The maximum number of regexes which the cache will hold.
+ * \param cache     A pointer to the cache to be populated.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if capacity is 0 or cache is NULL.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrCreateCache(size_t capacity, grrCache *cache);
+
+/**
+ * \brief           Looks up a pattern in a cache and compiles it if it isn't there.
+ *
+ * \note            The regex object must be released with grrFreeNfa once the caller is done with it.
+ *
+ * \param cache     The cache.
+ * \param string    The string to be compiled (does not have to be null-terminated).
+ * \param len       The length of the string.
+ * \param options   The compilation options.  If NULL, then the defaults are used.  Only regexes compiled
+ *                  with the same flags and limits are shared.  If profile is set, then the pattern is
+ *                  compiled by itself and isn't cached.
+ * \param nfa       A pointer to the GrrEngine regex object to be populated.
+ * \return          GRR_RET_OK if successful.
+ *                  Otherwise, the same values as grrCompileEx.  Patterns which fail to compile are not
+ *                  cached.
+ */
+int
+grrCacheCompile(grrCache cache, const char *string, size_t len, const grrCompileOptions *options,
+                grrNfa *nfa);
+
+/**
+ * \brief           Reads the counters of a cache.
+ *
+ * \param cache     The cache.
+ * \param stats     A pointer to the counters to be populated.
+ */
+void
+grrCacheStatistics(grrCache cache, grrCacheStats *stats);
+
+/**
+ * \brief           Frees a cache.
+ *
+ * \note            Returns immediately if cache is NULL.  Regexes which callers are still holding remain
+ *                  valid.
+ *
+ * \param cache     The cache.
+ */
+void
+grrFreeCache(grrCache cache);
+
+#endif  // __GRR_ENGINE_CACHE_H__
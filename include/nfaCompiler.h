@@ -6,10 +6,55 @@
 #ifndef __GRR_ENGINE_COMPILER_H__
 #define __GRR_ENGINE_COMPILER_H__
 
+#include <stddef.h>
 #include <sys/types.h>
 
 #include "nfaDef.h"
 
+/**
+ * \brief   Flags which alter how a regex is compiled.
+ */
+enum grrCompileFlags {
+    /// ASCII letters match regardless of case.  Non-ASCII characters are not folded.
+    GRR_COMPILE_CASELESS = 0x01,
+    /// Parenthesized groups record where they matched for grrSearchSubmatches.  Without this, groups only
+    /// group.  Groups are numbered from 1 in the order of their opening parentheses.
+    GRR_COMPILE_CAPTURES = 0x02,
+};
+
+/**
+ * \brief   The union of all of the valid compilation flags.
+ */
+#define GRR_COMPILE_ALL_FLAGS (GRR_COMPILE_CASELESS | GRR_COMPILE_CAPTURES)
+
+/**
+ * \brief   The most states a regex may have while it's being compiled if grrCompileOptions doesn't say
+ *          otherwise.
+ */
+#define GRR_COMPILE_DEFAULT_MAX_STATES (64 * 1024)
+
+/**
+ * \brief   Options for grrCompileEx.
+ */
+typedef struct grrCompileOptions {
+    /// A bitwise-OR of grrCompileFlags values.
+    unsigned int flags;
+    /// If not NULL, the path of a profile written by grrWriteProfile for the same pattern and flags.  The
+    /// states which were visited most often are laid out next to each other.
+    const char *profile;
+    /// The most states the regex may have at any point while it's being compiled.  Every search keeps a
+    /// few words per state on the stack, so this also bounds that.  If 0, then GRR_COMPILE_DEFAULT_MAX_STATES
+    /// is used.  SIZE_MAX removes the limit.
+    size_t max_states;
+    /// If not 0, the most states per byte of the pattern.  This rejects short patterns which expand into
+    /// large NFAs, such as "(a|b){5000}", even if they're within max_states.  Note that a negated character
+    /// class or one with non-ASCII characters can need a few dozen states on its own.
+    unsigned int max_expansion;
+    /// The most memory, in bytes, for each of the two tables of the lazy DFA which grrSearch runs lines
+    /// through.  Once a table is full, it's emptied and rebuilt.  If 0, then the default of 256 KiB is used.
+    size_t dfa_memory;
+} grrCompileOptions;
+
 /**
  *  \brief          Compiles a string into a regex object.
  *
@@ -18,9 +63,73 @@
  *  \param nfa      A pointer to the GrrEngine regex object to be populated.
  *  \return         GRR_RET_OK if successful.
  *                  GRR_RET_BAD_ARGS if either string or nfa is NULL.
- *                  GRR_RET_BAD_DATA if the string contained non-printable characters.
+ *                  GRR_RET_BAD_DATA if the string was not a valid regex.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ *                  GRR_RET_TOO_COMPLEX if the regex needs more than GRR_COMPILE_DEFAULT_MAX_STATES states.
  */
 int
 grrCompile(const char *string, size_t len, grrNfa *nfa);
 
+/**
+ *  \brief          Compiles a string into a regex object with the specified options.
+ *
+ *  \param string   The string to be compiled (does not have to be null-terminated).
+ *  \param len      The length of the string.
+ *  \param options  The compilation options.  If NULL, then the defaults are used, which is the same as calling
+ *                  grrCompile.
+ *  \param nfa      A pointer to the GrrEngine regex object to be populated.
+ *  \return         GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if either string or nfa is NULL or if an unknown flag was specified.
+ *                  GRR_RET_BAD_DATA if the string was not a valid regex or the profile doesn't belong to
+ *                  it.
+ *                  GRR_RET_IO_ERROR if the profile couldn't be opened or read, in which case errno holds
+ *                  the reason.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ *                  GRR_RET_TOO_COMPLEX if the regex exceeds max_states or max_expansion.  Nothing larger
+ *                  than the limit is allocated before this is detected.
+ */
+int
+grrCompileEx(const char *string, size_t len, const grrCompileOptions *options, grrNfa *nfa);
+
+/**
+ *  \brief              Estimates how many states a pattern will need without compiling it.
+ *
+ *  The pattern is scanned once and only a word per parenthesis is allocated, so this is cheap enough to run
+ *  on untrusted patterns before deciding whether to compile them.  Bounded repetitions are multiplied out
+ *  just as the compiler does, so the estimate grows with them in the same way.  It's close to the number of
+ *  states which grrCompileEx counts against max_states, although the compiled regex is usually much smaller
+ *  once it has been optimized.  Invalid patterns are not detected.
+ *
+ *  \param string       The string to be compiled (does not have to be null-terminated).
+ *  \param len          The length of the string.
+ *  \param num_states   A pointer to where the estimate will be stored.  It saturates at SIZE_MAX.
+ *  \return             GRR_RET_OK if successful.
+ *                      GRR_RET_BAD_ARGS if string or num_states is NULL.
+ *                      GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrEstimateStates(const char *string, size_t len, size_t *num_states);
+
+/**
+ *  \brief          Searches every line of a buffer with a regex and writes a profile of which of its states
+ *                  were visited and how often.
+ *
+ *  Compiling the same pattern with the same flags and the profile (see grrCompileOptions) lays the states out
+ *  so that the most frequently visited ones share cache lines.  Without a profile, the states are laid out in
+ *  breadth-first order.  Either way, only the speed of matching is affected and never the results.
+ *
+ *  \param nfa      The GrrEngine regex object.
+ *  \param buffer   The text, which should be representative of what the regex will be used on.  It does not
+ *                  need to be null-terminated.
+ *  \param size     The length of the buffer.
+ *  \param path     The path of the profile to be written.
+ *  \return         GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if nfa or path is NULL or if buffer is NULL while size isn't 0.
+ *                  GRR_RET_IO_ERROR if the profile couldn't be written, in which case errno holds the
+ *                  reason.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrWriteProfile(grrNfa nfa, const char *buffer, size_t size, const char *path);
+
 #endif  // __GRR_ENGINE_COMPILER_H__
@@ -6,6 +6,9 @@
 #ifndef __GRR_ENGINE_NFA_DEF_H__
 #define __GRR_ENGINE_NFA_DEF_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
 /**
  * \brief Function return values.
  */
@@ -20,11 +23,101 @@ enum grrRetValue {
     GRR_RET_OUT_OF_MEMORY,
     /// Invalid data was passed to the function.
     GRR_RET_BAD_DATA,
+    /// The regex exceeds one of the limits of grrCompileOptions.
+    GRR_RET_TOO_COMPLEX,
+    /// The function ran out of its work budget before finishing.  See grrBudget.
+    GRR_RET_BUDGET_EXHAUSTED,
+    /// Reading or writing a file descriptor failed.  errno holds the reason.
+    GRR_RET_IO_ERROR,
 };
 
+/**
+ * \brief   The engines which a compiled regex can be run with.  See grrExplain.
+ */
+typedef enum grrEngine {
+    /// The regex can't match anything so no engine is run.
+    GRR_ENGINE_NONE = 0,
+    /// The regex is a plain string and is compared with memcmp or found with memmem.
+    GRR_ENGINE_LITERAL,
+    /// At most one state is ever in flight and it's followed through a table of next states.
+    GRR_ENGINE_ONE_PASS,
+    /// A lazily-built DFA rules out lines without a match before the NFA finds where the match is.
+    GRR_ENGINE_DFA,
+    /// The NFA is only started at the beginning of the line since the regex is anchored there.
+    GRR_ENGINE_ANCHORED,
+    /// The NFA is run backward from the end of the line since the regex is anchored only there.
+    GRR_ENGINE_REVERSE,
+    /// The NFA's state sets are simulated.
+    GRR_ENGINE_NFA,
+} grrEngine;
+
+/**
+ * \brief   A limit on the work done by grrMatchWithBudget, grrSearchWithBudget, and grrFirstMatchWithBudget.
+ *
+ * A call which runs out of steps returns GRR_RET_BUDGET_EXHAUSTED, reports where it stopped, and leaves the
+ * states it had in flight in its scratch object.  Passing the same budget back to the same function, after
+ * adding more steps, with the same scratch object, regexes, and input picks up from there.  Using the scratch
+ * object for anything else in between discards the suspended call.
+ */
+typedef struct grrBudget {
+    /// The most steps the call may take.  Carrying a state over a byte is a step and so is reading the byte,
+    /// so a line costs at most its length times the number of states plus one.  The steps which were taken
+    /// are subtracted.  A call always gets through at least one byte, even with no steps, so that repeated
+    /// calls always make progress.
+    size_t steps;
+    /// Set by a call which ran out of steps and cleared once a call finishes.  Clear it to start over
+    /// instead.
+    bool suspended;
+} grrBudget;
+
+/**
+ * \brief   Where a match, or one of its groups, was found by grrSearchSubmatches.
+ */
+typedef struct grrSubmatch {
+    /// The index of the first character.  GRR_SUBMATCH_UNSET if the group didn't take part in the match.
+    size_t start;
+    /// The index of the character after the last one.  GRR_SUBMATCH_UNSET if start is.
+    size_t end;
+} grrSubmatch;
+
+/**
+ * \brief   Marks a group which didn't take part in a match.
+ */
+#define GRR_SUBMATCH_UNSET ((size_t)-1)
+
 /**
  * \brief   An opaque reference to GrrEngine's regex object.
  */
 typedef struct grrNfaStruct *grrNfa;
 
+/**
+ * \brief   An opaque reference to a reusable block of matching scratch space.
+ */
+typedef struct grrScratchStruct *grrScratch;
+
+/**
+ * \brief   An opaque reference to a cache of compiled regexes.
+ */
+typedef struct grrCacheStruct *grrCache;
+
+/**
+ * \brief   An opaque reference to a set of regexes which are searched for together.
+ */
+typedef struct grrSetStruct *grrSet;
+
+/**
+ * \brief   An opaque reference to a trigram index of a buffer of lines.
+ */
+typedef struct grrIndexStruct *grrIndex;
+
+/**
+ * \brief   An opaque reference to a list of regexes which can be replaced while other threads scan with it.
+ */
+typedef struct grrRuleSetStruct *grrRuleSet;
+
+/**
+ * \brief   An opaque reference to a thread's registration with a rule set.
+ */
+typedef struct grrRuleReaderStruct *grrRuleReader;
+
 #endif  // __GRR_ENGINE_NFA_DEF_H__
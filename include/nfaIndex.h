@@ -0,0 +1,149 @@
+/**
+ * \file    nfaIndex.h
+ * \brief   Search large, unchanging buffers of lines without scanning all of them.
+ *
+ * An index splits a buffer into blocks of whole lines and records which trigrams (i.e., runs of three bytes
+ * without a line break) occur in each block.  The trigrams are hashed into a fixed-size filter per block, so
+ * a block may be reported as containing a trigram which it doesn't but never the other way around.
+ *
+ * To search the buffer with a regex, the trigrams which a line must contain for the regex to match in it are
+ * worked out from the compiled regex.  Only the blocks which could contain them are searched.  A regex which
+ * doesn't require any trigrams (e.g., "a.b" or "[0-9]+") gets every block as a candidate.
+ *
+ * An index only stays valid as long as the buffer it was built from doesn't change.  It can be written to a
+ * file and read back so that it only has to be built once.  Index files use the host's byte order.
+ */
+
+#ifndef __GRR_ENGINE_INDEX_H__
+#define __GRR_ENGINE_INDEX_H__
+
+#include <sys/types.h>
+
+#include "nfaDef.h"
+
+/**
+ * \brief               Builds an index of a buffer.
+ *
+ * \param buffer        The buffer (does not have to be null-terminated).
+ * \param size          The length of the buffer.
+ * \param block_size    The number of bytes per block.  A block is extended to the end of the line in which
+ *                      this falls.  Smaller blocks make for fewer bytes to search but a larger index.  Each
+ *                      block's filter takes max(64, block_size / 16) bytes, rounded up to a power of two and
+ *                      capped at 2 MiB, so blocks under 1 KiB make the index larger than 1/16 of the buffer.
+ * \param index         A pointer to the index to be populated.
+ * \return              GRR_RET_OK if successful.
+ *                      GRR_RET_BAD_ARGS if buffer is NULL while size isn't 0, block_size is 0, or index is
+ *                      NULL.
+ *                      GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrBuildIndex(const char *buffer, size_t size, size_t block_size, grrIndex *index);
+
+/**
+ * \brief           Writes an index to a file.
+ *
+ * \param index     The index.
+ * \param path      The path of the file to be written.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if index or path is NULL.
+ *                  GRR_RET_IO_ERROR if the file couldn't be written, in which case errno holds the reason.
+ */
+int
+grrWriteIndex(grrIndex index, const char *path);
+
+/**
+ * \brief           Reads an index written by grrWriteIndex.
+ *
+ * \param path      The path of the file.
+ * \param index     A pointer to the index to be populated.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if path or index is NULL.
+ *                  GRR_RET_BAD_DATA if the file isn't a valid index.
+ *                  GRR_RET_IO_ERROR if the file couldn't be opened or read, in which case errno holds the
+ *                  reason.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrReadIndex(const char *path, grrIndex *index);
+
+/**
+ * \brief           Returns the number of blocks of an index.
+ *
+ * \param index     The index.
+ * \return          The number of blocks or 0 if index is NULL.
+ */
+size_t
+grrIndexNumBlocks(grrIndex index);
+
+/**
+ * \brief                   Finds which blocks of an index could contain a match for a regex.
+ *
+ * \param index             The index.
+ * \param nfa               The GrrEngine regex object.
+ * \param candidates        A bitmap of at least (n + 7) / 8 bytes where n is the number of blocks.  Bit k % 8
+ *                          of byte k / 8 will be set if and only if block k could contain a match.
+ * \param num_candidates    A pointer which will, if not NULL, point to the number of candidate blocks.
+ * \return                  GRR_RET_OK if successful.
+ *                          GRR_RET_BAD_ARGS if index, nfa, or candidates is NULL.
+ *                          GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrIndexCandidates(grrIndex index, grrNfa nfa, unsigned char *candidates, size_t *num_candidates);
+
+/**
+ * \brief               Finds the next line of an indexed buffer containing a match, skipping the blocks which
+ *                      aren't candidates.
+ *
+ * The lines are searched with grrSearch.
+ *
+ * \param index         The index.
+ * \param nfa           The GrrEngine regex object.
+ * \param candidates    The candidate blocks found by grrIndexCandidates for the same regex.
+ * \param buffer        The buffer the index was built from.
+ * \param size          The length of the buffer.
+ * \param from          The index of the beginning of the line from which to start searching.
+ * \param start         A pointer which will, if not NULL, point to the index within the buffer of the
+ *                      beginning of the longest match in the line if one was found.
+ * \param end           A pointer which will, if not NULL, point to the index within the buffer of the
+ *                      character after the end of the match if one was found.
+ * \param cursor        A pointer which will, if not NULL, point to the index of the beginning of the line
+ *                      after the one containing the match, which is where the next search should start.  If
+ *                      no match was found, then it will point to the end of the buffer.
+ * \return              GRR_RET_OK if a match was found.
+ *                      GRR_RET_BAD_ARGS if index, nfa, candidates, or buffer is NULL or if from is past the
+ *                      end of the buffer.
+ *                      GRR_RET_BAD_DATA if size isn't the length of the buffer the index was built from.
+ *                      GRR_RET_NOT_FOUND if no match was found.
+ */
+int
+grrIndexSearch(grrIndex index, grrNfa nfa, const unsigned char *candidates, const char *buffer, size_t size,
+               size_t from, size_t *start, size_t *end, size_t *cursor);
+
+/**
+ * \brief           Counts the lines of an indexed buffer which contain a match in the same way as grrCount
+ *                  but only searches the candidate blocks.
+ *
+ * \param index     The index.
+ * \param nfa       The GrrEngine regex object.
+ * \param buffer    The buffer the index was built from.
+ * \param size      The length of the buffer.
+ * \param count     A pointer to where the number of matching lines will be stored.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if index, nfa, buffer, or count is NULL.
+ *                  GRR_RET_BAD_DATA if size isn't the length of the buffer the index was built from.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrIndexCount(grrIndex index, grrNfa nfa, const char *buffer, size_t size, size_t *count);
+
+/**
+ * \brief           Frees an index.
+ *
+ * \note            Returns immediately if index is NULL.
+ *
+ * \param index     The index.
+ */
+void
+grrFreeIndex(grrIndex index);
+
+#endif  // __GRR_ENGINE_INDEX_H__
@@ -1,6 +1,14 @@
 #ifndef __GRR_ENGINE_NFA_INTERNALS_H__
 #define __GRR_ENGINE_NFA_INTERNALS_H__
 
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
 #include "nfaDef.h"
 
 enum specialCharacterValues {
@@ -8,38 +16,380 @@ enum specialCharacterValues {
     GRR_NFA_FIRST_CHAR,
     GRR_NFA_LAST_CHAR,
     GRR_NFA_LOOKAHEAD,
-    GRR_NFA_TAB,
 };
 
 #define GRR_NFA_EMPTY_TRANSITION_FLAG (1 << GRR_NFA_EMPTY_TRANSITION)
 #define GRR_NFA_FIRST_CHAR_FLAG       (1 << GRR_NFA_FIRST_CHAR)
 #define GRR_NFA_LAST_CHAR_FLAG        (1 << GRR_NFA_LAST_CHAR)
 #define GRR_NFA_LOOKAHEAD_FLAG        (1 << GRR_NFA_LOOKAHEAD)
-#define GRR_NFA_TAB_FLAG              (1 << GRR_NFA_TAB)
 
-#define GRR_NFA_ASCII_OFFSET     5
-#define GRR_NFA_NUM_SYMBOLS      (GRR_NFA_ASCII_OFFSET + 0x7e + 1 - 0x20)  // ASCII printables
-#define GRR_NFA_ASCII_ADJUSTMENT (0x20 - GRR_NFA_ASCII_OFFSET)
+#define GRR_NFA_NUM_SYMBOLS 256  // Every byte value
+
+#define IS_LINE_BREAK(c) ((c) == '\r' || (c) == '\n')
+
+#define GRR_NFA_UNBOUNDED UINT_MAX
 
-#define ADJUST_CHARACTER(c) (((c) == '\t') ? GRR_NFA_TAB : (c)-GRR_NFA_ASCII_ADJUSTMENT)
+#define GRR_NFA_DFA_MEMORY     (256 * 1024)  // The size of each of the two tables of a regex's lazy DFA.
+#define GRR_NFA_SET_DFA_MEMORY (4 * 1024 * 1024)  // The same for a regex set.
+#define GRR_NFA_DFA_GAVE_UP    (-1)  // Returned by nfaDfaScanLine if the DFA couldn't decide.
+
+#define GRR_NFA_BACKTRACK_BITS (8 * 1024)  // The most (state, position) pairs the backtracker will track.
+#define GRR_NFA_ONE_PASS_MEMORY (64 * 1024)  // The largest table a one-pass regex may be compiled into.
 
 typedef struct nfaTransition {
     int motion;
-    unsigned char symbols[(GRR_NFA_NUM_SYMBOLS + 7) / 8];
+    unsigned char flags;
+    unsigned char symbols[GRR_NFA_NUM_SYMBOLS / 8];
 } nfaTransition;
 
 typedef struct nfaNode {
     nfaTransition transitions[2];
     unsigned char two_transitions;
+    unsigned int tag;  // 1 plus the capture slot which the node records the position into or 0 if none.
 } nfaNode;
 
+/*
+ * Once a regex has been compiled, its nodes are frozen into a read-only program held in a single allocation.
+ * Each state is encoded as a byte giving its number of transitions, with GRR_NFA_CODE_CONSUMING set if they
+ * all consume a character, followed by the transitions.  A transition starts with a tag byte holding its
+ * flags, how its characters are stored, and whether its motion (and class index) needs 32 bits instead of 16.
+ * Then come the motion and the characters:  nothing, a single byte, a range of bytes, or an index into the
+ * program's table of character classes.
+ */
+typedef struct nfaProgram {
+    const uint32_t *offsets;  // Where each state's encoding begins in code.
+    const unsigned char *classes;  // GRR_NFA_NUM_SYMBOLS / 8 bytes for each class.
+    const unsigned char *code;
+    unsigned int length;  // The number of states which were encoded.
+    unsigned int num_classes;
+    size_t size;  // Of the whole allocation.
+} nfaProgram;
+
+#define GRR_NFA_CODE_COUNT       0x03
+#define GRR_NFA_CODE_CONSUMING   0x80
+#define GRR_NFA_CODE_FLAGS       0x0f
+#define GRR_NFA_CODE_KIND_SHIFT  4
+#define GRR_NFA_CODE_WIDE        0x40
+#define GRR_NFA_CODE_NONE        0
+#define GRR_NFA_CODE_BYTE        1
+#define GRR_NFA_CODE_RANGE       2
+#define GRR_NFA_CODE_CLASS       3
+
+/*
+ * A decoded transition.  It consumes the characters from low to high or, if symbols isn't NULL, the
+ * characters of that class.
+ */
+typedef struct nfaEdge {
+    int motion;
+    unsigned char flags;
+    unsigned char low;
+    unsigned char high;
+    const unsigned char *symbols;
+} nfaEdge;
+
+typedef struct nfaReverseEdge {
+    unsigned int source;
+    unsigned char transition;
+} nfaReverseEdge;
+
 struct grrNfaStruct {
-    nfaNode *nodes;
+    nfaNode *nodes;  // Only used while compiling.  Freed once the program has been built.
+    nfaProgram *program;
     char *string;
     unsigned int length;
+    unsigned int flags;
+    unsigned int pattern_hash;  // Of the string and the flags.  Profiles are stamped with it.
+    unsigned char anchors;  // GRR_NFA_FIRST_CHAR_FLAG and/or GRR_NFA_LAST_CHAR_FLAG if every match is anchored.
+    unsigned int min_length;  // GRR_NFA_UNBOUNDED if nothing can match.
+    unsigned int max_length;  // GRR_NFA_UNBOUNDED if there's no limit.
+    unsigned char first_bytes[GRR_NFA_NUM_SYMBOLS / 8];  // The characters which can begin a match.
+    unsigned char *literal;  // Set if the regex is a plain string, possibly anchored.
+    unsigned int literal_length;
+    unsigned int *reverse_offsets;  // Only set for regexes which are anchored at the end but not the start.
+    nfaReverseEdge *reverse_edges;
+    struct nfaDfa *dfa;  // Shared by every thread searching with the regex.
+    struct nfaOnePass *one_pass;  // Only set if grrMatch never has more than one state in flight.
+    unsigned int *tags;  // Only set with GRR_COMPILE_CAPTURES.  Each state's tag as described for nfaNode.
+    unsigned int num_groups;
+    grrEngine match_engine;  // Chosen by nfaSelectEngines once everything else has been built.
+    grrEngine search_engine;
+    // One for each holder:  every caller given it by grrCompile or grrCacheCompile and every cache, set, and
+    // rule set snapshot keeping it.  grrFreeNfa only frees it once the last one lets go.
+    atomic_uint references;
 };
 
+/*
+ * Describes the NFA which a lazy DFA is built from.  The NFA may hold several patterns, each with its own
+ * starting and accepting states.  The accepting states don't need to have nodes.
+ */
+typedef struct nfaDfaSource {
+    const nfaProgram *program;
+    unsigned int num_states;  // Including the accepting states.
+    const unsigned int *accepting;  // For each state, 1 plus its pattern's index if it accepts and 0 if not.
+    unsigned int num_patterns;
+    const unsigned int *seeds;  // The starting states.
+    unsigned int num_seeds;
+    const unsigned char *first_bytes;  // The characters which can begin a match of any of the patterns.
+    size_t memory;
+} nfaDfaSource;
+
+/*
+ * The trigrams which a line must contain for a regex to match in it:  a conjunction of clauses, each of which
+ * is a disjunction of trigrams.  Each clause is stored as its length followed by its trigrams in ascending
+ * order.  A trigram's characters are packed into its low 24 bits with the first one highest.  A query without
+ * clauses is satisfied by every line.
+ */
+typedef struct nfaTrigramQuery {
+    uint32_t *clauses;
+    unsigned int num_clauses;
+    bool never;  // Set if no line can contain a match.
+} nfaTrigramQuery;
+
+typedef struct nfaStateRecord {
+    size_t start_idx;
+    size_t end_idx;
+    unsigned int state;
+} nfaStateRecord;
+
+/*
+ * An entry of the stack used while adding states with their capture slots.  A frame either visits a state,
+ * stores a state's record once the transitions before its consuming one have been followed, or puts a slot
+ * back the way it was once everything after a tagged state has been visited.
+ */
+typedef struct nfaCaptureFrame {
+    size_t value;  // The slot's previous value.
+    unsigned int state;
+    unsigned int slot;  // GRR_NFA_VISIT_FRAME, GRR_NFA_PLACE_FRAME, or the slot to be restored.
+} nfaCaptureFrame;
+
+#define GRR_NFA_VISIT_FRAME UINT_MAX
+#define GRR_NFA_PLACE_FRAME (UINT_MAX - 1)
+
+typedef struct nfaStateSet {
+    nfaStateRecord *records;
+    unsigned int length;
+} nfaStateSet;
+
+enum nfaSuspendedCall {
+    GRR_NFA_SUSPENDED_MATCH = 1,
+    GRR_NFA_SUSPENDED_SEARCH,
+    GRR_NFA_SUSPENDED_FIRST_MATCH,
+};
+
+/*
+ * Where a budgeted call which ran out of steps stopped.  The state sets themselves stay where they were in
+ * the scratch object's records.
+ */
+typedef struct nfaSuspension {
+    const void *owner;  // The regex, or list of regexes, of the call.  NULL if nothing is suspended.
+    unsigned char call;  // One of nfaSuspendedCall, so that a call can only be resumed by the same function.
+    size_t num;  // The number of regexes in the list.
+    size_t size;  // The length of the input.
+    size_t idx;  // The position of the next byte to be read.
+    size_t line_end;
+    nfaStateRecord best;
+    nfaStateSet current;  // The states in flight for grrMatch and grrSearch.
+    size_t num_active;  // The rest are for grrFirstMatch.
+    size_t champion_score;
+    ssize_t champion;
+} nfaSuspension;
+
+struct grrScratchStruct {
+    nfaStateRecord *records;
+    nfaStateSet *sets;
+    unsigned int *stamps;
+    unsigned int *stack;
+    size_t *active;  // The regexes of a grrFirstMatch list which are still running.
+    unsigned long *visits;  // Only set while profiling.  Counts how often each state is added to a set.
+    size_t *slots;  // The capture slots of each record, followed by those being built and the best match's.
+    nfaCaptureFrame *frames;
+    size_t record_capacity;
+    size_t set_capacity;
+    unsigned int state_capacity;
+    size_t slot_capacity;
+    size_t frame_capacity;
+    unsigned int generation;
+    nfaSuspension suspension;
+};
+
+int
+nfaOptimize(grrNfa nfa);
+
+int
+nfaAnalyze(grrNfa nfa);
+
+int
+nfaLayout(grrNfa nfa, const char *profile);
+
+unsigned int
+nfaHashPattern(const char *string, size_t len, unsigned int flags);
+
+int
+nfaDetectLiteral(grrNfa nfa);
+
+int
+nfaSelectEngines(grrNfa nfa, size_t dfa_memory);
+
+int
+nfaMatchLiteral(grrNfa nfa, const char *string, size_t len);
+
+int
+nfaSearchLiteral(grrNfa nfa, const char *string, size_t len, size_t *start, size_t *end, size_t *cursor);
+
+int
+nfaDetectOnePass(grrNfa nfa);
+
+int
+nfaOnePassMatch(const struct nfaOnePass *engine, const char *string, size_t len);
+
+size_t
+nfaOnePassMemoryUsage(const struct nfaOnePass *engine);
+
+int
+nfaBacktrackMatch(grrNfa nfa, const char *string, size_t len);
+
+int
+nfaBacktrackSearch(grrNfa nfa, const char *string, size_t line_end, size_t last_seed, size_t *start,
+                   size_t *end);
+
+int
+nfaBuildTrigramQuery(grrNfa nfa, nfaTrigramQuery *query);
+
+void
+nfaFreeTrigramQuery(nfaTrigramQuery *query);
+
+int
+nfaCreateProgram(const nfaNode *nodes, unsigned int length, nfaProgram **program);
+
+void
+nfaThawState(const nfaProgram *program, unsigned int state, nfaNode *node);
+
+int
+nfaCreateDfa(const nfaDfaSource *source, struct nfaDfa **dfa);
+
+int
+nfaAttachDfa(grrNfa nfa, size_t memory);
+
+void
+nfaFreeDfa(struct nfaDfa *dfa);
+
+int
+nfaDfaScanLine(struct nfaDfa *dfa, const char *string, size_t len, unsigned char *matched);
+
+size_t
+nfaDfaMemoryUsage(struct nfaDfa *dfa);
+
+bool
+nfaDfaIsShuffled(const struct nfaDfa *dfa);
+
+const char *
+nfaFindLiteral(grrNfa nfa, const char *string, size_t len);
+
+ssize_t
+nfaFirstMatch(grrNfa *nfa_list, const unsigned int *candidates, size_t num_candidates, grrScratch scratch,
+              const char *source, size_t size, grrBudget *budget, size_t *processed, size_t *score);
+
+int
+nfaProfile(grrNfa nfa, const char *buffer, size_t size, unsigned long *visits);
+
+size_t
+nfaLineEnd(const char *string, size_t len, size_t idx);
+
+size_t
+nfaNextLine(const char *buffer, size_t size, size_t idx);
+
+int
+nfaReserveScratch(grrScratch scratch, unsigned int num_states, size_t num_records, size_t num_sets);
+
+int
+nfaReserveCaptures(grrScratch scratch, size_t num_slots, size_t num_frames);
+
 #define SET_FLAG(state, flag)    (state)[(flag) / 8] |= (1 << ((flag) % 8))
 #define IS_FLAG_SET(state, flag) ((state)[(flag) / 8] & (1 << ((flag) % 8)))
 
+/*
+ * Decodes the transitions of a state into edges, which must have room for two.  Returns how many there are.
+ */
+static inline unsigned int
+nfaDecodeState(const nfaProgram *program, unsigned int state, nfaEdge *edges) {
+    const unsigned char *code = program->code + program->offsets[state];
+    unsigned int count = *code++ & GRR_NFA_CODE_COUNT;
+
+    for (unsigned int k = 0; k < count; k++) {
+        unsigned char tag = *code++;
+        uint32_t index;
+
+        edges[k].flags = tag & GRR_NFA_CODE_FLAGS;
+        if (tag & GRR_NFA_CODE_WIDE) {
+            int32_t motion;
+
+            memcpy(&motion, code, sizeof(motion));
+            code += sizeof(motion);
+            edges[k].motion = motion;
+        } else {
+            int16_t motion;
+
+            memcpy(&motion, code, sizeof(motion));
+            code += sizeof(motion);
+            edges[k].motion = motion;
+        }
+
+        edges[k].symbols = NULL;
+        switch (tag >> GRR_NFA_CODE_KIND_SHIFT & 0x03) {
+        case GRR_NFA_CODE_BYTE:
+            edges[k].low = edges[k].high = *code++;
+            break;
+
+        case GRR_NFA_CODE_RANGE:
+            edges[k].low = code[0];
+            edges[k].high = code[1];
+            code += 2;
+            break;
+
+        case GRR_NFA_CODE_CLASS:
+            if (tag & GRR_NFA_CODE_WIDE) {
+                memcpy(&index, code, sizeof(index));
+                code += sizeof(index);
+            } else {
+                uint16_t narrow;
+
+                memcpy(&narrow, code, sizeof(narrow));
+                code += sizeof(narrow);
+                index = narrow;
+            }
+            edges[k].symbols = program->classes + (size_t)index * (GRR_NFA_NUM_SYMBOLS / 8);
+            break;
+
+        default:
+            edges[k].low = 1;
+            edges[k].high = 0;
+            break;
+        }
+    }
+
+    return count;
+}
+
+static inline bool
+nfaStateConsumes(const nfaProgram *program, unsigned int state) {
+    return program->code[program->offsets[state]] & GRR_NFA_CODE_CONSUMING;
+}
+
+/*
+ * Determines if an input is short enough for the backtracker.
+ */
+static inline bool
+nfaCanBacktrack(grrNfa nfa, size_t len) {
+    return len < GRR_NFA_BACKTRACK_BITS && ((size_t)nfa->length + 1) * (len + 1) <= GRR_NFA_BACKTRACK_BITS;
+}
+
+static inline bool
+nfaEdgeAccepts(const nfaEdge *edge, unsigned char character) {
+    if (edge->symbols) {
+        return IS_FLAG_SET(edge->symbols, character);
+    }
+    // A single unsigned comparison.  An empty range has high == low - 1 and so accepts nothing.
+    return (unsigned int)(character - edge->low) < (unsigned int)(edge->high - edge->low + 1);
+}
+
 #endif  // __GRR_ENGINE_NFA_INTERNALS_H__
@@ -0,0 +1,131 @@
+/**
+ * \file    nfaRuleSet.h
+ * \brief   Swap the regexes which many threads are scanning with without stopping them.
+ *
+ * A rule set holds the current snapshot of a list of regexes along with a regex set built from them.  Threads
+ * which scan with the rules register as readers.  A reader enters the rule set to get the current snapshot
+ * and leaves it once it's done with the snapshot.  Neither takes a lock or waits for anything.
+ *
+ * Publishing a new list of regexes replaces the snapshot atomically.  Readers which entered before then keep
+ * using the old snapshot until they leave and readers which enter afterward get the new one.  The old
+ * snapshot, along with its references to its regexes, is released once every reader which could have seen it
+ * has left.  This is checked whenever rules are published and when the rule set is freed, so a snapshot may
+ * outlive its readers until the next publication.
+ */
+
+#ifndef __GRR_ENGINE_RULE_SET_H__
+#define __GRR_ENGINE_RULE_SET_H__
+
+#include <sys/types.h>
+
+#include "nfaDef.h"
+
+/**
+ * \brief   The regexes of a rule set as seen by a reader.
+ */
+typedef struct grrRuleSnapshot {
+    /// The regexes in the order in which they were published.  Not valid once the reader leaves.
+    const grrNfa *nfa_list;
+    /// The length of nfa_list.
+    size_t num;
+    /// A regex set built from nfa_list, so a regex's index is its id.  NULL if num is 0.
+    grrSet set;
+    /// Counts the publications, starting from 1.
+    unsigned long version;
+} grrRuleSnapshot;
+
+/**
+ * \brief               Creates a rule set without any rules.
+ *
+ * \param max_readers   The most readers which can be registered at once.
+ * \param rules         A pointer to the rule set to be populated.
+ * \return              GRR_RET_OK if successful.
+ *                      GRR_RET_BAD_ARGS if max_readers is 0 or rules is NULL.
+ *                      GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrCreateRuleSet(unsigned int max_readers, grrRuleSet *rules);
+
+/**
+ * \brief           Replaces the rules of a rule set.
+ *
+ * The new snapshot is visible to readers as soon as this returns.  Old snapshots which no reader can be using
+ * anymore are released.  Calls from several threads are serialized but never block the readers.
+ *
+ * \note            The rule set holds its own references to the regex objects and so the caller may free them
+ *                  afterward.
+ *
+ * \param rules     The rule set.
+ * \param nfa_list  The array of GrrEngine regex objects.  May be NULL if num is 0.
+ * \param num       The length of the array.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if rules is NULL, if nfa_list is NULL while num isn't 0, or if any of the
+ *                  regexes is NULL.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.  The old rules stay in place.
+ *                  GRR_RET_TOO_COMPLEX if the regexes together are too large to be run as one.  The old rules
+ *                  stay in place.
+ */
+int
+grrPublishRules(grrRuleSet rules, grrNfa *nfa_list, size_t num);
+
+/**
+ * \brief           Registers the calling thread as a reader of a rule set.
+ *
+ * \note            A reader must only be used by one thread at a time.
+ *
+ * \param rules     The rule set.
+ * \param reader    A pointer to the reader to be populated.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if rules or reader is NULL.
+ *                  GRR_RET_NOT_FOUND if max_readers readers are already registered.
+ */
+int
+grrRegisterRuleReader(grrRuleSet rules, grrRuleReader *reader);
+
+/**
+ * \brief           Gets the current snapshot of a rule set.
+ *
+ * The snapshot stays valid, even if new rules are published, until grrLeaveRules is called.  A reader must
+ * leave before entering again.
+ *
+ * \param reader    The reader.
+ * \param snapshot  A pointer to the snapshot to be populated.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if reader or snapshot is NULL.
+ *                  GRR_RET_NOT_FOUND if no rules have been published yet.  The reader doesn't need to leave.
+ */
+int
+grrEnterRules(grrRuleReader reader, grrRuleSnapshot *snapshot);
+
+/**
+ * \brief           Releases the snapshot which a reader got from grrEnterRules.
+ *
+ * \note            Returns immediately if reader is NULL.
+ *
+ * \param reader    The reader.
+ */
+void
+grrLeaveRules(grrRuleReader reader);
+
+/**
+ * \brief           Unregisters a reader so that its slot can be reused.
+ *
+ * \note            Returns immediately if reader is NULL.  The reader must have left the rule set.
+ *
+ * \param reader    The reader.
+ */
+void
+grrUnregisterRuleReader(grrRuleReader reader);
+
+/**
+ * \brief           Frees a rule set along with every snapshot it still holds.
+ *
+ * \note            Returns immediately if rules is NULL.  Every reader must have been unregistered.  Regexes
+ *                  which callers are still holding remain valid.
+ *
+ * \param rules     The rule set.
+ */
+void
+grrFreeRuleSet(grrRuleSet rules);
+
+#endif  // __GRR_ENGINE_RULE_SET_H__
@@ -20,19 +20,61 @@
  * \param len       The length of the string.
  * \return          GRR_RET_OK if the string matched the regex.
  *                  GRR_RET_BAD_ARGS is either nfa or string is NULL.
- *                  GRR_RET_BAD_DATA if the string contained a non-printable character.
+ *                  GRR_RET_NOT_FOUND if the string did not match the regex.
  */
 int
 grrMatch(grrNfa nfa, const char *string, size_t len);
 
+/**
+ * \brief           Same as grrMatch but uses a scratch object instead of the stack.
+ *
+ * \param nfa       The GrrEngine regex object.
+ * \param scratch   The scratch object.  It will be grown if necessary.
+ * \param string    The string (does not have to be null-terminated).
+ * \param len       The length of the string.
+ * \return          GRR_RET_OK if the string matched the regex.
+ *                  GRR_RET_BAD_ARGS is either nfa, scratch, or string is NULL.
+ *                  GRR_RET_NOT_FOUND if the string did not match the regex.
+ *                  GRR_RET_OUT_OF_MEMORY if the scratch object could not be grown.
+ */
+int
+grrMatchWithScratch(grrNfa nfa, grrScratch scratch, const char *string, size_t len);
+
+/**
+ * \brief           Same as grrMatchWithScratch but stops once it has taken as many steps as the budget
+ *                  allows.
+ *
+ * An engine which can't be stopped partway through is only used if the budget covers all of its work.
+ * Otherwise, the regex's state sets are run a byte at a time.  See grrBudget for how to resume.
+ *
+ * \param nfa       The GrrEngine regex object.
+ * \param scratch   The scratch object.  It will be grown if necessary and holds the states in flight if the
+ *                  budget runs out.
+ * \param string    The string (does not have to be null-terminated).
+ * \param len       The length of the string.
+ * \param budget    The budget.  The steps which were taken are subtracted from it.
+ * \param cursor    A pointer which will, if not NULL, point to the index of the next character to be read if
+ *                  the budget ran out.
+ * \return          GRR_RET_OK if the string matched the regex.
+ *                  GRR_RET_BAD_ARGS if nfa, scratch, string, or budget is NULL or if the budget is
+ *                  suspended but not by a grrMatchWithBudget call with the same regex, scratch object, and
+ *                  length.
+ *                  GRR_RET_NOT_FOUND if the string did not match the regex.
+ *                  GRR_RET_OUT_OF_MEMORY if the scratch object could not be grown.
+ *                  GRR_RET_BUDGET_EXHAUSTED if the budget ran out before the match was decided.
+ */
+int
+grrMatchWithBudget(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrBudget *budget,
+                   size_t *cursor);
+
 /**
  * \brief            Determines if a string contains a substring which matches the regex.
  *
- * The function will stop processing characters when either it exhausts the specified length, a newline is
- * encountered, or a non-printable character is encountered with tolerant set to false.  If tolerant is true,
- * then the function will skip over such characters and treat them as beginning and end of lines.  For
- * example, if the regex is "^a+" and the string is "aa\x00aaad", then both sequences of "a"'s will be
- * considered matches.  However, they will be considered separate matches and so *end-*start will be 3.
+ * The string is treated as a sequence of bytes.  The function will stop processing characters when either it
+ * exhausts the specified length or a line break (i.e., '\n' or '\r') is encountered.  The line break counts as
+ * the end of the line for the purposes of '$' and lookahead classes.
+ *
+ * If more than one substring matches, then the longest one is reported.  Ties go to the leftmost one.
  *
  * \param nfa       The GrrEngine regex object.
  * \param string    The string (does not have to be null-terminated).
@@ -43,36 +85,228 @@ grrMatch(grrNfa nfa, const char *string, size_t len);
  *                  the longest match if one was found.
  * \param cursor    A pointer which will, if not NULL, point to the index of the character where the function
  *                  stopped searching.
- * \param tolerant  Indicates whether or not the function should exit upon encountering a non-printable
- *                  character.
+ * \param tolerant  Ignored.  It is kept for compatibility with earlier versions, where it controlled the
+ *                  handling of non-printable characters.
  * \return          GRR_RET_OK if a substring match was found.
  *                  GRR_RET_BAD_ARGS if either nfa or string is NULL.
  *                  GRR_RET_NOT_FOUND if no substring match was found.
- *                  GRR_RET_BAD_DATA if the string contained a non-printable character and tolerant was set
- *                  to false.
  */
 int
 grrSearch(grrNfa nfa, const char *string, size_t len, size_t *start, size_t *end, size_t *cursor,
           bool tolerant);
 
+/**
+ * \brief           Same as grrSearch but uses a scratch object instead of the stack.
+ *
+ * \param nfa       The GrrEngine regex object.
+ * \param scratch   The scratch object.  It will be grown if necessary.
+ * \param string    The string (does not have to be null-terminated).
+ * \param len       The length of the string.
+ * \param start     A pointer which will, if not NULL, point to the index of the beginning of the longest
+ *                  match if one was found.
+ * \param end       A pointer which will, if not NULL, point to the index of the character after the end of
+ *                  the longest match if one was found.
+ * \param cursor    A pointer which will, if not NULL, point to the index of the character where the function
+ *                  stopped searching.
+ * \param tolerant  Ignored.  It is kept for compatibility with earlier versions, where it controlled the
+ *                  handling of non-printable characters.
+ * \return          GRR_RET_OK if a substring match was found.
+ *                  GRR_RET_BAD_ARGS if either nfa, scratch, or string is NULL.
+ *                  GRR_RET_NOT_FOUND if no substring match was found.
+ *                  GRR_RET_OUT_OF_MEMORY if the scratch object could not be grown.
+ */
+int
+grrSearchWithScratch(grrNfa nfa, grrScratch scratch, const char *string, size_t len, size_t *start,
+                     size_t *end, size_t *cursor, bool tolerant);
+
+/**
+ * \brief           Same as grrSearchWithScratch but stops once it has taken as many steps as the budget
+ *                  allows.
+ *
+ * The DFA and the other engines which can't be stopped partway through are only used if the budget covers
+ * all of their work.  Otherwise, the regex's state sets are run a byte at a time, which finds the same match.
+ * See grrBudget for how to resume.
+ *
+ * \param nfa       The GrrEngine regex object.
+ * \param scratch   The scratch object.  It will be grown if necessary and holds the states in flight if the
+ *                  budget runs out.
+ * \param string    The string (does not have to be null-terminated).
+ * \param len       The length of the string.
+ * \param budget    The budget.  The steps which were taken are subtracted from it.
+ * \param start     A pointer which will, if not NULL, point to the index of the beginning of the longest
+ *                  match if one was found.
+ * \param end       A pointer which will, if not NULL, point to the index of the character after the end of
+ *                  the longest match if one was found.
+ * \param cursor    A pointer which will, if not NULL, point to the index of the character where the function
+ *                  stopped searching.  If the budget ran out, then this is the next character to be read.
+ * \return          GRR_RET_OK if a substring match was found.
+ *                  GRR_RET_BAD_ARGS if nfa, scratch, string, or budget is NULL or if the budget is
+ *                  suspended but not by a grrSearchWithBudget call with the same regex, scratch object, and
+ *                  length.
+ *                  GRR_RET_NOT_FOUND if no substring match was found.
+ *                  GRR_RET_OUT_OF_MEMORY if the scratch object could not be grown.
+ *                  GRR_RET_BUDGET_EXHAUSTED if the budget ran out before the search finished.
+ */
+int
+grrSearchWithBudget(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrBudget *budget,
+                    size_t *start, size_t *end, size_t *cursor);
+
+/**
+ * \brief                   Same as grrSearch but also reports where each group of the match was found.
+ *
+ * The regex must have been compiled with GRR_COMPILE_CAPTURES for its groups to be reported.  The groups are
+ * recorded while the match is found, in the same left-to-right pass over the line, so the line is never
+ * scanned again.  The match itself is the same one which grrSearch would report.  Within it, the groups are
+ * those which a backtracking engine would settle on for that match:  alternatives are tried from left to
+ * right and quantifiers match as much as they can.  A group inside of a quantifier reports its last
+ * repetition.
+ *
+ * The state sets are always used (after the DFA, if the regex has one, has ruled out lines without a match)
+ * and so this is slower than grrSearch.  The scratch space is allocated on the heap.
+ *
+ * \param nfa               The GrrEngine regex object.
+ * \param string            The string (does not have to be null-terminated).
+ * \param len               The length of the string.
+ * \param submatches        An array of at least num_submatches entries.  Entry 0 is set to the whole match
+ *                          and entry k to group k.  Groups which didn't take part in the match, as well as
+ *                          entries past the last group, are set to GRR_SUBMATCH_UNSET.
+ * \param num_submatches    The length of the array.  Only the groups which fit are tracked.
+ * \param cursor            A pointer which will, if not NULL, point to the index of the character where the
+ *                          function stopped searching.
+ * \return                  GRR_RET_OK if a substring match was found.
+ *                          GRR_RET_BAD_ARGS if nfa, string, or submatches is NULL or if num_submatches is 0.
+ *                          GRR_RET_NOT_FOUND if no substring match was found.
+ *                          GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrSearchSubmatches(grrNfa nfa, const char *string, size_t len, grrSubmatch *submatches,
+                    size_t num_submatches, size_t *cursor);
+
+/**
+ * \brief                   Same as grrSearchSubmatches but uses a scratch object.
+ *
+ * \param nfa               The GrrEngine regex object.
+ * \param scratch           The scratch object.  It will be grown if necessary.
+ * \param string            The string (does not have to be null-terminated).
+ * \param len               The length of the string.
+ * \param submatches        An array of at least num_submatches entries.  See grrSearchSubmatches.
+ * \param num_submatches    The length of the array.
+ * \param cursor            A pointer which will, if not NULL, point to the index of the character where the
+ *                          function stopped searching.
+ * \return                  GRR_RET_OK if a substring match was found.
+ *                          GRR_RET_BAD_ARGS if nfa, scratch, string, or submatches is NULL or if
+ *                          num_submatches is 0.
+ *                          GRR_RET_NOT_FOUND if no substring match was found.
+ *                          GRR_RET_OUT_OF_MEMORY if the scratch object could not be grown.
+ */
+int
+grrSearchSubmatchesWithScratch(grrNfa nfa, grrScratch scratch, const char *string, size_t len,
+                               grrSubmatch *submatches, size_t num_submatches, size_t *cursor);
+
+/**
+ * \brief           Counts the lines of a buffer which contain a match.
+ *
+ * A line ends at '\n', '\r', or "\r\n".  A line counts if grrSearch would find a match in it.  Only whether
+ * each line matches is worked out and not where, so this is cheaper than calling grrSearch on each line.
+ *
+ * \param nfa       The GrrEngine regex object.
+ * \param buffer    The buffer (does not have to be null-terminated).
+ * \param size      The length of the buffer.
+ * \param count     A pointer to where the number of matching lines will be stored.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if nfa, buffer, or count is NULL.
+ */
+int
+grrCount(grrNfa nfa, const char *buffer, size_t size, size_t *count);
+
+/**
+ * \brief               Finds which lines of a buffer contain a match.
+ *
+ * Lines are delimited in the same way as for grrCount.  If the buffer ends with a line break, then there's no
+ * empty line after it.
+ *
+ * \param nfa           The GrrEngine regex object.
+ * \param buffer        The buffer (does not have to be null-terminated).
+ * \param size          The length of the buffer.
+ * \param matched       A bitmap of at least (max_lines + 7) / 8 bytes.  Bit k % 8 of byte k / 8 will be set
+ *                      if and only if line k (counting from 0) contains a match.
+ * \param max_lines     The most lines to process.
+ * \param num_lines     A pointer to where the number of lines processed will be stored.
+ * \return              GRR_RET_OK if any line matched.
+ *                      GRR_RET_BAD_ARGS if nfa, buffer, matched, or num_lines is NULL.
+ *                      GRR_RET_NOT_FOUND if no line matched.
+ */
+int
+grrMatchingLines(grrNfa nfa, const char *buffer, size_t size, unsigned char *matched, size_t max_lines,
+                 size_t *num_lines);
+
 /**
  * \brief               Returns the index of regex which matches the most of the input from a buffer.
  *
- * Characters are read from the buffer until either the buffer is exhausted, a non-printable character is
- * encountered, or all of the regexes have given up on matching the text.
+ * Characters are read from the buffer until either the buffer is exhausted, a line break (i.e., '\n' or '\r')
+ * is encountered, or all of the regexes have given up on matching the text.  A regex whose first character or
+ * minimum length rules out a match is given up on before any characters are read.
  *
  * \param nfa_list      The array of GrrEngine regex objects.
  * \param num           The length of the array.
  * \param source        The buffer holding the text.  It does not need to be null-terminated.
  * \param size          The number of characters to be processed.
  * \param processed     Pointer to where the number of processed characters is stored.
- * \param score         If a regex matched some portion of the text, then this points to where the most
- *                      number of characters matched is stored.
+ * \param score         If not NULL, points to where the most number of characters matched is stored.
  * \return              The index of the regex with the longest match of the input or -1 if either no such
- *                      match was found or any of the parameters were NULL/zero.
+ *                      match was found or any of the parameters were NULL/zero.  Ties go to the regex with
+ *                      the lowest index.
  */
 ssize_t
 grrFirstMatch(grrNfa *nfa_list, size_t num, const char *source, size_t size, size_t *processed,
               size_t *score);
 
+/**
+ * \brief               Same as grrFirstMatch but uses a scratch object instead of the stack.
+ *
+ * \param nfa_list      The array of GrrEngine regex objects.
+ * \param num           The length of the array.
+ * \param scratch       The scratch object.  It will be grown if necessary.
+ * \param source        The buffer holding the text.  It does not need to be null-terminated.
+ * \param size          The number of characters to be processed.
+ * \param processed     Pointer to where the number of processed characters is stored.
+ * \param score         If not NULL, points to where the most number of characters matched is stored.
+ * \return              The index of the regex with the longest match of the input or -1 if either no such
+ *                      match was found, any of the parameters were NULL/zero, or the scratch object could
+ *                      not be grown.
+ */
+ssize_t
+grrFirstMatchWithScratch(grrNfa *nfa_list, size_t num, grrScratch scratch, const char *source, size_t size,
+                         size_t *processed, size_t *score);
+
+/**
+ * \brief               Same as grrFirstMatchWithScratch but stops once it has taken as many steps as the
+ *                      budget allows.
+ *
+ * See grrBudget for how to resume.  The same array must be passed back.
+ *
+ * \param nfa_list      The array of GrrEngine regex objects.
+ * \param num           The length of the array.
+ * \param scratch       The scratch object.  It will be grown if necessary and holds the states in flight if
+ *                      the budget runs out.
+ * \param source        The buffer holding the text.  It does not need to be null-terminated.
+ * \param size          The number of characters to be processed.
+ * \param budget        The budget.  The steps which were taken are subtracted from it.
+ * \param processed     Pointer to where the number of processed characters is stored.
+ * \param score         If not NULL, points to where the most number of characters matched is stored.
+ * \param index         Pointer to where the index of the regex with the longest match is stored.  It's -1 if
+ *                      no match was found.
+ * \return              GRR_RET_OK if a match was found.
+ *                      GRR_RET_BAD_ARGS if nfa_list, any of its regexes, scratch, source, budget, processed,
+ *                      or index is NULL, if num or size is 0, or if the budget is suspended but not by a
+ *                      grrFirstMatchWithBudget call with the same array, num, scratch object, and size.
+ *                      GRR_RET_NOT_FOUND if no match was found.
+ *                      GRR_RET_OUT_OF_MEMORY if the scratch object could not be grown.
+ *                      GRR_RET_BUDGET_EXHAUSTED if the budget ran out.  processed is where the regexes
+ *                      stopped.
+ */
+int
+grrFirstMatchWithBudget(grrNfa *nfa_list, size_t num, grrScratch scratch, const char *source, size_t size,
+                        grrBudget *budget, size_t *processed, size_t *score, ssize_t *index);
+
 #endif  // __GRR_RUNTIME_H__
@@ -0,0 +1,78 @@
+/**
+ * \file    nfaScan.h
+ * \brief   Search every line read from a file descriptor.
+ *
+ * A background thread reads the input into one buffer while the lines of the other are searched, so reading
+ * and matching overlap.  Lines which straddle two reads are put back together before they're searched.  Each
+ * match is passed to a callback along with where it is within the input.
+ */
+
+#ifndef __GRR_ENGINE_SCAN_H__
+#define __GRR_ENGINE_SCAN_H__
+
+#include <sys/types.h>
+
+#include "nfaDef.h"
+
+/**
+ * \brief   The size of each of the two read buffers if grrScanFd isn't given one.
+ */
+#define GRR_SCAN_DEFAULT_BUFFER_SIZE (256 * 1024)
+
+/**
+ * \brief   A match found by grrScanFd.
+ */
+typedef struct grrScanMatch {
+    /// The line containing the match.  It isn't null-terminated, doesn't include the line break, and is only
+    /// valid during the callback.
+    const char *line;
+    /// The length of the line.
+    size_t line_length;
+    /// The number of the line, counting from 0.
+    size_t line_number;
+    /// The offset of the beginning of the line.  If the file descriptor can seek, then offsets are from the
+    /// beginning of the file.  Otherwise, they're from wherever reading started.
+    off_t line_offset;
+    /// The offset of the beginning of the longest match in the line.
+    off_t start;
+    /// The offset of the character after the end of the match.
+    off_t end;
+} grrScanMatch;
+
+/**
+ * \brief   Receives the matches found by grrScanFd.
+ *
+ * \param match     The match.
+ * \param arg       The argument which was passed to grrScanFd.
+ * \return          GRR_RET_OK to keep scanning.  Any other value stops the scan and is returned by grrScanFd.
+ */
+typedef int (*grrScanCallback)(const grrScanMatch *match, void *arg);
+
+/**
+ * \brief               Reads a file descriptor until the end and reports the match in each line which
+ *                      grrSearch would report.
+ *
+ * Lines end in the same way as for grrCount.  If the background thread can't be started, then the reads and
+ * the searches take turns instead.
+ *
+ * The input is read ahead of the line being searched.  So, if the scan stops before the end of the input,
+ * then the position of the file descriptor is past the line where it stopped, by up to two buffers.  Use the
+ * offsets of the last match to tell where to pick up again.
+ *
+ * \param nfa           The GrrEngine regex object.
+ * \param fd            The file descriptor.  It's read from its current position and isn't closed.
+ * \param buffer_size   The size of each of the two read buffers.  If 0, then GRR_SCAN_DEFAULT_BUFFER_SIZE is
+ *                      used.  Lines can be longer than this.
+ * \param callback      The function which is called for each match, in the order of the lines.
+ * \param arg           Passed to the callback.
+ * \return              GRR_RET_OK if any line contained a match.
+ *                      GRR_RET_BAD_ARGS if nfa or callback is NULL.
+ *                      GRR_RET_IO_ERROR if reading failed, in which case errno holds the reason.
+ *                      GRR_RET_NOT_FOUND if no line contained a match.
+ *                      GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ *                      Otherwise, the value returned by the callback which stopped the scan.
+ */
+int
+grrScanFd(grrNfa nfa, int fd, size_t buffer_size, grrScanCallback callback, void *arg);
+
+#endif  // __GRR_ENGINE_SCAN_H__
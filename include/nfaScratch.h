@@ -0,0 +1,52 @@
+/**
+ * \file    nfaScratch.h
+ * \brief   Reusable scratch space for the regex-matching functions.
+ *
+ * A scratch object holds the state sets that the matching functions need while running.  It can be reused
+ * across calls and across regexes and grows as needed to accommodate the largest regex that it has served.
+ * A scratch object must not be used by more than one thread at a time.
+ */
+
+#ifndef __GRR_ENGINE_SCRATCH_H__
+#define __GRR_ENGINE_SCRATCH_H__
+
+#include "nfaDef.h"
+
+/**
+ * \brief           Creates a scratch object.
+ *
+ * \param nfa       If not NULL, the scratch object will be sized to accommodate this regex object.
+ * \param scratch   A pointer to the scratch object to be populated.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if scratch is NULL.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrCreateScratch(grrNfa nfa, grrScratch *scratch);
+
+/**
+ * \brief           Ensures that a scratch object can accommodate a regex object.
+ *
+ * The matching functions which take a scratch object will grow it themselves as needed.  Calling this
+ * function ahead of time moves the allocation out of the matching path.
+ *
+ * \param scratch   The scratch object.
+ * \param nfa       The GrrEngine regex object.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if either scratch or nfa is NULL.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ */
+int
+grrGrowScratch(grrScratch scratch, grrNfa nfa);
+
+/**
+ * \brief           Frees a scratch object.
+ *
+ * \note            Returns immediately if scratch is NULL.
+ *
+ * \param scratch   The scratch object.
+ */
+void
+grrFreeScratch(grrScratch scratch);
+
+#endif  // __GRR_ENGINE_SCRATCH_H__
@@ -0,0 +1,137 @@
+/**
+ * \file    nfaSet.h
+ * \brief   Search a line for many regexes at once.
+ *
+ * A regex set scans a line a single time no matter how many regexes it holds and reports which of them
+ * matched.  The regexes are combined into one automaton which is built lazily as lines are scanned and shared
+ * by every thread using the set.  A set can be used by several threads at once.
+ */
+
+#ifndef __GRR_ENGINE_SET_H__
+#define __GRR_ENGINE_SET_H__
+
+#include <sys/types.h>
+
+#include "nfaDef.h"
+
+/**
+ * \brief   Where one of the regexes of a set matched.
+ */
+typedef struct grrSetMatch {
+    /// The index of the regex within the set.
+    size_t id;
+    /// The index of the beginning of the longest match.
+    size_t start;
+    /// The index of the character after the end of the longest match.
+    size_t end;
+} grrSetMatch;
+
+/**
+ * \brief           Creates a regex set.
+ *
+ * \note            The set holds its own references to the regex objects and so the caller may free them
+ *                  afterward.
+ *
+ * \param nfa_list  The array of GrrEngine regex objects.  A regex's index in the array is its id.
+ * \param num       The length of the array.
+ * \param set       A pointer to the set to be populated.
+ * \return          GRR_RET_OK if successful.
+ *                  GRR_RET_BAD_ARGS if nfa_list or set is NULL, num is 0, or any of the regexes is NULL.
+ *                  GRR_RET_OUT_OF_MEMORY if a memory allocation failed.
+ *                  GRR_RET_TOO_COMPLEX if the regexes together are too large to be run as one.
+ */
+int
+grrCreateSet(grrNfa *nfa_list, size_t num, grrSet *set);
+
+/**
+ * \brief           Finds which regexes of a set match somewhere in a line.
+ *
+ * The line ends at the first line break (i.e., '\n' or '\r') or after len characters.  A regex matches if
+ * grrSearch would report a match for it.
+ *
+ * \param set       The regex set.
+ * \param string    The string (does not have to be null-terminated).
+ * \param len       The length of the string.
+ * \param matched   A bitmap of at least (num + 7) / 8 bytes.  Bit k % 8 of byte k / 8 will be set if and
+ *                  only if the regex with id k matched.
+ * \param cursor    A pointer which will, if not NULL, point to the index of the character where the function
+ *                  stopped searching.
+ * \return          GRR_RET_OK if any of the regexes matched.
+ *                  GRR_RET_BAD_ARGS if set, string, or matched is NULL.
+ *                  GRR_RET_NOT_FOUND if none of the regexes matched.
+ */
+int
+grrSetSearch(grrSet set, const char *string, size_t len, unsigned char *matched, size_t *cursor);
+
+/**
+ * \brief               Same as grrSetSearch but lists the regexes which matched along with where they did.
+ *
+ * The matches are listed in order of id.  The span of each is the one which grrSearch would report.
+ *
+ * \param set           The regex set.
+ * \param string        The string (does not have to be null-terminated).
+ * \param len           The length of the string.
+ * \param matches       The array to be populated.
+ * \param capacity      The length of the array.  Matches which don't fit are counted but not stored.
+ * \param num_matches   A pointer to where the number of regexes which matched will be stored.
+ * \param cursor        A pointer which will, if not NULL, point to the index of the character where the
+ *                      function stopped searching.
+ * \return              GRR_RET_OK if any of the regexes matched.
+ *                      GRR_RET_BAD_ARGS if set, string, or num_matches is NULL or if matches is NULL while
+ *                      capacity isn't 0.
+ *                      GRR_RET_NOT_FOUND if none of the regexes matched.
+ */
+int
+grrSetSearchMatches(grrSet set, const char *string, size_t len, grrSetMatch *matches, size_t capacity,
+                    size_t *num_matches, size_t *cursor);
+
+/**
+ * \brief               Same as grrFirstMatch but for the regexes of a set.
+ *
+ * The set indexes its regexes by the characters which can begin their matches.  Only the regexes which can
+ * match the first character are run and each is dropped as soon as it gives up.  This makes the function much
+ * faster than grrFirstMatch when there are many regexes and most of them don't match.
+ *
+ * The stack only needs room for the regexes which one character can start.  If even that's too much, then a
+ * scratch object is allocated for the call instead.
+ *
+ * \param set           The regex set.
+ * \param source        The buffer holding the text.  It does not need to be null-terminated.
+ * \param size          The number of characters to be processed.
+ * \param processed     Pointer to where the number of processed characters is stored.
+ * \param score         If not NULL, points to where the most number of characters matched is stored.
+ * \return              The id of the regex with the longest match of the input or -1 if either no such
+ *                      match was found, any of the parameters were NULL/zero, or a memory allocation
+ *                      failed.  Ties go to the regex with the lowest id.
+ */
+ssize_t
+grrSetFirstMatch(grrSet set, const char *source, size_t size, size_t *processed, size_t *score);
+
+/**
+ * \brief               Same as grrSetFirstMatch but uses a scratch object instead of the stack.
+ *
+ * \param set           The regex set.
+ * \param scratch       The scratch object.  It will be grown if necessary.
+ * \param source        The buffer holding the text.  It does not need to be null-terminated.
+ * \param size          The number of characters to be processed.
+ * \param processed     Pointer to where the number of processed characters is stored.
+ * \param score         If not NULL, points to where the most number of characters matched is stored.
+ * \return              The id of the regex with the longest match of the input or -1 if either no such
+ *                      match was found, any of the parameters were NULL/zero, or the scratch object could
+ *                      not be grown.
+ */
+ssize_t
+grrSetFirstMatchWithScratch(grrSet set, grrScratch scratch, const char *source, size_t size,
+                            size_t *processed, size_t *score);
+
+/**
+ * \brief       Frees a regex set.
+ *
+ * \note        Returns immediately if set is NULL.
+ *
+ * \param set   The regex set.
+ */
+void
+grrFreeSet(grrSet set);
+
+#endif  // __GRR_ENGINE_SET_H__
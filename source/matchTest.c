@@ -3,14 +3,59 @@
 
 #include "nfa.h"
 
+typedef struct regressionCase {
+    const char *regex;
+    const char *string;
+    int expected;
+} regressionCase;
+
+static const regressionCase regressions[] = {
+    {"a{0}b{0}", "", GRR_RET_OK},
+    {"a{0}b{0}", "a", GRR_RET_NOT_FOUND},
+    {"(a{0}|b)1", "1", GRR_RET_OK},
+    {"(a{0}|b)1", "b1", GRR_RET_OK},
+    {"(a{0}|b)1", "a1", GRR_RET_NOT_FOUND},
+    {"(|a)b", "b", GRR_RET_OK},
+    {"(|a)b", "ab", GRR_RET_OK},
+};
+
+static int
+runRegressions(void) {
+    int failures = 0;
+
+    for (size_t k = 0; k < sizeof(regressions) / sizeof(regressions[0]); k++) {
+        int ret;
+        grrNfa nfa;
+        const regressionCase *test = &regressions[k];
+
+        ret = grrCompile(test->regex, strlen(test->regex), &nfa);
+        if (ret == GRR_RET_OK) {
+            ret = grrMatch(nfa, test->string, strlen(test->string));
+            grrFreeNfa(nfa);
+        }
+        if (ret != test->expected) {
+            printf("\"%s\" on \"%s\": expected %i but got %i.\n", test->regex, test->string, test->expected,
+                   ret);
+            failures++;
+        }
+    }
+
+    printf("%i of %zu regression cases failed.\n", failures, sizeof(regressions) / sizeof(regressions[0]));
+    return failures ? 1 : 0;
+}
+
 int
 main(int argc, char **argv) {
     int ret;
     grrNfa nfa;
 
+    if (argc == 2 && strcmp(argv[1], "--check") == 0) {
+        return runRegressions();
+    }
     if (argc < 3) {
         fprintf(stderr, "Missing arguments\n");
         fprintf(stderr, "Usage: %s <regex> <string>\n", argv[0]);
+        fprintf(stderr, "       %s --check\n", argv[0]);
         return -1;
     }
 
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "nfaInternals.h"
 
@@ -8,8 +9,20 @@ grrFreeNfa(grrNfa nfa) {
         return;
     }
 
+    // Only the last holder of a shared regex frees it.
+    if (atomic_fetch_sub(&nfa->references, 1) > 1) {
+        return;
+    }
+
     free(nfa->nodes);
+    free(nfa->program);
     free(nfa->string);
+    free(nfa->literal);
+    free(nfa->reverse_offsets);
+    free(nfa->reverse_edges);
+    nfaFreeDfa(nfa->dfa);
+    free(nfa->one_pass);
+    free(nfa->tags);
     free(nfa);
 }
 
@@ -17,3 +30,37 @@ const char *
 grrDescription(grrNfa nfa) {
     return nfa->string;
 }
+
+unsigned int
+grrNumGroups(grrNfa nfa) {
+    return nfa ? nfa->num_groups : 0;
+}
+
+size_t
+grrNfaMemoryUsage(grrNfa nfa) {
+    size_t total;
+
+    if (!nfa) {
+        return 0;
+    }
+
+    total = sizeof(*nfa) + nfa->program->size + strlen(nfa->string) + 1;
+    if (nfa->literal) {
+        total += nfa->literal_length;
+    }
+    if (nfa->reverse_offsets) {
+        total += sizeof(*nfa->reverse_offsets) * ((size_t)nfa->length + 2) +
+                 sizeof(*nfa->reverse_edges) * nfa->reverse_offsets[nfa->length + 1];
+    }
+    if (nfa->dfa) {
+        total += nfaDfaMemoryUsage(nfa->dfa);
+    }
+    if (nfa->one_pass) {
+        total += nfaOnePassMemoryUsage(nfa->one_pass);
+    }
+    if (nfa->tags) {
+        total += sizeof(*nfa->tags) * ((size_t)nfa->length + 1);
+    }
+
+    return total;
+}
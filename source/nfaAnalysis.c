@@ -0,0 +1,458 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+
+static int
+buildReverseIndex(grrNfa nfa);
+
+static bool
+isStartAnchored(const grrNfa nfa, unsigned int *stack, bool *visited);
+
+static bool
+isEndAnchored(const grrNfa nfa, unsigned int *stack, bool *visited);
+
+static void
+computeFirstBytes(grrNfa nfa, unsigned int *stack, bool *visited);
+
+static int
+computeMinLength(grrNfa nfa, unsigned int *order);
+
+static int
+computeMaxLength(grrNfa nfa, unsigned int *stack, bool *visited);
+
+int
+nfaAnalyze(grrNfa nfa) {
+    int ret;
+    unsigned int *stack;
+    bool *visited;
+
+    ret = buildReverseIndex(nfa);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+
+    stack = malloc(sizeof(*stack) * ((size_t)nfa->length + 1));
+    visited = malloc(sizeof(*visited) * ((size_t)nfa->length + 1));
+    if (!stack || !visited) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    nfa->anchors = 0;
+    if (isStartAnchored(nfa, stack, visited)) {
+        nfa->anchors |= GRR_NFA_FIRST_CHAR_FLAG;
+    }
+    if (isEndAnchored(nfa, stack, visited)) {
+        nfa->anchors |= GRR_NFA_LAST_CHAR_FLAG;
+    }
+
+    computeFirstBytes(nfa, stack, visited);
+
+    ret = computeMinLength(nfa, stack);
+    if (ret != GRR_RET_OK) {
+        goto done;
+    }
+
+    ret = computeMaxLength(nfa, stack, visited);
+
+done:
+
+    // The reverse index is only needed by the backward scan done for regexes anchored only at the end.
+    if (ret != GRR_RET_OK || nfa->anchors != GRR_NFA_LAST_CHAR_FLAG) {
+        free(nfa->reverse_offsets);
+        free(nfa->reverse_edges);
+        nfa->reverse_offsets = NULL;
+        nfa->reverse_edges = NULL;
+    }
+
+    free(stack);
+    free(visited);
+    return ret;
+}
+
+/*
+ * Builds, for every state (including the accepting one), the list of transitions which lead into it.  The
+ * transitions leading into state k are reverse_edges[reverse_offsets[k]] up to
+ * reverse_edges[reverse_offsets[k + 1]].
+ */
+static int
+buildReverseIndex(grrNfa nfa) {
+    unsigned int *offsets;
+    nfaReverseEdge *edges;
+    size_t numEdges = 0;
+
+    offsets = calloc((size_t)nfa->length + 2, sizeof(*offsets));
+    if (!offsets) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        for (unsigned int j = 0; j <= nfa->nodes[k].two_transitions; j++) {
+            offsets[k + nfa->nodes[k].transitions[j].motion + 1]++;
+            numEdges++;
+        }
+    }
+    for (unsigned int k = 1; k <= nfa->length + 1; k++) {
+        offsets[k] += offsets[k - 1];
+    }
+
+    edges = malloc(sizeof(*edges) * (numEdges + 1));
+    if (!edges) {
+        free(offsets);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    // Fill each bucket using the offset of the following bucket as a cursor and then shift everything back.
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        for (unsigned int j = 0; j <= nfa->nodes[k].two_transitions; j++) {
+            unsigned int target = k + nfa->nodes[k].transitions[j].motion;
+
+            edges[offsets[target + 1] - 1].source = k;
+            edges[offsets[target + 1] - 1].transition = j;
+            offsets[target + 1]--;
+        }
+    }
+    for (unsigned int k = 0; k <= nfa->length; k++) {
+        offsets[k] = offsets[k + 1];
+    }
+    offsets[nfa->length + 1] = numEdges;
+
+    nfa->reverse_offsets = offsets;
+    nfa->reverse_edges = edges;
+    return GRR_RET_OK;
+}
+
+/*
+ * A regex is anchored at the start if nothing can be consumed from the first state without passing through a
+ * '^'.  Seeding the first state anywhere but the beginning of the line is then pointless.
+ */
+static bool
+isStartAnchored(const grrNfa nfa, unsigned int *stack, bool *visited) {
+    unsigned int depth = 0;
+
+    memset(visited, 0, sizeof(*visited) * (nfa->length + 1));
+    stack[depth++] = 0;
+    visited[0] = true;
+    while (depth > 0) {
+        unsigned int state = stack[--depth];
+
+        if (state == nfa->length) {
+            continue;
+        }
+
+        for (unsigned int j = 0; j <= nfa->nodes[state].two_transitions; j++) {
+            const nfaTransition *transition = &nfa->nodes[state].transitions[j];
+            unsigned int target = state + transition->motion;
+
+            if (transition->flags == 0) {
+                return false;
+            }
+            if ((transition->flags & GRR_NFA_FIRST_CHAR_FLAG) || visited[target]) {
+                continue;
+            }
+            visited[target] = true;
+            stack[depth++] = target;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * A regex is anchored at the end if the accepting state can't be reached from a consuming transition without
+ * passing through a '$'.  Every nonempty match then ends at the end of the line.
+ */
+static bool
+isEndAnchored(const grrNfa nfa, unsigned int *stack, bool *visited) {
+    unsigned int depth = 0;
+
+    memset(visited, 0, sizeof(*visited) * (nfa->length + 1));
+    stack[depth++] = nfa->length;
+    visited[nfa->length] = true;
+    while (depth > 0) {
+        unsigned int state = stack[--depth];
+
+        for (unsigned int k = nfa->reverse_offsets[state]; k < nfa->reverse_offsets[state + 1]; k++) {
+            unsigned int source = nfa->reverse_edges[k].source;
+            const nfaTransition *transition = &nfa->nodes[source].transitions[nfa->reverse_edges[k].transition];
+
+            if (transition->flags == 0) {
+                return false;
+            }
+            if ((transition->flags & GRR_NFA_LAST_CHAR_FLAG) || visited[source]) {
+                continue;
+            }
+            visited[source] = true;
+            stack[depth++] = source;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Collects every byte which can be consumed by the first character of a match.  The conditions on the empty
+ * transitions are ignored and so the set may be larger than necessary but never smaller.
+ */
+static void
+computeFirstBytes(grrNfa nfa, unsigned int *stack, bool *visited) {
+    unsigned int depth = 0;
+
+    memset(nfa->first_bytes, 0, sizeof(nfa->first_bytes));
+    memset(visited, 0, sizeof(*visited) * (nfa->length + 1));
+    stack[depth++] = 0;
+    visited[0] = true;
+    while (depth > 0) {
+        unsigned int state = stack[--depth];
+
+        if (state == nfa->length) {
+            continue;
+        }
+
+        for (unsigned int j = 0; j <= nfa->nodes[state].two_transitions; j++) {
+            const nfaTransition *transition = &nfa->nodes[state].transitions[j];
+            unsigned int target = state + transition->motion;
+
+            if (transition->flags == 0) {
+                for (size_t k = 0; k < sizeof(nfa->first_bytes); k++) {
+                    nfa->first_bytes[k] |= transition->symbols[k];
+                }
+            } else if (!visited[target]) {
+                visited[target] = true;
+                stack[depth++] = target;
+            }
+        }
+    }
+}
+
+/*
+ * Finds the fewest number of characters along any path to the accepting state by expanding the states one
+ * distance at a time.  The states at each distance are stored consecutively in order.
+ */
+static int
+computeMinLength(grrNfa nfa, unsigned int *order) {
+    unsigned int *distances, levelStart = 0, levelEnd = 1, distance = 0;
+
+    distances = malloc(sizeof(*distances) * ((size_t)nfa->length + 1));
+    if (!distances) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    for (unsigned int k = 0; k <= nfa->length; k++) {
+        distances[k] = GRR_NFA_UNBOUNDED;
+    }
+
+    nfa->min_length = GRR_NFA_UNBOUNDED;
+    order[0] = 0;
+    distances[0] = 0;
+    while (levelStart < levelEnd) {
+        unsigned int nextEnd;
+
+        // Everything reachable through empty transitions is at the same distance.
+        for (unsigned int k = levelStart; k < levelEnd; k++) {
+            unsigned int state = order[k];
+
+            if (state == nfa->length) {
+                nfa->min_length = distance;
+                goto done;
+            }
+            for (unsigned int j = 0; j <= nfa->nodes[state].two_transitions; j++) {
+                const nfaTransition *transition = &nfa->nodes[state].transitions[j];
+                unsigned int target = state + transition->motion;
+
+                if (transition->flags != 0 && distances[target] == GRR_NFA_UNBOUNDED) {
+                    distances[target] = distance;
+                    order[levelEnd++] = target;
+                }
+            }
+        }
+
+        nextEnd = levelEnd;
+        for (unsigned int k = levelStart; k < levelEnd; k++) {
+            unsigned int state = order[k];
+
+            for (unsigned int j = 0; j <= nfa->nodes[state].two_transitions; j++) {
+                const nfaTransition *transition = &nfa->nodes[state].transitions[j];
+                unsigned int target = state + transition->motion;
+
+                if (transition->flags == 0 && distances[target] == GRR_NFA_UNBOUNDED) {
+                    distances[target] = distance + 1;
+                    order[nextEnd++] = target;
+                }
+            }
+        }
+
+        levelStart = levelEnd;
+        levelEnd = nextEnd;
+        distance++;
+    }
+
+done:
+
+    free(distances);
+    return GRR_RET_OK;
+}
+
+/*
+ * Finds the most number of characters along any path to the accepting state.  Only the states which lie on
+ * some path from the first state to the accepting state matter.  Among those, a cycle through a consuming
+ * transition means that there is no bound.  Otherwise, the strongly-connected components (which can only be
+ * loops of empty transitions) form a DAG and the longest path through it is computed.  Tarjan's algorithm
+ * produces the components in reverse topological order, which is the order the DAG needs to be processed in.
+ */
+static int
+computeMaxLength(grrNfa nfa, unsigned int *stack, bool *useful) {
+    int ret = GRR_RET_OK;
+    unsigned int numStates = nfa->length + 1, depth, counter = 0, numComponents = 0, componentDepth = 0;
+    unsigned int *indices, *lowLinks, *components, *componentStack, *edgePositions, *longest;
+    bool *reachable;
+
+    indices = malloc(sizeof(*indices) * numStates);
+    lowLinks = malloc(sizeof(*lowLinks) * numStates);
+    components = malloc(sizeof(*components) * numStates);
+    componentStack = malloc(sizeof(*componentStack) * numStates);
+    edgePositions = malloc(sizeof(*edgePositions) * numStates);
+    longest = malloc(sizeof(*longest) * numStates);
+    reachable = calloc(numStates, sizeof(*reachable));
+    if (!indices || !lowLinks || !components || !componentStack || !edgePositions || !longest || !reachable) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    nfa->max_length = GRR_NFA_UNBOUNDED;
+    if (nfa->min_length == GRR_NFA_UNBOUNDED) {
+        goto done;
+    }
+
+    // Forward reachability from the first state...
+    depth = 0;
+    stack[depth++] = 0;
+    reachable[0] = true;
+    while (depth > 0) {
+        unsigned int state = stack[--depth];
+
+        if (state == nfa->length) {
+            continue;
+        }
+        for (unsigned int j = 0; j <= nfa->nodes[state].two_transitions; j++) {
+            unsigned int target = state + nfa->nodes[state].transitions[j].motion;
+
+            if (!reachable[target]) {
+                reachable[target] = true;
+                stack[depth++] = target;
+            }
+        }
+    }
+
+    // ...and backward reachability from the accepting state.
+    memset(useful, 0, sizeof(*useful) * numStates);
+    depth = 0;
+    stack[depth++] = nfa->length;
+    useful[nfa->length] = true;
+    while (depth > 0) {
+        unsigned int state = stack[--depth];
+
+        for (unsigned int k = nfa->reverse_offsets[state]; k < nfa->reverse_offsets[state + 1]; k++) {
+            unsigned int source = nfa->reverse_edges[k].source;
+
+            if (reachable[source] && !useful[source]) {
+                useful[source] = true;
+                stack[depth++] = source;
+            }
+        }
+    }
+
+    for (unsigned int k = 0; k < numStates; k++) {
+        indices[k] = UINT_MAX;
+    }
+
+    // An iterative version of Tarjan's algorithm starting from the first state.  edgePositions holds, for each
+    // state on the call stack, which of its transitions is to be looked at next.
+    depth = 0;
+    stack[depth++] = 0;
+    indices[0] = lowLinks[0] = counter++;
+    edgePositions[0] = 0;
+    componentStack[componentDepth++] = 0;
+    components[0] = UINT_MAX;
+    while (depth > 0) {
+        unsigned int state = stack[depth - 1];
+        unsigned int numTransitions = (state == nfa->length) ? 0 : nfa->nodes[state].two_transitions + 1U;
+
+        if (edgePositions[state] < numTransitions) {
+            unsigned int target = state + nfa->nodes[state].transitions[edgePositions[state]++].motion;
+
+            if (!useful[target]) {
+                continue;
+            }
+            if (indices[target] == UINT_MAX) {
+                indices[target] = lowLinks[target] = counter++;
+                edgePositions[target] = 0;
+                components[target] = UINT_MAX;
+                componentStack[componentDepth++] = target;
+                stack[depth++] = target;
+            } else if (components[target] == UINT_MAX && indices[target] < lowLinks[state]) {
+                lowLinks[state] = indices[target];
+            }
+            continue;
+        }
+
+        depth--;
+        if (depth > 0 && lowLinks[state] < lowLinks[stack[depth - 1]]) {
+            lowLinks[stack[depth - 1]] = lowLinks[state];
+        }
+
+        if (lowLinks[state] == indices[state]) {
+            unsigned int top = componentDepth, member, best = 0;
+
+            do {
+                member = componentStack[--componentDepth];
+                components[member] = numComponents;
+            } while (member != state);
+
+            // Every component reachable from this one has already been popped.
+            for (unsigned int k = componentDepth; k < top; k++) {
+                member = componentStack[k];
+                if (member == nfa->length) {
+                    continue;
+                }
+
+                for (unsigned int j = 0; j <= nfa->nodes[member].two_transitions; j++) {
+                    const nfaTransition *transition = &nfa->nodes[member].transitions[j];
+                    unsigned int target = member + transition->motion, length;
+
+                    if (!useful[target]) {
+                        continue;
+                    }
+                    if (components[target] == numComponents) {
+                        if (transition->flags == 0) {
+                            goto done;
+                        }
+                        continue;
+                    }
+
+                    length = longest[components[target]] + (transition->flags == 0);
+                    if (length > best) {
+                        best = length;
+                    }
+                }
+            }
+
+            longest[numComponents++] = best;
+        }
+    }
+
+    nfa->max_length = longest[components[0]];
+
+done:
+
+    free(indices);
+    free(lowLinks);
+    free(components);
+    free(componentStack);
+    free(edgePositions);
+    free(longest);
+    free(reachable);
+    return ret;
+}
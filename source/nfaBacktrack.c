@@ -0,0 +1,166 @@
+#include <alloca.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+
+/*
+ * For short inputs, walking the NFA depth-first is cheaper than maintaining state sets.  Every (state,
+ * position) pair which has been reached is marked in a bitmap and never explored again, so the work is
+ * bounded by the size of the bitmap rather than growing exponentially.
+ *
+ * Where a pair leads doesn't depend on where the match began.  So, grrSearch's bitmap is kept from one
+ * starting position to the next:  if an earlier start already reached a pair, it reached the same ends with
+ * longer matches.
+ *
+ * Stack entries hold the position in the upper 16 bits and the state in the lower 16, which is enough since
+ * neither can exceed GRR_NFA_BACKTRACK_BITS.
+ */
+
+typedef struct backtracker {
+    grrNfa nfa;
+    const char *string;
+    size_t len;  // The end of the input, which is where '$' and lookaheads are satisfied.
+    size_t width;  // The number of positions, including the end.
+    unsigned char *visited;
+    unsigned int *stack;
+    bool matching;  // Whether grrMatch's rules apply rather than grrSearch's.
+} backtracker;
+
+static void
+initBacktracker(backtracker *bt, grrNfa nfa, const char *string, size_t len, bool matching);
+
+static ssize_t
+explore(backtracker *bt, size_t start);
+
+int
+nfaBacktrackMatch(grrNfa nfa, const char *string, size_t len) {
+    size_t bits;
+    backtracker bt;
+
+    initBacktracker(&bt, nfa, string, len, true);
+    bits = ((size_t)nfa->length + 1) * bt.width;
+    bt.visited = alloca(bits / 8 + 1);
+    memset(bt.visited, 0, bits / 8 + 1);
+    bt.stack = alloca(sizeof(*bt.stack) * bits);
+
+    return (explore(&bt, 0) == (ssize_t)len) ? GRR_RET_OK : GRR_RET_NOT_FOUND;
+}
+
+int
+nfaBacktrackSearch(grrNfa nfa, const char *string, size_t line_end, size_t last_seed, size_t *start,
+                   size_t *end) {
+    size_t bits, bestStart = 0, bestLength = 0;
+    backtracker bt;
+
+    initBacktracker(&bt, nfa, string, line_end, false);
+    bits = ((size_t)nfa->length + 1) * bt.width;
+    bt.visited = alloca(bits / 8 + 1);
+    memset(bt.visited, 0, bits / 8 + 1);
+    bt.stack = alloca(sizeof(*bt.stack) * bits);
+
+    // A later start can only win with a strictly longer match.
+    for (size_t idx = 0; idx <= last_seed && line_end - idx > bestLength; idx++) {
+        ssize_t farthest;
+
+        // State 0's row of the bitmap comes first.
+        if (!IS_FLAG_SET(nfa->first_bytes, (unsigned char)string[idx]) || IS_FLAG_SET(bt.visited, idx)) {
+            continue;
+        }
+
+        farthest = explore(&bt, idx);
+        if (farthest > (ssize_t)idx && (size_t)farthest - idx > bestLength) {
+            bestStart = idx;
+            bestLength = farthest - idx;
+        }
+    }
+
+    if (bestLength == 0) {
+        return GRR_RET_NOT_FOUND;
+    }
+
+    if (start) {
+        *start = bestStart;
+    }
+    if (end) {
+        *end = bestStart + bestLength;
+    }
+    return GRR_RET_OK;
+}
+
+static void
+initBacktracker(backtracker *bt, grrNfa nfa, const char *string, size_t len, bool matching) {
+    bt->nfa = nfa;
+    bt->string = string;
+    bt->len = len;
+    bt->width = len + 1;
+    bt->matching = matching;
+}
+
+/*
+ * Explores everything reachable from the first state at a position which hasn't been reached yet.  Returns
+ * the farthest position at which the accepting state was reached or -1 if it wasn't.
+ *
+ * The transitions are resolved in the same way as the state set simulation does.  grrMatch ignores the
+ * anchors and only treats the end of the string as satisfying a lookahead.  grrSearch honors the anchors at
+ * the beginning and end of the line and checks lookaheads against the next character.
+ */
+static ssize_t
+explore(backtracker *bt, size_t start) {
+    unsigned int depth = 0;
+    ssize_t farthest = -1;
+    grrNfa nfa = bt->nfa;
+
+    SET_FLAG(bt->visited, start);
+    bt->stack[depth++] = (unsigned int)start << 16;
+    while (depth > 0) {
+        unsigned int entry, state, count;
+        size_t pos;
+        unsigned char character;
+        nfaEdge edges[2];
+
+        entry = bt->stack[--depth];
+        state = entry & 0xffff;
+        pos = entry >> 16;
+        if (state == nfa->length) {
+            if ((ssize_t)pos > farthest) {
+                farthest = pos;
+                if (bt->matching && pos == bt->len) {
+                    break;
+                }
+            }
+            continue;
+        }
+
+        character = (pos < bt->len) ? bt->string[pos] : 0;
+        count = nfaDecodeState(nfa->program, state, edges);
+        for (unsigned int k = 0; k < count; k++) {
+            unsigned int target = state + edges[k].motion;
+            size_t next = pos, bit;
+
+            if (edges[k].flags & GRR_NFA_EMPTY_TRANSITION_FLAG) {
+                if (!bt->matching && (((edges[k].flags & GRR_NFA_FIRST_CHAR_FLAG) && pos != 0) ||
+                                      ((edges[k].flags & GRR_NFA_LAST_CHAR_FLAG) && pos != bt->len))) {
+                    continue;
+                }
+            } else if (edges[k].flags & GRR_NFA_LOOKAHEAD_FLAG) {
+                if (pos != bt->len && !nfaEdgeAccepts(&edges[k], bt->matching ? 0 : character)) {
+                    continue;
+                }
+            } else {
+                if (pos == bt->len || !nfaEdgeAccepts(&edges[k], character)) {
+                    continue;
+                }
+                next = pos + 1;
+            }
+
+            bit = target * bt->width + next;
+            if (IS_FLAG_SET(bt->visited, bit)) {
+                continue;
+            }
+            SET_FLAG(bt->visited, bit);
+            bt->stack[depth++] = (unsigned int)next << 16 | target;
+        }
+    }
+
+    return farthest;
+}
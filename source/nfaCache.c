@@ -0,0 +1,286 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfa.h"
+#include "nfaInternals.h"
+
+typedef struct cacheEntry {
+    grrNfa nfa;  // The cache holds one reference.  The pattern's text is nfa->string.
+    size_t len;
+    grrCompileOptions options;  // With the defaults filled in.  A regex compiled with a profile isn't cached.
+    unsigned int hash;
+    struct cacheEntry *next_in_bucket;
+    struct cacheEntry *newer;
+    struct cacheEntry *older;
+} cacheEntry;
+
+struct grrCacheStruct {
+    pthread_mutex_t lock;
+    cacheEntry **buckets;
+    size_t bucket_mask;
+    cacheEntry *newest;
+    cacheEntry *oldest;
+    size_t size;
+    size_t capacity;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+static void
+fillInOptions(const grrCompileOptions *options, grrCompileOptions *key);
+
+static unsigned int
+hashPattern(const char *string, size_t len, const grrCompileOptions *key);
+
+static cacheEntry *
+findEntry(grrCache cache, const char *string, size_t len, const grrCompileOptions *key, unsigned int hash);
+
+static void
+unlinkEntry(grrCache cache, cacheEntry *entry);
+
+static void
+pushNewest(grrCache cache, cacheEntry *entry);
+
+static void
+evictOldest(grrCache cache);
+
+int
+grrCreateCache(size_t capacity, grrCache *cache) {
+    size_t numBuckets;
+
+    if (capacity == 0 || !cache) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    *cache = calloc(1, sizeof(struct grrCacheStruct));
+    if (!*cache) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    for (numBuckets = 1; numBuckets < capacity; numBuckets *= 2) {}
+    (*cache)->buckets = calloc(numBuckets, sizeof(*(*cache)->buckets));
+    if (!(*cache)->buckets || pthread_mutex_init(&(*cache)->lock, NULL) != 0) {
+        free((*cache)->buckets);
+        free(*cache);
+        *cache = NULL;
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    (*cache)->bucket_mask = numBuckets - 1;
+    (*cache)->capacity = capacity;
+
+    return GRR_RET_OK;
+}
+
+int
+grrCacheCompile(grrCache cache, const char *string, size_t len, const grrCompileOptions *options,
+                grrNfa *nfa) {
+    int ret;
+    unsigned int hash;
+    grrNfa compiled;
+    grrCompileOptions key;
+    cacheEntry *entry;
+
+    if (!cache || !string || !nfa) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    // The layout depends on the profile's contents, which aren't part of the key, so the regex isn't shared.
+    if (options && options->profile) {
+        return grrCompileEx(string, len, options, nfa);
+    }
+
+    fillInOptions(options, &key);
+    hash = hashPattern(string, len, &key);
+
+    pthread_mutex_lock(&cache->lock);
+    entry = findEntry(cache, string, len, &key, hash);
+    if (entry) {
+        cache->hits++;
+        unlinkEntry(cache, entry);
+        pushNewest(cache, entry);
+        atomic_fetch_add(&entry->nfa->references, 1);
+        *nfa = entry->nfa;
+        pthread_mutex_unlock(&cache->lock);
+        return GRR_RET_OK;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Compiling is the slow part so it's done without holding the lock.
+    ret = grrCompileEx(string, len, options, &compiled);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+
+    entry = malloc(sizeof(*entry));
+    if (!entry) {
+        grrFreeNfa(compiled);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    {
+        cacheEntry *existing;
+
+        // Another thread may have compiled the same pattern in the meantime.
+        existing = findEntry(cache, string, len, &key, hash);
+        if (existing) {
+            atomic_fetch_add(&existing->nfa->references, 1);
+            *nfa = existing->nfa;
+            pthread_mutex_unlock(&cache->lock);
+
+            free(entry);
+            grrFreeNfa(compiled);
+            return GRR_RET_OK;
+        }
+    }
+
+    if (cache->size == cache->capacity) {
+        evictOldest(cache);
+    }
+
+    entry->nfa = compiled;
+    entry->len = len;
+    entry->options = key;
+    entry->hash = hash;
+    entry->next_in_bucket = cache->buckets[hash & cache->bucket_mask];
+    cache->buckets[hash & cache->bucket_mask] = entry;
+    pushNewest(cache, entry);
+    cache->size++;
+
+    atomic_fetch_add(&compiled->references, 1);
+    *nfa = compiled;
+    pthread_mutex_unlock(&cache->lock);
+
+    return GRR_RET_OK;
+}
+
+void
+grrCacheStatistics(grrCache cache, grrCacheStats *stats) {
+    if (!cache || !stats) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->size = cache->size;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void
+grrFreeCache(grrCache cache) {
+    if (!cache) {
+        return;
+    }
+
+    for (cacheEntry *entry = cache->newest; entry;) {
+        cacheEntry *older = entry->older;
+
+        grrFreeNfa(entry->nfa);
+        free(entry);
+        entry = older;
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+/*
+ * The limits are part of the key.  Otherwise, a regex compiled under loose limits would be handed to a caller
+ * whose limits it exceeds.
+ */
+static void
+fillInOptions(const grrCompileOptions *options, grrCompileOptions *key) {
+    memset(key, 0, sizeof(*key));
+    if (options) {
+        key->flags = options->flags;
+        key->max_states = options->max_states;
+        key->max_expansion = options->max_expansion;
+        key->dfa_memory = options->dfa_memory;
+    }
+
+    if (key->max_states == 0) {
+        key->max_states = GRR_COMPILE_DEFAULT_MAX_STATES;
+    }
+    if (key->dfa_memory == 0) {
+        key->dfa_memory = GRR_NFA_DFA_MEMORY;
+    }
+}
+
+static unsigned int
+hashPattern(const char *string, size_t len, const grrCompileOptions *key) {
+    unsigned int hash;
+
+    hash = nfaHashPattern(string, len, key->flags);
+    hash = (hash ^ (unsigned int)key->max_states) * 16777619U;
+    hash = (hash ^ key->max_expansion) * 16777619U;
+    hash = (hash ^ (unsigned int)key->dfa_memory) * 16777619U;
+    return hash;
+}
+
+static cacheEntry *
+findEntry(grrCache cache, const char *string, size_t len, const grrCompileOptions *key, unsigned int hash) {
+    cacheEntry *entry;
+
+    for (entry = cache->buckets[hash & cache->bucket_mask]; entry; entry = entry->next_in_bucket) {
+        if (entry->hash == hash && entry->len == len && entry->options.flags == key->flags &&
+            entry->options.max_states == key->max_states &&
+            entry->options.max_expansion == key->max_expansion &&
+            entry->options.dfa_memory == key->dfa_memory && memcmp(entry->nfa->string, string, len) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+unlinkEntry(grrCache cache, cacheEntry *entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+static void
+pushNewest(grrCache cache, cacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+/*
+ * Drops the cache's reference to the least recently used regex.  Callers still holding it keep it alive.
+ */
+static void
+evictOldest(grrCache cache) {
+    cacheEntry *entry = cache->oldest, **link;
+
+    link = &cache->buckets[entry->hash & cache->bucket_mask];
+    while (*link != entry) {
+        link = &(*link)->next_in_bucket;
+    }
+    *link = entry->next_in_bucket;
+    unlinkEntry(cache, entry);
+    cache->size--;
+    cache->evictions++;
+
+    grrFreeNfa(entry->nfa);
+    free(entry);
+}
@@ -1,6 +1,6 @@
 #include <ctype.h>
-#include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,19 +9,25 @@
 #include "nfa.h"
 #include "nfaInternals.h"
 
-#define GRR_INVALID_CHARACTER     0x00
-#define GRR_WHITESPACE_CODE       0x01
-#define GRR_WILDCARD_CODE         0x02
-#define GRR_EMPTY_TRANSITION_CODE 0x03
-#define GRR_FIRST_CHAR_CODE       0x04
-#define GRR_LAST_CHAR_CODE        0x05
-#define GRR_DIGIT_CODE            0x06
+/*
+ * Symbol codes are either byte values or one of the following special codes.
+ */
+#define GRR_INVALID_CHARACTER     -1
+#define GRR_WHITESPACE_CODE       0x100
+#define GRR_WILDCARD_CODE         0x101
+#define GRR_EMPTY_TRANSITION_CODE 0x102
+#define GRR_FIRST_CHAR_CODE       0x103
+#define GRR_LAST_CHAR_CODE        0x104
+#define GRR_DIGIT_CODE            0x105
+
+#define GRR_MAX_CODEPOINT 0x10ffff
 
 #define GRR_NFA_PADDING 5
 
 typedef struct nfaStackFrame {
     grrNfa nfa;
     size_t idx;
+    unsigned int group;  // For a '(', the group's number.
     char reason;
 } nfaStackFrame;
 
@@ -29,8 +35,25 @@ typedef struct nfaStack {
     nfaStackFrame *frames;
     size_t length;
     size_t capacity;
+    size_t num_states;  // Held by the frames' NFAs.
 } nfaStack;
 
+typedef struct nfaCodepointRange {
+    unsigned int low;
+    unsigned int high;
+} nfaCodepointRange;
+
+/*
+ * A character class under construction.  Single bytes (including all of ASCII) are kept in the bitmap while
+ * non-ASCII codepoints are kept as ranges which will be compiled into UTF-8 byte sequences.
+ */
+typedef struct nfaCharacterClass {
+    unsigned char bytes[GRR_NFA_NUM_SYMBOLS / 8];
+    nfaCodepointRange *ranges;
+    size_t num_ranges;
+    size_t capacity;
+} nfaCharacterClass;
+
 static grrNfa
 newNfa(void);
 
@@ -46,14 +69,41 @@ freeNfaStack(nfaStack *stack);
 static ssize_t
 findParensInStack(const nfaStack *stack);
 
-static char
-resolveEscapeCharacter(char c) __attribute__((pure));
+static size_t
+statesLeft(const nfaStack *stack, grrNfa held, size_t max_states);
+
+static int
+resolveEscapeCharacter(const char *string, size_t len, size_t *idx);
+
+static int
+parseHexByte(const char *string, size_t len, size_t idx);
+
+static unsigned int
+decodeUtf8(const char *string, size_t len, size_t idx, unsigned int *codepoint);
+
+static unsigned int
+encodeUtf8(unsigned int codepoint, unsigned char *buffer);
+
+static grrNfa
+createCharacterNfa(int c, unsigned int flags);
+
+static grrNfa
+createByteRangeNfa(unsigned char low, unsigned char high);
+
+static grrNfa
+createSequenceNfa(const unsigned char *bytes, unsigned int length);
 
 static grrNfa
-createCharacterNfa(char c);
+createTagNfa(unsigned int tag);
+
+static int
+wrapGroup(grrNfa *nfa, unsigned int group);
+
+static void
+setSymbol(nfaTransition *transition, int c, unsigned int flags);
 
 static void
-setSymbol(nfaTransition *transition, char c);
+foldCase(unsigned char *symbols);
 
 static int
 concatenateNfas(grrNfa nfa1, grrNfa nfa2);
@@ -62,17 +112,59 @@ static int
 addDisjunctionToNfa(grrNfa nfa1, grrNfa nfa2);
 
 static int
-checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_t *newIdx);
+checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_t max_states,
+                   size_t *newIdx);
+
+static int
+resolveBraces(grrNfa nfa, const char *string, size_t len, size_t idx, size_t max_states, size_t *newIdx);
+
+static int
+resolveCharacterClass(const char *string, size_t len, size_t *idx, unsigned int flags, size_t max_states,
+                      grrNfa *nfa);
 
 static int
-resolveBraces(grrNfa nfa, const char *string, size_t len, size_t idx, size_t *newIdx);
+readClassMember(const char *string, size_t len, size_t *idx, unsigned int *value, bool *is_codepoint);
 
 static int
-resolveCharacterClass(const char *string, size_t len, size_t *idx, grrNfa *nfa);
+addCodepointRange(nfaCharacterClass *class, unsigned int low, unsigned int high);
+
+static int
+compareCodepointRanges(const void *item1, const void *item2);
+
+static void
+mergeCodepointRanges(nfaCharacterClass *class);
+
+static int
+negateCodepointRanges(nfaCharacterClass *class);
+
+static int
+addUtf8Range(grrNfa *nfa, unsigned int low, unsigned int high);
+
+static size_t
+maxStatesForPattern(const grrCompileOptions *options, size_t len);
+
+static double
+estimateQuantifier(const char *string, size_t len, size_t *idx, double atom);
+
+static double
+estimateClass(const char *string, size_t len, size_t *idx);
+
+static bool
+skipClassMember(const char *string, size_t len, size_t *idx, unsigned int *codepoint);
+
+static unsigned int
+countUtf8Range(unsigned int low, unsigned int high);
 
 int
 grrCompile(const char *string, size_t len, grrNfa *nfa) {
+    return grrCompileEx(string, len, NULL, nfa);
+}
+
+int
+grrCompileEx(const char *string, size_t len, const grrCompileOptions *options, grrNfa *nfa) {
     int ret;
+    unsigned int flags, numGroups = 0;
+    size_t maxStates;
     nfaStack stack = {0};
     grrNfa current;
 
@@ -80,12 +172,11 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
         return GRR_RET_BAD_ARGS;
     }
 
-    for (size_t idx = 0; idx < len; idx++) {
-        if (!isprint(string[idx])) {
-            fprintf(stderr, "Unprintable character at index %zu: 0x%02x\n", idx, (unsigned char)string[idx]);
-            return GRR_RET_BAD_DATA;
-        }
+    flags = options ? options->flags : 0;
+    if (flags & ~GRR_COMPILE_ALL_FLAGS) {
+        return GRR_RET_BAD_ARGS;
     }
+    maxStates = maxStatesForPattern(options, len);
 
     current = newNfa();
     if (!current) {
@@ -94,10 +185,11 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
 
     for (size_t idx = 0; idx < len; idx++) {
         ssize_t stackIdx;
-        char character;
+        int character;
+        unsigned int seqLen, codepoint;
         grrNfa temp;
 
-        character = string[idx];
+        character = (unsigned char)string[idx];
         switch (character) {
         case '(':
         case '|':
@@ -105,6 +197,9 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
             if (ret != GRR_RET_OK) {
                 goto error;
             }
+            if (character == '(') {
+                stack.frames[stack.length - 1].group = ++numGroups;
+            }
             current = newNfa();
             if (!current) {
                 ret = GRR_RET_OUT_OF_MEMORY;
@@ -121,6 +216,11 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
                 goto error;
             }
 
+            // The group's alternatives are merged into current so only the frames before it are left over.
+            for (size_t k = stackIdx + 1; k < stack.length; k++) {
+                stack.num_states -= stack.frames[k].nfa->length;
+            }
+
             if ((size_t)stackIdx < stack.length - 1) {
                 temp = stack.frames[stackIdx + 1].nfa;
                 stack.frames[stackIdx + 1].nfa = NULL;
@@ -142,12 +242,20 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
                 current = temp;
             }
 
-            ret = checkForQuantifier(current, string, len, idx, &idx);
+            // The tags go inside of the quantifier so that each repetition records its own positions.
+            if (flags & GRR_COMPILE_CAPTURES) {
+                ret = wrapGroup(&current, stack.frames[stackIdx].group);
+                if (ret != GRR_RET_OK) {
+                    goto error;
+                }
+            }
+
+            ret = checkForQuantifier(current, string, len, idx, statesLeft(&stack, NULL, maxStates), &idx);
             if (ret != GRR_RET_OK) {
-                grrFreeNfa(temp);
                 goto error;
             }
 
+            stack.num_states -= stack.frames[stackIdx].nfa->length;
             ret = concatenateNfas(stack.frames[stackIdx].nfa, current);
             if (ret != GRR_RET_OK) {
                 goto error;
@@ -158,7 +266,8 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
             break;
 
         case '[':
-            ret = resolveCharacterClass(string, len, &idx, &temp);
+            ret = resolveCharacterClass(string, len, &idx, flags, statesLeft(&stack, current, maxStates),
+                                        &temp);
             if (ret != GRR_RET_OK) {
                 goto error;
             }
@@ -196,7 +305,7 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
             goto error;
 
         case '\\':
-            character = resolveEscapeCharacter(string[++idx]);
+            character = resolveEscapeCharacter(string, len, &idx);
             if (character == GRR_INVALID_CHARACTER) {
                 fprintf(stderr, "Invalid character escape:\n");
                 printIdxForString(string, len, idx);
@@ -228,32 +337,48 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
             }
 
             if (string[idx] == '[') {
-                ret = resolveCharacterClass(string, len, &idx, &temp);
+                size_t classIdx = idx;
+
+                ret = resolveCharacterClass(string, len, &idx, flags, statesLeft(&stack, current, maxStates),
+                                            &temp);
                 if (ret != GRR_RET_OK) {
                     goto error;
                 }
+                if (temp->length != 1 || temp->nodes[0].two_transitions) {
+                    fprintf(stderr, "Lookahead must be a single-byte character class:\n");
+                    printIdxForString(string, len, classIdx);
+                    grrFreeNfa(temp);
+                    ret = GRR_RET_BAD_DATA;
+                    goto error;
+                }
             } else if (string[idx] == '\\') {
-                character = resolveEscapeCharacter(string[++idx]);
+                character = resolveEscapeCharacter(string, len, &idx);
                 if (character == GRR_INVALID_CHARACTER) {
                     fprintf(stderr, "Invalid character escape:\n");
                     printIdxForString(string, len, idx);
                     ret = GRR_RET_BAD_DATA;
                     goto error;
                 }
-                temp = createCharacterNfa(character);
+                temp = createCharacterNfa(character, flags);
                 if (!temp) {
                     ret = GRR_RET_OUT_OF_MEMORY;
                     goto error;
                 }
             } else {
-                temp = createCharacterNfa(string[idx]);
+                if (decodeUtf8(string, len, idx, &codepoint) > 0) {
+                    fprintf(stderr, "Lookahead must be a single byte:\n");
+                    printIdxForString(string, len, idx);
+                    ret = GRR_RET_BAD_DATA;
+                    goto error;
+                }
+                temp = createCharacterNfa((unsigned char)string[idx], flags);
                 if (!temp) {
                     ret = GRR_RET_OUT_OF_MEMORY;
                     goto error;
                 }
             }
-            temp->nodes[0].transitions[0].symbols[0] |= GRR_NFA_LOOKAHEAD_FLAG;
-            temp->nodes[0].transitions[0].symbols[0] &= ~GRR_NFA_EMPTY_TRANSITION_FLAG;
+            temp->nodes[0].transitions[0].flags |= GRR_NFA_LOOKAHEAD_FLAG;
+            temp->nodes[0].transitions[0].flags &= ~GRR_NFA_EMPTY_TRANSITION_FLAG;
 
             if (idx != len - 1) {
                 fprintf(stderr, "Unexpected text following ending bar:\n");
@@ -271,14 +396,21 @@ grrCompile(const char *string, size_t len, grrNfa *nfa) {
             break;
 
         default:
+            seqLen = decodeUtf8(string, len, idx, &codepoint);
+            if (seqLen > 0) {
+                // A multibyte UTF-8 character is a single atom as far as quantifiers are concerned.
+                temp = createSequenceNfa((const unsigned char *)string + idx, seqLen);
+                idx += seqLen - 1;
+            } else {
 add_character:
-            temp = createCharacterNfa(character);
+                temp = createCharacterNfa(character, flags);
+            }
             if (!temp) {
                 ret = GRR_RET_OUT_OF_MEMORY;
                 goto error;
             }
 
-            ret = checkForQuantifier(temp, string, len, idx, &idx);
+            ret = checkForQuantifier(temp, string, len, idx, statesLeft(&stack, current, maxStates), &idx);
             if (ret != GRR_RET_OK) {
                 grrFreeNfa(temp);
                 goto error;
@@ -291,6 +423,15 @@ add_character:
             }
             break;
         }
+
+        // Each piece was checked against what the rest of the regex left it.  This catches the few states
+        // which joining them adds.
+        if (stack.num_states + current->length > maxStates) {
+            fprintf(stderr, "Regex needs more than %zu states:\n", maxStates);
+            printIdxForString(string, len, idx);
+            ret = GRR_RET_TOO_COMPLEX;
+            goto error;
+        }
     }
 
     for (ssize_t k = stack.length - 1; k >= 0; k--) {
@@ -310,8 +451,65 @@ add_character:
         }
         current = stack.frames[k].nfa;
         stack.frames[k].nfa = NULL;
+        if (current->length > maxStates) {
+            fprintf(stderr, "Regex needs more than %zu states:\n", maxStates);
+            printIdxForString(string, len, stack.frames[k].idx);
+            ret = GRR_RET_TOO_COMPLEX;
+            goto error;
+        }
     }
     free(stack.frames);
+    stack = (nfaStack){0};
+
+    ret = nfaOptimize(current);
+    if (ret != GRR_RET_OK) {
+        goto error;
+    }
+
+    current->pattern_hash = nfaHashPattern(string, len, flags);
+    ret = nfaLayout(current, options ? options->profile : NULL);
+    if (ret != GRR_RET_OK) {
+        goto error;
+    }
+
+    ret = nfaAnalyze(current);
+    if (ret != GRR_RET_OK) {
+        goto error;
+    }
+
+    ret = nfaDetectLiteral(current);
+    if (ret != GRR_RET_OK) {
+        goto error;
+    }
+
+    ret = nfaCreateProgram(current->nodes, current->length, &current->program);
+    if (ret != GRR_RET_OK) {
+        goto error;
+    }
+    if (flags & GRR_COMPILE_CAPTURES) {
+        current->tags = calloc((size_t)current->length + 1, sizeof(*current->tags));
+        if (!current->tags) {
+            ret = GRR_RET_OUT_OF_MEMORY;
+            goto error;
+        }
+        for (unsigned int k = 0; k < current->length; k++) {
+            current->tags[k] = current->nodes[k].tag;
+        }
+        current->num_groups = numGroups;
+    }
+    free(current->nodes);
+    current->nodes = NULL;
+
+    ret = nfaDetectOnePass(current);
+    if (ret != GRR_RET_OK) {
+        goto error;
+    }
+
+    ret = nfaSelectEngines(current,
+                           (options && options->dfa_memory) ? options->dfa_memory : GRR_NFA_DFA_MEMORY);
+    if (ret != GRR_RET_OK) {
+        goto error;
+    }
 
     current->string = malloc(len + 1);
     if (!current->string) {
@@ -321,6 +519,7 @@ add_character:
     memcpy(current->string, string, len);
     current->string[len] = '\0';
 
+    current->flags = flags;
     *nfa = current;
     return GRR_RET_OK;
 
@@ -332,6 +531,85 @@ error:
     return ret;
 }
 
+int
+grrEstimateStates(const char *string, size_t len, size_t *num_states) {
+    size_t numParens = 0, depth = 0;
+    double total = 0, *saved;
+
+    if (!string || !num_states) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    for (size_t idx = 0; idx < len; idx++) {
+        if (string[idx] == '(') {
+            numParens++;
+        }
+    }
+    saved = malloc(sizeof(*saved) * (numParens + 1));
+    if (!saved) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    // This follows grrCompileEx's parse but only keeps the number of states of each unclosed group.
+    for (size_t idx = 0; idx < len; idx++) {
+        unsigned int seqLen, codepoint;
+        double atom;
+
+        switch (string[idx]) {
+        case '(':
+            saved[depth++] = total;
+            total = 0;
+            continue;
+
+        case '|':
+            // Each alternative is joined to the others by a split.
+            total++;
+            continue;
+
+        case ')':
+            if (depth == 0) {
+                continue;
+            }
+            atom = total;
+            total = saved[--depth];
+            break;
+
+        case '[': atom = estimateClass(string, len, &idx); break;
+
+        case '\\':
+            resolveEscapeCharacter(string, len, &idx);
+            atom = 1;
+            break;
+
+        case '/':
+            // Everything after the bar is a single lookahead.
+            atom = 1;
+            idx = len;
+            break;
+
+        default:
+            seqLen = decodeUtf8(string, len, idx, &codepoint);
+            if (seqLen > 0) {
+                atom = seqLen;
+                idx += seqLen - 1;
+            } else {
+                atom = 1;
+            }
+            break;
+        }
+
+        total += atom + estimateQuantifier(string, len, &idx, atom);
+    }
+
+    while (depth > 0) {
+        total += saved[--depth];
+    }
+    free(saved);
+
+    *num_states = (total >= (double)SIZE_MAX) ? SIZE_MAX : (size_t)total;
+    return GRR_RET_OK;
+}
+
 static grrNfa
 newNfa(void) {
     grrNfa nfa;
@@ -339,6 +617,7 @@ newNfa(void) {
     nfa = malloc(sizeof(struct grrNfaStruct));
     if (nfa) {
         *nfa = (struct grrNfaStruct){0};
+        atomic_init(&nfa->references, 1);
     }
     return nfa;
 }
@@ -372,6 +651,7 @@ pushNfaToStack(nfaStack *stack, grrNfa nfa, size_t idx, char reason) {
     stack->frames[stack->length].idx = idx;
     stack->frames[stack->length].reason = reason;
     stack->length++;
+    stack->num_states += nfa->length;
 
     return GRR_RET_OK;
 }
@@ -385,6 +665,19 @@ freeNfaStack(nfaStack *stack) {
         grrFreeNfa(stack->frames[k].nfa);
         stack->frames[k].nfa = NULL;
     }
+    free(stack->frames);
+}
+
+/*
+ * The states which a piece can still grow to, so that a repetition is rejected before it's expanded rather
+ * than once it has been joined with the rest of the regex.  held is the piece which the next one will be
+ * concatenated to, if it isn't on the stack.
+ */
+static size_t
+statesLeft(const nfaStack *stack, grrNfa held, size_t max_states) {
+    size_t used = stack->num_states + (held ? held->length : 0);
+
+    return (used < max_states) ? max_states - used : 0;
 }
 
 static ssize_t
@@ -398,11 +691,28 @@ findParensInStack(const nfaStack *stack) {
     return -1;
 }
 
-static char
-resolveEscapeCharacter(char c) {
-    switch (c) {
+static int
+resolveEscapeCharacter(const char *string, size_t len, size_t *idx) {
+    int value;
+
+    if (*idx + 1 == len) {
+        return GRR_INVALID_CHARACTER;
+    }
+
+    switch (string[++(*idx)]) {
     case 't': return '\t'; break;
 
+    case 'n': return '\n'; break;
+
+    case 'r': return '\r'; break;
+
+    case 'x':
+        value = parseHexByte(string, len, *idx + 1);
+        if (value >= 0) {
+            *idx += 2;
+        }
+        return value;
+
     case '\\':
     case '/':
     case '(':
@@ -417,7 +727,7 @@ resolveEscapeCharacter(char c) {
     case '?':
     case '^':
     case '$':
-    case '|': return c; break;
+    case '|': return (unsigned char)string[*idx]; break;
 
     case 's': return GRR_WHITESPACE_CODE;
 
@@ -427,8 +737,96 @@ resolveEscapeCharacter(char c) {
     }
 }
 
+static int
+parseHexByte(const char *string, size_t len, size_t idx) {
+    int value = 0;
+
+    if (idx + 2 > len) {
+        return GRR_INVALID_CHARACTER;
+    }
+
+    for (size_t k = idx; k < idx + 2; k++) {
+        int c = (unsigned char)string[k];
+
+        if (!isxdigit(c)) {
+            return GRR_INVALID_CHARACTER;
+        }
+        value = value * 16 + (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+    }
+
+    return value;
+}
+
+/*
+ * Returns the length of the multibyte UTF-8 sequence starting at idx or 0 if there isn't a valid one.
+ */
+static unsigned int
+decodeUtf8(const char *string, size_t len, size_t idx, unsigned int *codepoint) {
+    unsigned int seqLen, value, minimum;
+    unsigned char c;
+
+    c = string[idx];
+    if (c >= 0xc2 && c <= 0xdf) {
+        seqLen = 2;
+        value = c & 0x1f;
+        minimum = 0x80;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        seqLen = 3;
+        value = c & 0x0f;
+        minimum = 0x800;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        seqLen = 4;
+        value = c & 0x07;
+        minimum = 0x10000;
+    } else {
+        return 0;
+    }
+
+    if (idx + seqLen > len) {
+        return 0;
+    }
+
+    for (unsigned int k = 1; k < seqLen; k++) {
+        c = string[idx + k];
+        if ((c & 0xc0) != 0x80) {
+            return 0;
+        }
+        value = (value << 6) | (c & 0x3f);
+    }
+
+    if (value < minimum || value > GRR_MAX_CODEPOINT || (value >= 0xd800 && value <= 0xdfff)) {
+        return 0;
+    }
+
+    *codepoint = value;
+    return seqLen;
+}
+
+static unsigned int
+encodeUtf8(unsigned int codepoint, unsigned char *buffer) {
+    if (codepoint < 0x80) {
+        buffer[0] = codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        buffer[0] = 0xc0 | (codepoint >> 6);
+        buffer[1] = 0x80 | (codepoint & 0x3f);
+        return 2;
+    } else if (codepoint < 0x10000) {
+        buffer[0] = 0xe0 | (codepoint >> 12);
+        buffer[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        buffer[2] = 0x80 | (codepoint & 0x3f);
+        return 3;
+    } else {
+        buffer[0] = 0xf0 | (codepoint >> 18);
+        buffer[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+        buffer[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+        buffer[3] = 0x80 | (codepoint & 0x3f);
+        return 4;
+    }
+}
+
 static grrNfa
-createCharacterNfa(char c) {
+createCharacterNfa(int c, unsigned int flags) {
     grrNfa nfa;
     nfaNode *nodes;
 
@@ -438,9 +836,9 @@ createCharacterNfa(char c) {
     }
 
     nodes->transitions[0].motion = 1;
-    setSymbol(&nodes->transitions[0], c);
+    setSymbol(&nodes->transitions[0], c, flags);
     if (c == GRR_FIRST_CHAR_CODE || c == GRR_LAST_CHAR_CODE) {
-        setSymbol(&nodes->transitions[0], GRR_EMPTY_TRANSITION_CODE);
+        setSymbol(&nodes->transitions[0], GRR_EMPTY_TRANSITION_CODE, 0);
     }
 
     nfa = newNfa();
@@ -455,50 +853,138 @@ createCharacterNfa(char c) {
     return nfa;
 }
 
-static void
-setSymbol(nfaTransition *transition, char c) {
-    char c2;
+static grrNfa
+createByteRangeNfa(unsigned char low, unsigned char high) {
+    grrNfa nfa;
+
+    nfa = createCharacterNfa(low, 0);
+    if (nfa) {
+        for (unsigned int c = low + 1; c <= high; c++) {
+            SET_FLAG(nfa->nodes[0].transitions[0].symbols, c);
+        }
+    }
+
+    return nfa;
+}
+
+static grrNfa
+createSequenceNfa(const unsigned char *bytes, unsigned int length) {
+    grrNfa nfa;
+
+    nfa = createCharacterNfa(bytes[0], 0);
+    for (unsigned int k = 1; nfa && k < length; k++) {
+        grrNfa temp;
+
+        temp = createCharacterNfa(bytes[k], 0);
+        if (!temp || concatenateNfas(nfa, temp) != GRR_RET_OK) {
+            grrFreeNfa(temp);
+            grrFreeNfa(nfa);
+            return NULL;
+        }
+    }
+
+    return nfa;
+}
+
+/*
+ * Creates a single empty transition which records the current position into a capture slot.
+ */
+static grrNfa
+createTagNfa(unsigned int tag) {
+    grrNfa nfa;
 
+    nfa = createCharacterNfa(GRR_EMPTY_TRANSITION_CODE, 0);
+    if (nfa) {
+        nfa->nodes[0].tag = tag;
+    }
+    return nfa;
+}
+
+/*
+ * Surrounds a group with the tags which record where it begins and ends.  Group k records into slots 2k - 2
+ * and 2k - 1.  *nfa is replaced by the wrapped group, or left alone if nothing could be allocated.
+ */
+static int
+wrapGroup(grrNfa *nfa, unsigned int group) {
+    grrNfa open, close;
+
+    open = createTagNfa(2 * group - 1);
+    close = createTagNfa(2 * group);
+    if (!open || !close || concatenateNfas(open, *nfa) != GRR_RET_OK) {
+        grrFreeNfa(open);
+        grrFreeNfa(close);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    *nfa = open;
+
+    if (concatenateNfas(open, close) != GRR_RET_OK) {
+        grrFreeNfa(close);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    return GRR_RET_OK;
+}
+
+static void
+setSymbol(nfaTransition *transition, int c, unsigned int flags) {
     switch (c) {
     case GRR_WHITESPACE_CODE:
-        transition->symbols[0] |= GRR_NFA_TAB_FLAG;
-        c2 = ' ' - GRR_NFA_ASCII_ADJUSTMENT;
-        goto set_character;
+        SET_FLAG(transition->symbols, ' ');
+        SET_FLAG(transition->symbols, '\t');
+        break;
 
     case GRR_WILDCARD_CODE:
         memset(transition->symbols, 0xff, sizeof(transition->symbols));
-        transition->symbols[0] &= ~(GRR_NFA_EMPTY_TRANSITION_FLAG | GRR_NFA_FIRST_CHAR_FLAG |
-                                    GRR_NFA_LAST_CHAR_FLAG | GRR_NFA_LOOKAHEAD_FLAG);
+        transition->symbols['\r' / 8] &= ~(1 << ('\r' % 8));
+        transition->symbols['\n' / 8] &= ~(1 << ('\n' % 8));
         break;
 
-    case GRR_EMPTY_TRANSITION_CODE: c2 = GRR_NFA_EMPTY_TRANSITION; goto set_character;
+    case GRR_EMPTY_TRANSITION_CODE: transition->flags |= GRR_NFA_EMPTY_TRANSITION_FLAG; break;
 
-    case GRR_FIRST_CHAR_CODE: c2 = GRR_NFA_FIRST_CHAR; goto set_character;
+    case GRR_FIRST_CHAR_CODE: transition->flags |= GRR_NFA_FIRST_CHAR_FLAG; break;
 
-    case GRR_LAST_CHAR_CODE: c2 = GRR_NFA_LAST_CHAR; goto set_character;
+    case GRR_LAST_CHAR_CODE: transition->flags |= GRR_NFA_LAST_CHAR_FLAG; break;
 
     case GRR_DIGIT_CODE:
-        for (int k = 0; k < 10; k++) {
-            c2 = '0' + k - GRR_NFA_ASCII_ADJUSTMENT;
-            SET_FLAG(transition->symbols, c2);
+        for (int k = '0'; k <= '9'; k++) {
+            SET_FLAG(transition->symbols, k);
         }
         break;
 
-    case '\t': c2 = GRR_NFA_TAB; goto set_character;
-
     default:
-        c2 = c - GRR_NFA_ASCII_ADJUSTMENT;
-set_character:
-        SET_FLAG(transition->symbols, c2);
+        SET_FLAG(transition->symbols, c);
+        if (flags & GRR_COMPILE_CASELESS) {
+            foldCase(transition->symbols);
+        }
         break;
     }
 }
 
+/*
+ * Makes every ASCII letter in the set match both of its cases.
+ */
+static void
+foldCase(unsigned char *symbols) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        int upper = c - 'a' + 'A';
+
+        if (IS_FLAG_SET(symbols, c) || IS_FLAG_SET(symbols, upper)) {
+            SET_FLAG(symbols, c);
+            SET_FLAG(symbols, upper);
+        }
+    }
+}
+
 static int
 concatenateNfas(grrNfa nfa1, grrNfa nfa2) {
     size_t newLen;
     nfaNode *success;
 
+    if (nfa2->length == 0) {
+        // Otherwise, two empty NFAs would have realloc free the nodes and return NULL.
+        grrFreeNfa(nfa2);
+        return GRR_RET_OK;
+    }
+
     newLen = nfa1->length + nfa2->length;
     success = realloc(nfa1->nodes, sizeof(nfaNode) * newLen);
     if (!success) {
@@ -535,9 +1021,10 @@ addDisjunctionToNfa(grrNfa nfa1, grrNfa nfa2) {
     memset(success, 0, sizeof(nfaNode));
     success[0].two_transitions = 1;
     for (int k = 0; k < 2; k++) {
-        setSymbol(&success[0].transitions[k], GRR_EMPTY_TRANSITION_CODE);
+        setSymbol(&success[0].transitions[k], GRR_EMPTY_TRANSITION_CODE, 0);
     }
-    success[0].transitions[0].motion = 1;
+    // An empty first branch goes straight to the end rather than into the second branch.
+    success[0].transitions[0].motion = len1 ? 1 : 1 + len2;
     success[0].transitions[1].motion = len1 + 1;
 
     for (unsigned int k = 0; k < len1; k++) {
@@ -553,7 +1040,8 @@ addDisjunctionToNfa(grrNfa nfa1, grrNfa nfa2) {
 }
 
 static int
-checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_t *newIdx) {
+checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_t max_states,
+                   size_t *newIdx) {
     bool question = false, plus = false;
 
     if (idx + 1 == len) {
@@ -567,7 +1055,7 @@ checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_
 
     case '*': question = plus = true; break;
 
-    case '{': return resolveBraces(nfa, string, len, idx + 1, newIdx);
+    case '{': return resolveBraces(nfa, string, len, idx + 1, max_states, newIdx);
 
     default: *newIdx = idx; return GRR_RET_OK;
     }
@@ -588,7 +1076,7 @@ checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_
         memset(success + length, 0, sizeof(nfaNode));
         success[length].two_transitions = 1;
         for (int k = 0; k < 2; k++) {
-            setSymbol(&success[length].transitions[k], GRR_EMPTY_TRANSITION_CODE);
+            setSymbol(&success[length].transitions[k], GRR_EMPTY_TRANSITION_CODE, 0);
         }
         success[length].transitions[0].motion = -1 * (int)length;
         success[length].transitions[1].motion = 1;
@@ -597,7 +1085,9 @@ checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_
     }
 
     if (question) {
-        if (nfa->nodes[0].two_transitions) {
+        // The skip can only be added to the first node if nothing else transitions back to it (other than the
+        // loop added for a '+').
+        if (nfa->nodes[0].two_transitions || nfa->length > (plus ? 2 : 1)) {
             nfaNode *success;
 
             success = realloc(nfa->nodes, sizeof(nfaNode) * (nfa->length + 1));
@@ -611,7 +1101,7 @@ checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_
             success[0].two_transitions = 1;
 
             for (int k = 0; k < 2; k++) {
-                setSymbol(&success[0].transitions[k], GRR_EMPTY_TRANSITION_CODE);
+                setSymbol(&success[0].transitions[k], GRR_EMPTY_TRANSITION_CODE, 0);
             }
             success[0].transitions[0].motion = 1;
             success[0].transitions[1].motion = nfa->length + 1;
@@ -621,8 +1111,8 @@ checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_
             nfaNode *node;
 
             node = nfa->nodes;
-            memset(node->transitions[1].symbols, 0, sizeof(nfa->nodes[0].transitions[1].symbols));
-            setSymbol(&node->transitions[1], GRR_EMPTY_TRANSITION_CODE);
+            memset(&node->transitions[1], 0, sizeof(node->transitions[1]));
+            setSymbol(&node->transitions[1], GRR_EMPTY_TRANSITION_CODE, 0);
             node->transitions[1].motion = nfa->length;
             node->two_transitions = 1;
         }
@@ -632,14 +1122,13 @@ checkForQuantifier(grrNfa nfa, const char *string, size_t len, size_t idx, size_
 }
 
 static int
-resolveBraces(grrNfa nfa, const char *string, size_t len, size_t idx, size_t *newIdx) {
+resolveBraces(grrNfa nfa, const char *string, size_t len, size_t idx, size_t max_states, size_t *newIdx) {
     size_t end, numNodes;
     long value;
-    char *buffer, *temp;
     nfaNode *success;
 
     for (end = idx + 1; end < len && string[end] != '}'; end++) {
-        if (!isdigit(string[end])) {
+        if (!isdigit((unsigned char)string[end])) {
             fprintf(stderr, "Expected digit inside braces:\n");
             printIdxForString(string, len, end);
             return GRR_RET_BAD_DATA;
@@ -659,22 +1148,38 @@ resolveBraces(grrNfa nfa, const char *string, size_t len, size_t idx, size_t *ne
 
     *newIdx = end;
 
-    buffer = alloca(end - idx);
-    memcpy(buffer, string + idx + 1, end - 1 - idx);
-    buffer[end - idx] = '\0';
-
-    errno = 0;
-    value = strtol(buffer, &temp, 10);
-    if (errno != 0 || temp == buffer || temp[0] != '\0') {
-        fprintf(stderr, "Invalid quantifier inside braces:\n");
-        printIdxForString(string, len, idx + 1);
-        return GRR_RET_BAD_DATA;
+    value = 0;
+    for (size_t k = idx + 1; k < end; k++) {
+        value = value * 10 + (string[k] - '0');
+        if (value > INT_MAX) {
+            fprintf(stderr, "Invalid quantifier inside braces:\n");
+            printIdxForString(string, len, idx + 1);
+            return GRR_RET_BAD_DATA;
+        }
     }
     if (value == 1) {
         return GRR_RET_OK;
     }
+    if (value == 0) {
+        // The piece is replaced by a single empty transition so that it can still be concatenated and used as
+        // a branch of a disjunction.
+        memset(nfa->nodes, 0, sizeof(nfaNode));
+        setSymbol(&nfa->nodes[0].transitions[0], GRR_EMPTY_TRANSITION_CODE, 0);
+        nfa->nodes[0].transitions[0].motion = 1;
+        nfa->length = 1;
+        return GRR_RET_OK;
+    }
 
     numNodes = nfa->length;
+    // Checked before anything is allocated since this is where small patterns turn into huge NFAs.
+    if (numNodes * value > max_states) {
+        fprintf(stderr, "Repetition needs more than the %zu states which the regex has left:\n", max_states);
+        printIdxForString(string, len, idx);
+        return GRR_RET_TOO_COMPLEX;
+    }
+    if (numNodes * value > UINT_MAX / sizeof(nfaNode)) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
     success = realloc(nfa->nodes, sizeof(nfaNode) * numNodes * value);
     if (!success) {
         return GRR_RET_OUT_OF_MEMORY;
@@ -691,10 +1196,12 @@ resolveBraces(grrNfa nfa, const char *string, size_t len, size_t idx, size_t *ne
 }
 
 static int
-resolveCharacterClass(const char *string, size_t len, size_t *idx, grrNfa *nfa) {
+resolveCharacterClass(const char *string, size_t len, size_t *idx, unsigned int flags, size_t max_states,
+                      grrNfa *nfa) {
     int ret;
     size_t idx2;
     bool negation;
+    nfaCharacterClass class = {0};
     nfaNode *node;
 
     if (*idx == len - 1) {
@@ -703,11 +1210,6 @@ resolveCharacterClass(const char *string, size_t len, size_t *idx, grrNfa *nfa)
         return GRR_RET_BAD_DATA;
     }
 
-    node = calloc(1, sizeof(nfaNode));
-    if (!node) {
-        return GRR_RET_OUT_OF_MEMORY;
-    }
-
     idx2 = *idx;
     if (string[*idx + 1] == '^') {
         negation = true;
@@ -717,104 +1219,116 @@ resolveCharacterClass(const char *string, size_t len, size_t *idx, grrNfa *nfa)
         (*idx)++;
     }
     if (*idx < len && string[*idx] == '-') {
-        setSymbol(&node->transitions[0], '-');
+        SET_FLAG(class.bytes, '-');
         (*idx)++;
     }
-    while (*idx < len - 1 && string[*idx] != ']') {
-        char character;
-
-        character = string[*idx];
-
-        if (string[*idx + 1] == '-') {
-            char possibleRangeEnd, character2;
+    while (*idx < len && string[*idx] != ']') {
+        unsigned int low, high;
+        bool lowIsCodepoint, highIsCodepoint;
+        size_t memberIdx = *idx;
 
-            if (*idx == len - 2) {
-                fprintf(stderr, "Unclosed range in character class:\n");
-                printIdxForString(string, len, *idx);
-                ret = GRR_RET_BAD_DATA;
-                goto error;
-            }
+        ret = readClassMember(string, len, idx, &low, &lowIsCodepoint);
+        if (ret != GRR_RET_OK) {
+            goto error;
+        }
 
-            if (character >= 'A' && character < 'Z') {
-                possibleRangeEnd = 'Z';
-            } else if (character >= 'a' && character < 'z') {
-                possibleRangeEnd = 'z';
-            } else if (character >= '0' && character < '9') {
-                possibleRangeEnd = '9';
-            } else {
-                fprintf(stderr, "Invalid character class range:\n");
-                printIdxForString(string, len, *idx);
-                ret = GRR_RET_BAD_DATA;
+        if (*idx + 1 < len && string[*idx] == '-' && string[*idx + 1] != ']') {
+            (*idx)++;
+            ret = readClassMember(string, len, idx, &high, &highIsCodepoint);
+            if (ret != GRR_RET_OK) {
                 goto error;
             }
 
-            character2 = string[*idx + 2];
-            if (!(character2 > character && character2 <= possibleRangeEnd)) {
+            if (high <= low || (low >= 0x80 && lowIsCodepoint != highIsCodepoint)) {
                 fprintf(stderr, "Invalid character class range:\n");
-                printIdxForString(string, len, *idx);
+                printIdxForString(string, len, memberIdx);
                 ret = GRR_RET_BAD_DATA;
                 goto error;
             }
-
-            for (char c = character; c <= character2; c++) {
-                setSymbol(&node->transitions[0], c);
-            }
-
-            *idx += 3;
-            continue;
+            lowIsCodepoint = highIsCodepoint;
+        } else {
+            high = low;
         }
 
-        if (character == '\\') {
-            character = string[*idx + 1];
-
-            switch (character) {
-            case '[':
-            case ']': break;
-
-            case 't': character = '\t'; break;
-
-            default:
-                fprintf(stderr, "Invalid character escape:\n");
-                printIdxForString(string, len, *idx);
-                ret = GRR_RET_BAD_DATA;
+        if (lowIsCodepoint) {
+            ret = addCodepointRange(&class, low, high);
+            if (ret != GRR_RET_OK) {
                 goto error;
             }
-
-            *idx += 2;
         } else {
-            (*idx)++;
+            for (unsigned int c = low; c <= high; c++) {
+                SET_FLAG(class.bytes, c);
+            }
         }
-
-        setSymbol(&node->transitions[0], character);
     }
 
-    if (*idx >= len || string[*idx] != ']') {
+    if (*idx >= len) {
         fprintf(stderr, "Unclosed character class:\n");
         printIdxForString(string, len, idx2);
         ret = GRR_RET_BAD_DATA;
         goto error;
     }
 
+    if (flags & GRR_COMPILE_CASELESS) {
+        foldCase(class.bytes);
+    }
+
     if (negation) {
-        for (size_t k = 0; k < sizeof(node->transitions[0].symbols); k++) {
-            node->transitions[0].symbols[k] ^= 0xff;
+        if (class.num_ranges > 0) {
+            // A negated class with non-ASCII characters is negated over codepoints rather than bytes.
+            for (size_t k = 0x80 / 8; k < sizeof(class.bytes); k++) {
+                if (class.bytes[k]) {
+                    fprintf(stderr, "Negated character class mixes raw bytes with non-ASCII characters:\n");
+                    printIdxForString(string, len, idx2);
+                    ret = GRR_RET_BAD_DATA;
+                    goto error;
+                }
+            }
+            for (size_t k = 0; k < 0x80 / 8; k++) {
+                class.bytes[k] ^= 0xff;
+            }
+            ret = negateCodepointRanges(&class);
+            if (ret != GRR_RET_OK) {
+                goto error;
+            }
+        } else {
+            for (size_t k = 0; k < sizeof(class.bytes); k++) {
+                class.bytes[k] ^= 0xff;
+            }
         }
-        node->transitions[0].symbols[0] &= ~GRR_NFA_FIRST_CHAR_FLAG;
-        node->transitions[0].symbols[0] &= ~GRR_NFA_LAST_CHAR_FLAG;
-        node->transitions[0].symbols[0] &= ~GRR_NFA_LOOKAHEAD_FLAG;
+        class.bytes['\r' / 8] &= ~(1 << ('\r' % 8));
+        class.bytes['\n' / 8] &= ~(1 << ('\n' % 8));
+    } else {
+        mergeCodepointRanges(&class);
     }
 
+    node = calloc(1, sizeof(nfaNode));
+    if (!node) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto error;
+    }
+    memcpy(node->transitions[0].symbols, class.bytes, sizeof(class.bytes));
     node->transitions[0].motion = 1;
 
     *nfa = newNfa();
     if (!*nfa) {
+        free(node);
         ret = GRR_RET_OUT_OF_MEMORY;
         goto error;
     }
     (*nfa)->nodes = node;
     (*nfa)->length = 1;
 
-    ret = checkForQuantifier(*nfa, string, len, *idx, idx);
+    for (size_t k = 0; k < class.num_ranges; k++) {
+        ret = addUtf8Range(nfa, class.ranges[k].low, class.ranges[k].high);
+        if (ret != GRR_RET_OK) {
+            grrFreeNfa(*nfa);
+            goto error;
+        }
+    }
+    free(class.ranges);
+
+    ret = checkForQuantifier(*nfa, string, len, *idx, max_states, idx);
     if (ret != GRR_RET_OK) {
         grrFreeNfa(*nfa);
         return ret;
@@ -824,6 +1338,387 @@ resolveCharacterClass(const char *string, size_t len, size_t *idx, grrNfa *nfa)
 
 error:
 
-    free(node);
+    free(class.ranges);
     return ret;
 }
+
+/*
+ * Reads a single character out of a character class.  A multibyte UTF-8 sequence is read as a codepoint while
+ * everything else is read as a single byte.
+ */
+static int
+readClassMember(const char *string, size_t len, size_t *idx, unsigned int *value, bool *is_codepoint) {
+    unsigned int seqLen;
+    int character;
+
+    *is_codepoint = false;
+
+    if (string[*idx] == '\\') {
+        if (*idx + 1 == len) {
+            fprintf(stderr, "Unclosed character class:\n");
+            printIdxForString(string, len, *idx);
+            return GRR_RET_BAD_DATA;
+        }
+
+        switch (string[*idx + 1]) {
+        case '[':
+        case ']':
+        case '\\':
+        case '-':
+        case '^': character = (unsigned char)string[*idx + 1]; break;
+
+        case 't': character = '\t'; break;
+
+        case 'n': character = '\n'; break;
+
+        case 'r': character = '\r'; break;
+
+        case 'x':
+            character = parseHexByte(string, len, *idx + 2);
+            if (character != GRR_INVALID_CHARACTER) {
+                *idx += 2;
+                break;
+            }
+            // fall through
+
+        default:
+            fprintf(stderr, "Invalid character escape:\n");
+            printIdxForString(string, len, *idx);
+            return GRR_RET_BAD_DATA;
+        }
+
+        *idx += 2;
+        *value = character;
+        return GRR_RET_OK;
+    }
+
+    seqLen = decodeUtf8(string, len, *idx, value);
+    if (seqLen > 0) {
+        *is_codepoint = true;
+        *idx += seqLen;
+    } else {
+        *value = (unsigned char)string[*idx];
+        (*idx)++;
+    }
+
+    return GRR_RET_OK;
+}
+
+static int
+addCodepointRange(nfaCharacterClass *class, unsigned int low, unsigned int high) {
+    for (; low < 0x80 && low <= high; low++) {
+        SET_FLAG(class->bytes, low);
+    }
+    if (low > high) {
+        return GRR_RET_OK;
+    }
+
+    if (class->num_ranges == class->capacity) {
+        nfaCodepointRange *success;
+        size_t newCapacity;
+
+        newCapacity = class->capacity + GRR_NFA_PADDING;
+        success = realloc(class->ranges, sizeof(nfaCodepointRange) * newCapacity);
+        if (!success) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        class->ranges = success;
+        class->capacity = newCapacity;
+    }
+
+    class->ranges[class->num_ranges].low = low;
+    class->ranges[class->num_ranges].high = high;
+    class->num_ranges++;
+
+    return GRR_RET_OK;
+}
+
+static int
+compareCodepointRanges(const void *item1, const void *item2) {
+    const nfaCodepointRange *range1 = item1, *range2 = item2;
+
+    return (range1->low > range2->low) - (range1->low < range2->low);
+}
+
+static void
+mergeCodepointRanges(nfaCharacterClass *class) {
+    size_t length = 0;
+
+    if (class->num_ranges == 0) {
+        return;
+    }
+
+    qsort(class->ranges, class->num_ranges, sizeof(nfaCodepointRange), compareCodepointRanges);
+    for (size_t k = 1; k < class->num_ranges; k++) {
+        if (class->ranges[k].low <= class->ranges[length].high + 1) {
+            if (class->ranges[k].high > class->ranges[length].high) {
+                class->ranges[length].high = class->ranges[k].high;
+            }
+        } else {
+            class->ranges[++length] = class->ranges[k];
+        }
+    }
+    class->num_ranges = length + 1;
+}
+
+static int
+negateCodepointRanges(nfaCharacterClass *class) {
+    unsigned int low = 0x80;
+    size_t num_ranges;
+    nfaCodepointRange *ranges;
+
+    mergeCodepointRanges(class);
+    ranges = class->ranges;
+    num_ranges = class->num_ranges;
+    class->ranges = NULL;
+    class->num_ranges = class->capacity = 0;
+
+    for (size_t k = 0; k < num_ranges; k++) {
+        if (ranges[k].low > low && addCodepointRange(class, low, ranges[k].low - 1) != GRR_RET_OK) {
+            free(ranges);
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        low = ranges[k].high + 1;
+    }
+    free(ranges);
+
+    if (low <= GRR_MAX_CODEPOINT) {
+        return addCodepointRange(class, low, GRR_MAX_CODEPOINT);
+    }
+    return GRR_RET_OK;
+}
+
+/*
+ * Adds the UTF-8 encodings of a range of codepoints to an NFA as alternatives.  The range is split until each
+ * piece can be expressed as a sequence of byte ranges.
+ */
+static int
+addUtf8Range(grrNfa *nfa, unsigned int low, unsigned int high) {
+    static const unsigned int boundaries[] = {0x7f, 0x7ff, 0xffff};
+    int ret;
+    unsigned int seqLen;
+    unsigned char lowBytes[4], highBytes[4];
+    grrNfa sequence;
+
+    if (low <= 0xdfff && high >= 0xd800) {
+        // Surrogates can't be encoded.
+        if (low < 0xd800) {
+            ret = addUtf8Range(nfa, low, 0xd7ff);
+            if (ret != GRR_RET_OK) {
+                return ret;
+            }
+        }
+        return (high > 0xdfff) ? addUtf8Range(nfa, 0xe000, high) : GRR_RET_OK;
+    }
+
+    for (size_t k = 0; k < sizeof(boundaries) / sizeof(boundaries[0]); k++) {
+        if (low <= boundaries[k] && high > boundaries[k]) {
+            ret = addUtf8Range(nfa, low, boundaries[k]);
+            if (ret != GRR_RET_OK) {
+                return ret;
+            }
+            return addUtf8Range(nfa, boundaries[k] + 1, high);
+        }
+    }
+
+    for (unsigned int k = 1; k < 4; k++) {
+        unsigned int mask;
+
+        mask = (1 << (6 * k)) - 1;
+        if ((low & ~mask) != (high & ~mask)) {
+            if ((low & mask) != 0) {
+                ret = addUtf8Range(nfa, low, low | mask);
+                if (ret != GRR_RET_OK) {
+                    return ret;
+                }
+                return addUtf8Range(nfa, (low | mask) + 1, high);
+            }
+            if ((high & mask) != mask) {
+                ret = addUtf8Range(nfa, low, (high & ~mask) - 1);
+                if (ret != GRR_RET_OK) {
+                    return ret;
+                }
+                return addUtf8Range(nfa, high & ~mask, high);
+            }
+        }
+    }
+
+    seqLen = encodeUtf8(low, lowBytes);
+    encodeUtf8(high, highBytes);
+
+    sequence = createByteRangeNfa(lowBytes[0], highBytes[0]);
+    if (!sequence) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    for (unsigned int k = 1; k < seqLen; k++) {
+        grrNfa temp;
+
+        temp = createByteRangeNfa(lowBytes[k], highBytes[k]);
+        if (!temp) {
+            grrFreeNfa(sequence);
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        ret = concatenateNfas(sequence, temp);
+        if (ret != GRR_RET_OK) {
+            grrFreeNfa(temp);
+            grrFreeNfa(sequence);
+            return ret;
+        }
+    }
+
+    ret = addDisjunctionToNfa(*nfa, sequence);
+    if (ret != GRR_RET_OK) {
+        grrFreeNfa(sequence);
+    }
+    return ret;
+}
+
+static size_t
+maxStatesForPattern(const grrCompileOptions *options, size_t len) {
+    size_t maxStates = GRR_COMPILE_DEFAULT_MAX_STATES;
+
+    if (!options) {
+        return maxStates;
+    }
+
+    if (options->max_states) {
+        maxStates = options->max_states;
+    }
+    if (options->max_expansion && len < maxStates / options->max_expansion) {
+        maxStates = len * options->max_expansion;
+    }
+
+    return maxStates;
+}
+
+/*
+ * Returns how many states the quantifier following idx adds to an atom with the specified number of states
+ * and moves idx past it.  As with checkForQuantifier, '?' and '*' may not need their skip.
+ */
+static double
+estimateQuantifier(const char *string, size_t len, size_t *idx, double atom) {
+    double value = 0;
+
+    if (*idx + 1 >= len) {
+        return 0;
+    }
+
+    switch (string[*idx + 1]) {
+    case '?':
+    case '+': (*idx)++; return 1;
+
+    case '*': (*idx)++; return 2;
+
+    case '{':
+        for (*idx += 2; *idx < len && isdigit((unsigned char)string[*idx]); (*idx)++) {
+            value = value * 10 + (string[*idx] - '0');
+        }
+        return (value == 1) ? 0 : atom * (value - 1);
+
+    default: return 0;
+    }
+}
+
+/*
+ * Moves idx to the closing bracket of the character class starting at idx and returns how many states the
+ * class will need.  Non-ASCII ranges are counted as addUtf8Range splits them.  The ranges of a negated class
+ * aren't worked out.  Instead, every non-ASCII codepoint is counted and each member is assumed to need
+ * splits on both sides of the hole it leaves as well.
+ */
+static double
+estimateClass(const char *string, size_t len, size_t *idx) {
+    bool negation = false, hasCodepoints = false;
+    double ranges = 0;
+
+    (*idx)++;
+    if (*idx < len && string[*idx] == '^') {
+        negation = true;
+        (*idx)++;
+    }
+    if (*idx < len && string[*idx] == '-') {
+        (*idx)++;
+    }
+
+    while (*idx < len && string[*idx] != ']') {
+        unsigned int low, high;
+
+        if (!skipClassMember(string, len, idx, &low)) {
+            if (*idx + 1 < len && string[*idx] == '-' && string[*idx + 1] != ']') {
+                (*idx)++;
+                skipClassMember(string, len, idx, &high);
+            }
+            continue;
+        }
+
+        high = low;
+        if (*idx + 1 < len && string[*idx] == '-' && string[*idx + 1] != ']') {
+            (*idx)++;
+            if (!skipClassMember(string, len, idx, &high) || high < low) {
+                high = low;
+            }
+        }
+        ranges += countUtf8Range(low, high);
+        hasCodepoints = true;
+    }
+
+    if (negation && hasCodepoints) {
+        ranges = countUtf8Range(0x80, GRR_MAX_CODEPOINT) + 3 * ranges;
+    }
+    return 1 + ranges;
+}
+
+/*
+ * Moves idx past the class member starting at it without reporting errors.  Returns true, and sets the
+ * codepoint, if it's a multibyte UTF-8 character.
+ */
+static bool
+skipClassMember(const char *string, size_t len, size_t *idx, unsigned int *codepoint) {
+    unsigned int seqLen;
+
+    if (string[*idx] == '\\') {
+        *idx += (*idx + 1 < len && string[*idx + 1] == 'x') ? 4 : 2;
+        return false;
+    }
+
+    seqLen = decodeUtf8(string, len, *idx, codepoint);
+    *idx += seqLen ? seqLen : 1;
+    return seqLen > 0;
+}
+
+/*
+ * Returns how many states addUtf8Range adds for a range of codepoints.  The splits mirror those of
+ * addUtf8Range.
+ */
+static unsigned int
+countUtf8Range(unsigned int low, unsigned int high) {
+    static const unsigned int boundaries[] = {0x7f, 0x7ff, 0xffff};
+    unsigned char buffer[4];
+
+    if (low <= 0xdfff && high >= 0xd800) {
+        return ((low < 0xd800) ? countUtf8Range(low, 0xd7ff) : 0) +
+               ((high > 0xdfff) ? countUtf8Range(0xe000, high) : 0);
+    }
+
+    for (size_t k = 0; k < sizeof(boundaries) / sizeof(boundaries[0]); k++) {
+        if (low <= boundaries[k] && high > boundaries[k]) {
+            return countUtf8Range(low, boundaries[k]) + countUtf8Range(boundaries[k] + 1, high);
+        }
+    }
+
+    for (unsigned int k = 1; k < 4; k++) {
+        unsigned int mask;
+
+        mask = (1 << (6 * k)) - 1;
+        if ((low & ~mask) != (high & ~mask)) {
+            if ((low & mask) != 0) {
+                return countUtf8Range(low, low | mask) + countUtf8Range((low | mask) + 1, high);
+            }
+            if ((high & mask) != mask) {
+                return countUtf8Range(low, (high & ~mask) - 1) + countUtf8Range(high & ~mask, high);
+            }
+        }
+    }
+
+    // A byte range per byte of the encoding plus the split which joins the sequence to the rest of the class.
+    return encodeUtf8(low, buffer) + 1;
+}
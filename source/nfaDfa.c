@@ -0,0 +1,974 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define DFA_HAVE_SHUFFLE
+#endif
+
+/*
+ * A lazily-built DFA which is shared by every thread using a regex or a regex set.  It only answers which
+ * patterns have a nonempty match somewhere in a line; the NFAs are run afterward to find out where.
+ *
+ * The NFA it's built from may hold several patterns laid out one after the other, each with its own accepting
+ * state.  A DFA state is the set of NFA states reached after consuming at least one character, before the
+ * empty transitions have been followed, along with the patterns whose accepting states were reached on the
+ * way in.  The empty transitions are followed while computing the next transition since that's when the
+ * character under the cursor (needed by lookaheads) is known.  The first state of each table is the one for
+ * the beginning of a line, where '^' may be crossed.  The second is the idle state, where nothing is in
+ * flight.
+ *
+ * Transitions are read without locking.  Missing ones are computed while holding the lock and published with
+ * a release store after the target state has been fully initialized.  When a table fills up, the other table
+ * is cleared and swapped in, but only if no thread is still reading it.  Otherwise, the caller falls back to
+ * the NFA for the current line.  Either way, readers are never made to wait.
+ *
+ * When a single regex needs only a handful of states before its first match, the whole DFA is built when the
+ * regex is compiled and laid out as a shuffle table: one 16-byte row per byte value holding the next state
+ * for each current state.  Every state which records a match leads to a single match state which never
+ * leaves, so the line only has to be checked once in a while.  With SSSE3, the current state sits in a vector
+ * register and each byte costs one pshufb.  Since the row is picked by the byte rather than by the state, the
+ * loads can be issued ahead and only the shuffle is on the critical path.
+ */
+
+#define DFA_UNKNOWN (-1)
+
+#define DFA_START_STATE 0
+#define DFA_IDLE_STATE  1
+
+#define DFA_ENTRY_MATCHES 0x01  // Some patterns matched right before the state was entered.
+#define DFA_END_MATCHES   0x02  // Some patterns match if the line ends in this state.
+
+#define DFA_MIN_STATES   8
+#define DFA_SET_ESTIMATE 16
+#define DFA_EMPTY_BUCKET UINT_MAX
+
+#define SHUFFLE_NUM_STATES   16
+#define SHUFFLE_MATCH_STATE  (SHUFFLE_NUM_STATES - 1)
+#define SHUFFLE_CHECK_PERIOD 64  // How many bytes are run between checks for the match state.
+// The most lazy states a shuffle table is built through: the start and idle states, up to 15 more without a
+// match, and those which record one.
+#define SHUFFLE_LAZY_STATES  (4 * SHUFFLE_NUM_STATES)
+
+typedef struct nfaDfaTable {
+    atomic_uint readers;
+    unsigned int num_states;
+    unsigned int state_capacity;
+    atomic_int *transitions;
+    unsigned char *first;
+    unsigned char *has_matches;
+    size_t *set_offsets;
+    unsigned int *set_arena;
+    size_t arena_capacity;
+    size_t *match_offsets;  // The entry matches of state k followed by its end matches.
+    unsigned int *match_arena;
+    size_t match_capacity;
+    unsigned int *buckets;
+    unsigned int bucket_mask;
+} nfaDfaTable;
+
+typedef struct nfaShuffleDfa {
+    _Alignas(16) unsigned char rows[GRR_NFA_NUM_SYMBOLS][SHUFFLE_NUM_STATES];
+    unsigned int end_states;  // A bitmap of the states where a match is found if the line ends.
+    bool simd;
+} nfaShuffleDfa;
+
+struct nfaDfa {
+    _Atomic(nfaDfaTable *) current;
+    nfaDfaTable tables[2];
+    pthread_mutex_t lock;
+    size_t memory;
+    const nfaProgram *program;
+    unsigned int num_states;
+    nfaEdge *edges;  // Two for each state.  Decoded ahead of time since building states goes over them a lot.
+    unsigned char *edge_counts;
+    unsigned int *accepting;
+    unsigned int num_patterns;
+    unsigned int *seeds;
+    unsigned int num_seeds;
+    unsigned int *seed_closures[2];  // The consuming states reached from the seeds, without and with '^'.
+    unsigned int seed_closure_lengths[2];
+    unsigned int num_classes;
+    unsigned char classes[GRR_NFA_NUM_SYMBOLS];
+    unsigned char representatives[GRR_NFA_NUM_SYMBOLS];
+    unsigned char first_bytes[GRR_NFA_NUM_SYMBOLS / 8];
+    nfaShuffleDfa *shuffle;  // NULL unless the whole DFA fits in a shuffle table.
+
+    // Everything below is only used while holding the lock.
+    unsigned int *stamps;
+    unsigned int *stack;
+    unsigned int *closure;
+    unsigned int *targets;
+    unsigned int *matches;
+    unsigned int *end_matches;
+    unsigned int generation;
+};
+
+static void
+computeByteClasses(struct nfaDfa *dfa);
+
+static nfaDfaTable *
+acquireTable(struct nfaDfa *dfa);
+
+static void
+releaseTable(nfaDfaTable *table);
+
+static int
+prepareTable(struct nfaDfa *dfa, nfaDfaTable *table, unsigned int max_states);
+
+static void
+freeTable(nfaDfaTable *table);
+
+static unsigned int
+hashState(const unsigned int *set, unsigned int length, const unsigned int *matches, unsigned int num_matches,
+          unsigned char first);
+
+static int
+findOrAddState(struct nfaDfa *dfa, nfaDfaTable *table, const unsigned int *set, unsigned int length,
+               const unsigned int *matches, unsigned int num_matches, unsigned char first);
+
+static void
+nextDfaGeneration(struct nfaDfa *dfa);
+
+static void
+closeStates(struct nfaDfa *dfa, const unsigned int *states, unsigned int count, unsigned char flags,
+            unsigned char character, unsigned int *num_consuming, unsigned int *matches,
+            unsigned int *num_matches);
+
+static int
+computeTransition(struct nfaDfa *dfa, nfaDfaTable *table, int state, unsigned int class);
+
+static void
+recordMatches(const nfaDfaTable *table, size_t from, size_t to, unsigned char *matched);
+
+static int
+compareStates(const void *item1, const void *item2);
+
+static int
+buildShuffleDfa(struct nfaDfa *dfa);
+
+static unsigned int
+runShuffleDfa(const nfaShuffleDfa *shuffle, const unsigned char *string, size_t len);
+
+#ifdef DFA_HAVE_SHUFFLE
+static unsigned int
+runShuffleDfaSimd(const nfaShuffleDfa *shuffle, const unsigned char *string, size_t len);
+#endif
+
+int
+nfaCreateDfa(const nfaDfaSource *source, struct nfaDfa **dfa) {
+    struct nfaDfa *new;
+    size_t numStates = source->num_states;
+    bool hasLookahead = false;
+
+    new = calloc(1, sizeof(*new));
+    if (!new) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    new->edges = malloc(sizeof(*new->edges) * 2 * numStates);
+    new->edge_counts = malloc(numStates);
+    new->accepting = malloc(sizeof(*new->accepting) * numStates);
+    new->seeds = malloc(sizeof(*new->seeds) * (source->num_seeds + 1));
+    new->stamps = calloc(numStates, sizeof(*new->stamps));
+    new->stack = malloc(sizeof(*new->stack) * numStates);
+    new->closure = malloc(sizeof(*new->closure) * numStates);
+    new->targets = malloc(sizeof(*new->targets) * numStates);
+    new->matches = malloc(sizeof(*new->matches) * source->num_patterns);
+    new->end_matches = malloc(sizeof(*new->end_matches) * source->num_patterns);
+    if (!new->edges || !new->edge_counts || !new->accepting || !new->seeds || !new->stamps || !new->stack ||
+        !new->closure || !new->targets || !new->matches || !new->end_matches) {
+        goto error;
+    }
+
+    memcpy(new->accepting, source->accepting, sizeof(*new->accepting) * numStates);
+    memcpy(new->seeds, source->seeds, sizeof(*new->seeds) * source->num_seeds);
+    memcpy(new->first_bytes, source->first_bytes, sizeof(new->first_bytes));
+    new->program = source->program;
+    new->num_states = source->num_states;
+    new->num_patterns = source->num_patterns;
+    new->num_seeds = source->num_seeds;
+    new->memory = source->memory;
+    for (size_t k = 0; k < numStates; k++) {
+        new->edge_counts[k] = new->accepting[k] ? 0 : nfaDecodeState(new->program, k, new->edges + 2 * k);
+        for (unsigned int j = 0; j < new->edge_counts[k]; j++) {
+            if (new->edges[2 * k + j].flags & GRR_NFA_LOOKAHEAD_FLAG) {
+                hasLookahead = true;
+            }
+        }
+    }
+    computeByteClasses(new);
+
+    // Every transition starts the patterns over again.  Unless a lookahead makes it depend on the character,
+    // where that leads is always the same.
+    if (!hasLookahead) {
+        for (int k = 0; k < 2; k++) {
+            unsigned int length = 0;
+
+            nextDfaGeneration(new);
+            closeStates(new, new->seeds, new->num_seeds, k ? GRR_NFA_FIRST_CHAR_FLAG : 0, 0, &length, NULL,
+                        NULL);
+            new->seed_closures[k] = malloc(sizeof(*new->seed_closures[k]) * (length + 1));
+            if (!new->seed_closures[k]) {
+                goto error;
+            }
+            memcpy(new->seed_closures[k], new->closure, sizeof(*new->closure) * length);
+            new->seed_closure_lengths[k] = length;
+        }
+    }
+
+    if (pthread_mutex_init(&new->lock, NULL) != 0) {
+        goto error;
+    }
+
+    atomic_init(&new->current, NULL);
+    for (int k = 0; k < 2; k++) {
+        atomic_init(&new->tables[k].readers, 0);
+    }
+
+    *dfa = new;
+    return GRR_RET_OK;
+
+error:
+
+    free(new->seed_closures[0]);
+    free(new->seed_closures[1]);
+    free(new->edges);
+    free(new->edge_counts);
+    free(new->accepting);
+    free(new->seeds);
+    free(new->stamps);
+    free(new->stack);
+    free(new->closure);
+    free(new->targets);
+    free(new->matches);
+    free(new->end_matches);
+    free(new);
+    return GRR_RET_OUT_OF_MEMORY;
+}
+
+int
+nfaAttachDfa(grrNfa nfa, size_t memory) {
+    int ret;
+    unsigned int *accepting, seed = 0;
+    nfaDfaSource source;
+
+    accepting = calloc((size_t)nfa->length + 1, sizeof(*accepting));
+    if (!accepting) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    accepting[nfa->length] = 1;
+
+    source.program = nfa->program;
+    source.num_states = nfa->length + 1;
+    source.accepting = accepting;
+    source.num_patterns = 1;
+    source.seeds = &seed;
+    source.num_seeds = 1;
+    source.first_bytes = nfa->first_bytes;
+    source.memory = memory;
+    ret = nfaCreateDfa(&source, &nfa->dfa);
+    free(accepting);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+
+    ret = buildShuffleDfa(nfa->dfa);
+    if (ret != GRR_RET_OK) {
+        nfaFreeDfa(nfa->dfa);
+        nfa->dfa = NULL;
+    }
+    return ret;
+}
+
+void
+nfaFreeDfa(struct nfaDfa *dfa) {
+    if (!dfa) {
+        return;
+    }
+
+    for (int k = 0; k < 2; k++) {
+        freeTable(&dfa->tables[k]);
+    }
+    pthread_mutex_destroy(&dfa->lock);
+    free(dfa->seed_closures[0]);
+    free(dfa->seed_closures[1]);
+    free(dfa->edges);
+    free(dfa->edge_counts);
+    free(dfa->accepting);
+    free(dfa->seeds);
+    free(dfa->stamps);
+    free(dfa->stack);
+    free(dfa->closure);
+    free(dfa->targets);
+    free(dfa->matches);
+    free(dfa->end_matches);
+    free(dfa->shuffle);
+    free(dfa);
+}
+
+bool
+nfaDfaIsShuffled(const struct nfaDfa *dfa) {
+    return dfa && dfa->shuffle;
+}
+
+size_t
+nfaDfaMemoryUsage(struct nfaDfa *dfa) {
+    size_t total;
+
+    total = sizeof(*dfa) + sizeof(unsigned int) * (5 * (size_t)dfa->num_states + dfa->num_seeds + 1 +
+                                                   2 * (size_t)dfa->num_patterns) +
+            (2 * sizeof(*dfa->edges) + 1) * dfa->num_states +
+            sizeof(unsigned int) * (dfa->seed_closure_lengths[0] + dfa->seed_closure_lengths[1]);
+    if (dfa->shuffle) {
+        total += sizeof(*dfa->shuffle);
+    }
+
+    // The tables are only allocated while holding the lock.
+    pthread_mutex_lock(&dfa->lock);
+    for (int k = 0; k < 2; k++) {
+        const nfaDfaTable *table = &dfa->tables[k];
+        size_t capacity = table->state_capacity;
+
+        if (!table->transitions) {
+            continue;
+        }
+        total += sizeof(*table->transitions) * capacity * dfa->num_classes + 2 * capacity +
+                 sizeof(*table->set_offsets) * (capacity + 1) +
+                 sizeof(*table->set_arena) * table->arena_capacity +
+                 sizeof(*table->match_offsets) * (2 * capacity + 1) +
+                 sizeof(*table->match_arena) * table->match_capacity +
+                 sizeof(*table->buckets) * ((size_t)table->bucket_mask + 1);
+    }
+    pthread_mutex_unlock(&dfa->lock);
+
+    return total;
+}
+
+int
+nfaDfaScanLine(struct nfaDfa *dfa, const char *string, size_t len, unsigned char *matched) {
+    int ret, state = DFA_START_STATE;
+    bool found = false;
+    size_t idx = 0;
+    unsigned int numClasses;
+    nfaDfaTable *table;
+
+    if (dfa->shuffle) {
+        unsigned int final;
+
+        final = runShuffleDfa(dfa->shuffle, (const unsigned char *)string, len);
+        if (final != SHUFFLE_MATCH_STATE && !(dfa->shuffle->end_states & (1U << final))) {
+            return GRR_RET_NOT_FOUND;
+        }
+        if (matched) {
+            SET_FLAG(matched, 0);
+        }
+        return GRR_RET_OK;
+    }
+
+    table = acquireTable(dfa);
+    if (!table) {
+        return GRR_NFA_DFA_GAVE_UP;
+    }
+
+    numClasses = dfa->num_classes;
+    while (idx < len) {
+        unsigned int class;
+        int next;
+
+        if (state == DFA_IDLE_STATE) {
+            // Nothing is in flight so skip ahead to the next character which can begin a match.
+            while (idx < len && !IS_FLAG_SET(dfa->first_bytes, (unsigned char)string[idx])) {
+                idx++;
+            }
+            if (idx == len) {
+                break;
+            }
+        }
+
+        class = dfa->classes[(unsigned char)string[idx++]];
+        next = atomic_load_explicit(&table->transitions[(size_t)state * numClasses + class],
+                                    memory_order_acquire);
+        if (next == DFA_UNKNOWN) {
+            next = computeTransition(dfa, table, state, class);
+            if (next == DFA_UNKNOWN) {
+                ret = GRR_NFA_DFA_GAVE_UP;
+                goto done;
+            }
+        }
+        state = next;
+
+        if (table->has_matches[state] & DFA_ENTRY_MATCHES) {
+            found = true;
+            if (!matched) {
+                ret = GRR_RET_OK;
+                goto done;
+            }
+            recordMatches(table, table->match_offsets[2 * state], table->match_offsets[2 * state + 1],
+                          matched);
+        }
+    }
+
+    if (table->has_matches[state] & DFA_END_MATCHES) {
+        found = true;
+        if (matched) {
+            recordMatches(table, table->match_offsets[2 * state + 1], table->match_offsets[2 * state + 2],
+                          matched);
+        }
+    }
+    ret = found ? GRR_RET_OK : GRR_RET_NOT_FOUND;
+
+done:
+
+    releaseTable(table);
+    return ret;
+}
+
+/*
+ * Splits the bytes into classes which no transition of the NFA can tell apart so that each DFA state needs
+ * one transition per class rather than one per byte.
+ */
+static void
+computeByteClasses(struct nfaDfa *dfa) {
+    unsigned int numClasses = 1;
+    int newIds[2 * GRR_NFA_NUM_SYMBOLS];
+
+    memset(dfa->classes, 0, sizeof(dfa->classes));
+    for (unsigned int k = 0; k < dfa->num_states; k++) {
+        const nfaEdge *edges = dfa->edges + 2 * k;
+
+        for (unsigned int j = 0; j < dfa->edge_counts[k]; j++) {
+            unsigned int nextClass = 0;
+
+            if (edges[j].flags & GRR_NFA_EMPTY_TRANSITION_FLAG) {
+                continue;
+            }
+
+            for (unsigned int i = 0; i < 2 * numClasses; i++) {
+                newIds[i] = -1;
+            }
+            for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+                unsigned int key = 2 * dfa->classes[c] + nfaEdgeAccepts(&edges[j], c);
+
+                if (newIds[key] < 0) {
+                    newIds[key] = nextClass++;
+                }
+                dfa->classes[c] = newIds[key];
+            }
+            numClasses = nextClass;
+        }
+    }
+
+    dfa->num_classes = numClasses;
+    for (int c = GRR_NFA_NUM_SYMBOLS - 1; c >= 0; c--) {
+        dfa->representatives[dfa->classes[c]] = c;
+    }
+}
+
+/*
+ * Registers the caller as a reader of the current table.  The table is checked again after the reader count
+ * goes up because a table which has been swapped out may be cleared as soon as it has no readers.
+ */
+static nfaDfaTable *
+acquireTable(struct nfaDfa *dfa) {
+    for (;;) {
+        nfaDfaTable *table;
+
+        table = atomic_load(&dfa->current);
+        if (!table) {
+            int ret;
+
+            pthread_mutex_lock(&dfa->lock);
+            ret = GRR_RET_OK;
+            if (!atomic_load(&dfa->current)) {
+                ret = prepareTable(dfa, &dfa->tables[0], UINT_MAX);
+                if (ret == GRR_RET_OK) {
+                    atomic_store(&dfa->current, &dfa->tables[0]);
+                }
+            }
+            pthread_mutex_unlock(&dfa->lock);
+
+            if (ret != GRR_RET_OK) {
+                return NULL;
+            }
+            continue;
+        }
+
+        atomic_fetch_add(&table->readers, 1);
+        if (atomic_load(&dfa->current) == table) {
+            return table;
+        }
+        atomic_fetch_sub(&table->readers, 1);
+    }
+}
+
+static void
+releaseTable(nfaDfaTable *table) {
+    atomic_fetch_sub(&table->readers, 1);
+}
+
+/*
+ * Allocates the table, with room for at most max_states states, if it hasn't been yet and empties it.  Must
+ * be called with the lock held and while no
+ * other thread can be reading the table.
+ */
+static int
+prepareTable(struct nfaDfa *dfa, nfaDfaTable *table, unsigned int max_states) {
+    if (!table->transitions) {
+        size_t perState, capacity, buckets, setEstimate;
+
+        setEstimate = (dfa->num_states < DFA_SET_ESTIMATE) ? dfa->num_states : DFA_SET_ESTIMATE;
+        perState = dfa->num_classes * sizeof(atomic_int) + 2 + 3 * sizeof(size_t) + 2 * sizeof(unsigned int) +
+                   (setEstimate + 2) * sizeof(unsigned int);
+        capacity = dfa->memory / perState;
+        if (capacity > max_states) {
+            capacity = max_states;
+        }
+        if (capacity < DFA_MIN_STATES) {
+            capacity = DFA_MIN_STATES;
+        }
+        if (capacity > INT_MAX / dfa->num_classes) {
+            capacity = INT_MAX / dfa->num_classes;
+        }
+        for (buckets = 1; buckets < 2 * capacity; buckets *= 2) {}
+
+        table->state_capacity = capacity;
+        table->arena_capacity = capacity * setEstimate;
+        if (table->arena_capacity < 2 * (size_t)dfa->num_states) {
+            table->arena_capacity = 2 * (size_t)dfa->num_states;
+        }
+        table->match_capacity = 2 * capacity;
+        if (table->match_capacity < 4 * (size_t)dfa->num_patterns) {
+            table->match_capacity = 4 * (size_t)dfa->num_patterns;
+        }
+        table->bucket_mask = buckets - 1;
+
+        table->transitions = malloc(sizeof(*table->transitions) * capacity * dfa->num_classes);
+        table->first = malloc(capacity);
+        table->has_matches = malloc(capacity);
+        table->set_offsets = malloc(sizeof(*table->set_offsets) * (capacity + 1));
+        table->set_arena = malloc(sizeof(*table->set_arena) * table->arena_capacity);
+        table->match_offsets = malloc(sizeof(*table->match_offsets) * (2 * capacity + 1));
+        table->match_arena = malloc(sizeof(*table->match_arena) * table->match_capacity);
+        table->buckets = malloc(sizeof(*table->buckets) * buckets);
+        if (!table->transitions || !table->first || !table->has_matches || !table->set_offsets ||
+            !table->set_arena || !table->match_offsets || !table->match_arena || !table->buckets) {
+            freeTable(table);
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+    }
+
+    table->num_states = 0;
+    table->set_offsets[0] = 0;
+    table->match_offsets[0] = 0;
+    for (unsigned int k = 0; k <= table->bucket_mask; k++) {
+        table->buckets[k] = DFA_EMPTY_BUCKET;
+    }
+
+    findOrAddState(dfa, table, NULL, 0, NULL, 0, 1);
+    findOrAddState(dfa, table, NULL, 0, NULL, 0, 0);
+
+    return GRR_RET_OK;
+}
+
+static void
+freeTable(nfaDfaTable *table) {
+    free(table->transitions);
+    free(table->first);
+    free(table->has_matches);
+    free(table->set_offsets);
+    free(table->set_arena);
+    free(table->match_offsets);
+    free(table->match_arena);
+    free(table->buckets);
+    table->transitions = NULL;
+    table->first = NULL;
+    table->has_matches = NULL;
+    table->set_offsets = NULL;
+    table->set_arena = NULL;
+    table->match_offsets = NULL;
+    table->match_arena = NULL;
+    table->buckets = NULL;
+}
+
+static unsigned int
+hashState(const unsigned int *set, unsigned int length, const unsigned int *matches, unsigned int num_matches,
+          unsigned char first) {
+    unsigned int hash = 2166136261U ^ first;
+
+    for (unsigned int k = 0; k < length; k++) {
+        hash = (hash ^ set[k]) * 16777619U;
+    }
+    for (unsigned int k = 0; k < num_matches; k++) {
+        hash = (hash ^ ~matches[k]) * 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * Returns the index of the state for a set of NFA states and entry matches, adding it if necessary, or
+ * DFA_UNKNOWN if the table is full.  Must be called with the lock held.
+ */
+static int
+findOrAddState(struct nfaDfa *dfa, nfaDfaTable *table, const unsigned int *set, unsigned int length,
+               const unsigned int *matches, unsigned int num_matches, unsigned char first) {
+    unsigned int bucket, state, numEndMatches = 0, numConsuming = 0;
+    size_t offset, matchOffset;
+    unsigned char flags;
+
+    for (bucket = hashState(set, length, matches, num_matches, first) & table->bucket_mask;
+         table->buckets[bucket] != DFA_EMPTY_BUCKET; bucket = (bucket + 1) & table->bucket_mask) {
+        state = table->buckets[bucket];
+        offset = table->set_offsets[state];
+        matchOffset = table->match_offsets[2 * state];
+        if (table->first[state] == first && table->set_offsets[state + 1] - offset == length &&
+            table->match_offsets[2 * state + 1] - matchOffset == num_matches &&
+            (length == 0 || memcmp(table->set_arena + offset, set, sizeof(*set) * length) == 0) &&
+            (num_matches == 0 ||
+             memcmp(table->match_arena + matchOffset, matches, sizeof(*matches) * num_matches) == 0)) {
+            return state;
+        }
+    }
+
+    // Find out which patterns match if the line ends in the new state.
+    flags = GRR_NFA_LAST_CHAR_FLAG | GRR_NFA_LOOKAHEAD_FLAG | (first ? GRR_NFA_FIRST_CHAR_FLAG : 0);
+    nextDfaGeneration(dfa);
+    closeStates(dfa, set, length, flags, 0, &numConsuming, dfa->end_matches, &numEndMatches);
+
+    offset = table->set_offsets[table->num_states];
+    matchOffset = table->match_offsets[2 * table->num_states];
+    if (table->num_states == table->state_capacity || offset + length > table->arena_capacity ||
+        matchOffset + num_matches + numEndMatches > table->match_capacity) {
+        return DFA_UNKNOWN;
+    }
+
+    state = table->num_states;
+    if (length > 0) {
+        memcpy(table->set_arena + offset, set, sizeof(*set) * length);
+    }
+    table->set_offsets[state + 1] = offset + length;
+    if (num_matches > 0) {
+        memcpy(table->match_arena + matchOffset, matches, sizeof(*matches) * num_matches);
+    }
+    if (numEndMatches > 0) {
+        memcpy(table->match_arena + matchOffset + num_matches, dfa->end_matches,
+               sizeof(*dfa->end_matches) * numEndMatches);
+    }
+    table->match_offsets[2 * state + 1] = matchOffset + num_matches;
+    table->match_offsets[2 * state + 2] = matchOffset + num_matches + numEndMatches;
+    table->first[state] = first;
+    table->has_matches[state] = (num_matches ? DFA_ENTRY_MATCHES : 0) | (numEndMatches ? DFA_END_MATCHES : 0);
+    for (unsigned int k = 0; k < dfa->num_classes; k++) {
+        atomic_store_explicit(&table->transitions[(size_t)state * dfa->num_classes + k], DFA_UNKNOWN,
+                              memory_order_relaxed);
+    }
+    table->buckets[bucket] = state;
+    table->num_states++;
+
+    return state;
+}
+
+static void
+nextDfaGeneration(struct nfaDfa *dfa) {
+    if (++dfa->generation == 0) {
+        memset(dfa->stamps, 0, sizeof(*dfa->stamps) * dfa->num_states);
+        dfa->generation = 1;
+    }
+}
+
+/*
+ * Follows the empty transitions from a list of states in the same way that addState does.  The states with
+ * consuming transitions are appended to dfa->closure.  If matches isn't NULL, the indices of the patterns
+ * whose accepting states were reached are appended to it.
+ */
+static void
+closeStates(struct nfaDfa *dfa, const unsigned int *states, unsigned int count, unsigned char flags,
+            unsigned char character, unsigned int *num_consuming, unsigned int *matches,
+            unsigned int *num_matches) {
+    unsigned int depth = 0;
+
+    for (unsigned int k = 0; k < count; k++) {
+        if (dfa->stamps[states[k]] != dfa->generation) {
+            dfa->stamps[states[k]] = dfa->generation;
+            dfa->stack[depth++] = states[k];
+        }
+    }
+
+    while (depth > 0) {
+        unsigned int state = dfa->stack[--depth], numEdges = dfa->edge_counts[state];
+        bool consumes = false;
+        const nfaEdge *edges = dfa->edges + 2 * state;
+
+        if (dfa->accepting[state]) {
+            if (matches) {
+                matches[(*num_matches)++] = dfa->accepting[state] - 1;
+            }
+            continue;
+        }
+
+        for (unsigned int j = 0; j < numEdges; j++) {
+            unsigned int target;
+
+            if (edges[j].flags & GRR_NFA_EMPTY_TRANSITION_FLAG) {
+                if (edges[j].flags & (GRR_NFA_FIRST_CHAR_FLAG | GRR_NFA_LAST_CHAR_FLAG) & ~flags) {
+                    continue;
+                }
+            } else if (edges[j].flags & GRR_NFA_LOOKAHEAD_FLAG) {
+                if (!(flags & GRR_NFA_LOOKAHEAD_FLAG) && !nfaEdgeAccepts(&edges[j], character)) {
+                    continue;
+                }
+            } else {
+                consumes = true;
+                continue;
+            }
+
+            target = state + edges[j].motion;
+            if (dfa->stamps[target] != dfa->generation) {
+                dfa->stamps[target] = dfa->generation;
+                dfa->stack[depth++] = target;
+            }
+        }
+
+        if (consumes) {
+            dfa->closure[(*num_consuming)++] = state;
+        }
+    }
+}
+
+/*
+ * Computes and publishes a transition.  Returns the new state or DFA_UNKNOWN if the table is full.
+ */
+static int
+computeTransition(struct nfaDfa *dfa, nfaDfaTable *table, int state, unsigned int class) {
+    int next;
+    unsigned int numConsuming = 0, numTargets = 0, numMatches = 0, setLength;
+    unsigned char character, flags;
+    const unsigned int *set;
+    atomic_int *slot;
+
+    character = dfa->representatives[class];
+    slot = &table->transitions[(size_t)state * dfa->num_classes + class];
+
+    pthread_mutex_lock(&dfa->lock);
+
+    next = atomic_load_explicit(slot, memory_order_relaxed);
+    if (next != DFA_UNKNOWN) {
+        goto done;
+    }
+
+    set = table->set_arena + table->set_offsets[state];
+    setLength = table->set_offsets[state + 1] - table->set_offsets[state];
+    flags = table->first[state] ? GRR_NFA_FIRST_CHAR_FLAG : 0;
+    nextDfaGeneration(dfa);
+    closeStates(dfa, set, setLength, flags, character, &numConsuming, dfa->matches, &numMatches);
+
+    // Matches can also start at this character.  Reaching an accepting state from here would be an empty
+    // match, which doesn't count.
+    if (dfa->seed_closures[0]) {
+        const unsigned int *seedClosure = dfa->seed_closures[flags != 0];
+
+        for (unsigned int k = 0; k < dfa->seed_closure_lengths[flags != 0]; k++) {
+            if (dfa->stamps[seedClosure[k]] != dfa->generation) {
+                dfa->stamps[seedClosure[k]] = dfa->generation;
+                dfa->closure[numConsuming++] = seedClosure[k];
+            }
+        }
+    } else {
+        closeStates(dfa, dfa->seeds, dfa->num_seeds, flags, character, &numConsuming, NULL, NULL);
+    }
+
+    nextDfaGeneration(dfa);
+    for (unsigned int k = 0; k < numConsuming; k++) {
+        const nfaEdge *edges = dfa->edges + 2 * dfa->closure[k];
+        unsigned int numEdges = dfa->edge_counts[dfa->closure[k]];
+
+        for (unsigned int j = 0; j < numEdges; j++) {
+            unsigned int target = dfa->closure[k] + edges[j].motion;
+
+            if (edges[j].flags || !nfaEdgeAccepts(&edges[j], character) ||
+                dfa->stamps[target] == dfa->generation) {
+                continue;
+            }
+            dfa->stamps[target] = dfa->generation;
+            dfa->targets[numTargets++] = target;
+        }
+    }
+    qsort(dfa->targets, numTargets, sizeof(*dfa->targets), compareStates);
+    qsort(dfa->matches, numMatches, sizeof(*dfa->matches), compareStates);
+
+    next = findOrAddState(dfa, table, dfa->targets, numTargets, dfa->matches, numMatches, 0);
+    if (next == DFA_UNKNOWN) {
+        nfaDfaTable *other = &dfa->tables[table == &dfa->tables[0]];
+
+        // Swap in the other table for the next line if nobody is still reading it.
+        if (atomic_load(&dfa->current) == table && atomic_load(&other->readers) == 0 &&
+            prepareTable(dfa, other, UINT_MAX) == GRR_RET_OK) {
+            atomic_store(&dfa->current, other);
+        }
+        goto done;
+    }
+
+    atomic_store_explicit(slot, next, memory_order_release);
+
+done:
+
+    pthread_mutex_unlock(&dfa->lock);
+    return next;
+}
+
+static void
+recordMatches(const nfaDfaTable *table, size_t from, size_t to, unsigned char *matched) {
+    for (size_t k = from; k < to; k++) {
+        SET_FLAG(matched, table->match_arena[k]);
+    }
+}
+
+static int
+compareStates(const void *item1, const void *item2) {
+    unsigned int state1 = *(const unsigned int *)item1, state2 = *(const unsigned int *)item2;
+
+    return (state1 > state2) - (state1 < state2);
+}
+
+/*
+ * Builds the DFA of a single regex up to its first match in full and lays it out as a shuffle table if it has
+ * few enough states.  Regexes with more states are left to the lazy DFA, which isn't an error.  The states
+ * are found through a table of their own which is only big enough for that, so that the lazy tables are only
+ * allocated once a regex which needs them is searched.
+ */
+static int
+buildShuffleDfa(struct nfaDfa *dfa) {
+    int ret, lazyStates[SHUFFLE_MATCH_STATE];
+    unsigned int numStates = 1, endStates = 0;
+    unsigned char targets[SHUFFLE_MATCH_STATE][GRR_NFA_NUM_SYMBOLS];
+    nfaDfaTable lazyTable = {0}, *table = &lazyTable;
+
+    pthread_mutex_lock(&dfa->lock);
+    ret = prepareTable(dfa, table, SHUFFLE_LAZY_STATES);
+    pthread_mutex_unlock(&dfa->lock);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+
+    // The states are numbered in the order in which they're found, so the start state gets 0.
+    lazyStates[0] = DFA_START_STATE;
+    for (unsigned int state = 0; state < numStates; state++) {
+        if (table->has_matches[lazyStates[state]] & DFA_END_MATCHES) {
+            endStates |= 1U << state;
+        }
+
+        for (unsigned int class = 0; class < dfa->num_classes; class++) {
+            int next;
+            unsigned int target;
+            size_t slot = (size_t)lazyStates[state] * dfa->num_classes + class;
+
+            next = atomic_load_explicit(&table->transitions[slot], memory_order_acquire);
+            if (next == DFA_UNKNOWN) {
+                next = computeTransition(dfa, table, lazyStates[state], class);
+                if (next == DFA_UNKNOWN) {
+                    goto done;
+                }
+            }
+
+            if (table->has_matches[next] & DFA_ENTRY_MATCHES) {
+                target = SHUFFLE_MATCH_STATE;
+            } else {
+                for (target = 0; target < numStates && lazyStates[target] != next; target++) {}
+                if (target == numStates) {
+                    if (numStates == SHUFFLE_MATCH_STATE) {
+                        goto done;
+                    }
+                    lazyStates[numStates++] = next;
+                }
+            }
+            targets[state][class] = target;
+        }
+    }
+
+    dfa->shuffle = aligned_alloc(_Alignof(nfaShuffleDfa), sizeof(*dfa->shuffle));
+    if (!dfa->shuffle) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    memset(dfa->shuffle->rows, 0, sizeof(dfa->shuffle->rows));
+    for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+        for (unsigned int state = 0; state < numStates; state++) {
+            dfa->shuffle->rows[c][state] = targets[state][dfa->classes[c]];
+        }
+        dfa->shuffle->rows[c][SHUFFLE_MATCH_STATE] = SHUFFLE_MATCH_STATE;
+    }
+    dfa->shuffle->end_states = endStates;
+#ifdef DFA_HAVE_SHUFFLE
+    dfa->shuffle->simd = __builtin_cpu_supports("ssse3");
+#else
+    dfa->shuffle->simd = false;
+#endif
+
+done:
+
+    freeTable(table);
+    return ret;
+}
+
+/*
+ * Returns the state the shuffle table is in at the end of the string, or the match state as soon as it's
+ * reached.
+ */
+static unsigned int
+runShuffleDfa(const nfaShuffleDfa *shuffle, const unsigned char *string, size_t len) {
+    unsigned int state = 0;
+    size_t idx = 0;
+
+#ifdef DFA_HAVE_SHUFFLE
+    if (shuffle->simd) {
+        return runShuffleDfaSimd(shuffle, string, len);
+    }
+#endif
+
+    while (idx < len) {
+        size_t stop = (len - idx > SHUFFLE_CHECK_PERIOD) ? idx + SHUFFLE_CHECK_PERIOD : len;
+
+        for (; idx < stop; idx++) {
+            state = shuffle->rows[string[idx]][state];
+        }
+        if (state == SHUFFLE_MATCH_STATE) {
+            break;
+        }
+    }
+
+    return state;
+}
+
+#ifdef DFA_HAVE_SHUFFLE
+
+/*
+ * Every byte of the state vector holds the current state.  Shuffling a row by it looks up the next state in
+ * every byte at once, so the vector never needs to be broadcast again.
+ */
+__attribute__((target("ssse3"))) static unsigned int
+runShuffleDfaSimd(const nfaShuffleDfa *shuffle, const unsigned char *string, size_t len) {
+    __m128i state = _mm_setzero_si128();
+    const __m128i *rows = (const __m128i *)shuffle->rows;
+    size_t idx = 0;
+
+    while (idx < len) {
+        size_t stop = (len - idx > SHUFFLE_CHECK_PERIOD) ? idx + SHUFFLE_CHECK_PERIOD : len;
+
+        for (; idx < stop; idx++) {
+            state = _mm_shuffle_epi8(_mm_load_si128(&rows[string[idx]]), state);
+        }
+        if ((_mm_cvtsi128_si32(state) & 0xff) == SHUFFLE_MATCH_STATE) {
+            break;
+        }
+    }
+
+    return _mm_cvtsi128_si32(state) & 0xff;
+}
+
+#endif  // DFA_HAVE_SHUFFLE
@@ -0,0 +1,243 @@
+#include <stdlib.h>
+
+#include "nfa.h"
+#include "nfaInternals.h"
+
+#define COST_ROUNDS 64  // How many characters the cost estimate is run for.
+
+/*
+ * Each entry point is given the cheapest engine which can handle the regex.  A plain string needs no NFA at
+ * all.  grrMatch follows a single state through a table if the regex is one-pass.  grrSearch only starts an
+ * anchored regex at one end of the line and puts a lazy DFA in front of the others.  Whatever is left runs
+ * the state sets, which are replaced by the backtracker for inputs short enough (see nfaCanBacktrack).
+ */
+
+static int
+estimateCost(grrNfa nfa, bool matching, double *cost);
+
+static void
+closeProbabilities(const nfaProgram *program, unsigned int length, double *probabilities);
+
+static double
+acceptedFraction(const nfaEdge *edge);
+
+int
+nfaSelectEngines(grrNfa nfa, size_t dfa_memory) {
+    if (nfa->min_length == GRR_NFA_UNBOUNDED) {
+        nfa->match_engine = nfa->search_engine = GRR_ENGINE_NONE;
+        return GRR_RET_OK;
+    }
+    if (nfa->literal) {
+        nfa->match_engine = nfa->search_engine = GRR_ENGINE_LITERAL;
+        return GRR_RET_OK;
+    }
+
+    nfa->match_engine = nfa->one_pass ? GRR_ENGINE_ONE_PASS : GRR_ENGINE_NFA;
+
+    if (nfa->reverse_offsets) {
+        nfa->search_engine = GRR_ENGINE_REVERSE;
+    } else if (nfa->anchors & GRR_NFA_FIRST_CHAR_FLAG) {
+        nfa->search_engine = GRR_ENGINE_ANCHORED;
+    } else {
+        nfa->search_engine = GRR_ENGINE_DFA;
+        return nfaAttachDfa(nfa, dfa_memory);
+    }
+
+    return GRR_RET_OK;
+}
+
+int
+grrExplain(grrNfa nfa, grrExplanation *explanation) {
+    int ret;
+    unsigned int numFirstBytes = 0;
+
+    if (!nfa || !explanation) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    *explanation = (grrExplanation){0};
+    explanation->match_engine = nfa->match_engine;
+    explanation->search_engine = nfa->search_engine;
+    explanation->num_states = nfa->length;
+    explanation->num_classes = nfa->program->num_classes;
+    explanation->min_length = nfa->min_length;
+    explanation->max_length = nfa->max_length;
+    explanation->anchored_start = nfa->anchors & GRR_NFA_FIRST_CHAR_FLAG;
+    explanation->anchored_end = nfa->anchors & GRR_NFA_LAST_CHAR_FLAG;
+    if (nfa->literal) {
+        explanation->literal = (const char *)nfa->literal;
+        explanation->literal_length = nfa->literal_length;
+    }
+    explanation->backtrack_limit = GRR_NFA_BACKTRACK_BITS / ((size_t)nfa->length + 1);
+    explanation->small_dfa = nfaDfaIsShuffled(nfa->dfa);
+
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        nfaEdge edges[2];
+
+        explanation->num_transitions += nfaDecodeState(nfa->program, k, edges);
+        if (nfaStateConsumes(nfa->program, k)) {
+            explanation->num_consuming_states++;
+        }
+    }
+    for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+        if (IS_FLAG_SET(nfa->first_bytes, c)) {
+            numFirstBytes++;
+        }
+    }
+    explanation->num_first_bytes = numFirstBytes;
+
+    if (nfa->match_engine == GRR_ENGINE_NONE) {
+        return GRR_RET_OK;
+    }
+    if (nfa->match_engine == GRR_ENGINE_LITERAL) {
+        // memmem can skip ahead by up to the length of the string.
+        explanation->match_cost = 1;
+        explanation->search_cost = 1.0 / (nfa->literal_length ? nfa->literal_length : 1);
+        return GRR_RET_OK;
+    }
+
+    if (nfa->match_engine == GRR_ENGINE_ONE_PASS) {
+        explanation->match_cost = 1;
+    } else {
+        ret = estimateCost(nfa, true, &explanation->match_cost);
+        if (ret != GRR_RET_OK) {
+            return ret;
+        }
+    }
+
+    if (nfa->search_engine == GRR_ENGINE_DFA) {
+        explanation->search_cost = 1;
+        return GRR_RET_OK;
+    }
+    return estimateCost(nfa, false, &explanation->search_cost);
+}
+
+const char *
+grrEngineName(grrEngine engine) {
+    switch (engine) {
+    case GRR_ENGINE_NONE: return "none";
+    case GRR_ENGINE_LITERAL: return "literal";
+    case GRR_ENGINE_ONE_PASS: return "one-pass";
+    case GRR_ENGINE_DFA: return "DFA";
+    case GRR_ENGINE_ANCHORED: return "anchored NFA";
+    case GRR_ENGINE_REVERSE: return "reverse NFA";
+    case GRR_ENGINE_NFA: return "NFA";
+    default: return "unknown";
+    }
+}
+
+/*
+ * Estimates how many transitions the state set simulation looks at per character.  The probability of each
+ * state being in flight is carried from one character to the next, assuming that the states are independent,
+ * and the estimate is taken once this has settled.
+ *
+ * grrSearch is assumed to see random characters, every one equally likely, and the first state is added
+ * wherever the character can begin a match.  grrMatch is assumed to see a string which every transition
+ * accepts and so the estimate is an upper bound.
+ */
+static int
+estimateCost(grrNfa nfa, bool matching, double *cost) {
+    double *current, *next, seed = 0, total = 0;
+
+    current = calloc((size_t)nfa->length + 1, sizeof(*current));
+    next = calloc((size_t)nfa->length + 1, sizeof(*next));
+    if (!current || !next) {
+        free(current);
+        free(next);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    if (matching) {
+        current[0] = 1;
+    } else {
+        for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+            if (IS_FLAG_SET(nfa->first_bytes, c)) {
+                seed += 1.0 / GRR_NFA_NUM_SYMBOLS;
+            }
+        }
+    }
+
+    for (unsigned int round = 0; round < COST_ROUNDS; round++) {
+        double *temp;
+
+        current[0] = (seed > current[0]) ? seed : current[0];
+        closeProbabilities(nfa->program, nfa->length, current);
+
+        total = 0;
+        for (unsigned int k = 0; k <= nfa->length; k++) {
+            next[k] = 1;
+        }
+        for (unsigned int k = 0; k < nfa->length; k++) {
+            nfaEdge edges[2];
+            unsigned int count;
+
+            count = nfaDecodeState(nfa->program, k, edges);
+            for (unsigned int j = 0; j < count; j++) {
+                if (edges[j].flags == 0) {
+                    double taken = current[k] * (matching ? 1 : acceptedFraction(&edges[j]));
+
+                    total += current[k];
+                    // For now, next holds the probability of each state not being entered.
+                    next[k + edges[j].motion] *= 1 - taken;
+                }
+            }
+        }
+        for (unsigned int k = 0; k <= nfa->length; k++) {
+            next[k] = 1 - next[k];
+        }
+
+        temp = current;
+        current = next;
+        next = temp;
+    }
+
+    *cost = total;
+    free(current);
+    free(next);
+    return GRR_RET_OK;
+}
+
+/*
+ * Spreads the probabilities along the empty transitions and lookaheads.  A state reached from several others
+ * is given the highest of their probabilities.
+ */
+static void
+closeProbabilities(const nfaProgram *program, unsigned int length, double *probabilities) {
+    bool changed = true;
+
+    // The states are laid out breadth-first so most empty transitions lead forward and few passes are needed.
+    for (unsigned int pass = 0; changed && pass <= length; pass++) {
+        changed = false;
+        for (unsigned int k = 0; k < length; k++) {
+            nfaEdge edges[2];
+            unsigned int count;
+
+            if (probabilities[k] == 0) {
+                continue;
+            }
+
+            count = nfaDecodeState(program, k, edges);
+            for (unsigned int j = 0; j < count; j++) {
+                double *target = &probabilities[k + edges[j].motion];
+
+                if (edges[j].flags != 0 && *target < probabilities[k]) {
+                    *target = probabilities[k];
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+static double
+acceptedFraction(const nfaEdge *edge) {
+    unsigned int count = 0;
+
+    for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+        if (nfaEdgeAccepts(edge, c)) {
+            count++;
+        }
+    }
+
+    return (double)count / GRR_NFA_NUM_SYMBOLS;
+}
@@ -0,0 +1,448 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfa.h"
+#include "nfaInternals.h"
+
+/*
+ * Each block's trigrams are recorded in a filter of 2^filter_shift bits.  A trigram sets two bits, picked by
+ * two multiplicative hashes, and a block may contain it only if both are set.  The filters take a bit for
+ * every two bytes of the buffer.
+ *
+ * An index file begins with INDEX_HEADER followed by the version, the size of the buffer, the number of
+ * blocks, and the filter shift as 64-bit integers.  Then come the blocks' offsets and the filters.
+ */
+
+#define INDEX_HEADER  "grrengine index\n"
+#define INDEX_VERSION 1
+
+#define MIN_FILTER_SHIFT 9
+#define MAX_FILTER_SHIFT 24
+
+struct grrIndexStruct {
+    uint64_t size;  // Of the buffer which was indexed.
+    uint64_t num_blocks;
+    uint64_t *offsets;  // Where each block begins, followed by the size.
+    unsigned int filter_shift;
+    unsigned char *filters;
+};
+
+static int
+findBlocks(grrIndex index, const char *buffer, size_t block_size);
+
+static void
+fillFilter(const char *block, size_t size, unsigned int shift, unsigned char *filter);
+
+static bool
+blockMatches(const grrIndex index, size_t block, const uint64_t *bits, const nfaTrigramQuery *query);
+
+static size_t
+filterBytes(const grrIndex index);
+
+static inline void
+trigramBits(uint32_t trigram, unsigned int shift, uint64_t *bit1, uint64_t *bit2) {
+    *bit1 = ((trigram + 1) * 0x9e3779b97f4a7c15ULL) >> (64 - shift);
+    *bit2 = ((trigram + 1) * 0xc2b2ae3d27d4eb4fULL) >> (64 - shift);
+}
+
+int
+grrBuildIndex(const char *buffer, size_t size, size_t block_size, grrIndex *index) {
+    int ret;
+    grrIndex new;
+
+    if ((!buffer && size > 0) || block_size == 0 || !index) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    new = calloc(1, sizeof(*new));
+    if (!new) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    new->size = size;
+
+    ret = findBlocks(new, buffer, block_size);
+    if (ret != GRR_RET_OK) {
+        grrFreeIndex(new);
+        return ret;
+    }
+
+    new->filter_shift = MIN_FILTER_SHIFT;
+    while (new->filter_shift < MAX_FILTER_SHIFT && ((size_t)1 << new->filter_shift) < block_size / 2) {
+        new->filter_shift++;
+    }
+
+    new->filters = calloc(new->num_blocks, filterBytes(new));
+    if (!new->filters && new->num_blocks > 0) {
+        grrFreeIndex(new);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    for (size_t k = 0; k < new->num_blocks; k++) {
+        fillFilter(buffer + new->offsets[k], new->offsets[k + 1] - new->offsets[k], new->filter_shift,
+                   new->filters + k * filterBytes(new));
+    }
+
+    *index = new;
+    return GRR_RET_OK;
+}
+
+int
+grrWriteIndex(grrIndex index, const char *path) {
+    uint64_t header[4];
+    FILE *file;
+    bool written;
+
+    if (!index || !path) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    file = fopen(path, "wb");
+    if (!file) {
+        return GRR_RET_IO_ERROR;
+    }
+
+    header[0] = INDEX_VERSION;
+    header[1] = index->size;
+    header[2] = index->num_blocks;
+    header[3] = index->filter_shift;
+    written = fwrite(INDEX_HEADER, 1, sizeof(INDEX_HEADER) - 1, file) == sizeof(INDEX_HEADER) - 1 &&
+              fwrite(header, sizeof(header), 1, file) == 1 &&
+              fwrite(index->offsets, sizeof(*index->offsets), index->num_blocks + 1, file) ==
+                  index->num_blocks + 1 &&
+              fwrite(index->filters, filterBytes(index), index->num_blocks, file) == index->num_blocks;
+    if (!written) {
+        int error = errno;
+
+        fclose(file);
+        errno = error;
+        return GRR_RET_IO_ERROR;
+    }
+
+    return (fclose(file) == 0) ? GRR_RET_OK : GRR_RET_IO_ERROR;
+}
+
+int
+grrReadIndex(const char *path, grrIndex *index) {
+    int ret = GRR_RET_BAD_DATA;
+    uint64_t header[4];
+    char magic[sizeof(INDEX_HEADER) - 1];
+    FILE *file;
+    grrIndex new;
+
+    if (!path || !index) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    file = fopen(path, "rb");
+    if (!file) {
+        return GRR_RET_IO_ERROR;
+    }
+
+    new = calloc(1, sizeof(*new));
+    if (!new) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto error;
+    }
+
+    if (fread(magic, sizeof(magic), 1, file) != 1 || fread(header, sizeof(header), 1, file) != 1) {
+        goto error;
+    }
+    if (memcmp(magic, INDEX_HEADER, sizeof(magic)) != 0 || header[0] != INDEX_VERSION ||
+        header[3] < MIN_FILTER_SHIFT || header[3] > MAX_FILTER_SHIFT || header[2] > header[1] ||
+        header[2] >= SIZE_MAX >> MAX_FILTER_SHIFT) {
+        goto error;
+    }
+    new->size = header[1];
+    new->num_blocks = header[2];
+    new->filter_shift = header[3];
+
+    new->offsets = malloc(sizeof(*new->offsets) * (new->num_blocks + 1));
+    new->filters = malloc(new->num_blocks * filterBytes(new) + 1);
+    if (!new->offsets || !new->filters) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto error;
+    }
+    if (fread(new->offsets, sizeof(*new->offsets), new->num_blocks + 1, file) != new->num_blocks + 1 ||
+        fread(new->filters, filterBytes(new), new->num_blocks, file) != new->num_blocks) {
+        goto error;
+    }
+
+    // The blocks have to cover the buffer in order.
+    if (new->offsets[0] != 0 || new->offsets[new->num_blocks] != new->size) {
+        goto error;
+    }
+    for (size_t k = 0; k < new->num_blocks; k++) {
+        if (new->offsets[k] >= new->offsets[k + 1]) {
+            goto error;
+        }
+    }
+
+    fclose(file);
+    *index = new;
+    return GRR_RET_OK;
+
+error:
+
+    // A short read is only a truncated index if it wasn't the file system's fault.
+    if (ferror(file)) {
+        int error = errno;
+
+        fclose(file);
+        grrFreeIndex(new);
+        errno = error;
+        return GRR_RET_IO_ERROR;
+    }
+    fclose(file);
+    grrFreeIndex(new);
+    return ret;
+}
+
+size_t
+grrIndexNumBlocks(grrIndex index) {
+    return index ? index->num_blocks : 0;
+}
+
+int
+grrIndexCandidates(grrIndex index, grrNfa nfa, unsigned char *candidates, size_t *num_candidates) {
+    int ret;
+    size_t count = 0, numTrigrams = 0;
+    uint64_t *bits;
+    nfaTrigramQuery query;
+
+    if (!index || !nfa || !candidates) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    ret = nfaBuildTrigramQuery(nfa, &query);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+
+    // Each trigram's bits are worked out once.  They're stored in the same layout as the clauses.
+    for (unsigned int k = 0, idx = 0; k < query.num_clauses; k++, idx += query.clauses[idx] + 1) {
+        numTrigrams += query.clauses[idx] + 1;
+    }
+    bits = malloc(sizeof(*bits) * 2 * (numTrigrams + 1));
+    if (!bits) {
+        nfaFreeTrigramQuery(&query);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    for (size_t k = 0; k < numTrigrams; k++) {
+        trigramBits(query.clauses[k], index->filter_shift, &bits[2 * k], &bits[2 * k + 1]);
+    }
+
+    memset(candidates, 0, (index->num_blocks + 7) / 8);
+    for (size_t k = 0; k < index->num_blocks; k++) {
+        if (blockMatches(index, k, bits, &query)) {
+            SET_FLAG(candidates, k);
+            count++;
+        }
+    }
+
+    if (num_candidates) {
+        *num_candidates = count;
+    }
+    free(bits);
+    nfaFreeTrigramQuery(&query);
+    return GRR_RET_OK;
+}
+
+int
+grrIndexSearch(grrIndex index, grrNfa nfa, const unsigned char *candidates, const char *buffer, size_t size,
+               size_t from, size_t *start, size_t *end, size_t *cursor) {
+    size_t block, low, high;
+
+    if (!index || !nfa || !candidates || !buffer || from > size) {
+        return GRR_RET_BAD_ARGS;
+    }
+    if (size != index->size) {
+        return GRR_RET_BAD_DATA;
+    }
+
+    // Find the last block which begins at or before from.
+    low = 0;
+    high = index->num_blocks;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+
+        if (index->offsets[middle] <= from) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    block = low;
+
+    while (from < size) {
+        size_t blockEnd, matchStart, matchEnd, lineEnd;
+
+        if (!IS_FLAG_SET(candidates, block)) {
+            from = index->offsets[++block];
+            continue;
+        }
+
+        blockEnd = index->offsets[block + 1];
+        if (grrSearch(nfa, buffer + from, blockEnd - from, &matchStart, &matchEnd, &lineEnd, false) ==
+            GRR_RET_OK) {
+            if (start) {
+                *start = from + matchStart;
+            }
+            if (end) {
+                *end = from + matchEnd;
+            }
+            if (cursor) {
+                *cursor = nfaNextLine(buffer, size, from + lineEnd);
+            }
+            return GRR_RET_OK;
+        }
+
+        from = nfaNextLine(buffer, size, from + lineEnd);
+        if (from >= blockEnd) {
+            block++;
+        }
+    }
+
+    if (cursor) {
+        *cursor = size;
+    }
+    return GRR_RET_NOT_FOUND;
+}
+
+int
+grrIndexCount(grrIndex index, grrNfa nfa, const char *buffer, size_t size, size_t *count) {
+    int ret;
+    size_t total = 0;
+    unsigned char *candidates;
+
+    if (!index || !nfa || !buffer || !count) {
+        return GRR_RET_BAD_ARGS;
+    }
+    if (size != index->size) {
+        return GRR_RET_BAD_DATA;
+    }
+
+    candidates = malloc((index->num_blocks + 7) / 8 + 1);
+    if (!candidates) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    ret = grrIndexCandidates(index, nfa, candidates, NULL);
+    if (ret != GRR_RET_OK) {
+        free(candidates);
+        return ret;
+    }
+
+    for (size_t k = 0; k < index->num_blocks; k++) {
+        size_t blockCount;
+
+        if (IS_FLAG_SET(candidates, k)) {
+            grrCount(nfa, buffer + index->offsets[k], index->offsets[k + 1] - index->offsets[k], &blockCount);
+            total += blockCount;
+        }
+    }
+
+    free(candidates);
+    *count = total;
+    return GRR_RET_OK;
+}
+
+void
+grrFreeIndex(grrIndex index) {
+    if (!index) {
+        return;
+    }
+
+    free(index->offsets);
+    free(index->filters);
+    free(index);
+}
+
+/*
+ * Splits the buffer into blocks which end at the beginning of a line.
+ */
+static int
+findBlocks(grrIndex index, const char *buffer, size_t block_size) {
+    size_t capacity = 16, pos = 0;
+
+    index->offsets = malloc(sizeof(*index->offsets) * capacity);
+    if (!index->offsets) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    while (pos < index->size) {
+        if (index->num_blocks + 2 > capacity) {
+            uint64_t *offsets;
+
+            offsets = realloc(index->offsets, sizeof(*offsets) * capacity * 2);
+            if (!offsets) {
+                return GRR_RET_OUT_OF_MEMORY;
+            }
+            index->offsets = offsets;
+            capacity *= 2;
+        }
+
+        index->offsets[index->num_blocks++] = pos;
+        pos = (index->size - pos > block_size) ? nfaNextLine(buffer, index->size, pos + block_size - 1) :
+                                                 index->size;
+    }
+    index->offsets[index->num_blocks] = index->size;
+
+    return GRR_RET_OK;
+}
+
+static void
+fillFilter(const char *block, size_t size, unsigned int shift, unsigned char *filter) {
+    uint32_t trigram = 0;
+    unsigned int run = 0;  // How many characters since the last line break.
+
+    for (size_t k = 0; k < size; k++) {
+        unsigned char c = block[k];
+        uint64_t bit1, bit2;
+
+        if (IS_LINE_BREAK(c)) {
+            run = 0;
+            continue;
+        }
+
+        trigram = (trigram << 8 | c) & 0xffffff;
+        if (++run < 3) {
+            continue;
+        }
+        trigramBits(trigram, shift, &bit1, &bit2);
+        SET_FLAG(filter, bit1);
+        SET_FLAG(filter, bit2);
+    }
+}
+
+/*
+ * Determines if a block might satisfy every clause of a query.
+ */
+static bool
+blockMatches(const grrIndex index, size_t block, const uint64_t *bits, const nfaTrigramQuery *query) {
+    const unsigned char *filter = index->filters + block * filterBytes(index);
+
+    if (query->never) {
+        return false;
+    }
+
+    for (unsigned int k = 0, idx = 0; k < query->num_clauses; k++, idx += query->clauses[idx] + 1) {
+        bool satisfied = false;
+
+        for (unsigned int j = 1; j <= query->clauses[idx]; j++) {
+            if (IS_FLAG_SET(filter, bits[2 * (idx + j)]) && IS_FLAG_SET(filter, bits[2 * (idx + j) + 1])) {
+                satisfied = true;
+                break;
+            }
+        }
+        if (!satisfied) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static size_t
+filterBytes(const grrIndex index) {
+    return ((size_t)1 << index->filter_shift) / 8;
+}
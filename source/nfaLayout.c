@@ -0,0 +1,288 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaCompiler.h"
+#include "nfaInternals.h"
+
+/*
+ * The parser lays states out in whatever order the pattern produced them, so an alternation's branches and a
+ * loop's way back can be far apart.  The states are renumbered in breadth-first order from the start so that
+ * states which are active together tend to share cache lines.  If a profile is given, the states which were
+ * visited most often come first instead, ties keeping their breadth-first order.  The start state stays 0.
+ *
+ * A profile lists the visits in breadth-first order.  Since that order only depends on the shape of the NFA,
+ * a profile taken from a regex which was itself laid out from a profile still lines up.  The header holds the
+ * number of states and a hash of the pattern and flags so that another regex's profile is rejected.
+ */
+
+#define PROFILE_HEADER "grrengine profile"
+
+typedef struct layoutEntry {
+    unsigned long visits;
+    unsigned int state;
+    unsigned int rank;  // The state's breadth-first position.
+} layoutEntry;
+
+static void
+programOrder(const nfaProgram *program, unsigned int length, unsigned int *order, unsigned int *ranks);
+
+static int
+readProfile(const char *path, unsigned int length, unsigned int hash, unsigned long *visits);
+
+static int
+compareEntries(const void *item1, const void *item2);
+
+int
+nfaLayout(grrNfa nfa, const char *profile) {
+    int ret;
+    unsigned int *order, *map, numOrdered = 0;
+    unsigned long *visits = NULL;
+    layoutEntry *entries = NULL;
+    nfaNode *nodes = NULL;
+
+    if (nfa->length == 0) {
+        return GRR_RET_OK;
+    }
+
+    order = malloc(sizeof(*order) * nfa->length);
+    map = malloc(sizeof(*map) * ((size_t)nfa->length + 1));
+    if (!order || !map) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        map[k] = UINT_MAX;
+    }
+    map[0] = 0;
+    order[numOrdered++] = 0;
+    for (unsigned int k = 0; k < numOrdered; k++) {
+        const nfaNode *node = &nfa->nodes[order[k]];
+
+        for (unsigned int j = 0; j <= node->two_transitions; j++) {
+            unsigned int target = order[k] + node->transitions[j].motion;
+
+            if (target < nfa->length && map[target] == UINT_MAX) {
+                map[target] = numOrdered;
+                order[numOrdered++] = target;
+            }
+        }
+    }
+    // The optimizer removes unreachable states but they would keep their relative order regardless.
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        if (map[k] == UINT_MAX) {
+            map[k] = numOrdered;
+            order[numOrdered++] = k;
+        }
+    }
+
+    if (profile) {
+        visits = malloc(sizeof(*visits) * nfa->length);
+        entries = malloc(sizeof(*entries) * nfa->length);
+        if (!visits || !entries) {
+            ret = GRR_RET_OUT_OF_MEMORY;
+            goto done;
+        }
+
+        ret = readProfile(profile, nfa->length, nfa->pattern_hash, visits);
+        if (ret != GRR_RET_OK) {
+            goto done;
+        }
+
+        for (unsigned int k = 0; k < nfa->length; k++) {
+            entries[k].visits = visits[k];
+            entries[k].state = order[k];
+            entries[k].rank = k;
+        }
+        qsort(entries + 1, nfa->length - 1, sizeof(*entries), compareEntries);
+        for (unsigned int k = 0; k < nfa->length; k++) {
+            map[entries[k].state] = k;
+        }
+    }
+    map[nfa->length] = nfa->length;
+
+    nodes = malloc(sizeof(*nodes) * nfa->length);
+    if (!nodes) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        nfaNode *node = &nodes[map[k]];
+
+        *node = nfa->nodes[k];
+        for (unsigned int j = 0; j <= node->two_transitions; j++) {
+            node->transitions[j].motion = (int)map[k + node->transitions[j].motion] - (int)map[k];
+        }
+    }
+
+    free(nfa->nodes);
+    nfa->nodes = nodes;
+    ret = GRR_RET_OK;
+
+done:
+
+    free(order);
+    free(map);
+    free(visits);
+    free(entries);
+    return ret;
+}
+
+int
+grrWriteProfile(grrNfa nfa, const char *buffer, size_t size, const char *path) {
+    int ret;
+    unsigned int *order;
+    unsigned long *visits;
+    FILE *file;
+
+    if (!nfa || (!buffer && size > 0) || !path) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    visits = calloc((size_t)nfa->length + 1, sizeof(*visits));
+    order = malloc(sizeof(*order) * 2 * ((size_t)nfa->length + 1));
+    if (!visits || !order) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+    ret = nfaProfile(nfa, buffer, size, visits);
+    if (ret != GRR_RET_OK) {
+        goto done;
+    }
+    programOrder(nfa->program, nfa->length, order, order + nfa->length + 1);
+
+    file = fopen(path, "w");
+    if (!file) {
+        ret = GRR_RET_IO_ERROR;
+        goto done;
+    }
+
+    fprintf(file, "%s\n%u %x\n", PROFILE_HEADER, nfa->length, nfa->pattern_hash);
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        fprintf(file, "%lu\n", visits[order[k]]);
+    }
+    if (ferror(file)) {
+        int error = errno;
+
+        fclose(file);
+        errno = error;
+        ret = GRR_RET_IO_ERROR;
+    } else {
+        ret = (fclose(file) == 0) ? GRR_RET_OK : GRR_RET_IO_ERROR;
+    }
+
+done:
+
+    free(visits);
+    free(order);
+    return ret;
+}
+
+unsigned int
+nfaHashPattern(const char *string, size_t len, unsigned int flags) {
+    unsigned int hash = 2166136261U ^ flags;
+
+    for (size_t k = 0; k < len; k++) {
+        hash = (hash ^ (unsigned char)string[k]) * 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * The same breadth-first walk as nfaLayout's but over a compiled regex.
+ */
+static void
+programOrder(const nfaProgram *program, unsigned int length, unsigned int *order, unsigned int *ranks) {
+    unsigned int numOrdered = 0;
+
+    if (length == 0) {
+        return;
+    }
+    for (unsigned int k = 0; k < length; k++) {
+        ranks[k] = UINT_MAX;
+    }
+
+    ranks[0] = 0;
+    order[numOrdered++] = 0;
+    for (unsigned int k = 0; k < numOrdered; k++) {
+        nfaEdge edges[2];
+        unsigned int count;
+
+        count = nfaDecodeState(program, order[k], edges);
+        for (unsigned int j = 0; j < count; j++) {
+            unsigned int target = order[k] + edges[j].motion;
+
+            if (target < length && ranks[target] == UINT_MAX) {
+                ranks[target] = numOrdered;
+                order[numOrdered++] = target;
+            }
+        }
+    }
+    for (unsigned int k = 0; k < length; k++) {
+        if (ranks[k] == UINT_MAX) {
+            ranks[k] = numOrdered;
+            order[numOrdered++] = k;
+        }
+    }
+}
+
+static int
+readProfile(const char *path, unsigned int length, unsigned int hash, unsigned long *visits) {
+    int ret = GRR_RET_BAD_DATA;
+    unsigned int fileLength, fileHash;
+    char header[sizeof(PROFILE_HEADER) + 1];
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open the profile %s\n", path);
+        return GRR_RET_IO_ERROR;
+    }
+
+    if (!fgets(header, sizeof(header), file) || strcmp(header, PROFILE_HEADER "\n") != 0 ||
+        fscanf(file, "%u %x", &fileLength, &fileHash) != 2) {
+        if (!ferror(file)) {
+            fprintf(stderr, "%s is not a profile\n", path);
+        }
+        goto done;
+    }
+    if (fileLength != length || fileHash != hash) {
+        fprintf(stderr, "The profile %s was written for a different regex\n", path);
+        goto done;
+    }
+
+    for (unsigned int k = 0; k < length; k++) {
+        if (fscanf(file, "%lu", &visits[k]) != 1) {
+            if (!ferror(file)) {
+                fprintf(stderr, "The profile %s is truncated\n", path);
+            }
+            goto done;
+        }
+    }
+    ret = GRR_RET_OK;
+
+done:
+
+    if (ferror(file)) {
+        int error = errno;
+
+        fprintf(stderr, "Could not read the profile %s\n", path);
+        fclose(file);
+        errno = error;
+        return GRR_RET_IO_ERROR;
+    }
+    fclose(file);
+    return ret;
+}
+
+static int
+compareEntries(const void *item1, const void *item2) {
+    const layoutEntry *entry1 = item1, *entry2 = item2;
+
+    if (entry1->visits != entry2->visits) {
+        return (entry1->visits < entry2->visits) ? 1 : -1;
+    }
+    return (entry1->rank > entry2->rank) - (entry1->rank < entry2->rank);
+}
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+
+static int
+singleSymbol(const nfaTransition *transition);
+
+/*
+ * A literal regex compiles into a chain of nodes which each have a single transition: any number of '^'s, the
+ * characters, and then any number of '$'s.
+ */
+int
+nfaDetectLiteral(grrNfa nfa) {
+    unsigned int state = 0, length = 0, hops;
+    unsigned char anchors = 0;
+    unsigned char *literal;
+
+    literal = malloc(nfa->length);
+    if (!literal) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    // Bounding the walk by the number of nodes keeps a cycle from trapping it.
+    for (hops = 0; hops < nfa->length && state < nfa->length; hops++) {
+        const nfaTransition *transition = &nfa->nodes[state].transitions[0];
+        int character;
+
+        if (nfa->nodes[state].two_transitions) {
+            break;
+        }
+
+        if (transition->flags == (GRR_NFA_EMPTY_TRANSITION_FLAG | GRR_NFA_FIRST_CHAR_FLAG)) {
+            if (length > 0 || (anchors & GRR_NFA_LAST_CHAR_FLAG)) {
+                break;
+            }
+            anchors |= GRR_NFA_FIRST_CHAR_FLAG;
+        } else if (transition->flags == (GRR_NFA_EMPTY_TRANSITION_FLAG | GRR_NFA_LAST_CHAR_FLAG)) {
+            anchors |= GRR_NFA_LAST_CHAR_FLAG;
+        } else {
+            character = singleSymbol(transition);
+            if (character < 0 || (anchors & GRR_NFA_LAST_CHAR_FLAG)) {
+                break;
+            }
+            literal[length++] = character;
+        }
+
+        state += transition->motion;
+    }
+
+    if (state != nfa->length || length == 0) {
+        free(literal);
+        return GRR_RET_OK;
+    }
+
+    nfa->literal = literal;
+    nfa->literal_length = length;
+    return GRR_RET_OK;
+}
+
+int
+nfaMatchLiteral(grrNfa nfa, const char *string, size_t len) {
+    // grrMatch ignores the anchors.
+    if (len != nfa->literal_length || memcmp(string, nfa->literal, len) != 0) {
+        return GRR_RET_NOT_FOUND;
+    }
+    return GRR_RET_OK;
+}
+
+int
+nfaSearchLiteral(grrNfa nfa, const char *string, size_t len, size_t *start, size_t *end, size_t *cursor) {
+    size_t lineLen, literalLen;
+    const char *match = NULL;
+
+    lineLen = nfaLineEnd(string, len, 0);
+    if (cursor) {
+        *cursor = lineLen;
+    }
+
+    literalLen = nfa->literal_length;
+    if (literalLen > lineLen) {
+        return GRR_RET_NOT_FOUND;
+    }
+
+    switch (nfa->anchors) {
+    case GRR_NFA_FIRST_CHAR_FLAG | GRR_NFA_LAST_CHAR_FLAG:
+        if (literalLen == lineLen && memcmp(string, nfa->literal, literalLen) == 0) {
+            match = string;
+        }
+        break;
+
+    case GRR_NFA_FIRST_CHAR_FLAG:
+        if (memcmp(string, nfa->literal, literalLen) == 0) {
+            match = string;
+        }
+        break;
+
+    case GRR_NFA_LAST_CHAR_FLAG:
+        if (memcmp(string + lineLen - literalLen, nfa->literal, literalLen) == 0) {
+            match = string + lineLen - literalLen;
+        }
+        break;
+
+    default: match = memmem(string, lineLen, nfa->literal, literalLen); break;
+    }
+
+    if (!match) {
+        return GRR_RET_NOT_FOUND;
+    }
+
+    if (start) {
+        *start = match - string;
+    }
+    if (end) {
+        *end = match - string + literalLen;
+    }
+    return GRR_RET_OK;
+}
+
+const char *
+nfaFindLiteral(grrNfa nfa, const char *string, size_t len) {
+    return memmem(string, len, nfa->literal, nfa->literal_length);
+}
+
+/*
+ * Returns the character matched by a transition if it's an unconditional transition on exactly one character
+ * other than a line break.  Otherwise, returns -1.
+ */
+static int
+singleSymbol(const nfaTransition *transition) {
+    int character = -1;
+
+    if (transition->flags) {
+        return -1;
+    }
+
+    for (unsigned int k = 0; k < sizeof(transition->symbols); k++) {
+        if (transition->symbols[k] == 0) {
+            continue;
+        }
+        if (character >= 0 || (transition->symbols[k] & (transition->symbols[k] - 1))) {
+            return -1;
+        }
+        character = k * 8 + __builtin_ctz(transition->symbols[k]);
+    }
+
+    return (character >= 0 && !IS_LINE_BREAK(character)) ? character : -1;
+}
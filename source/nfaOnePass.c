@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+
+/*
+ * A regex is one-pass if, once the empty transitions have been followed, at most one state can be reached on
+ * any given character.  grrMatch then only ever has a single state in flight, so the NFA is compiled into a
+ * table holding, for each state which can be entered by consuming a character, the state entered next on
+ * each class of characters.  Row 0 is a dead state which loops on itself.  Entries are the offsets of the
+ * rows rather than their indices so that following one costs a single load.
+ *
+ * grrMatch ignores the anchors, so they're followed like any other empty transition.  A lookahead is crossed
+ * at the end of the string or, as the state set simulation does, if it accepts the null character.  So, each
+ * row's transitions are found without crossing the other lookaheads and whether it accepts is found with.
+ */
+
+#define ONE_PASS_DEAD_ROW 0
+
+struct nfaOnePass {
+    unsigned int start;  // The offset of the row of the NFA's first state.
+    unsigned int num_classes;
+    unsigned char classes[GRR_NFA_NUM_SYMBOLS];
+    const unsigned int *next;
+    const unsigned char *accepting;  // For each row, whether the accepting state can be reached from it.
+    size_t size;  // Of the whole allocation.
+};
+
+static unsigned int
+computeClasses(const nfaProgram *program, unsigned int length, unsigned char *classes);
+
+static bool
+fillRow(const nfaProgram *program, unsigned int length, const unsigned int *rows, unsigned int state,
+        const unsigned char *classes, unsigned int numClasses, unsigned int *stamps, unsigned int *stack,
+        unsigned int *next);
+
+static void
+closeRow(const nfaProgram *program, unsigned int length, unsigned int state, unsigned int *stamps,
+         unsigned int *stack, unsigned char *accepting);
+
+int
+nfaDetectOnePass(grrNfa nfa) {
+    int ret;
+    unsigned int *rows, *stamps, *stack, *next, numRows = 1, numClasses;
+    size_t tableSize, size;
+    unsigned char classes[GRR_NFA_NUM_SYMBOLS];
+    unsigned char *block, *accepting;
+    struct nfaOnePass *new;
+
+    if (nfa->length == 0 || nfa->literal || nfa->min_length == GRR_NFA_UNBOUNDED) {
+        return GRR_RET_OK;
+    }
+
+    rows = malloc(sizeof(*rows) * ((size_t)nfa->length + 1));
+    stamps = calloc((size_t)nfa->length + 1, sizeof(*stamps));
+    stack = malloc(sizeof(*stack) * ((size_t)nfa->length + 1));
+    if (!rows || !stamps || !stack) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    for (unsigned int k = 0; k <= nfa->length; k++) {
+        rows[k] = UINT_MAX;
+    }
+    rows[0] = numRows++;
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        nfaEdge edges[2];
+        unsigned int count;
+
+        count = nfaDecodeState(nfa->program, k, edges);
+        for (unsigned int j = 0; j < count; j++) {
+            unsigned int target = k + edges[j].motion;
+
+            if (edges[j].flags == 0 && rows[target] == UINT_MAX) {
+                rows[target] = numRows++;
+            }
+        }
+    }
+
+    numClasses = computeClasses(nfa->program, nfa->length, classes);
+    tableSize = sizeof(*next) * numRows * numClasses;
+    if (tableSize > GRR_NFA_ONE_PASS_MEMORY) {
+        ret = GRR_RET_OK;
+        goto done;
+    }
+
+    size = sizeof(*new) + tableSize + numRows;
+    block = malloc(size);
+    if (!block) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+    new = (struct nfaOnePass *)block;
+    next = (unsigned int *)(block + sizeof(*new));
+    accepting = block + sizeof(*new) + tableSize;
+
+    memset(next, 0, tableSize);
+    memset(accepting, 0, numRows);
+    for (unsigned int k = 0; k <= nfa->length; k++) {
+        if (rows[k] != UINT_MAX && !fillRow(nfa->program, nfa->length, rows, k, classes, numClasses, stamps,
+                                            stack, next + (size_t)rows[k] * numClasses)) {
+            free(block);
+            ret = GRR_RET_OK;
+            goto done;
+        }
+    }
+    for (unsigned int k = 0; k <= nfa->length; k++) {
+        if (rows[k] != UINT_MAX) {
+            closeRow(nfa->program, nfa->length, k, stamps, stack, &accepting[rows[k]]);
+        }
+    }
+
+    new->start = rows[0] * numClasses;
+    new->num_classes = numClasses;
+    memcpy(new->classes, classes, sizeof(classes));
+    new->next = next;
+    new->accepting = accepting;
+    new->size = size;
+    nfa->one_pass = new;
+    ret = GRR_RET_OK;
+
+done:
+
+    free(rows);
+    free(stamps);
+    free(stack);
+    return ret;
+}
+
+int
+nfaOnePassMatch(const struct nfaOnePass *engine, const char *string, size_t len) {
+    unsigned int offset = engine->start;
+
+    for (size_t idx = 0; idx < len; idx++) {
+        offset = engine->next[offset + engine->classes[(unsigned char)string[idx]]];
+        if (offset == ONE_PASS_DEAD_ROW) {
+            return GRR_RET_NOT_FOUND;
+        }
+    }
+
+    return engine->accepting[offset / engine->num_classes] ? GRR_RET_OK : GRR_RET_NOT_FOUND;
+}
+
+size_t
+nfaOnePassMemoryUsage(const struct nfaOnePass *engine) {
+    return engine->size;
+}
+
+/*
+ * Splits the bytes into classes which no consuming transition can tell apart, as the DFA does.
+ */
+static unsigned int
+computeClasses(const nfaProgram *program, unsigned int length, unsigned char *classes) {
+    unsigned int numClasses = 1;
+    int newIds[2 * GRR_NFA_NUM_SYMBOLS];
+
+    memset(classes, 0, GRR_NFA_NUM_SYMBOLS);
+    for (unsigned int k = 0; k < length; k++) {
+        nfaEdge edges[2];
+        unsigned int count;
+
+        count = nfaDecodeState(program, k, edges);
+        for (unsigned int j = 0; j < count; j++) {
+            unsigned int nextClass = 0;
+
+            if (edges[j].flags != 0) {
+                continue;
+            }
+
+            for (unsigned int i = 0; i < 2 * numClasses; i++) {
+                newIds[i] = -1;
+            }
+            for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+                unsigned int key = 2 * classes[c] + nfaEdgeAccepts(&edges[j], c);
+
+                if (newIds[key] < 0) {
+                    newIds[key] = nextClass++;
+                }
+                classes[c] = newIds[key];
+            }
+            numClasses = nextClass;
+        }
+    }
+
+    return numClasses;
+}
+
+/*
+ * Follows the empty transitions from a state, in the middle of the string, and records where each class of
+ * characters leads.  Returns false if some class leads to more than one state.
+ */
+static bool
+fillRow(const nfaProgram *program, unsigned int length, const unsigned int *rows, unsigned int state,
+        const unsigned char *classes, unsigned int numClasses, unsigned int *stamps, unsigned int *stack,
+        unsigned int *next) {
+    unsigned int depth = 0, stamp = 2 * state + 1;
+
+    stamps[state] = stamp;
+    stack[depth++] = state;
+    while (depth > 0) {
+        unsigned int current = stack[--depth], count;
+        nfaEdge edges[2];
+
+        if (current == length) {
+            continue;
+        }
+
+        count = nfaDecodeState(program, current, edges);
+        for (unsigned int j = 0; j < count; j++) {
+            unsigned int target = current + edges[j].motion;
+
+            if (edges[j].flags & GRR_NFA_LOOKAHEAD_FLAG) {
+                if (nfaEdgeAccepts(&edges[j], 0) && stamps[target] != stamp) {
+                    stamps[target] = stamp;
+                    stack[depth++] = target;
+                }
+                continue;
+            }
+            if (edges[j].flags & GRR_NFA_EMPTY_TRANSITION_FLAG) {
+                if (stamps[target] != stamp) {
+                    stamps[target] = stamp;
+                    stack[depth++] = target;
+                }
+                continue;
+            }
+
+            for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+                unsigned int *entry = &next[classes[c]];
+
+                if (!nfaEdgeAccepts(&edges[j], c)) {
+                    continue;
+                }
+                if (*entry != ONE_PASS_DEAD_ROW && *entry != rows[target] * numClasses) {
+                    return false;
+                }
+                *entry = rows[target] * numClasses;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Follows the empty transitions from a state at the end of the string, where every lookahead is crossed, to
+ * find out if the accepting state can be reached.
+ */
+static void
+closeRow(const nfaProgram *program, unsigned int length, unsigned int state, unsigned int *stamps,
+         unsigned int *stack, unsigned char *accepting) {
+    unsigned int depth = 0, stamp = 2 * state + 2;
+
+    stamps[state] = stamp;
+    stack[depth++] = state;
+    while (depth > 0) {
+        unsigned int current = stack[--depth], count;
+        nfaEdge edges[2];
+
+        if (current == length) {
+            *accepting = 1;
+            return;
+        }
+
+        count = nfaDecodeState(program, current, edges);
+        for (unsigned int j = 0; j < count; j++) {
+            unsigned int target = current + edges[j].motion;
+
+            if (edges[j].flags != 0 && stamps[target] != stamp) {
+                stamps[target] = stamp;
+                stack[depth++] = target;
+            }
+        }
+    }
+}
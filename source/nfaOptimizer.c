@@ -0,0 +1,443 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+
+/*
+ * While the passes run, every motion holds the absolute index of its target rather than an offset.  The
+ * accepting state is the index equal to the NFA's length.
+ */
+
+#define IS_PLAIN_EPSILON(transition) ((transition)->flags == GRR_NFA_EMPTY_TRANSITION_FLAG)
+#define IS_CONSUMING(transition)     ((transition)->flags == 0)
+
+static void
+makeMotionsAbsolute(grrNfa nfa);
+
+static void
+makeMotionsRelative(grrNfa nfa);
+
+static unsigned int
+skipEpsilonChain(const grrNfa nfa, unsigned int state);
+
+static bool
+skipEpsilonChains(grrNfa nfa, unsigned int *start);
+
+static bool
+isSingleConsumer(const grrNfa nfa, unsigned int state);
+
+static bool
+isDeadEnd(const grrNfa nfa, unsigned int state);
+
+static bool
+mergeCharacterAlternatives(grrNfa nfa);
+
+static bool
+factorCommonPrefixes(grrNfa nfa, unsigned int start, unsigned int *inDegrees);
+
+static int
+compareNodes(const nfaNode *node1, const nfaNode *node2);
+
+static bool
+mergeEquivalentNodes(grrNfa nfa, unsigned int *start, const nfaNode **order, unsigned int *map);
+
+static int
+compactNfa(grrNfa nfa, unsigned int start, unsigned int *map);
+
+static int
+compareNodePointers(const void *item1, const void *item2);
+
+int
+nfaOptimize(grrNfa nfa) {
+    int ret;
+    unsigned int start = 0;
+    unsigned int *scratch;
+    const nfaNode **order;
+    bool changed;
+
+    if (nfa->length == 0) {
+        return GRR_RET_OK;
+    }
+
+    scratch = malloc(sizeof(*scratch) * 2 * ((size_t)nfa->length + 1));
+    order = malloc(sizeof(*order) * nfa->length);
+    if (!scratch || !order) {
+        free(scratch);
+        free(order);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    makeMotionsAbsolute(nfa);
+
+    // Every pass either shrinks the reachable NFA or moves a split one node further along a path so a bound on
+    // the number of rounds is only a safeguard.
+    for (unsigned int round = 0; round <= nfa->length; round++) {
+        changed = skipEpsilonChains(nfa, &start);
+        changed |= mergeCharacterAlternatives(nfa);
+        changed |= factorCommonPrefixes(nfa, start, scratch);
+        changed |= mergeEquivalentNodes(nfa, &start, order, scratch);
+        if (!changed) {
+            break;
+        }
+    }
+
+    ret = compactNfa(nfa, start, scratch);
+    makeMotionsRelative(nfa);
+
+    free(scratch);
+    free(order);
+    return ret;
+}
+
+static void
+makeMotionsAbsolute(grrNfa nfa) {
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        for (unsigned int j = 0; j <= nfa->nodes[k].two_transitions; j++) {
+            nfa->nodes[k].transitions[j].motion += k;
+        }
+    }
+}
+
+static void
+makeMotionsRelative(grrNfa nfa) {
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        for (unsigned int j = 0; j <= nfa->nodes[k].two_transitions; j++) {
+            nfa->nodes[k].transitions[j].motion -= k;
+        }
+    }
+}
+
+/*
+ * Follows nodes whose only transition is an unconditional epsilon.  The number of hops is bounded by the length
+ * of the NFA so that a cycle of such nodes can't hang the compiler.
+ */
+static unsigned int
+skipEpsilonChain(const grrNfa nfa, unsigned int state) {
+    for (unsigned int hops = 0; hops < nfa->length && state < nfa->length; hops++) {
+        const nfaNode *node = &nfa->nodes[state];
+
+        // A tagged node records a capture and so has to stay on the path.
+        if (node->two_transitions || !IS_PLAIN_EPSILON(&node->transitions[0]) || node->tag) {
+            break;
+        }
+        state = node->transitions[0].motion;
+    }
+
+    return state;
+}
+
+static bool
+skipEpsilonChains(grrNfa nfa, unsigned int *start) {
+    bool changed = false;
+    unsigned int state;
+
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        for (unsigned int j = 0; j <= nfa->nodes[k].two_transitions; j++) {
+            nfaTransition *transition = &nfa->nodes[k].transitions[j];
+
+            state = skipEpsilonChain(nfa, transition->motion);
+            if (state != (unsigned int)transition->motion) {
+                transition->motion = state;
+                changed = true;
+            }
+        }
+    }
+
+    state = skipEpsilonChain(nfa, *start);
+    if (state != *start) {
+        *start = state;
+        changed = true;
+    }
+
+    return changed;
+}
+
+static bool
+isSingleConsumer(const grrNfa nfa, unsigned int state) {
+    return state < nfa->length && !nfa->nodes[state].two_transitions &&
+           IS_CONSUMING(&nfa->nodes[state].transitions[0]);
+}
+
+static bool
+isDeadEnd(const grrNfa nfa, unsigned int state) {
+    const unsigned char *symbols;
+
+    if (!isSingleConsumer(nfa, state)) {
+        return false;
+    }
+
+    symbols = nfa->nodes[state].transitions[0].symbols;
+    for (size_t k = 0; k < sizeof(nfa->nodes[state].transitions[0].symbols); k++) {
+        if (symbols[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Drops the branches of a split which can never consume anything (e.g., the empty byte node of "[é]") and turns
+ * a split between two single-character nodes that lead to the same place into one character class.  Since
+ * disjunctions nest, "a|b|c" collapses into "[abc]" over repeated passes.
+ */
+static bool
+mergeCharacterAlternatives(grrNfa nfa) {
+    bool changed = false;
+
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        nfaNode *node = &nfa->nodes[k];
+        const nfaTransition *first, *second;
+
+        if (!node->two_transitions || !IS_PLAIN_EPSILON(&node->transitions[0]) ||
+            !IS_PLAIN_EPSILON(&node->transitions[1])) {
+            continue;
+        }
+
+        for (unsigned int j = 0; j < 2; j++) {
+            if (isDeadEnd(nfa, node->transitions[j].motion)) {
+                node->transitions[0] = node->transitions[1 - j];
+                memset(&node->transitions[1], 0, sizeof(node->transitions[1]));
+                node->two_transitions = 0;
+                changed = true;
+                break;
+            }
+        }
+        if (!node->two_transitions) {
+            continue;
+        }
+
+        if (!isSingleConsumer(nfa, node->transitions[0].motion) ||
+            !isSingleConsumer(nfa, node->transitions[1].motion)) {
+            continue;
+        }
+
+        first = &nfa->nodes[node->transitions[0].motion].transitions[0];
+        second = &nfa->nodes[node->transitions[1].motion].transitions[0];
+        if (first->motion != second->motion) {
+            continue;
+        }
+
+        node->transitions[0].motion = first->motion;
+        node->transitions[0].flags = 0;
+        for (size_t i = 0; i < sizeof(first->symbols); i++) {
+            node->transitions[0].symbols[i] = first->symbols[i] | second->symbols[i];
+        }
+        memset(&node->transitions[1], 0, sizeof(node->transitions[1]));
+        node->two_transitions = 0;
+        changed = true;
+    }
+
+    return changed;
+}
+
+/*
+ * Turns a split between two nodes that consume the same characters into a node which consumes the characters
+ * followed by a split.  For example, "abc|abd" becomes "a(bc|bd)" and then "ab(c|d)".  Only nodes with no other
+ * predecessors are rewritten since the rewrite changes what the node does.
+ */
+static bool
+factorCommonPrefixes(grrNfa nfa, unsigned int start, unsigned int *inDegrees) {
+    bool changed = false;
+
+    memset(inDegrees, 0, sizeof(*inDegrees) * (nfa->length + 1));
+    inDegrees[start]++;
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        for (unsigned int j = 0; j <= nfa->nodes[k].two_transitions; j++) {
+            inDegrees[nfa->nodes[k].transitions[j].motion]++;
+        }
+    }
+
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        nfaNode *node = &nfa->nodes[k], *firstNode, *secondNode;
+        unsigned int firstIdx, secondIdx;
+        int secondTarget;
+
+        if (!node->two_transitions || !IS_PLAIN_EPSILON(&node->transitions[0]) ||
+            !IS_PLAIN_EPSILON(&node->transitions[1])) {
+            continue;
+        }
+
+        firstIdx = node->transitions[0].motion;
+        secondIdx = node->transitions[1].motion;
+        if (firstIdx == secondIdx || firstIdx == k || !isSingleConsumer(nfa, firstIdx) ||
+            !isSingleConsumer(nfa, secondIdx) || inDegrees[firstIdx] != 1) {
+            continue;
+        }
+
+        firstNode = &nfa->nodes[firstIdx];
+        secondNode = &nfa->nodes[secondIdx];
+        if (memcmp(firstNode->transitions[0].symbols, secondNode->transitions[0].symbols,
+                   sizeof(firstNode->transitions[0].symbols)) != 0) {
+            continue;
+        }
+        secondTarget = secondNode->transitions[0].motion;
+
+        node->transitions[0] = firstNode->transitions[0];
+        node->transitions[0].motion = firstIdx;
+        memset(&node->transitions[1], 0, sizeof(node->transitions[1]));
+        node->two_transitions = 0;
+
+        firstNode->transitions[0].flags = GRR_NFA_EMPTY_TRANSITION_FLAG;
+        memset(firstNode->transitions[0].symbols, 0, sizeof(firstNode->transitions[0].symbols));
+        memset(&firstNode->transitions[1], 0, sizeof(firstNode->transitions[1]));
+        firstNode->transitions[1].flags = GRR_NFA_EMPTY_TRANSITION_FLAG;
+        firstNode->transitions[1].motion = secondTarget;
+        firstNode->two_transitions = 1;
+
+        // The in-degrees are now stale for everything involved so let the next round handle them.
+        inDegrees[firstIdx] = 0;
+        inDegrees[secondIdx] = 0;
+        changed = true;
+    }
+
+    return changed;
+}
+
+static int
+compareNodes(const nfaNode *node1, const nfaNode *node2) {
+    if (node1->two_transitions != node2->two_transitions) {
+        return (int)node1->two_transitions - (int)node2->two_transitions;
+    }
+    if (node1->tag != node2->tag) {
+        return (node1->tag > node2->tag) - (node1->tag < node2->tag);
+    }
+
+    for (unsigned int j = 0; j <= node1->two_transitions; j++) {
+        const nfaTransition *transition1 = &node1->transitions[j], *transition2 = &node2->transitions[j];
+        int ret;
+
+        if (transition1->motion != transition2->motion) {
+            return (transition1->motion > transition2->motion) - (transition1->motion < transition2->motion);
+        }
+        if (transition1->flags != transition2->flags) {
+            return (int)transition1->flags - (int)transition2->flags;
+        }
+        ret = memcmp(transition1->symbols, transition2->symbols, sizeof(transition1->symbols));
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int
+compareNodePointers(const void *item1, const void *item2) {
+    const nfaNode *node1 = *(const nfaNode *const *)item1, *node2 = *(const nfaNode *const *)item2;
+    int ret;
+
+    ret = compareNodes(node1, node2);
+    if (ret == 0) {
+        ret = (node1 > node2) - (node1 < node2);
+    }
+    return ret;
+}
+
+/*
+ * Nodes with identical transitions are interchangeable and so all but one of them can be dropped.  This shares
+ * the common suffixes of alternatives (e.g., "abc|xbc").
+ */
+static bool
+mergeEquivalentNodes(grrNfa nfa, unsigned int *start, const nfaNode **order, unsigned int *map) {
+    bool changed = false;
+
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        order[k] = &nfa->nodes[k];
+        map[k] = k;
+    }
+    map[nfa->length] = nfa->length;
+
+    qsort(order, nfa->length, sizeof(*order), compareNodePointers);
+    for (unsigned int k = 1; k < nfa->length; k++) {
+        if (compareNodes(order[k - 1], order[k]) == 0) {
+            map[order[k] - nfa->nodes] = map[order[k - 1] - nfa->nodes];
+        }
+    }
+
+    // Only redirections count as changes since the duplicates themselves stay behind until compaction.
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        for (unsigned int j = 0; j <= nfa->nodes[k].two_transitions; j++) {
+            nfaTransition *transition = &nfa->nodes[k].transitions[j];
+
+            if (map[transition->motion] != (unsigned int)transition->motion) {
+                transition->motion = map[transition->motion];
+                changed = true;
+            }
+        }
+    }
+    if (map[*start] != *start) {
+        *start = map[*start];
+        changed = true;
+    }
+
+    return changed;
+}
+
+/*
+ * Drops the nodes which can't be reached from the start and renumbers the rest so that the start comes first
+ * and everything else keeps its relative order.
+ */
+static int
+compactNfa(grrNfa nfa, unsigned int start, unsigned int *map) {
+    unsigned int *stack, stackLength = 0, newLength = 0;
+    nfaNode *nodes;
+
+    if (start == nfa->length) {
+        nfa->length = 0;
+        return GRR_RET_OK;
+    }
+
+    stack = map + nfa->length + 1;
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        map[k] = UINT_MAX;
+    }
+    map[nfa->length] = 0;
+
+    map[start] = 0;
+    stack[stackLength++] = start;
+    while (stackLength > 0) {
+        const nfaNode *node = &nfa->nodes[stack[--stackLength]];
+
+        for (unsigned int j = 0; j <= node->two_transitions; j++) {
+            unsigned int target = node->transitions[j].motion;
+
+            if (map[target] == UINT_MAX) {
+                map[target] = 0;
+                stack[stackLength++] = target;
+            }
+        }
+    }
+
+    map[start] = newLength++;
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        if (k != start && map[k] != UINT_MAX) {
+            map[k] = newLength++;
+        }
+    }
+    map[nfa->length] = newLength;
+
+    if (newLength == nfa->length && start == 0) {
+        return GRR_RET_OK;
+    }
+
+    nodes = malloc(sizeof(nfaNode) * newLength);
+    if (!nodes) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    for (unsigned int k = 0; k < nfa->length; k++) {
+        if (map[k] != UINT_MAX) {
+            nodes[map[k]] = nfa->nodes[k];
+            for (unsigned int j = 0; j <= nodes[map[k]].two_transitions; j++) {
+                nodes[map[k]].transitions[j].motion = map[nodes[map[k]].transitions[j].motion];
+            }
+        }
+    }
+
+    free(nfa->nodes);
+    nfa->nodes = nodes;
+    nfa->length = newLength;
+
+    return GRR_RET_OK;
+}
@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+
+#define CLASS_SIZE        (GRR_NFA_NUM_SYMBOLS / 8)
+#define EMPTY_CLASS_SLOT  UINT_MAX
+
+typedef struct classTable {
+    unsigned char *classes;
+    unsigned int length;
+    unsigned int capacity;
+    unsigned int *slots;
+    unsigned int slot_mask;
+} classTable;
+
+static unsigned char
+symbolKind(const unsigned char *symbols, unsigned char *low, unsigned char *high);
+
+static int
+findOrAddClass(classTable *table, const unsigned char *symbols, unsigned int *index);
+
+static unsigned int
+hashClass(const unsigned char *symbols);
+
+static size_t
+encodeState(const nfaNode *node, const classTable *table, const unsigned int *indices, unsigned char *code);
+
+/*
+ * The program is built in two passes.  The first collects the character classes and measures the code.  The
+ * second, once everything has been allocated in one block, writes the code.
+ */
+int
+nfaCreateProgram(const nfaNode *nodes, unsigned int length, nfaProgram **program) {
+    int ret;
+    size_t codeSize = 0, offsetsSize, size;
+    unsigned int *indices;
+    unsigned int numSlots;
+    classTable table = {0};
+    nfaProgram *new;
+    unsigned char *block, *code;
+    uint32_t *offsets;
+
+    indices = malloc(sizeof(*indices) * (2 * (size_t)length + 1));
+    for (numSlots = 16; numSlots < 4 * (size_t)length; numSlots *= 2) {}
+    table.slots = malloc(sizeof(*table.slots) * numSlots);
+    if (!indices || !table.slots) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+    memset(table.slots, 0xff, sizeof(*table.slots) * numSlots);
+    table.slot_mask = numSlots - 1;
+
+    for (unsigned int k = 0; k < length; k++) {
+        for (unsigned int j = 0; j <= nodes[k].two_transitions; j++) {
+            const nfaTransition *transition = &nodes[k].transitions[j];
+            unsigned char low, high;
+
+            indices[2 * k + j] = 0;
+            if (symbolKind(transition->symbols, &low, &high) == GRR_NFA_CODE_CLASS) {
+                ret = findOrAddClass(&table, transition->symbols, &indices[2 * k + j]);
+                if (ret != GRR_RET_OK) {
+                    goto done;
+                }
+            }
+        }
+    }
+
+    for (unsigned int k = 0; k < length; k++) {
+        codeSize += encodeState(&nodes[k], &table, indices + 2 * k, NULL);
+    }
+    // The offsets are 32 bits.
+    if (codeSize > UINT32_MAX) {
+        ret = GRR_RET_TOO_COMPLEX;
+        goto done;
+    }
+
+    offsetsSize = sizeof(*offsets) * length;
+    size = sizeof(*new) + offsetsSize + (size_t)CLASS_SIZE * table.length + codeSize;
+    block = malloc(size);
+    if (!block) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    new = (nfaProgram *)block;
+    offsets = (uint32_t *)(block + sizeof(*new));
+    new->classes = block + sizeof(*new) + offsetsSize;
+    code = block + sizeof(*new) + offsetsSize + (size_t)CLASS_SIZE * table.length;
+    if (table.length > 0) {
+        memcpy(block + sizeof(*new) + offsetsSize, table.classes, (size_t)CLASS_SIZE * table.length);
+    }
+
+    codeSize = 0;
+    for (unsigned int k = 0; k < length; k++) {
+        offsets[k] = codeSize;
+        codeSize += encodeState(&nodes[k], &table, indices + 2 * k, code + codeSize);
+    }
+
+    new->offsets = offsets;
+    new->code = code;
+    new->length = length;
+    new->num_classes = table.length;
+    new->size = size;
+    *program = new;
+    ret = GRR_RET_OK;
+
+done:
+
+    free(indices);
+    free(table.slots);
+    free(table.classes);
+    return ret;
+}
+
+void
+nfaThawState(const nfaProgram *program, unsigned int state, nfaNode *node) {
+    unsigned int count;
+    nfaEdge edges[2];
+
+    *node = (nfaNode){0};
+    count = nfaDecodeState(program, state, edges);
+    node->two_transitions = (count == 2);
+    for (unsigned int k = 0; k < count; k++) {
+        nfaTransition *transition = &node->transitions[k];
+
+        transition->motion = edges[k].motion;
+        transition->flags = edges[k].flags;
+        if (edges[k].symbols) {
+            memcpy(transition->symbols, edges[k].symbols, sizeof(transition->symbols));
+        } else {
+            for (unsigned int c = edges[k].low; c <= edges[k].high; c++) {
+                SET_FLAG(transition->symbols, c);
+            }
+        }
+    }
+}
+
+/*
+ * Works out how a transition's characters are best stored.  low and high are set for single bytes and
+ * ranges.
+ */
+static unsigned char
+symbolKind(const unsigned char *symbols, unsigned char *low, unsigned char *high) {
+    int first = -1, last = -1;
+    unsigned int count = 0;
+
+    for (unsigned int k = 0; k < CLASS_SIZE; k++) {
+        if (symbols[k] == 0) {
+            continue;
+        }
+        if (first < 0) {
+            first = k * 8 + __builtin_ctz(symbols[k]);
+        }
+        last = k * 8 + 31 - __builtin_clz(symbols[k]);
+        count += __builtin_popcount(symbols[k]);
+    }
+
+    if (count == 0) {
+        return GRR_NFA_CODE_NONE;
+    }
+    if (count != (unsigned int)(last - first + 1)) {
+        return GRR_NFA_CODE_CLASS;
+    }
+
+    *low = first;
+    *high = last;
+    return (first == last) ? GRR_NFA_CODE_BYTE : GRR_NFA_CODE_RANGE;
+}
+
+/*
+ * Looks a class up in the table, adding it if it isn't there yet, so that each distinct class is only stored
+ * once.
+ */
+static int
+findOrAddClass(classTable *table, const unsigned char *symbols, unsigned int *index) {
+    unsigned int slot;
+
+    for (slot = hashClass(symbols) & table->slot_mask; table->slots[slot] != EMPTY_CLASS_SLOT;
+         slot = (slot + 1) & table->slot_mask) {
+        if (memcmp(table->classes + (size_t)CLASS_SIZE * table->slots[slot], symbols, CLASS_SIZE) == 0) {
+            *index = table->slots[slot];
+            return GRR_RET_OK;
+        }
+    }
+
+    if (table->length == table->capacity) {
+        unsigned int newCapacity = table->capacity ? 2 * table->capacity : 8;
+        unsigned char *success;
+
+        success = realloc(table->classes, (size_t)CLASS_SIZE * newCapacity);
+        if (!success) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        table->classes = success;
+        table->capacity = newCapacity;
+    }
+
+    memcpy(table->classes + (size_t)CLASS_SIZE * table->length, symbols, CLASS_SIZE);
+    table->slots[slot] = table->length;
+    *index = table->length++;
+    return GRR_RET_OK;
+}
+
+static unsigned int
+hashClass(const unsigned char *symbols) {
+    unsigned int hash = 2166136261U;
+
+    for (unsigned int k = 0; k < CLASS_SIZE; k++) {
+        hash = (hash ^ symbols[k]) * 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * Writes a state's encoding to code and returns its size.  If code is NULL, only the size is returned.
+ */
+static size_t
+encodeState(const nfaNode *node, const classTable *table, const unsigned int *indices, unsigned char *code) {
+    size_t size = 1;
+
+    if (code) {
+        code[0] = 1 + node->two_transitions;
+        if (node->transitions[0].flags == 0 && (!node->two_transitions || node->transitions[1].flags == 0)) {
+            code[0] |= GRR_NFA_CODE_CONSUMING;
+        }
+    }
+
+    for (unsigned int k = 0; k <= node->two_transitions; k++) {
+        const nfaTransition *transition = &node->transitions[k];
+        unsigned char kind, low = 0, high = 0, tag;
+        bool wide;
+
+        kind = symbolKind(transition->symbols, &low, &high);
+        wide = (transition->motion < INT16_MIN || transition->motion > INT16_MAX ||
+                (kind == GRR_NFA_CODE_CLASS && table->length > UINT16_MAX + 1U));
+        tag = (transition->flags & GRR_NFA_CODE_FLAGS) | (kind << GRR_NFA_CODE_KIND_SHIFT) |
+              (wide ? GRR_NFA_CODE_WIDE : 0);
+
+        if (code) {
+            code[size] = tag;
+            if (wide) {
+                int32_t motion = transition->motion;
+
+                memcpy(code + size + 1, &motion, sizeof(motion));
+            } else {
+                int16_t motion = transition->motion;
+
+                memcpy(code + size + 1, &motion, sizeof(motion));
+            }
+        }
+        size += 1 + (wide ? sizeof(int32_t) : sizeof(int16_t));
+
+        switch (kind) {
+        case GRR_NFA_CODE_BYTE:
+            if (code) {
+                code[size] = low;
+            }
+            size += 1;
+            break;
+
+        case GRR_NFA_CODE_RANGE:
+            if (code) {
+                code[size] = low;
+                code[size + 1] = high;
+            }
+            size += 2;
+            break;
+
+        case GRR_NFA_CODE_CLASS:
+            if (code) {
+                if (wide) {
+                    uint32_t index = indices[k];
+
+                    memcpy(code + size, &index, sizeof(index));
+                } else {
+                    uint16_t index = indices[k];
+
+                    memcpy(code + size, &index, sizeof(index));
+                }
+            }
+            size += wide ? sizeof(uint32_t) : sizeof(uint16_t);
+            break;
+
+        default: break;
+        }
+    }
+
+    return size;
+}
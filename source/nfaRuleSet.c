@@ -0,0 +1,269 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "nfa.h"
+#include "nfaInternals.h"
+
+/*
+ * Old snapshots are reclaimed by epoch.  The rule set's epoch goes up each time a snapshot is replaced and
+ * the replaced snapshot is stamped with the epoch from before the increase.  A reader announces the epoch it
+ * saw before it loads the current snapshot and withdraws the announcement when it leaves.  Whichever snapshot
+ * a reader loaded, it was current when the reader announced, so the reader's epoch is no later than the one
+ * the snapshot was stamped with.  A snapshot can therefore be released once every reader announces a later
+ * epoch or none at all.
+ */
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct ruleSnapshot {
+    grrRuleSnapshot view;
+    grrNfa *nfa_list;  // The same array as view.nfa_list.  The snapshot holds a reference to each regex.
+    unsigned long retired_epoch;
+    struct ruleSnapshot *next_retired;
+} ruleSnapshot;
+
+struct grrRuleReaderStruct {
+    // Each reader gets its own cache line so that readers don't slow each other down.
+    _Alignas(CACHE_LINE_SIZE) atomic_ulong epoch;  // 0 while the reader isn't in the rule set.
+    atomic_bool in_use;
+    grrRuleSet rules;
+};
+
+struct grrRuleSetStruct {
+    _Atomic(ruleSnapshot *) current;
+    atomic_ulong epoch;  // Starts at 1 so that readers can use 0 to mean that they aren't reading.
+    pthread_mutex_t lock;  // Serializes the publishers.
+    ruleSnapshot *retired;
+    struct grrRuleReaderStruct *readers;
+    unsigned int max_readers;
+    unsigned long version;
+};
+
+static int
+createSnapshot(grrNfa *nfa_list, size_t num, unsigned long version, ruleSnapshot **snapshot);
+
+static void
+freeSnapshot(ruleSnapshot *snapshot);
+
+static void
+reclaimSnapshots(grrRuleSet rules);
+
+int
+grrCreateRuleSet(unsigned int max_readers, grrRuleSet *rules) {
+    if (max_readers == 0 || !rules) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    *rules = calloc(1, sizeof(struct grrRuleSetStruct));
+    if (!*rules) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    (*rules)->readers = aligned_alloc(CACHE_LINE_SIZE, sizeof(*(*rules)->readers) * max_readers);
+    if (!(*rules)->readers || pthread_mutex_init(&(*rules)->lock, NULL) != 0) {
+        free((*rules)->readers);
+        free(*rules);
+        *rules = NULL;
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    for (unsigned int k = 0; k < max_readers; k++) {
+        atomic_init(&(*rules)->readers[k].epoch, 0);
+        atomic_init(&(*rules)->readers[k].in_use, false);
+        (*rules)->readers[k].rules = *rules;
+    }
+    atomic_init(&(*rules)->current, NULL);
+    atomic_init(&(*rules)->epoch, 1);
+    (*rules)->max_readers = max_readers;
+
+    return GRR_RET_OK;
+}
+
+int
+grrPublishRules(grrRuleSet rules, grrNfa *nfa_list, size_t num) {
+    int ret;
+    ruleSnapshot *snapshot, *old;
+
+    if (!rules || (!nfa_list && num > 0)) {
+        return GRR_RET_BAD_ARGS;
+    }
+    for (size_t k = 0; k < num; k++) {
+        if (!nfa_list[k]) {
+            return GRR_RET_BAD_ARGS;
+        }
+    }
+
+    pthread_mutex_lock(&rules->lock);
+
+    ret = createSnapshot(nfa_list, num, rules->version + 1, &snapshot);
+    if (ret != GRR_RET_OK) {
+        goto done;
+    }
+    rules->version++;
+
+    old = atomic_exchange(&rules->current, snapshot);
+    if (old) {
+        old->retired_epoch = atomic_fetch_add(&rules->epoch, 1);
+        old->next_retired = rules->retired;
+        rules->retired = old;
+    }
+    reclaimSnapshots(rules);
+
+done:
+
+    pthread_mutex_unlock(&rules->lock);
+    return ret;
+}
+
+int
+grrRegisterRuleReader(grrRuleSet rules, grrRuleReader *reader) {
+    if (!rules || !reader) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    for (unsigned int k = 0; k < rules->max_readers; k++) {
+        bool expected = false;
+
+        if (atomic_compare_exchange_strong(&rules->readers[k].in_use, &expected, true)) {
+            *reader = &rules->readers[k];
+            return GRR_RET_OK;
+        }
+    }
+
+    return GRR_RET_NOT_FOUND;
+}
+
+int
+grrEnterRules(grrRuleReader reader, grrRuleSnapshot *snapshot) {
+    ruleSnapshot *current;
+
+    if (!reader || !snapshot) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    // Both of these are sequentially consistent so that a publisher which doesn't see the announcement is
+    // guaranteed to have swapped in its snapshot before the reader loads it.
+    atomic_store(&reader->epoch, atomic_load(&reader->rules->epoch));
+    current = atomic_load(&reader->rules->current);
+    if (!current) {
+        atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+        return GRR_RET_NOT_FOUND;
+    }
+
+    *snapshot = current->view;
+    return GRR_RET_OK;
+}
+
+void
+grrLeaveRules(grrRuleReader reader) {
+    if (reader) {
+        atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+    }
+}
+
+void
+grrUnregisterRuleReader(grrRuleReader reader) {
+    if (reader) {
+        atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+        atomic_store_explicit(&reader->in_use, false, memory_order_release);
+    }
+}
+
+void
+grrFreeRuleSet(grrRuleSet rules) {
+    ruleSnapshot *next;
+
+    if (!rules) {
+        return;
+    }
+
+    freeSnapshot(atomic_load(&rules->current));
+    for (ruleSnapshot *snapshot = rules->retired; snapshot; snapshot = next) {
+        next = snapshot->next_retired;
+        freeSnapshot(snapshot);
+    }
+
+    pthread_mutex_destroy(&rules->lock);
+    free(rules->readers);
+    free(rules);
+}
+
+static int
+createSnapshot(grrNfa *nfa_list, size_t num, unsigned long version, ruleSnapshot **snapshot) {
+    int ret;
+    ruleSnapshot *new;
+
+    new = calloc(1, sizeof(*new));
+    if (!new) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    if (num > 0) {
+        new->nfa_list = malloc(sizeof(*new->nfa_list) * num);
+        if (!new->nfa_list) {
+            free(new);
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+
+        ret = grrCreateSet(nfa_list, num, &new->view.set);
+        if (ret != GRR_RET_OK) {
+            free(new->nfa_list);
+            free(new);
+            return ret;
+        }
+
+        for (size_t k = 0; k < num; k++) {
+            new->nfa_list[k] = nfa_list[k];
+            atomic_fetch_add(&nfa_list[k]->references, 1);
+        }
+    }
+
+    new->view.nfa_list = new->nfa_list;
+    new->view.num = num;
+    new->view.version = version;
+    *snapshot = new;
+    return GRR_RET_OK;
+}
+
+static void
+freeSnapshot(ruleSnapshot *snapshot) {
+    if (!snapshot) {
+        return;
+    }
+
+    for (size_t k = 0; k < snapshot->view.num; k++) {
+        grrFreeNfa(snapshot->nfa_list[k]);
+    }
+    free(snapshot->nfa_list);
+    grrFreeSet(snapshot->view.set);
+    free(snapshot);
+}
+
+/*
+ * Releases the retired snapshots which every reader has moved past.  Called with the lock held.
+ */
+static void
+reclaimSnapshots(grrRuleSet rules) {
+    unsigned long oldest = ULONG_MAX;
+    ruleSnapshot **link;
+
+    for (unsigned int k = 0; k < rules->max_readers; k++) {
+        unsigned long epoch = atomic_load(&rules->readers[k].epoch);
+
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    link = &rules->retired;
+    while (*link) {
+        ruleSnapshot *snapshot = *link;
+
+        if (snapshot->retired_epoch < oldest) {
+            *link = snapshot->next_retired;
+            freeSnapshot(snapshot);
+        } else {
+            link = &snapshot->next_retired;
+        }
+    }
+}
@@ -1,428 +1,1615 @@
 #include <alloca.h>
-#include <assert.h>
-#include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "nfaInternals.h"
 #include "nfaRuntime.h"
+#include "nfaScratch.h"
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+#define REPEAT_BYTE(c) (0x0101010101010101ULL * (unsigned char)(c))
+
+// Returned by screenMatch and screenSearch if only the state sets can answer.
+#define STATE_SETS_NEEDED (-1)
+
+// The functions which don't take a scratch object use a heap one instead of the stack if they'd need more
+// than this.
+#define MAX_STACK_SCRATCH (256 * 1024)
+
+#define STACK_SCRATCH_SIZE(num_states, num_records, num_sets)                                              \
+    (sizeof(nfaStateRecord) * ((num_records) + 1) + sizeof(nfaStateSet) * ((num_sets) + 1) +             \
+     sizeof(unsigned int) * 3 * (num_states) + sizeof(size_t) * ((num_sets) / 2 + 1))
+
+/*
+ * The functions which don't take a scratch object keep their scratch space on the stack.
+ */
+#define INIT_STACK_SCRATCH(scratch, num_states, num_records, num_sets)                  \
+    do {                                                                                \
+        (scratch)->records = alloca(sizeof(nfaStateRecord) * ((num_records) + 1));      \
+        (scratch)->sets = alloca(sizeof(nfaStateSet) * ((num_sets) + 1));               \
+        (scratch)->stamps = alloca(sizeof(unsigned int) * (num_states));                \
+        memset((scratch)->stamps, 0, sizeof(unsigned int) * (num_states));              \
+        (scratch)->stack = alloca(sizeof(unsigned int) * 2 * (num_states));             \
+        (scratch)->active = alloca(sizeof(size_t) * ((num_sets) / 2 + 1));              \
+        (scratch)->visits = NULL;                                                       \
+        (scratch)->record_capacity = (num_records);                                     \
+        (scratch)->set_capacity = (num_sets);                                           \
+        (scratch)->state_capacity = (num_states);                                       \
+        (scratch)->generation = 0;                                                      \
+    } while (0)
+
+static int
+screenMatch(grrNfa nfa, const char *string, size_t len, grrBudget *budget);
+
+static int
+matchNfa(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrBudget *budget, size_t *cursor);
+
+static int
+screenSearch(grrNfa nfa, const char *string, size_t len, grrBudget *budget, bool profiling, size_t *start,
+             size_t *end, size_t *cursor);
+
+static int
+searchNfa(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrBudget *budget, size_t *start,
+          size_t *end, size_t *cursor);
+
+static int
+reverseSearchNfa(grrNfa nfa, grrScratch scratch, const char *string, size_t len, size_t *start, size_t *end,
+                 size_t *cursor);
+
+static int
+searchSubmatches(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrSubmatch *submatches,
+                 size_t num_submatches, size_t *cursor);
+
+static size_t
+countLines(grrNfa nfa, grrScratch scratch, const char *buffer, size_t size, unsigned char *matched,
+           size_t max_lines, size_t *num_lines);
 
-typedef struct nfaStateRecord {
-    size_t start_idx;
-    size_t end_idx;
-    size_t score;
-    unsigned int state;
-} nfaStateRecord;
+static bool
+lineMatches(grrNfa nfa, grrScratch scratch, const char *string, size_t len);
+
+static size_t
+countLineBreaks(const char *string, size_t len);
 
-typedef struct nfaStateSet {
-    nfaStateRecord *records;
-    unsigned int length;
-} nfaStateSet;
+static unsigned int
+countZeroBytes(uint64_t word);
+
+static void
+nextGeneration(grrScratch scratch);
 
 static bool
-determineNextState(unsigned int depth, grrNfa nfa, unsigned int state, char character,
-                   unsigned char *state_set);
+chargeBudget(grrBudget *budget, size_t cost);
+
+static bool
+spendBudget(grrBudget *budget, size_t cost, bool progressed);
+
+static void
+suspendCall(grrScratch scratch, grrBudget *budget, unsigned char call, const void *owner, size_t num,
+            size_t size, size_t idx);
 
 static bool
-canTransitionToAcceptingState(grrNfa nfa, unsigned int state, unsigned char *visited_states);
+isSuspendedCall(grrScratch scratch, unsigned char call, const void *owner, size_t num, size_t size);
+
+static unsigned char
+positionFlags(const char *string, size_t len, size_t idx, unsigned char *character);
+
+static void
+stepStateSet(grrNfa nfa, grrScratch scratch, const nfaStateSet *current, nfaStateSet *next,
+             unsigned char character, size_t idx, unsigned char flags, unsigned char next_character,
+             nfaStateRecord *best);
 
 static void
-determineNextStateRecord(unsigned int depth, grrNfa nfa, unsigned int state, const nfaStateRecord *record,
-                         char character, unsigned char flags, nfaStateSet *set);
+addState(grrNfa nfa, grrScratch scratch, nfaStateSet *set, unsigned int state, size_t start_idx,
+         size_t end_idx, unsigned char flags, unsigned char character, nfaStateRecord *best);
 
 static void
-maybePlaceRecord(const nfaStateRecord *record, unsigned int state, nfaStateSet *set, bool update_score);
+addStateReverse(grrNfa nfa, grrScratch scratch, nfaStateSet *set, unsigned int state, const char *string,
+                size_t idx, size_t line_end);
+
+static void
+stepCaptureSet(grrNfa nfa, grrScratch scratch, const nfaStateSet *current, nfaStateSet *next,
+               unsigned char character, size_t idx, unsigned char flags, unsigned char next_character,
+               unsigned int num_slots, nfaStateRecord *best);
+
+static void
+addCaptureState(grrNfa nfa, grrScratch scratch, nfaStateSet *set, unsigned int state, size_t start_idx,
+                size_t end_idx, unsigned char flags, unsigned char character, size_t *slots,
+                unsigned int num_slots, nfaStateRecord *best);
+
+static void
+placeCaptureRecord(grrScratch scratch, nfaStateSet *set, unsigned int state, size_t start_idx, size_t end_idx,
+                   const size_t *slots, unsigned int num_slots);
 
 int
 grrMatch(grrNfa nfa, const char *string, size_t len) {
-    unsigned int state_set_len;
-    unsigned char *current_state_set, *next_state_set;
+    int ret;
+    struct grrScratchStruct scratch;
 
     if (!nfa || !string) {
         return GRR_RET_BAD_ARGS;
     }
-    state_set_len = (nfa->length + 1 + 7) / 8;  // The +1 is for the accepting state.
-    current_state_set = alloca(state_set_len);
-    next_state_set = alloca(state_set_len);
-    memset(current_state_set, 0, state_set_len);
-    SET_FLAG(current_state_set, 0);
 
-    for (size_t idx = 0; idx < len; idx++) {
-        bool still_alive = false;
-        char character;
+    // Nothing is reserved for the state sets unless the other engines can't answer.
+    ret = screenMatch(nfa, string, len, NULL);
+    if (ret != STATE_SETS_NEEDED) {
+        return ret;
+    }
 
-        character = string[idx];
-        if (!isprint(character) && character != '\t') {
-            return GRR_RET_BAD_DATA;
+    if (STACK_SCRATCH_SIZE(nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0) > MAX_STACK_SCRATCH) {
+        grrScratch heapScratch;
+
+        ret = grrCreateScratch(nfa, &heapScratch);
+        if (ret != GRR_RET_OK) {
+            return ret;
         }
+        ret = matchNfa(nfa, heapScratch, string, len, NULL, NULL);
+        grrFreeScratch(heapScratch);
+        return ret;
+    }
 
-        character = ADJUST_CHARACTER(character);
-        memset(next_state_set, 0, state_set_len);
+    INIT_STACK_SCRATCH(&scratch, nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0);
+    return matchNfa(nfa, &scratch, string, len, NULL, NULL);
+}
 
-        for (unsigned int state = 0; state < nfa->length; state++) {
-            if (!IS_FLAG_SET(current_state_set, state)) {
-                continue;
-            }
+int
+grrMatchWithScratch(grrNfa nfa, grrScratch scratch, const char *string, size_t len) {
+    int ret;
 
-            if (determineNextState(0, nfa, state, character, next_state_set)) {
-                still_alive = true;
-            }
-        }
+    if (!nfa || !scratch || !string) {
+        return GRR_RET_BAD_ARGS;
+    }
 
-        if (!still_alive) {
-            return GRR_RET_NOT_FOUND;
-        }
+    ret = screenMatch(nfa, string, len, NULL);
+    if (ret != STATE_SETS_NEEDED) {
+        return ret;
+    }
 
-        memcpy(current_state_set, next_state_set, state_set_len);
+    ret = grrGrowScratch(scratch, nfa);
+    if (ret != GRR_RET_OK) {
+        return ret;
     }
 
-    for (unsigned int k = 0; k <= nfa->length; k++) {
-        if (IS_FLAG_SET(current_state_set, k)) {
-            unsigned char visited_states[state_set_len];
+    return matchNfa(nfa, scratch, string, len, NULL, NULL);
+}
 
-            memset(visited_states, 0, sizeof(visited_states));
+int
+grrMatchWithBudget(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrBudget *budget,
+                   size_t *cursor) {
+    int ret;
 
-            if (canTransitionToAcceptingState(nfa, k, visited_states)) {
-                return GRR_RET_OK;
-            }
+    if (!nfa || !scratch || !string || !budget) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    if (budget->suspended) {
+        if (!isSuspendedCall(scratch, GRR_NFA_SUSPENDED_MATCH, nfa, 1, len)) {
+            return GRR_RET_BAD_ARGS;
+        }
+    } else {
+        ret = screenMatch(nfa, string, len, budget);
+        if (ret != STATE_SETS_NEEDED) {
+            return ret;
+        }
+
+        ret = grrGrowScratch(scratch, nfa);
+        if (ret != GRR_RET_OK) {
+            return ret;
         }
     }
 
-    return GRR_RET_NOT_FOUND;
+    return matchNfa(nfa, scratch, string, len, budget, cursor);
 }
 
 int
 grrSearch(grrNfa nfa, const char *string, size_t len, size_t *start, size_t *end, size_t *cursor,
           bool tolerant) {
-    unsigned int length;
-    size_t champion_score;
-    nfaStateSet current_state_set, next_state_set;
+    int ret;
+    struct grrScratchStruct scratch;
 
     if (!nfa || !string) {
         return GRR_RET_BAD_ARGS;
     }
 
-    if (cursor) {
-        *cursor = len;
+    (void)tolerant;
+
+    // Nothing is reserved for the state sets unless the other engines can't answer.
+    ret = screenSearch(nfa, string, len, NULL, false, start, end, cursor);
+    if (ret != STATE_SETS_NEEDED) {
+        return ret;
+    }
+
+    if (STACK_SCRATCH_SIZE(nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0) > MAX_STACK_SCRATCH) {
+        grrScratch heapScratch;
+
+        ret = grrCreateScratch(nfa, &heapScratch);
+        if (ret != GRR_RET_OK) {
+            return ret;
+        }
+        ret = searchNfa(nfa, heapScratch, string, len, NULL, start, end, cursor);
+        grrFreeScratch(heapScratch);
+        return ret;
+    }
+
+    INIT_STACK_SCRATCH(&scratch, nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0);
+    return searchNfa(nfa, &scratch, string, len, NULL, start, end, cursor);
+}
+
+int
+grrSearchWithScratch(grrNfa nfa, grrScratch scratch, const char *string, size_t len, size_t *start,
+                     size_t *end, size_t *cursor, bool tolerant) {
+    int ret;
+
+    if (!nfa || !scratch || !string) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    (void)tolerant;
+
+    ret = screenSearch(nfa, string, len, NULL, false, start, end, cursor);
+    if (ret != STATE_SETS_NEEDED) {
+        return ret;
+    }
+
+    ret = grrGrowScratch(scratch, nfa);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+
+    return searchNfa(nfa, scratch, string, len, NULL, start, end, cursor);
+}
+
+int
+grrSearchWithBudget(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrBudget *budget,
+                    size_t *start, size_t *end, size_t *cursor) {
+    int ret;
+
+    if (!nfa || !scratch || !string || !budget) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    if (budget->suspended) {
+        if (!isSuspendedCall(scratch, GRR_NFA_SUSPENDED_SEARCH, nfa, 1, len)) {
+            return GRR_RET_BAD_ARGS;
+        }
+    } else {
+        ret = screenSearch(nfa, string, len, budget, false, start, end, cursor);
+        if (ret != STATE_SETS_NEEDED) {
+            return ret;
+        }
+
+        ret = grrGrowScratch(scratch, nfa);
+        if (ret != GRR_RET_OK) {
+            return ret;
+        }
+    }
+
+    return searchNfa(nfa, scratch, string, len, budget, start, end, cursor);
+}
+
+int
+grrSearchSubmatches(grrNfa nfa, const char *string, size_t len, grrSubmatch *submatches,
+                    size_t num_submatches, size_t *cursor) {
+    int ret;
+    grrScratch scratch;
+
+    if (!nfa || !string || !submatches || num_submatches == 0) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    ret = grrCreateScratch(nfa, &scratch);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+    ret = grrSearchSubmatchesWithScratch(nfa, scratch, string, len, submatches, num_submatches, cursor);
+    grrFreeScratch(scratch);
+    return ret;
+}
+
+int
+grrSearchSubmatchesWithScratch(grrNfa nfa, grrScratch scratch, const char *string, size_t len,
+                               grrSubmatch *submatches, size_t num_submatches, size_t *cursor) {
+    int ret;
+    size_t numSlots, numStates;
+
+    if (!nfa || !scratch || !string || !submatches || num_submatches == 0) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    ret = grrGrowScratch(scratch, nfa);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+
+    // Each record gets its own slots, as do the record being built and the best match.  A state which is
+    // visited pushes at most two states and a slot to be restored.
+    numSlots = 2 * MIN(nfa->num_groups, num_submatches - 1);
+    numStates = (size_t)nfa->length + 1;
+    ret = nfaReserveCaptures(scratch, (2 * numStates + 2) * numSlots, 3 * numStates + 1);
+    if (ret != GRR_RET_OK) {
+        return ret;
+    }
+
+    return searchSubmatches(nfa, scratch, string, len, submatches, num_submatches, cursor);
+}
+
+ssize_t
+grrFirstMatch(grrNfa *nfa_list, size_t num, const char *source, size_t size, size_t *processed,
+              size_t *score) {
+    unsigned int max_length = 0;
+    size_t total_length = 0;
+    struct grrScratchStruct scratch;
+
+    if (!nfa_list || num == 0 || !source || size == 0 || !processed) {
+        return -1;
+    }
+
+    for (size_t k = 0; k < num; k++) {
+        if (!nfa_list[k]) {
+            return -1;
+        }
+
+        if (nfa_list[k]->length > max_length) {
+            max_length = nfa_list[k]->length;
+        }
+        total_length += nfa_list[k]->length;
+    }
+
+    if (STACK_SCRATCH_SIZE(max_length + 1, 2 * total_length, 2 * num) > MAX_STACK_SCRATCH) {
+        ssize_t ret;
+        grrScratch heapScratch;
+
+        if (grrCreateScratch(NULL, &heapScratch) != GRR_RET_OK) {
+            return -1;
+        }
+        ret = grrFirstMatchWithScratch(nfa_list, num, heapScratch, source, size, processed, score);
+        grrFreeScratch(heapScratch);
+        return ret;
+    }
+
+    INIT_STACK_SCRATCH(&scratch, max_length + 1, 2 * total_length, 2 * num);
+    return nfaFirstMatch(nfa_list, NULL, num, &scratch, source, size, NULL, processed, score);
+}
+
+ssize_t
+grrFirstMatchWithScratch(grrNfa *nfa_list, size_t num, grrScratch scratch, const char *source, size_t size,
+                         size_t *processed, size_t *score) {
+    unsigned int max_length = 0;
+    size_t total_length = 0;
+
+    if (!nfa_list || num == 0 || !scratch || !source || size == 0 || !processed) {
+        return -1;
+    }
+
+    for (size_t k = 0; k < num; k++) {
+        if (!nfa_list[k]) {
+            return -1;
+        }
+
+        if (nfa_list[k]->length > max_length) {
+            max_length = nfa_list[k]->length;
+        }
+        total_length += nfa_list[k]->length;
+    }
+
+    if (nfaReserveScratch(scratch, max_length + 1, 2 * total_length, 2 * num) != GRR_RET_OK) {
+        return -1;
+    }
+
+    return nfaFirstMatch(nfa_list, NULL, num, scratch, source, size, NULL, processed, score);
+}
+
+int
+grrFirstMatchWithBudget(grrNfa *nfa_list, size_t num, grrScratch scratch, const char *source, size_t size,
+                        grrBudget *budget, size_t *processed, size_t *score, ssize_t *index) {
+    unsigned int max_length = 0;
+    size_t total_length = 0;
+
+    if (!nfa_list || num == 0 || !scratch || !source || size == 0 || !budget || !processed || !index) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    for (size_t k = 0; k < num; k++) {
+        if (!nfa_list[k]) {
+            return GRR_RET_BAD_ARGS;
+        }
+
+        if (nfa_list[k]->length > max_length) {
+            max_length = nfa_list[k]->length;
+        }
+        total_length += nfa_list[k]->length;
+    }
+
+    if (budget->suspended) {
+        if (!isSuspendedCall(scratch, GRR_NFA_SUSPENDED_FIRST_MATCH, nfa_list, num, size)) {
+            return GRR_RET_BAD_ARGS;
+        }
+    } else if (nfaReserveScratch(scratch, max_length + 1, 2 * total_length, 2 * num) != GRR_RET_OK) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    *index = nfaFirstMatch(nfa_list, NULL, num, scratch, source, size, budget, processed, score);
+    if (budget->suspended) {
+        return GRR_RET_BUDGET_EXHAUSTED;
+    }
+    return (*index >= 0) ? GRR_RET_OK : GRR_RET_NOT_FOUND;
+}
+
+int
+grrCount(grrNfa nfa, const char *buffer, size_t size, size_t *count) {
+    int ret;
+    struct grrScratchStruct scratch;
+
+    if (!nfa || !buffer || !count) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    // A literal never runs the state sets.
+    if (nfa->search_engine == GRR_ENGINE_LITERAL) {
+        *count = countLines(nfa, NULL, buffer, size, NULL, SIZE_MAX, NULL);
+        return GRR_RET_OK;
+    }
+
+    if (STACK_SCRATCH_SIZE(nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0) > MAX_STACK_SCRATCH) {
+        grrScratch heapScratch;
+
+        ret = grrCreateScratch(nfa, &heapScratch);
+        if (ret != GRR_RET_OK) {
+            return ret;
+        }
+        *count = countLines(nfa, heapScratch, buffer, size, NULL, SIZE_MAX, NULL);
+        grrFreeScratch(heapScratch);
+        return GRR_RET_OK;
+    }
+
+    INIT_STACK_SCRATCH(&scratch, nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0);
+    *count = countLines(nfa, &scratch, buffer, size, NULL, SIZE_MAX, NULL);
+    return GRR_RET_OK;
+}
+
+int
+grrMatchingLines(grrNfa nfa, const char *buffer, size_t size, unsigned char *matched, size_t max_lines,
+                 size_t *num_lines) {
+    size_t count;
+    struct grrScratchStruct scratch;
+
+    if (!nfa || !buffer || !matched || !num_lines) {
+        return GRR_RET_BAD_ARGS;
     }
 
-    length = nfa->length;
-    current_state_set.records = alloca(sizeof(nfaStateRecord) * (length + 1));
-    memset(current_state_set.records, 0, sizeof(nfaStateRecord) * (length + 1));
-    current_state_set.length = 0;
+    memset(matched, 0, max_lines / 8 + (max_lines % 8 != 0));
+
+    // A literal never runs the state sets.
+    if (nfa->search_engine == GRR_ENGINE_LITERAL) {
+        count = countLines(nfa, NULL, buffer, size, matched, max_lines, num_lines);
+    } else if (STACK_SCRATCH_SIZE(nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0) > MAX_STACK_SCRATCH) {
+        grrScratch heapScratch;
+
+        if (grrCreateScratch(nfa, &heapScratch) != GRR_RET_OK) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        count = countLines(nfa, heapScratch, buffer, size, matched, max_lines, num_lines);
+        grrFreeScratch(heapScratch);
+    } else {
+        INIT_STACK_SCRATCH(&scratch, nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0);
+        count = countLines(nfa, &scratch, buffer, size, matched, max_lines, num_lines);
+    }
+
+    return (count > 0) ? GRR_RET_OK : GRR_RET_NOT_FOUND;
+}
+
+/*
+ * Answers grrMatch with the engines which need no scratch space.  If budget isn't NULL, then the engines
+ * which can't be stopped partway through are only used if the budget covers all of their work.  Returns
+ * STATE_SETS_NEEDED if only matchNfa can answer.
+ */
+static int
+screenMatch(grrNfa nfa, const char *string, size_t len, grrBudget *budget) {
+    switch (nfa->match_engine) {
+    case GRR_ENGINE_NONE: return GRR_RET_NOT_FOUND;
+    case GRR_ENGINE_LITERAL: return nfaMatchLiteral(nfa, string, len);
+    default: break;
+    }
 
-    next_state_set.records = alloca(sizeof(nfaStateRecord) * (length + 1));
+    if (len < nfa->min_length || (nfa->max_length != GRR_NFA_UNBOUNDED && len > nfa->max_length)) {
+        return GRR_RET_NOT_FOUND;
+    }
 
-    for (size_t idx = 0; idx < len; idx++) {
-        char character;
-        unsigned char flags = 0;
-        nfaStateRecord first_state;
+    if (nfa->match_engine == GRR_ENGINE_ONE_PASS && chargeBudget(budget, len)) {
+        return nfaOnePassMatch(nfa->one_pass, string, len);
+    }
+    if (nfaCanBacktrack(nfa, len) && chargeBudget(budget, ((size_t)nfa->length + 1) * (len + 1))) {
+        return nfaBacktrackMatch(nfa, string, len);
+    }
 
-        character = string[idx];
+    return STATE_SETS_NEEDED;
+}
 
-        if (character == '\r' || character == '\n') {
+/*
+ * Runs the state sets for a string which screenMatch couldn't decide.  If budget isn't NULL, then only as
+ * many steps as it allows are taken and cursor is set to where the match stopped.
+ */
+static int
+matchNfa(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrBudget *budget, size_t *cursor) {
+    unsigned char flags = GRR_NFA_FIRST_CHAR_FLAG | GRR_NFA_LAST_CHAR_FLAG;
+    size_t idx = 0, first_idx;
+    nfaStateRecord best = {0};
+    nfaStateSet current, next;
+
+    if (budget && budget->suspended) {
+        idx = scratch->suspension.idx;
+        current = scratch->suspension.current;
+        next.records = scratch->records + ((current.records == scratch->records) ? nfa->length : 0);
+        budget->suspended = false;
+        scratch->suspension.owner = NULL;
+    } else {
+        current.records = scratch->records;
+        current.length = 0;
+        next.records = scratch->records + nfa->length;
+
+        // grrMatch ignores the anchors and only honors a lookahead at the end of the string.
+        nextGeneration(scratch);
+        addState(nfa, scratch, &current, 0, 0, 0, flags | ((len == 0) ? GRR_NFA_LOOKAHEAD_FLAG : 0), 0,
+                 &best);
+    }
+
+    for (first_idx = idx; idx < len; idx++) {
+        nfaStateSet temp;
+
+        if (current.length == 0) {
+            return GRR_RET_NOT_FOUND;
+        }
+        if (budget && !spendBudget(budget, current.length + 1, idx > first_idx)) {
+            scratch->suspension.current = current;
+            suspendCall(scratch, budget, GRR_NFA_SUSPENDED_MATCH, nfa, 1, len, idx);
             if (cursor) {
                 *cursor = idx;
             }
+            return GRR_RET_BUDGET_EXHAUSTED;
+        }
 
-            break;
+        nextGeneration(scratch);
+        next.length = 0;
+        stepStateSet(nfa, scratch, &current, &next, string[idx], idx,
+                     flags | ((idx + 1 == len) ? GRR_NFA_LOOKAHEAD_FLAG : 0), 0, &best);
+
+        temp = current;
+        current = next;
+        next = temp;
+    }
+
+    return (scratch->stamps[nfa->length] == scratch->generation) ? GRR_RET_OK : GRR_RET_NOT_FOUND;
+}
+
+/*
+ * Answers grrSearch with the engines which need no scratch space.  If budget isn't NULL, then the engines
+ * which can't be stopped partway through are only used if the budget covers all of their work.  A profiling
+ * run skips the DFA and the backtracker so that every line shows up in the profile.  Returns
+ * STATE_SETS_NEEDED if only searchNfa can answer.
+ */
+static int
+screenSearch(grrNfa nfa, const char *string, size_t len, grrBudget *budget, bool profiling, size_t *start,
+             size_t *end, size_t *cursor) {
+    size_t line_end, last_seed;
+
+    if (!budget) {
+        switch (nfa->search_engine) {
+        case GRR_ENGINE_LITERAL: return nfaSearchLiteral(nfa, string, len, start, end, cursor);
+        case GRR_ENGINE_REVERSE: return STATE_SETS_NEEDED;
+        default: break;
+        }
+    }
+
+    line_end = nfaLineEnd(string, len, 0);
+    if (cursor) {
+        *cursor = line_end;
+    }
+
+    // Only nonempty matches are reported so a match needs at least one character.
+    if (nfa->search_engine == GRR_ENGINE_NONE || line_end < MAX(nfa->min_length, 1)) {
+        return GRR_RET_NOT_FOUND;
+    }
+    // A match which starts after this point wouldn't fit into the line.
+    last_seed = (nfa->anchors & GRR_NFA_FIRST_CHAR_FLAG) ? 0 : line_end - MAX(nfa->min_length, 1);
+
+    if (nfa->search_engine == GRR_ENGINE_LITERAL && chargeBudget(budget, line_end)) {
+        return nfaSearchLiteral(nfa, string, len, start, end, cursor);
+    }
+
+    // The shared DFA rules out lines without a match.  The NFA is still needed to find where a match is.
+    if (nfa->search_engine == GRR_ENGINE_DFA && !profiling && chargeBudget(budget, line_end) &&
+        nfaDfaScanLine(nfa->dfa, string, line_end, NULL) == GRR_RET_NOT_FOUND) {
+        return GRR_RET_NOT_FOUND;
+    }
+
+    if (!profiling && nfaCanBacktrack(nfa, line_end) &&
+        chargeBudget(budget, ((size_t)nfa->length + 1) * (line_end + 1))) {
+        return nfaBacktrackSearch(nfa, string, line_end, last_seed, start, end);
+    }
+
+    return STATE_SETS_NEEDED;
+}
+
+/*
+ * Runs the state sets for a line which screenSearch couldn't decide.  If budget isn't NULL, then only as many
+ * steps as it allows are taken.  Otherwise, a regex anchored only at the end of the line is run backward from
+ * there.  With a budget, it's run from the front of the line, which finds the same match.
+ */
+static int
+searchNfa(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrBudget *budget, size_t *start,
+          size_t *end, size_t *cursor) {
+    size_t idx = 0, first_idx, line_end, last_seed;
+    unsigned char flags, next_character;
+    nfaStateRecord best = {0};
+    nfaStateSet current, next;
+
+    if (budget && budget->suspended) {
+        idx = scratch->suspension.idx;
+        line_end = scratch->suspension.line_end;
+        best = scratch->suspension.best;
+        current = scratch->suspension.current;
+        next.records = scratch->records + ((current.records == scratch->records) ? nfa->length : 0);
+        last_seed = (nfa->anchors & GRR_NFA_FIRST_CHAR_FLAG) ? 0 : line_end - MAX(nfa->min_length, 1);
+        budget->suspended = false;
+        scratch->suspension.owner = NULL;
+    } else {
+        if (!budget && nfa->search_engine == GRR_ENGINE_REVERSE) {
+            return reverseSearchNfa(nfa, scratch, string, len, start, end, cursor);
         }
 
-        next_state_set.length = 0;
+        // screenSearch has already ruled out a line which is too short.
+        line_end = nfaLineEnd(string, len, 0);
+        last_seed = (nfa->anchors & GRR_NFA_FIRST_CHAR_FLAG) ? 0 : line_end - MAX(nfa->min_length, 1);
 
-        if (!isprint(character) && character != '\t') {
-            if (!tolerant) {
-                if (cursor) {
-                    *cursor = idx;
-                }
+        current.records = scratch->records;
+        current.length = 0;
+        next.records = scratch->records + nfa->length;
+    }
+
+    for (first_idx = idx; idx < line_end;) {
+        nfaStateSet temp;
 
-                return GRR_RET_BAD_DATA;
+        if (current.length == 0) {
+            size_t limit = last_seed + 1, skipped = idx;
+
+            // Nothing is in flight so skip ahead to the next position whose character can start a match.
+            // Each byte skipped is a step.
+            if (budget) {
+                limit = MIN(limit, idx + MAX(budget->steps, 1));
+            }
+            while (idx < limit && !IS_FLAG_SET(nfa->first_bytes, (unsigned char)string[idx])) {
+                idx++;
+            }
+            if (budget) {
+                budget->steps -= MIN(budget->steps, idx - skipped);
+            }
+            if (idx > last_seed) {
+                break;
+            }
+            if (idx == limit) {
+                scratch->suspension.current = current;
+                goto suspend;
             }
 
-            for (unsigned int k = 0; k < current_state_set.length; k++) {
-                if (current_state_set.records[k].state == length) {
-                    if (k > 0) {
-                        memcpy(current_state_set.records + 0, current_state_set.records + k,
-                               sizeof(nfaStateRecord));
-                    }
-                    goto skip_over_clear;
-                }
+            flags = positionFlags(string, len, idx, &next_character);
+            nextGeneration(scratch);
+            addState(nfa, scratch, &current, 0, idx, idx, flags, next_character, &best);
+            if (current.length == 0) {
+                idx++;
+                continue;
             }
+        }
+
+        if (budget && !spendBudget(budget, current.length + 1, idx > first_idx)) {
+            scratch->suspension.current = current;
+            goto suspend;
+        }
+
+        flags = positionFlags(string, len, idx + 1, &next_character);
+        nextGeneration(scratch);
+        next.length = 0;
+        stepStateSet(nfa, scratch, &current, &next, string[idx], idx, flags, next_character, &best);
+        if (idx + 1 <= last_seed && IS_FLAG_SET(nfa->first_bytes, next_character)) {
+            addState(nfa, scratch, &next, 0, idx + 1, idx + 1, flags, next_character, &best);
+        }
+
+        temp = current;
+        current = next;
+        next = temp;
+        idx++;
+
+        // Nothing which is still in flight could beat a match of the maximum length.
+        if (nfa->max_length != GRR_NFA_UNBOUNDED && best.end_idx - best.start_idx == nfa->max_length) {
+            break;
+        }
+    }
+
+    if (cursor) {
+        *cursor = line_end;
+    }
+    if (best.end_idx == best.start_idx) {
+        return GRR_RET_NOT_FOUND;
+    }
+
+    if (start) {
+        *start = best.start_idx;
+    }
+    if (end) {
+        *end = best.end_idx;
+    }
+    return GRR_RET_OK;
+
+suspend:
+
+    scratch->suspension.line_end = line_end;
+    scratch->suspension.best = best;
+    suspendCall(scratch, budget, GRR_NFA_SUSPENDED_SEARCH, nfa, 1, len, idx);
+    if (cursor) {
+        *cursor = idx;
+    }
+    return GRR_RET_BUDGET_EXHAUSTED;
+}
+
+/*
+ * The same walk as searchNfa's without a budget but every record carries the positions recorded by the tagged
+ * states it passed through.  The slots of the record at scratch->records[k] are at scratch->slots[k *
+ * num_slots].  They're followed by the slots of a new record, which are all unset, and then by those of the
+ * best match so far.
+ */
+static int
+searchSubmatches(grrNfa nfa, grrScratch scratch, const char *string, size_t len, grrSubmatch *submatches,
+                 size_t num_submatches, size_t *cursor) {
+    unsigned int numSlots;
+    size_t idx = 0, line_end, last_seed;
+    size_t *seedSlots, *bestSlots;
+    unsigned char flags, next_character;
+    nfaStateRecord best = {0};
+    nfaStateSet current, next;
+
+    for (size_t k = 0; k < num_submatches; k++) {
+        submatches[k].start = submatches[k].end = GRR_SUBMATCH_UNSET;
+    }
+
+    line_end = nfaLineEnd(string, len, 0);
+    if (cursor) {
+        *cursor = line_end;
+    }
+    if (nfa->search_engine == GRR_ENGINE_NONE || line_end < MAX(nfa->min_length, 1)) {
+        return GRR_RET_NOT_FOUND;
+    }
+    last_seed = (nfa->anchors & GRR_NFA_FIRST_CHAR_FLAG) ? 0 : line_end - MAX(nfa->min_length, 1);
+
+    if (nfa->search_engine == GRR_ENGINE_DFA && nfaDfaScanLine(nfa->dfa, string, line_end, NULL) ==
+                                                    GRR_RET_NOT_FOUND) {
+        return GRR_RET_NOT_FOUND;
+    }
+
+    numSlots = 2 * MIN(nfa->num_groups, num_submatches - 1);
+    seedSlots = scratch->slots + 2 * ((size_t)nfa->length + 1) * numSlots;
+    bestSlots = seedSlots + numSlots;
+    for (unsigned int k = 0; k < numSlots; k++) {
+        seedSlots[k] = GRR_SUBMATCH_UNSET;
+    }
+
+    current.records = scratch->records;
+    current.length = 0;
+    next.records = scratch->records + nfa->length;
 
-            memset(current_state_set.records, 0, sizeof(nfaStateRecord) * current_state_set.length);
+    while (idx < line_end) {
+        nfaStateSet temp;
 
-skip_over_clear:
-            do {
+        if (current.length == 0) {
+            while (idx <= last_seed && !IS_FLAG_SET(nfa->first_bytes, (unsigned char)string[idx])) {
                 idx++;
-            } while (idx < len && !isprint(string[idx]) && string[idx] != '\t');
-            if (idx == len) {
+            }
+            if (idx > last_seed) {
                 break;
             }
 
-            character = string[idx];
-            flags |= GRR_NFA_FIRST_CHAR_FLAG;
-        } else if (idx == 0) {
-            flags |= GRR_NFA_FIRST_CHAR_FLAG;
+            flags = positionFlags(string, len, idx, &next_character);
+            nextGeneration(scratch);
+            addCaptureState(nfa, scratch, &current, 0, idx, idx, flags, next_character, seedSlots, numSlots,
+                            &best);
+            if (current.length == 0) {
+                idx++;
+                continue;
+            }
         }
 
-        character = ADJUST_CHARACTER(character);
-
-        for (unsigned int k = 0; k < current_state_set.length; k++) {
-            determineNextStateRecord(0, nfa, current_state_set.records[k].state,
-                                     current_state_set.records + k, character, flags, &next_state_set);
+        flags = positionFlags(string, len, idx + 1, &next_character);
+        nextGeneration(scratch);
+        next.length = 0;
+        stepCaptureSet(nfa, scratch, &current, &next, string[idx], idx, flags, next_character, numSlots,
+                       &best);
+        if (idx + 1 <= last_seed && IS_FLAG_SET(nfa->first_bytes, next_character)) {
+            addCaptureState(nfa, scratch, &next, 0, idx + 1, idx + 1, flags, next_character, seedSlots,
+                            numSlots, &best);
         }
 
-        first_state.state = 0;
-        first_state.start_idx = first_state.end_idx = idx;
-        first_state.score = 0;
+        temp = current;
+        current = next;
+        next = temp;
+        idx++;
 
-        determineNextStateRecord(0, nfa, 0, &first_state, character, flags, &next_state_set);
+        if (nfa->max_length != GRR_NFA_UNBOUNDED && best.end_idx - best.start_idx == nfa->max_length) {
+            break;
+        }
+    }
 
-        memcpy(current_state_set.records, next_state_set.records,
-               sizeof(nfaStateRecord) * next_state_set.length);
-        current_state_set.length = next_state_set.length;
+    if (best.end_idx == best.start_idx) {
+        return GRR_RET_NOT_FOUND;
     }
 
-    champion_score = 0;
-    for (unsigned int k = 0; k < current_state_set.length; k++) {
-        if (current_state_set.records[k].score > champion_score) {
-            unsigned char visited_states[(nfa->length + 1 + 7) / 8];  // The +1 is for the accepting state.
+    submatches[0].start = best.start_idx;
+    submatches[0].end = best.end_idx;
+    for (unsigned int k = 0; k < numSlots; k += 2) {
+        if (bestSlots[k] != GRR_SUBMATCH_UNSET && bestSlots[k + 1] != GRR_SUBMATCH_UNSET) {
+            submatches[1 + k / 2].start = bestSlots[k];
+            submatches[1 + k / 2].end = bestSlots[k + 1];
+        }
+    }
+    return GRR_RET_OK;
+}
 
-            memset(visited_states, 0, sizeof(visited_states));
+/*
+ * For a regex which is anchored only at the end, every match ends at the end of the line.  So, the NFA is run
+ * backward from there and the earliest position at which the first state is reached is the start of the
+ * longest match.  The scan stops as soon as the states die out rather than walking the whole line.
+ */
+static int
+reverseSearchNfa(grrNfa nfa, grrScratch scratch, const char *string, size_t len, size_t *start, size_t *end,
+                 size_t *cursor) {
+    size_t idx, line_end, match_start;
+    nfaStateSet current, next;
+
+    current.records = scratch->records;
+    current.length = 0;
+    next.records = scratch->records + nfa->length + 1;
+
+    line_end = nfaLineEnd(string, len, 0);
+    if (cursor) {
+        *cursor = line_end;
+    }
+    match_start = line_end;
 
-            if (canTransitionToAcceptingState(nfa, current_state_set.records[k].state, visited_states)) {
-                if (start) {
-                    *start = current_state_set.records[k].start_idx;
-                }
-                if (end) {
-                    *end = current_state_set.records[k].end_idx;
-                }
+    if (nfa->search_engine == GRR_ENGINE_NONE || line_end < MAX(nfa->min_length, 1)) {
+        return GRR_RET_NOT_FOUND;
+    }
 
-                champion_score = current_state_set.records[k].score;
+    nextGeneration(scratch);
+    addStateReverse(nfa, scratch, &current, nfa->length, string, line_end, line_end);
+    for (idx = line_end; idx > 0 && current.length > 0; idx--) {
+        unsigned char character;
+        nfaStateSet temp;
+
+        character = string[idx - 1];
+        nextGeneration(scratch);
+        next.length = 0;
+        for (unsigned int k = 0; k < current.length; k++) {
+            unsigned int state = current.records[k].state;
+
+            for (unsigned int e = nfa->reverse_offsets[state]; e < nfa->reverse_offsets[state + 1]; e++) {
+                unsigned int source = nfa->reverse_edges[e].source;
+                nfaEdge edges[2];
+                const nfaEdge *edge = &edges[nfa->reverse_edges[e].transition];
+
+                nfaDecodeState(nfa->program, source, edges);
+                if (edge->flags || !nfaEdgeAccepts(edge, character)) {
+                    continue;
+                }
+                addStateReverse(nfa, scratch, &next, source, string, idx - 1, line_end);
             }
         }
+
+        if (scratch->stamps[0] == scratch->generation) {
+            match_start = idx - 1;
+        }
+
+        temp = current;
+        current = next;
+        next = temp;
+    }
+
+    if (match_start == line_end) {
+        return GRR_RET_NOT_FOUND;
     }
 
-    return (champion_score > 0) ? GRR_RET_OK : GRR_RET_NOT_FOUND;
+    if (start) {
+        *start = match_start;
+    }
+    if (end) {
+        *end = line_end;
+    }
+    return GRR_RET_OK;
 }
 
+/*
+ * Runs the regexes of a list side by side over the text.  If candidates isn't NULL, it lists, in ascending
+ * order, the only regexes which could match the first character.  Otherwise, every regex is a candidate.
+ * Regexes which give up on matching are dropped from the active list so that they cost nothing afterward.
+ *
+ * If budget isn't NULL, then only as many steps as it allows are taken.  Running out is reported through
+ * the budget with processed set to where the regexes stopped.
+ */
 ssize_t
-grrFirstMatch(grrNfa *nfa_list, size_t num, const char *source, size_t size, size_t *processed,
-              size_t *score) {
-    unsigned char flags = GRR_NFA_FIRST_CHAR_FLAG | GRR_NFA_LAST_CHAR_FLAG;
-    size_t champion;
-    nfaStateSet current_state_sets[num], next_state_sets[num];
-
-    if (!nfa_list || num == 0 || !source || size == 0 || !processed) {
-        return -1;
+nfaFirstMatch(grrNfa *nfa_list, const unsigned int *candidates, size_t num_candidates, grrScratch scratch,
+              const char *source, size_t size, grrBudget *budget, size_t *processed, size_t *score) {
+    size_t offset = 0, champion_score = 0, line_end = SIZE_MAX, num_active = 0, first_idx;
+    size_t num_started = num_candidates;
+    ssize_t champion = -1;
+    unsigned char flags, next_character;
+    nfaStateSet *current_sets, *next_sets;
+
+    // Only the candidates can be started, so the sets only need room for them.
+    current_sets = scratch->sets;
+    next_sets = scratch->sets + num_candidates;
+    flags = positionFlags(source, size, 0, &next_character);
+
+    if (budget && budget->suspended) {
+        // The sets, along with the active list, were left where they were.
+        *processed = scratch->suspension.idx;
+        num_active = scratch->suspension.num_active;
+        champion_score = scratch->suspension.champion_score;
+        champion = scratch->suspension.champion;
+        budget->suspended = false;
+        scratch->suspension.owner = NULL;
+        // The regexes were started by the call which ran out.
+        num_started = 0;
+    } else {
+        *processed = 0;
     }
 
-    for (size_t k = 0; k < num; k++) {
-        current_state_sets[k].records = alloca(sizeof(nfaStateRecord) * (nfa_list[k]->length + 1));
-        current_state_sets[k].length = 0;
+    // Regexes which can't match the line are given up on right away.
+    for (size_t j = 0; j < num_started && !(flags & GRR_NFA_LAST_CHAR_FLAG); j++) {
+        nfaStateRecord best = {0};
+        size_t k = candidates ? candidates[j] : j;
+        grrNfa nfa = nfa_list[k];
 
-        next_state_sets[k].records = alloca(sizeof(nfaStateRecord) * (nfa_list[k]->length + 1));
+        if (nfa->min_length == GRR_NFA_UNBOUNDED || !IS_FLAG_SET(nfa->first_bytes, next_character)) {
+            continue;
+        }
+        if (nfa->min_length > 1) {
+            if (line_end == SIZE_MAX) {
+                line_end = nfaLineEnd(source, size, 0);
+            }
+            if (line_end < nfa->min_length) {
+                continue;
+            }
+        }
+
+        // Only the regexes which are started are given room for their states.
+        current_sets[num_active].records = scratch->records + offset;
+        current_sets[num_active].length = 0;
+        next_sets[num_active].records = scratch->records + offset + nfa->length;
+
+        nextGeneration(scratch);
+        addState(nfa, scratch, current_sets + num_active, 0, 0, 0, flags, next_character, &best);
+        if (current_sets[num_active].length > 0) {
+            scratch->active[num_active++] = k;
+            offset += 2 * (size_t)nfa->length;
+        }
     }
 
-    for (*processed = 0; *processed < size; (*processed)++) {
-        char character;
-        bool still_alive = false;
+    for (first_idx = *processed; *processed < size && !IS_LINE_BREAK(source[*processed]); (*processed)++) {
+        unsigned char character;
+        size_t num_alive = 0;
 
-        character = source[*processed];
-        if (!isprint(character) && character != '\t') {
+        if (num_active == 0) {
             break;
         }
-        character = ADJUST_CHARACTER(character);
+        if (budget) {
+            size_t cost = 1;
 
-        if (*processed == 0) {
-            for (size_t k = 0; k < num; k++) {
-                nfaStateRecord first_state = {0};
-
-                determineNextStateRecord(0, nfa_list[k], 0, &first_state, character, flags,
-                                         next_state_sets + k);
+            for (size_t j = 0; j < num_active; j++) {
+                cost += current_sets[j].length;
+            }
+            if (!spendBudget(budget, cost, *processed > first_idx)) {
+                scratch->suspension.num_active = num_active;
+                scratch->suspension.champion_score = champion_score;
+                scratch->suspension.champion = champion;
+                suspendCall(scratch, budget, GRR_NFA_SUSPENDED_FIRST_MATCH, nfa_list, num_candidates, size,
+                            *processed);
+                return -1;
             }
-        } else {
-            for (size_t k = 0; k < num; k++) {
-                nfaStateSet *current;
+        }
 
-                current = current_state_sets + k;
-                if (current->length == 0) {
-                    continue;
-                }
-                next_state_sets[k].length = 0;
+        character = source[*processed];
+        flags = positionFlags(source, size, *processed + 1, &next_character);
+
+        // The active list stays in ascending order so that ties still go to the lowest index.
+        for (size_t j = 0; j < num_active; j++) {
+            nfaStateRecord best = {0};
+            nfaStateSet temp;
+            size_t k = scratch->active[j];
+
+            nextGeneration(scratch);
+            next_sets[j].length = 0;
+            stepStateSet(nfa_list[k], scratch, current_sets + j, next_sets + j, character, *processed, flags,
+                         next_character, &best);
+            if (best.end_idx > champion_score) {
+                champion_score = best.end_idx;
+                champion = k;
+            }
 
-                for (unsigned int j = 0; j < current->length; j++) {
-                    determineNextStateRecord(0, nfa_list[k], current->records[j].state, current->records + j,
-                                             character, flags, next_state_sets + k);
-                }
+            if (next_sets[j].length > 0) {
+                temp = current_sets[j];
+                current_sets[num_alive] = next_sets[j];
+                next_sets[num_alive] = temp;
+                scratch->active[num_alive++] = k;
             }
         }
+        num_active = num_alive;
+    }
 
-        for (size_t k = 0; k < num; k++) {
-            nfaStateSet *next;
+    if (score) {
+        *score = champion_score;
+    }
+    return champion;
+}
 
-            next = next_state_sets + k;
+/*
+ * Counts the lines of a buffer, up to max_lines of them, which contain a match.  Only whether a line
+ * matches is worked out and not where.
+ */
+static size_t
+countLines(grrNfa nfa, grrScratch scratch, const char *buffer, size_t size, unsigned char *matched,
+           size_t max_lines, size_t *num_lines) {
+    size_t pos = 0, line = 0, count = 0;
+
+    if (nfa->search_engine == GRR_ENGINE_LITERAL && nfa->anchors == 0) {
+        // An unanchored literal contains no line breaks and so it can be searched for across lines.  The line
+        // breaks only need to be counted if the caller wants to know which lines matched.
+        bool numbered = matched || num_lines;
+
+        while (line < max_lines) {
+            const char *found;
+            size_t idx;
+
+            found = (pos < size) ? nfaFindLiteral(nfa, buffer + pos, size - pos) : NULL;
+            if (!found) {
+                if (num_lines && pos < size) {
+                    line += countLineBreaks(buffer + pos, size - pos) + !IS_LINE_BREAK(buffer[size - 1]);
+                }
+                break;
+            }
 
-            if (next->length > 0) {
-                memcpy(current_state_sets[k].records, next->records, sizeof(nfaStateRecord) * next->length);
-                if (next->length > 1 || next->records[0].state != nfa_list[k]->length) {
-                    still_alive = true;
+            idx = found - buffer;
+            if (numbered) {
+                line += countLineBreaks(buffer + pos, idx - pos);
+                if (line >= max_lines) {
+                    break;
                 }
             }
+
+            if (matched) {
+                SET_FLAG(matched, line);
+            }
+            count++;
+            line++;
+            pos = nfaNextLine(buffer, size, idx);
         }
 
-        if (!still_alive) {
-            break;
+        if (num_lines) {
+            *num_lines = MIN(line, max_lines);
         }
+        return count;
     }
 
-    *score = 0;
-    for (size_t k = 0; k < num; k++) {
-        nfaStateSet *current;
-
-        current = current_state_sets + k;
+    while (pos < size && line < max_lines) {
+        size_t lineEnd;
 
-        for (unsigned int j = 0; j < current->length; j++) {
-            if (current->records[j].state == nfa_list[k]->length) {
-                if (current->records[j].score > *score) {
-                    *score = current->records[j].score;
-                    champion = k;
-                }
+        lineEnd = nfaLineEnd(buffer, size, pos);
+        if (lineMatches(nfa, scratch, buffer + pos, lineEnd - pos)) {
+            if (matched) {
+                SET_FLAG(matched, line);
             }
+            count++;
         }
+        line++;
+        pos = nfaNextLine(buffer, size, lineEnd);
     }
 
-    return (*score > 0) ? (ssize_t)champion : -1;
+    if (num_lines) {
+        *num_lines = line;
+    }
+    return count;
 }
 
+/*
+ * Determines if a line contains a match with the cheapest engine available.
+ */
 static bool
-determineNextState(unsigned int depth, grrNfa nfa, unsigned int state, char character,
-                   unsigned char *state_set) {
-    const nfaNode *nodes;
-    bool still_alive = false;
+lineMatches(grrNfa nfa, grrScratch scratch, const char *string, size_t len) {
+    int ret;
 
-    if (state == nfa->length) {
-        // We've reached the accepting state but we have another character to process.
-        return false;
+    if (nfa->search_engine == GRR_ENGINE_LITERAL) {
+        return nfaSearchLiteral(nfa, string, len, NULL, NULL, NULL) == GRR_RET_OK;
     }
 
-    assert(depth < nfa->length);
+    if (nfa->search_engine == GRR_ENGINE_DFA) {
+        ret = nfaDfaScanLine(nfa->dfa, string, len, NULL);
+        if (ret != GRR_NFA_DFA_GAVE_UP) {
+            return ret == GRR_RET_OK;
+        }
+    }
+
+    ret = screenSearch(nfa, string, len, NULL, false, NULL, NULL, NULL);
+    if (ret == STATE_SETS_NEEDED) {
+        ret = searchNfa(nfa, scratch, string, len, NULL, NULL, NULL, NULL);
+    }
+    return ret == GRR_RET_OK;
+}
 
-    nodes = nfa->nodes;
-    for (unsigned int k = 0; k <= nodes[state].two_transitions; k++) {
-        unsigned int new_state;
+/*
+ * Counts the line breaks in a string eight bytes at a time.  "\r\n" counts as a single line break.
+ */
+static size_t
+countLineBreaks(const char *string, size_t len) {
+    size_t count = 0, returns = 0, idx = 0;
 
-        new_state = state + nodes[state].transitions[k].motion;
+    for (; idx + sizeof(uint64_t) <= len; idx += sizeof(uint64_t)) {
+        uint64_t word;
 
-        if (IS_FLAG_SET(nodes[state].transitions[k].symbols, character)) {
-            SET_FLAG(state_set, new_state);
-            still_alive = true;
-        } else if (IS_FLAG_SET(nodes[state].transitions[k].symbols, GRR_NFA_EMPTY_TRANSITION)) {
-            if (determineNextState(depth + 1, nfa, new_state, character, state_set)) {
-                still_alive = true;
+        memcpy(&word, string + idx, sizeof(word));
+        count += countZeroBytes(word ^ REPEAT_BYTE('\n'));
+        returns += countZeroBytes(word ^ REPEAT_BYTE('\r'));
+    }
+    for (; idx < len; idx++) {
+        if (string[idx] == '\n') {
+            count++;
+        } else if (string[idx] == '\r') {
+            returns++;
+        }
+    }
+
+    if (returns > 0) {
+        const char *end = string + len, *found;
+
+        found = memchr(string, '\r', len);
+        while (found) {
+            if (found + 1 < end && found[1] == '\n') {
+                count--;
             }
-        } else if (IS_FLAG_SET(nodes[state].transitions[k].symbols, GRR_NFA_LOOKAHEAD)) {
-            return false;
+            found = memchr(found + 1, '\r', end - found - 1);
         }
     }
 
-    return still_alive;
+    return count + returns;
 }
 
-static bool
-canTransitionToAcceptingState(grrNfa nfa, unsigned int state, unsigned char *visited_states) {
-    const nfaNode *nodes;
+/*
+ * Counts the zero bytes of a word.  The high bit of each byte of the mask is set if and only if the byte is
+ * zero, with no carries between bytes.
+ */
+static unsigned int
+countZeroBytes(uint64_t word) {
+    uint64_t low = REPEAT_BYTE(0x7f), mask;
 
-    if (state == nfa->length) {
-        return true;
+    mask = ~(((word & low) + low) | word | low);
+    return __builtin_popcountll(mask);
+}
+
+static void
+nextGeneration(grrScratch scratch) {
+    if (++scratch->generation == 0) {
+        memset(scratch->stamps, 0, sizeof(*scratch->stamps) * scratch->state_capacity);
+        scratch->generation = 1;
     }
+}
 
-    if (IS_FLAG_SET(visited_states, state)) {
+/*
+ * Takes the cost of work which can't be stopped partway through out of a budget.  Returns false, without
+ * taking anything, if the budget can't cover all of it.  A NULL budget covers everything.
+ */
+static bool
+chargeBudget(grrBudget *budget, size_t cost) {
+    if (!budget) {
+        return true;
+    }
+    if (budget->steps < cost) {
         return false;
     }
-    SET_FLAG(visited_states, state);
 
-    nodes = nfa->nodes;
-    for (unsigned int k = 0; k <= nodes[state].two_transitions; k++) {
-        if (IS_FLAG_SET(nodes[state].transitions[k].symbols, GRR_NFA_EMPTY_TRANSITION) ||
-            IS_FLAG_SET(nodes[state].transitions[k].symbols, GRR_NFA_LOOKAHEAD)) {
-            unsigned int new_state;
+    budget->steps -= cost;
+    return true;
+}
 
-            new_state = state + nodes[state].transitions[k].motion;
-            if (canTransitionToAcceptingState(nfa, new_state, visited_states)) {
-                return true;
-            }
+/*
+ * Takes the cost of the next byte out of a budget.  Returns false if the budget can't cover it and the call
+ * has already made progress.  Otherwise, the byte is processed even if the budget can't cover it.
+ */
+static bool
+spendBudget(grrBudget *budget, size_t cost, bool progressed) {
+    if (budget->steps < cost) {
+        if (progressed) {
+            return false;
         }
+        cost = budget->steps;
     }
 
-    return false;
+    budget->steps -= cost;
+    return true;
 }
 
+/*
+ * Records where a budgeted call stopped.  The caller has already stored whatever else it needs to resume.
+ */
 static void
-determineNextStateRecord(unsigned int depth, grrNfa nfa, unsigned int state, const nfaStateRecord *record,
-                         char character, unsigned char flags, nfaStateSet *set) {
-    const nfaNode *nodes;
+suspendCall(grrScratch scratch, grrBudget *budget, unsigned char call, const void *owner, size_t num,
+            size_t size, size_t idx) {
+    scratch->suspension.owner = owner;
+    scratch->suspension.call = call;
+    scratch->suspension.num = num;
+    scratch->suspension.size = size;
+    scratch->suspension.idx = idx;
+    budget->suspended = true;
+}
 
-    if (state == nfa->length) {
-        maybePlaceRecord(record, state, set, (depth > 0));
-        return;
+/*
+ * Checks that a call being resumed is the one which stopped, since the state sets it left behind mean
+ * nothing to any other.
+ */
+static bool
+isSuspendedCall(grrScratch scratch, unsigned char call, const void *owner, size_t num, size_t size) {
+    const nfaSuspension *suspension = &scratch->suspension;
+
+    return suspension->owner == owner && suspension->call == call && suspension->num == num &&
+           suspension->size == size;
+}
+
+/*
+ * Determines which of the conditional transitions may be taken at a position in the string.  When the
+ * position isn't at the end of the line, the character found there is stored so that lookaheads can check it.
+ */
+static unsigned char
+positionFlags(const char *string, size_t len, size_t idx, unsigned char *character) {
+    unsigned char flags = 0;
+
+    if (idx == 0) {
+        flags |= GRR_NFA_FIRST_CHAR_FLAG;
     }
 
-    assert(depth < nfa->length);
+    if (idx == len || IS_LINE_BREAK(string[idx])) {
+        flags |= GRR_NFA_LAST_CHAR_FLAG | GRR_NFA_LOOKAHEAD_FLAG;
+        *character = 0;
+    } else {
+        *character = string[idx];
+    }
+
+    return flags;
+}
+
+static void
+stepStateSet(grrNfa nfa, grrScratch scratch, const nfaStateSet *current, nfaStateSet *next,
+             unsigned char character, size_t idx, unsigned char flags, unsigned char next_character,
+             nfaStateRecord *best) {
+    for (unsigned int k = 0; k < current->length; k++) {
+        unsigned int state, count;
+        nfaEdge edges[2];
+
+        state = current->records[k].state;
+        count = nfaDecodeState(nfa->program, state, edges);
+        for (unsigned int j = 0; j < count; j++) {
+            if (edges[j].flags || !nfaEdgeAccepts(&edges[j], character)) {
+                continue;
+            }
+
+            addState(nfa, scratch, next, state + edges[j].motion, current->records[k].start_idx, idx + 1,
+                     flags, next_character, best);
+        }
+    }
+}
 
-    nodes = nfa->nodes;
-    for (unsigned int k = 0; k <= nodes[state].two_transitions; k++) {
-        unsigned int new_state;
-        const unsigned char *symbols;
+/*
+ * Adds a state, along with every state reachable from it by empty transitions, to a state set.  The flags
+ * describe which of the conditional transitions may be taken at the current position.  A record which
+ * reaches the accepting state is not stored in the set but is instead compared against the best match.
+ * Records must be added in order of increasing start index so that the first record to reach a state is
+ * the one which keeps it.
+ */
+static void
+addState(grrNfa nfa, grrScratch scratch, nfaStateSet *set, unsigned int state, size_t start_idx,
+         size_t end_idx, unsigned char flags, unsigned char character, nfaStateRecord *best) {
+    unsigned int depth = 0, generation;
+    unsigned int *stamps, *stack;
+    unsigned long *visits;
+
+    stamps = scratch->stamps;
+    stack = scratch->stack;
+    visits = scratch->visits;
+    generation = scratch->generation;
+
+    stack[depth++] = state;
+    while (depth > 0) {
+        bool consumes = false;
+        unsigned int count;
+        nfaEdge edges[2];
+
+        state = stack[--depth];
+        if (state == nfa->length) {
+            size_t length, best_length;
+
+            stamps[state] = generation;
+            length = end_idx - start_idx;
+            best_length = best->end_idx - best->start_idx;
+            if (length > best_length || (length == best_length && start_idx < best->start_idx)) {
+                best->start_idx = start_idx;
+                best->end_idx = end_idx;
+            }
+            continue;
+        }
 
-        new_state = state + nodes[state].transitions[k].motion;
+        if (stamps[state] == generation) {
+            continue;
+        }
+        stamps[state] = generation;
+        if (visits) {
+            visits[state]++;
+        }
 
-        symbols = nodes[state].transitions[k].symbols;
-        if (IS_FLAG_SET(symbols, GRR_NFA_LOOKAHEAD)) {
-            if (!IS_FLAG_SET(symbols, character)) {
+        count = nfaStateConsumes(nfa->program, state) ? 0 : nfaDecodeState(nfa->program, state, edges);
+        consumes = (count == 0);
+        for (unsigned int k = 0; k < count; k++) {
+            if (edges[k].flags & GRR_NFA_EMPTY_TRANSITION_FLAG) {
+                if (edges[k].flags & (GRR_NFA_FIRST_CHAR_FLAG | GRR_NFA_LAST_CHAR_FLAG) & ~flags) {
+                    continue;
+                }
+            } else if (edges[k].flags & GRR_NFA_LOOKAHEAD_FLAG) {
+                if (!(flags & GRR_NFA_LOOKAHEAD_FLAG) && !nfaEdgeAccepts(&edges[k], character)) {
+                    continue;
+                }
+            } else {
+                consumes = true;
                 continue;
             }
 
-            maybePlaceRecord(record, new_state, set, false);
-        } else if (IS_FLAG_SET(symbols, character)) {
-            maybePlaceRecord(record, new_state, set, true);
-        } else if (IS_FLAG_SET(symbols, GRR_NFA_EMPTY_TRANSITION)) {
-            if (IS_FLAG_SET(symbols, GRR_NFA_FIRST_CHAR) && !(flags & GRR_NFA_FIRST_CHAR_FLAG)) {
+            stack[depth++] = state + edges[k].motion;
+        }
+
+        if (consumes) {
+            set->records[set->length].state = state;
+            set->records[set->length].start_idx = start_idx;
+            set->records[set->length].end_idx = end_idx;
+            set->length++;
+        }
+    }
+}
+
+static void
+stepCaptureSet(grrNfa nfa, grrScratch scratch, const nfaStateSet *current, nfaStateSet *next,
+               unsigned char character, size_t idx, unsigned char flags, unsigned char next_character,
+               unsigned int num_slots, nfaStateRecord *best) {
+    for (unsigned int k = 0; k < current->length; k++) {
+        unsigned int state, count;
+        size_t *slots;
+        nfaEdge edges[2];
+
+        state = current->records[k].state;
+        // addCaptureState puts back whatever it changes so the record's own slots can be built upon.
+        slots = scratch->slots + (size_t)(current->records + k - scratch->records) * num_slots;
+        count = nfaDecodeState(nfa->program, state, edges);
+        for (unsigned int j = 0; j < count; j++) {
+            if (edges[j].flags || !nfaEdgeAccepts(&edges[j], character)) {
                 continue;
             }
 
-            if (IS_FLAG_SET(symbols, GRR_NFA_LAST_CHAR)) {
+            addCaptureState(nfa, scratch, next, state + edges[j].motion, current->records[k].start_idx,
+                            idx + 1, flags, next_character, slots, num_slots, best);
+        }
+    }
+}
+
+/*
+ * Same as addState but the states are visited in the order of their transitions, the way a backtracking
+ * engine would try them, so that the first record to reach a state is also the one which a backtracking
+ * engine would prefer.  A tagged state records end_idx into slots, which is put back once everything reached
+ * through the state has been visited.
+ */
+static void
+addCaptureState(grrNfa nfa, grrScratch scratch, nfaStateSet *set, unsigned int state, size_t start_idx,
+                size_t end_idx, unsigned char flags, unsigned char character, size_t *slots,
+                unsigned int num_slots, nfaStateRecord *best) {
+    unsigned int depth = 0, generation;
+    unsigned int *stamps;
+    nfaCaptureFrame *frames;
+
+    stamps = scratch->stamps;
+    frames = scratch->frames;
+    generation = scratch->generation;
+
+    frames[depth++] = (nfaCaptureFrame){.state = state, .slot = GRR_NFA_VISIT_FRAME};
+    while (depth > 0) {
+        nfaCaptureFrame frame = frames[--depth];
+        bool placed = false;
+        unsigned int count, tag;
+        nfaEdge edges[2];
+
+        if (frame.slot == GRR_NFA_PLACE_FRAME) {
+            placeCaptureRecord(scratch, set, frame.state, start_idx, end_idx, slots, num_slots);
+            continue;
+        }
+        if (frame.slot != GRR_NFA_VISIT_FRAME) {
+            slots[frame.slot] = frame.value;
+            continue;
+        }
+
+        state = frame.state;
+        if (state == nfa->length) {
+            size_t length, best_length;
+
+            length = end_idx - start_idx;
+            best_length = best->end_idx - best->start_idx;
+            if (length > best_length || (length == best_length && start_idx < best->start_idx)) {
+                best->start_idx = start_idx;
+                best->end_idx = end_idx;
+                memcpy(scratch->slots + (2 * ((size_t)nfa->length + 1) + 1) * num_slots, slots,
+                       sizeof(*slots) * num_slots);
+            }
+            continue;
+        }
+
+        if (stamps[state] == generation) {
+            continue;
+        }
+        stamps[state] = generation;
+
+        tag = nfa->tags ? nfa->tags[state] : 0;
+        if (tag > 0 && tag <= num_slots) {
+            frames[depth++] = (nfaCaptureFrame){.value = slots[tag - 1], .slot = tag - 1};
+            slots[tag - 1] = end_idx;
+        }
+
+        if (nfaStateConsumes(nfa->program, state)) {
+            placeCaptureRecord(scratch, set, state, start_idx, end_idx, slots, num_slots);
+            continue;
+        }
+
+        // The frames are popped in reverse so the first transition is pushed last.
+        count = nfaDecodeState(nfa->program, state, edges);
+        for (unsigned int k = count; k-- > 0;) {
+            if (edges[k].flags & GRR_NFA_EMPTY_TRANSITION_FLAG) {
+                if (edges[k].flags & (GRR_NFA_FIRST_CHAR_FLAG | GRR_NFA_LAST_CHAR_FLAG) & ~flags) {
+                    continue;
+                }
+            } else if (edges[k].flags & GRR_NFA_LOOKAHEAD_FLAG) {
+                if (!(flags & GRR_NFA_LOOKAHEAD_FLAG) && !nfaEdgeAccepts(&edges[k], character)) {
+                    continue;
+                }
+            } else {
+                if (!placed) {
+                    frames[depth++] = (nfaCaptureFrame){.state = state, .slot = GRR_NFA_PLACE_FRAME};
+                    placed = true;
+                }
                 continue;
             }
 
-            determineNextStateRecord(depth + 1, nfa, new_state, record, character, flags, set);
+            frames[depth].state = state + edges[k].motion;
+            frames[depth++].slot = GRR_NFA_VISIT_FRAME;
         }
     }
 }
 
 static void
-maybePlaceRecord(const nfaStateRecord *record, unsigned int state, nfaStateSet *set, bool update_score) {
-    unsigned int k;
-    size_t new_score;
+placeCaptureRecord(grrScratch scratch, nfaStateSet *set, unsigned int state, size_t start_idx, size_t end_idx,
+                   const size_t *slots, unsigned int num_slots) {
+    nfaStateRecord *record = &set->records[set->length++];
+
+    record->state = state;
+    record->start_idx = start_idx;
+    record->end_idx = end_idx;
+    memcpy(scratch->slots + (size_t)(record - scratch->records) * num_slots, slots,
+           sizeof(*slots) * num_slots);
+}
 
-    for (k = 0; k < set->length; k++) {
-        if (set->records[k].state == state) {
-            break;
+/*
+ * The reverse of addState:  adds a state, along with every state from which it can be reached by empty
+ * transitions that may be taken at idx, to a state set.
+ */
+static void
+addStateReverse(grrNfa nfa, grrScratch scratch, nfaStateSet *set, unsigned int state, const char *string,
+                size_t idx, size_t line_end) {
+    unsigned int depth = 0, generation;
+    unsigned int *stamps, *stack;
+
+    stamps = scratch->stamps;
+    stack = scratch->stack;
+    generation = scratch->generation;
+
+    if (stamps[state] == generation) {
+        return;
+    }
+    stamps[state] = generation;
+    stack[depth++] = state;
+
+    while (depth > 0) {
+        state = stack[--depth];
+        set->records[set->length++].state = state;
+        if (scratch->visits) {
+            scratch->visits[state]++;
         }
+
+        for (unsigned int k = nfa->reverse_offsets[state]; k < nfa->reverse_offsets[state + 1]; k++) {
+            unsigned int source = nfa->reverse_edges[k].source;
+            nfaEdge edges[2];
+            const nfaEdge *edge = &edges[nfa->reverse_edges[k].transition];
+
+            if (stamps[source] == generation) {
+                continue;
+            }
+            nfaDecodeState(nfa->program, source, edges);
+            if (edge->flags == 0) {
+                continue;
+            }
+
+            if (edge->flags & GRR_NFA_EMPTY_TRANSITION_FLAG) {
+                if (((edge->flags & GRR_NFA_FIRST_CHAR_FLAG) && idx != 0) ||
+                    ((edge->flags & GRR_NFA_LAST_CHAR_FLAG) && idx != line_end)) {
+                    continue;
+                }
+            } else if (idx != line_end && !nfaEdgeAccepts(edge, (unsigned char)string[idx])) {
+                continue;
+            }
+
+            stamps[source] = generation;
+            stack[depth++] = source;
+        }
+    }
+}
+
+/*
+ * Searches every line of a buffer while counting how often each state is visited.
+ */
+int
+nfaProfile(grrNfa nfa, const char *buffer, size_t size, unsigned long *visits) {
+    grrScratch scratch;
+
+    if (grrCreateScratch(nfa, &scratch) != GRR_RET_OK) {
+        return GRR_RET_OUT_OF_MEMORY;
     }
 
-    new_score = record->score + (update_score ? 1 : 0);
-    if (k == set->length || new_score > set->records[k].score) {
-        set->records[k].start_idx = record->start_idx;
-        set->records[k].end_idx = record->end_idx;
-        set->records[k].score = new_score;
-        if (update_score) {
-            set->records[k].end_idx++;
+    scratch->visits = visits;
+    for (size_t pos = 0; pos < size; pos = nfaNextLine(buffer, size, pos)) {
+        const char *line = buffer + pos;
+
+        if (screenSearch(nfa, line, size - pos, NULL, true, NULL, NULL, NULL) == STATE_SETS_NEEDED) {
+            searchNfa(nfa, scratch, line, size - pos, NULL, NULL, NULL, NULL);
         }
+    }
 
-        if (k == set->length) {
-            set->records[k].state = state;
-            set->length++;
+    grrFreeScratch(scratch);
+    return GRR_RET_OK;
+}
+
+size_t
+nfaLineEnd(const char *string, size_t len, size_t idx) {
+    const char *found;
+
+    found = memchr(string + idx, '\n', len - idx);
+    if (found) {
+        len = found - string;
+    }
+    found = memchr(string + idx, '\r', len - idx);
+    if (found) {
+        len = found - string;
+    }
+
+    return len;
+}
+
+/*
+ * Returns the index of the beginning of the line after the one containing idx.  "\r\n" counts as a single
+ * line break.
+ */
+size_t
+nfaNextLine(const char *buffer, size_t size, size_t idx) {
+    idx = nfaLineEnd(buffer, size, idx);
+    if (idx < size) {
+        if (buffer[idx] == '\r' && idx + 1 < size && buffer[idx + 1] == '\n') {
+            idx++;
         }
+        idx++;
     }
+
+    return idx;
 }
@@ -0,0 +1,425 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nfa.h"
+#include "nfaInternals.h"
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+/*
+ * The reader thread and the scanner pass two buffers back and forth.  The reader fills them in turn and the
+ * scanner takes them in the same order, so the reader only has to know how many buffers the scanner holds.
+ * A read of nothing marks the end of the input (or a failed read) and is the last buffer handed over.
+ *
+ * If the scanner finishes early, the reader may be waiting on a pipe which never gets any more data.  So the
+ * reader only reads once poll says that the file descriptor is ready, and the scanner wakes it up by writing
+ * to a pipe of its own, which the reader polls as well.
+ */
+
+typedef struct scanBuffer {
+    char *data;
+    size_t length;
+    int error;  // The errno of a failed read or 0.
+} scanBuffer;
+
+typedef struct scanReader {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    scanBuffer buffers[2];
+    unsigned int num_full;  // The number of buffers handed to the scanner and not yet given back.
+    bool stop;  // Set by the scanner if it finishes before the end of the input.
+    bool threaded;
+    int fd;
+    int wake[2];  // The scanner writes to wake[1] when it sets stop.
+    size_t buffer_size;
+} scanReader;
+
+typedef struct scanState {
+    grrNfa nfa;
+    grrScratch scratch;
+    grrScanCallback callback;
+    void *arg;
+    unsigned char *matched;  // A bitmap of the lines of a buffer.
+    char *carry;  // The beginning of a line which continues into the next buffer.
+    size_t carry_length;
+    size_t carry_capacity;
+    off_t carry_offset;
+    off_t offset;  // Of the beginning of the buffer being scanned.
+    size_t line_number;
+    bool skip_newline;  // Set if the last buffer ended with a '\r' which may be followed by a '\n'.
+    bool found;
+} scanState;
+
+static void *
+readAhead(void *arg);
+
+static bool
+waitForInput(scanReader *reader);
+
+static void
+readBuffer(scanReader *reader, scanBuffer *buffer);
+
+static scanBuffer *
+takeBuffer(scanReader *reader, unsigned int idx);
+
+static void
+giveBackBuffer(scanReader *reader);
+
+static int
+scanChunk(scanState *state, const char *data, size_t length);
+
+static int
+scanLines(scanState *state, const char *data, size_t length, off_t offset);
+
+static int
+scanLine(scanState *state, const char *line, size_t length, off_t offset);
+
+static int
+appendToCarry(scanState *state, const char *data, size_t length);
+
+int
+grrScanFd(grrNfa nfa, int fd, size_t buffer_size, grrScanCallback callback, void *arg) {
+    int ret, error = 0;
+    pthread_t thread;
+    scanReader reader = {.fd = fd};
+    scanState state = {.nfa = nfa, .callback = callback, .arg = arg};
+
+    if (!nfa || !callback) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    reader.buffer_size = buffer_size ? buffer_size : GRR_SCAN_DEFAULT_BUFFER_SIZE;
+    reader.buffers[0].data = malloc(reader.buffer_size);
+    reader.buffers[1].data = malloc(reader.buffer_size);
+    state.matched = malloc(reader.buffer_size / 8 + 1);
+    if (!reader.buffers[0].data || !reader.buffers[1].data || !state.matched) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+    ret = grrCreateScratch(nfa, &state.scratch);
+    if (ret != GRR_RET_OK) {
+        goto done;
+    }
+
+    state.offset = lseek(fd, 0, SEEK_CUR);
+    if (state.offset < 0) {
+        state.offset = 0;
+    }
+    // Only a hint.  It fails harmlessly on pipes.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (pipe(reader.wake) == 0) {
+        if (pthread_mutex_init(&reader.lock, NULL) == 0) {
+            if (pthread_cond_init(&reader.cond, NULL) == 0) {
+                reader.threaded = (pthread_create(&thread, NULL, readAhead, &reader) == 0);
+                if (!reader.threaded) {
+                    pthread_cond_destroy(&reader.cond);
+                }
+            }
+            if (!reader.threaded) {
+                pthread_mutex_destroy(&reader.lock);
+            }
+        }
+        if (!reader.threaded) {
+            close(reader.wake[0]);
+            close(reader.wake[1]);
+        }
+    }
+
+    for (unsigned int idx = 0;; idx ^= 1) {
+        scanBuffer *buffer;
+
+        buffer = takeBuffer(&reader, idx);
+        if (buffer->length == 0) {
+            error = buffer->error;
+            ret = error ? GRR_RET_IO_ERROR : GRR_RET_OK;
+            break;
+        }
+
+        ret = scanChunk(&state, buffer->data, buffer->length);
+        giveBackBuffer(&reader);
+        if (ret != GRR_RET_OK) {
+            break;
+        }
+    }
+
+    if (reader.threaded) {
+        char wake = 0;
+
+        pthread_mutex_lock(&reader.lock);
+        reader.stop = true;
+        pthread_cond_signal(&reader.cond);
+        pthread_mutex_unlock(&reader.lock);
+        // The pipe is empty so the write can't block.  If the reader already finished, then nobody reads it.
+        while (write(reader.wake[1], &wake, 1) < 0 && errno == EINTR) {}
+        pthread_join(thread, NULL);
+        pthread_cond_destroy(&reader.cond);
+        pthread_mutex_destroy(&reader.lock);
+        close(reader.wake[0]);
+        close(reader.wake[1]);
+    }
+
+    // The last line doesn't need a line break.
+    if (ret == GRR_RET_OK && state.carry_length > 0) {
+        ret = scanLine(&state, state.carry, state.carry_length, state.carry_offset);
+    }
+    if (ret == GRR_RET_OK && !state.found) {
+        ret = GRR_RET_NOT_FOUND;
+    }
+
+done:
+
+    free(reader.buffers[0].data);
+    free(reader.buffers[1].data);
+    free(state.matched);
+    free(state.carry);
+    grrFreeScratch(state.scratch);
+    if (error) {
+        errno = error;
+    }
+    return ret;
+}
+
+static void *
+readAhead(void *arg) {
+    scanReader *reader = arg;
+
+    for (unsigned int idx = 0;; idx ^= 1) {
+        scanBuffer *buffer = &reader->buffers[idx];
+
+        pthread_mutex_lock(&reader->lock);
+        while (reader->num_full == 2 && !reader->stop) {
+            pthread_cond_wait(&reader->cond, &reader->lock);
+        }
+        if (reader->stop) {
+            pthread_mutex_unlock(&reader->lock);
+            break;
+        }
+        pthread_mutex_unlock(&reader->lock);
+
+        if (!waitForInput(reader)) {
+            break;
+        }
+        readBuffer(reader, buffer);
+
+        pthread_mutex_lock(&reader->lock);
+        reader->num_full++;
+        pthread_cond_signal(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+
+        if (buffer->length == 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns false if the scanner stopped before the file descriptor had anything to read.  Errors are left for
+ * the read to report.
+ */
+static bool
+waitForInput(scanReader *reader) {
+    struct pollfd fds[2] = {
+        {.fd = reader->fd, .events = POLLIN},
+        {.fd = reader->wake[0], .events = POLLIN},
+    };
+
+    // poll ignores negative file descriptors instead of flagging them.
+    if (reader->fd < 0) {
+        return true;
+    }
+
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) {
+            return true;
+        }
+    }
+
+    return !(fds[1].revents & POLLIN);
+}
+
+/*
+ * A single read is handed over as it is rather than waiting for the buffer to fill, so that the lines coming
+ * from a pipe are searched as soon as they arrive.
+ */
+static void
+readBuffer(scanReader *reader, scanBuffer *buffer) {
+    ssize_t amount;
+
+    do {
+        amount = read(reader->fd, buffer->data, reader->buffer_size);
+    } while (amount < 0 && errno == EINTR);
+
+    buffer->length = (amount > 0) ? (size_t)amount : 0;
+    buffer->error = (amount < 0) ? errno : 0;
+}
+
+static scanBuffer *
+takeBuffer(scanReader *reader, unsigned int idx) {
+    if (!reader->threaded) {
+        // Without the thread, the reads and the searches take turns with a single buffer.
+        readBuffer(reader, &reader->buffers[0]);
+        return &reader->buffers[0];
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    while (reader->num_full == 0) {
+        pthread_cond_wait(&reader->cond, &reader->lock);
+    }
+    pthread_mutex_unlock(&reader->lock);
+
+    return &reader->buffers[idx];
+}
+
+static void
+giveBackBuffer(scanReader *reader) {
+    if (reader->threaded) {
+        pthread_mutex_lock(&reader->lock);
+        reader->num_full--;
+        pthread_cond_signal(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+    }
+}
+
+/*
+ * Searches the lines of a buffer.  A line which began in an earlier buffer is finished off first and a line
+ * which doesn't end in this buffer is carried over to the next.
+ */
+static int
+scanChunk(scanState *state, const char *data, size_t length) {
+    int ret;
+    size_t pos = 0, complete;
+
+    if (state->skip_newline) {
+        state->skip_newline = false;
+        if (data[0] == '\n') {
+            pos = 1;
+        }
+    }
+
+    if (state->carry_length > 0) {
+        size_t lineEnd;
+
+        lineEnd = nfaLineEnd(data, length, pos);
+        ret = appendToCarry(state, data + pos, lineEnd - pos);
+        if (ret != GRR_RET_OK) {
+            return ret;
+        }
+        if (lineEnd == length) {
+            state->offset += length;
+            return GRR_RET_OK;
+        }
+
+        ret = scanLine(state, state->carry, state->carry_length, state->carry_offset);
+        if (ret != GRR_RET_OK) {
+            return ret;
+        }
+        state->carry_length = 0;
+        pos = nfaNextLine(data, length, lineEnd);
+        state->skip_newline = (pos == length && data[length - 1] == '\r');
+    }
+
+    for (complete = length; complete > pos && !IS_LINE_BREAK(data[complete - 1]); complete--) {}
+    if (complete > pos) {
+        ret = scanLines(state, data + pos, complete - pos, state->offset + pos);
+        if (ret != GRR_RET_OK) {
+            return ret;
+        }
+        state->skip_newline = (complete == length && data[length - 1] == '\r');
+    }
+
+    if (complete < length) {
+        state->carry_offset = state->offset + complete;
+        ret = appendToCarry(state, data + complete, length - complete);
+        if (ret != GRR_RET_OK) {
+            return ret;
+        }
+    }
+
+    state->offset += length;
+    return GRR_RET_OK;
+}
+
+/*
+ * Searches a run of whole lines.  The lines without a match are ruled out together by grrMatchingLines,
+ * which skips ahead with the regex's cheapest engine, and only the rest are searched for where the match is.
+ */
+static int
+scanLines(scanState *state, const char *data, size_t length, off_t offset) {
+    int ret;
+    size_t numLines, pos = 0;
+
+    // Every line has at least its line break so there can't be more lines than bytes.
+    if (grrMatchingLines(state->nfa, data, length, state->matched, length, &numLines) != GRR_RET_OK) {
+        state->line_number += numLines;
+        return GRR_RET_OK;
+    }
+
+    for (size_t line = 0; line < numLines; line++) {
+        size_t lineEnd;
+
+        lineEnd = nfaLineEnd(data, length, pos);
+        if (IS_FLAG_SET(state->matched, line)) {
+            ret = scanLine(state, data + pos, lineEnd - pos, offset + pos);
+            if (ret != GRR_RET_OK) {
+                return ret;
+            }
+        } else {
+            state->line_number++;
+        }
+        pos = nfaNextLine(data, length, lineEnd);
+    }
+
+    return GRR_RET_OK;
+}
+
+static int
+scanLine(scanState *state, const char *line, size_t length, off_t offset) {
+    int ret = GRR_RET_OK;
+    size_t start, end;
+
+    if (grrSearchWithScratch(state->nfa, state->scratch, line, length, &start, &end, NULL, false) ==
+        GRR_RET_OK) {
+        grrScanMatch match = {
+            .line = line,
+            .line_length = length,
+            .line_number = state->line_number,
+            .line_offset = offset,
+            .start = offset + start,
+            .end = offset + end,
+        };
+
+        state->found = true;
+        ret = state->callback(&match, state->arg);
+    }
+
+    state->line_number++;
+    return ret;
+}
+
+static int
+appendToCarry(scanState *state, const char *data, size_t length) {
+    if (state->carry_length + length > state->carry_capacity) {
+        size_t newCapacity;
+        char *success;
+
+        newCapacity = MAX(2 * state->carry_capacity, state->carry_length + length);
+        success = realloc(state->carry, newCapacity);
+        if (!success) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        state->carry = success;
+        state->carry_capacity = newCapacity;
+    }
+
+    memcpy(state->carry + state->carry_length, data, length);
+    state->carry_length += length;
+    return GRR_RET_OK;
+}
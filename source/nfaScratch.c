@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+#include "nfaScratch.h"
+
+int
+grrCreateScratch(grrNfa nfa, grrScratch *scratch) {
+    int ret;
+
+    if (!scratch) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    *scratch = calloc(1, sizeof(struct grrScratchStruct));
+    if (!*scratch) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    if (nfa) {
+        ret = grrGrowScratch(*scratch, nfa);
+        if (ret != GRR_RET_OK) {
+            grrFreeScratch(*scratch);
+            *scratch = NULL;
+            return ret;
+        }
+    }
+
+    return GRR_RET_OK;
+}
+
+int
+grrGrowScratch(grrScratch scratch, grrNfa nfa) {
+    if (!scratch || !nfa) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    // The +1's are for the accepting state.
+    return nfaReserveScratch(scratch, nfa->length + 1, 2 * ((size_t)nfa->length + 1), 0);
+}
+
+void
+grrFreeScratch(grrScratch scratch) {
+    if (!scratch) {
+        return;
+    }
+
+    free(scratch->records);
+    free(scratch->sets);
+    free(scratch->stamps);
+    free(scratch->stack);
+    free(scratch->active);
+    free(scratch->slots);
+    free(scratch->frames);
+    free(scratch);
+}
+
+int
+nfaReserveScratch(grrScratch scratch, unsigned int num_states, size_t num_records, size_t num_sets) {
+    // Whatever a budgeted call left in the scratch object is about to be overwritten.
+    scratch->suspension.owner = NULL;
+
+    if (num_states > scratch->state_capacity) {
+        unsigned int *stamps, *stack;
+
+        stamps = calloc(num_states, sizeof(*stamps));
+        stack = malloc(sizeof(*stack) * 2 * num_states);
+        if (!stamps || !stack) {
+            free(stamps);
+            free(stack);
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+
+        free(scratch->stamps);
+        free(scratch->stack);
+        scratch->stamps = stamps;
+        scratch->stack = stack;
+        scratch->state_capacity = num_states;
+        scratch->generation = 0;
+    }
+
+    if (num_records > scratch->record_capacity) {
+        nfaStateRecord *success;
+
+        success = realloc(scratch->records, sizeof(nfaStateRecord) * num_records);
+        if (!success) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        scratch->records = success;
+        scratch->record_capacity = num_records;
+    }
+
+    if (num_sets > scratch->set_capacity) {
+        nfaStateSet *success;
+        size_t *active;
+
+        success = realloc(scratch->sets, sizeof(nfaStateSet) * num_sets);
+        if (!success) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        scratch->sets = success;
+
+        // There are two sets for each regex but only one entry in the active list.
+        active = realloc(scratch->active, sizeof(*active) * (num_sets / 2 + 1));
+        if (!active) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        scratch->active = active;
+        scratch->set_capacity = num_sets;
+    }
+
+    return GRR_RET_OK;
+}
+
+int
+nfaReserveCaptures(grrScratch scratch, size_t num_slots, size_t num_frames) {
+    if (num_slots > scratch->slot_capacity) {
+        size_t *success;
+
+        success = realloc(scratch->slots, sizeof(*success) * num_slots);
+        if (!success) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        scratch->slots = success;
+        scratch->slot_capacity = num_slots;
+    }
+
+    if (num_frames > scratch->frame_capacity) {
+        nfaCaptureFrame *success;
+
+        success = realloc(scratch->frames, sizeof(*success) * num_frames);
+        if (!success) {
+            return GRR_RET_OUT_OF_MEMORY;
+        }
+        scratch->frames = success;
+        scratch->frame_capacity = num_frames;
+    }
+
+    return GRR_RET_OK;
+}
@@ -0,0 +1,380 @@
+#include <alloca.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfa.h"
+#include "nfaInternals.h"
+
+// grrSetFirstMatch uses a heap scratch object instead of the stack if it would need more than this.
+#define SET_MAX_STACK_SCRATCH (256 * 1024)
+
+struct grrSetStruct {
+    grrNfa *patterns;
+    size_t num_patterns;
+    nfaProgram *program;  // The patterns' states, each followed by a slot for its accepting state.
+    struct nfaDfa *dfa;
+    unsigned int *dispatch;  // For each byte, where its regexes start in candidates.
+    unsigned int *candidates;
+    unsigned int max_length;
+    size_t max_candidates;  // The most regexes which any one byte dispatches to.
+    size_t max_candidate_length;  // The most states which any one byte's regexes have between them.
+    size_t stack_scratch_size;  // What grrSetFirstMatch needs on the stack, in bytes.
+};
+
+static int
+buildSetDfa(grrSet set);
+
+static int
+buildDispatch(grrSet set);
+
+static void
+searchEachPattern(grrSet set, const char *string, size_t len, unsigned char *matched);
+
+int
+grrCreateSet(grrNfa *nfa_list, size_t num, grrSet *set) {
+    int ret;
+    grrSet new;
+
+    if (!nfa_list || num == 0 || !set) {
+        return GRR_RET_BAD_ARGS;
+    }
+    for (size_t k = 0; k < num; k++) {
+        if (!nfa_list[k]) {
+            return GRR_RET_BAD_ARGS;
+        }
+    }
+
+    new = calloc(1, sizeof(*new));
+    if (!new) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    new->patterns = malloc(sizeof(*new->patterns) * num);
+    if (!new->patterns) {
+        free(new);
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    for (size_t k = 0; k < num; k++) {
+        atomic_fetch_add(&nfa_list[k]->references, 1);
+        new->patterns[k] = nfa_list[k];
+    }
+    new->num_patterns = num;
+
+    ret = buildSetDfa(new);
+    if (ret == GRR_RET_OK) {
+        ret = buildDispatch(new);
+    }
+    if (ret != GRR_RET_OK) {
+        grrFreeSet(new);
+        return ret;
+    }
+
+    *set = new;
+    return GRR_RET_OK;
+}
+
+int
+grrSetSearch(grrSet set, const char *string, size_t len, unsigned char *matched, size_t *cursor) {
+    size_t lineEnd;
+    int ret;
+
+    if (!set || !string || !matched) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    lineEnd = nfaLineEnd(string, len, 0);
+    if (cursor) {
+        *cursor = lineEnd;
+    }
+
+    memset(matched, 0, (set->num_patterns + 7) / 8);
+    ret = nfaDfaScanLine(set->dfa, string, lineEnd, matched);
+    if (ret == GRR_NFA_DFA_GAVE_UP) {
+        memset(matched, 0, (set->num_patterns + 7) / 8);
+        searchEachPattern(set, string, lineEnd, matched);
+
+        ret = GRR_RET_NOT_FOUND;
+        for (size_t k = 0; k < (set->num_patterns + 7) / 8; k++) {
+            if (matched[k]) {
+                ret = GRR_RET_OK;
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int
+grrSetSearchMatches(grrSet set, const char *string, size_t len, grrSetMatch *matches, size_t capacity,
+                    size_t *num_matches, size_t *cursor) {
+    int ret;
+    size_t lineEnd, count = 0;
+    unsigned char *matched;
+
+    if (!set || !string || !num_matches || (!matches && capacity > 0)) {
+        return GRR_RET_BAD_ARGS;
+    }
+
+    matched = alloca((set->num_patterns + 7) / 8);
+    ret = grrSetSearch(set, string, len, matched, &lineEnd);
+    if (cursor) {
+        *cursor = lineEnd;
+    }
+
+    if (ret == GRR_RET_OK) {
+        for (size_t k = 0; k < set->num_patterns; k++) {
+            if (!IS_FLAG_SET(matched, k)) {
+                continue;
+            }
+
+            // The set only knows that the pattern matched.  Its own search finds where.
+            if (count < capacity) {
+                matches[count].id = k;
+                grrSearch(set->patterns[k], string, lineEnd, &matches[count].start, &matches[count].end, NULL,
+                          false);
+            }
+            count++;
+        }
+    }
+
+    *num_matches = count;
+    return ret;
+}
+
+ssize_t
+grrSetFirstMatch(grrSet set, const char *source, size_t size, size_t *processed, size_t *score) {
+    struct grrScratchStruct scratch;
+    unsigned char c;
+
+    if (!set || !source || size == 0 || !processed) {
+        return -1;
+    }
+
+    if (set->stack_scratch_size > SET_MAX_STACK_SCRATCH) {
+        ssize_t ret;
+        grrScratch heapScratch;
+
+        if (grrCreateScratch(NULL, &heapScratch) != GRR_RET_OK) {
+            return -1;
+        }
+        ret = grrSetFirstMatchWithScratch(set, heapScratch, source, size, processed, score);
+        grrFreeScratch(heapScratch);
+        return ret;
+    }
+
+    c = source[0];
+    scratch.records = alloca(sizeof(nfaStateRecord) * (2 * set->max_candidate_length + 1));
+    scratch.sets = alloca(sizeof(nfaStateSet) * (2 * set->max_candidates + 1));
+    scratch.stamps = alloca(sizeof(unsigned int) * (set->max_length + 1));
+    memset(scratch.stamps, 0, sizeof(unsigned int) * (set->max_length + 1));
+    scratch.stack = alloca(sizeof(unsigned int) * 2 * (set->max_length + 1));
+    scratch.active = alloca(sizeof(size_t) * (set->max_candidates + 1));
+    scratch.visits = NULL;
+    scratch.record_capacity = 2 * set->max_candidate_length;
+    scratch.set_capacity = 2 * set->max_candidates;
+    scratch.state_capacity = set->max_length + 1;
+    scratch.generation = 0;
+
+    return nfaFirstMatch(set->patterns, set->candidates + set->dispatch[c],
+                         set->dispatch[c + 1] - set->dispatch[c], &scratch, source, size, NULL, processed,
+                         score);
+}
+
+ssize_t
+grrSetFirstMatchWithScratch(grrSet set, grrScratch scratch, const char *source, size_t size,
+                            size_t *processed, size_t *score) {
+    unsigned char c;
+
+    if (!set || !scratch || !source || size == 0 || !processed) {
+        return -1;
+    }
+
+    if (nfaReserveScratch(scratch, set->max_length + 1, 2 * set->max_candidate_length,
+                          2 * set->max_candidates) != GRR_RET_OK) {
+        return -1;
+    }
+
+    c = source[0];
+    return nfaFirstMatch(set->patterns, set->candidates + set->dispatch[c],
+                         set->dispatch[c + 1] - set->dispatch[c], scratch, source, size, NULL, processed,
+                         score);
+}
+
+void
+grrFreeSet(grrSet set) {
+    if (!set) {
+        return;
+    }
+
+    free(set->dispatch);
+    free(set->candidates);
+    nfaFreeDfa(set->dfa);
+    free(set->program);
+    if (set->patterns) {
+        for (size_t k = 0; k < set->num_patterns; k++) {
+            grrFreeNfa(set->patterns[k]);
+        }
+    }
+    free(set->patterns);
+    free(set);
+}
+
+/*
+ * Lays the patterns' states out one after the other so that a single DFA can run all of them.  Since motions
+ * are relative, the states can be copied as they are.  They're thawed back into nodes and then frozen into a
+ * program of their own.
+ */
+static int
+buildSetDfa(grrSet set) {
+    int ret;
+    size_t numStates = 0, offset = 0;
+    unsigned int *accepting = NULL, *seeds = NULL, numSeeds = 0;
+    nfaNode *nodes;
+    unsigned char firstBytes[GRR_NFA_NUM_SYMBOLS / 8] = {0};
+    nfaDfaSource source;
+
+    for (size_t k = 0; k < set->num_patterns; k++) {
+        numStates += (size_t)set->patterns[k]->length + 1;
+    }
+    if (numStates > INT_MAX || set->num_patterns > INT_MAX) {
+        return GRR_RET_TOO_COMPLEX;
+    }
+
+    nodes = calloc(numStates, sizeof(*nodes));
+    accepting = calloc(numStates, sizeof(*accepting));
+    seeds = malloc(sizeof(*seeds) * set->num_patterns);
+    if (!nodes || !accepting || !seeds) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    for (size_t k = 0; k < set->num_patterns; k++) {
+        grrNfa nfa = set->patterns[k];
+
+        for (unsigned int j = 0; j < nfa->length; j++) {
+            nfaThawState(nfa->program, j, nodes + offset + j);
+        }
+        accepting[offset + nfa->length] = k + 1;
+
+        // A pattern which can't match doesn't need to be started.
+        if (nfa->min_length != GRR_NFA_UNBOUNDED) {
+            seeds[numSeeds++] = offset;
+            for (size_t j = 0; j < sizeof(firstBytes); j++) {
+                firstBytes[j] |= nfa->first_bytes[j];
+            }
+        }
+
+        offset += (size_t)nfa->length + 1;
+    }
+
+    ret = nfaCreateProgram(nodes, numStates, &set->program);
+    if (ret != GRR_RET_OK) {
+        goto done;
+    }
+
+    source.program = set->program;
+    source.num_states = numStates;
+    source.accepting = accepting;
+    source.num_patterns = set->num_patterns;
+    source.seeds = seeds;
+    source.num_seeds = numSeeds;
+    source.first_bytes = firstBytes;
+    source.memory = GRR_NFA_SET_DFA_MEMORY;
+    ret = nfaCreateDfa(&source, &set->dfa);
+
+done:
+
+    free(nodes);
+    free(accepting);
+    free(seeds);
+    return ret;
+}
+
+/*
+ * Indexes the regexes by the characters which can begin their matches so that grrSetFirstMatch only has to
+ * start the ones which could match the first character.  The lists are in ascending order of id.  Since no
+ * more regexes than one list holds are ever started together, the longest list bounds the scratch space.
+ */
+static int
+buildDispatch(grrSet set) {
+    size_t numCandidates = 0, lengths[GRR_NFA_NUM_SYMBOLS] = {0};
+
+    set->dispatch = calloc(GRR_NFA_NUM_SYMBOLS + 1, sizeof(*set->dispatch));
+    if (!set->dispatch) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    for (size_t k = 0; k < set->num_patterns; k++) {
+        grrNfa nfa = set->patterns[k];
+
+        if (nfa->length > set->max_length) {
+            set->max_length = nfa->length;
+        }
+
+        if (nfa->min_length == GRR_NFA_UNBOUNDED) {
+            continue;
+        }
+        for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+            if (IS_FLAG_SET(nfa->first_bytes, c)) {
+                set->dispatch[c + 1]++;
+                lengths[c] += nfa->length;
+                numCandidates++;
+            }
+        }
+    }
+    if (numCandidates > UINT_MAX) {
+        return GRR_RET_TOO_COMPLEX;
+    }
+
+    for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+        if (set->dispatch[c + 1] > set->max_candidates) {
+            set->max_candidates = set->dispatch[c + 1];
+        }
+        if (lengths[c] > set->max_candidate_length) {
+            set->max_candidate_length = lengths[c];
+        }
+        set->dispatch[c + 1] += set->dispatch[c];
+    }
+    set->stack_scratch_size = sizeof(nfaStateRecord) * (2 * set->max_candidate_length + 1) +
+                              sizeof(nfaStateSet) * (2 * set->max_candidates + 1) +
+                              sizeof(unsigned int) * 3 * ((size_t)set->max_length + 1) +
+                              sizeof(size_t) * (set->max_candidates + 1);
+
+    set->candidates = malloc(sizeof(*set->candidates) * (numCandidates + 1));
+    if (!set->candidates) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+
+    {
+        unsigned int fill[GRR_NFA_NUM_SYMBOLS];
+
+        memcpy(fill, set->dispatch, sizeof(fill));
+        for (size_t k = 0; k < set->num_patterns; k++) {
+            grrNfa nfa = set->patterns[k];
+
+            if (nfa->min_length == GRR_NFA_UNBOUNDED) {
+                continue;
+            }
+            for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+                if (IS_FLAG_SET(nfa->first_bytes, c)) {
+                    set->candidates[fill[c]++] = k;
+                }
+            }
+        }
+    }
+
+    return GRR_RET_OK;
+}
+
+/*
+ * The fallback for when the DFA can't make room for a line.
+ */
+static void
+searchEachPattern(grrSet set, const char *string, size_t len, unsigned char *matched) {
+    for (size_t k = 0; k < set->num_patterns; k++) {
+        if (grrSearch(set->patterns[k], string, len, NULL, NULL, NULL, false) == GRR_RET_OK) {
+            SET_FLAG(matched, k);
+        }
+    }
+}
@@ -0,0 +1,474 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfaInternals.h"
+
+/*
+ * Works out which trigrams a line must contain for a regex to match in it.  The result is a conjunction of
+ * clauses, each of which is a disjunction of trigrams.
+ *
+ * The states are visited backward from the accepting state.  For each one, two things are known about the
+ * strings which lead from it to the accepting state:  the first two characters they can begin with (fewer if
+ * they're shorter or if nothing is known) and the clauses they satisfy.  Prepending a character to a string
+ * whose first two characters are known yields a trigram which it begins with.
+ *
+ * Every state in a loop gets the same information:  nothing about how the strings begin and the clauses of
+ * the ways out of the loop, since every string has to leave through one of them.
+ *
+ * Everything is bounded so that the analysis stays cheap.  Past a bound, information is dropped, which only
+ * makes the query match more lines.
+ */
+
+#define MAX_PREFIXES 64
+#define MAX_CLAUSE   32  // Trigrams in a single clause.
+#define MAX_CLAUSES  16
+
+#define PREFIX(length, characters) ((uint32_t)(length) << 16 | (characters))
+#define PREFIX_LENGTH(prefix)      ((prefix) >> 16)
+
+/*
+ * Prefixes are encoded by PREFIX.  Each clause is stored as its length followed by its trigrams in ascending
+ * order.  The empty prefix means that nothing is known about how the strings begin.
+ */
+typedef struct trigramInfo {
+    uint32_t prefixes[MAX_PREFIXES];
+    unsigned int num_prefixes;
+    uint32_t clauses[MAX_CLAUSES * (MAX_CLAUSE + 1)];
+    unsigned int clauses_length;
+    unsigned int num_clauses;
+    bool never;  // Set if the accepting state can't be reached.
+} trigramInfo;
+
+/*
+ * The same, sized to fit, for each strongly connected component once it has been visited.
+ */
+typedef struct storedInfo {
+    uint32_t *words;  // The prefixes followed by the clauses.
+    unsigned int num_prefixes;
+    unsigned int clauses_length;
+    unsigned int num_clauses;
+    bool never;
+} storedInfo;
+
+typedef struct tarjanFrame {
+    unsigned int state;
+    unsigned int next_edge;
+} tarjanFrame;
+
+static void
+loadInfo(const storedInfo *stored, trigramInfo *info);
+
+static int
+storeInfo(const trigramInfo *info, storedInfo *stored);
+
+static void
+edgeInfo(const nfaEdge *edge, const storedInfo *target, trigramInfo *info);
+
+static void
+orInfo(trigramInfo *info, const trigramInfo *other);
+
+static void
+addClause(trigramInfo *info, const uint32_t *clause, unsigned int length);
+
+static void
+dropSubsumedClauses(trigramInfo *info);
+
+static bool
+isSubset(const uint32_t *clause1, const uint32_t *clause2);
+
+static unsigned int
+sortUnique(uint32_t *values, unsigned int length);
+
+static int
+compareWords(const void *item1, const void *item2);
+
+int
+nfaBuildTrigramQuery(grrNfa nfa, nfaTrigramQuery *query) {
+    int ret;
+    unsigned int *indices, *lows, *components, *stack;
+    unsigned int numStates = nfa->length + 1, counter = 0, depth = 0, numFrames = 0, numComponents = 0;
+    bool *onStack;
+    tarjanFrame *frames;
+    storedInfo *stored;
+    trigramInfo info, other;
+
+    *query = (nfaTrigramQuery){0};
+    if (nfa->min_length == GRR_NFA_UNBOUNDED) {
+        query->never = true;
+        return GRR_RET_OK;
+    }
+
+    indices = malloc(sizeof(*indices) * numStates);
+    lows = malloc(sizeof(*lows) * numStates);
+    components = malloc(sizeof(*components) * numStates);
+    stack = malloc(sizeof(*stack) * numStates);
+    onStack = calloc(numStates, sizeof(*onStack));
+    frames = malloc(sizeof(*frames) * numStates);
+    stored = calloc(numStates, sizeof(*stored));
+    if (!indices || !lows || !components || !stack || !onStack || !frames || !stored) {
+        ret = GRR_RET_OUT_OF_MEMORY;
+        goto done;
+    }
+    for (unsigned int k = 0; k < numStates; k++) {
+        indices[k] = components[k] = UINT_MAX;
+    }
+
+    // Tarjan's algorithm finishes each component after every component reachable from it.
+    indices[0] = lows[0] = counter++;
+    stack[depth++] = 0;
+    onStack[0] = true;
+    frames[numFrames++] = (tarjanFrame){.state = 0, .next_edge = 0};
+    while (numFrames > 0) {
+        tarjanFrame *frame = &frames[numFrames - 1];
+        unsigned int state = frame->state, count = 0, root;
+        nfaEdge edges[2];
+        bool cyclic;
+
+        if (state < nfa->length) {
+            count = nfaDecodeState(nfa->program, state, edges);
+        }
+        if (frame->next_edge < count) {
+            unsigned int target = state + edges[frame->next_edge++].motion;
+
+            if (indices[target] == UINT_MAX) {
+                indices[target] = lows[target] = counter++;
+                stack[depth++] = target;
+                onStack[target] = true;
+                frames[numFrames++] = (tarjanFrame){.state = target, .next_edge = 0};
+            } else if (onStack[target] && indices[target] < lows[state]) {
+                lows[state] = indices[target];
+            }
+            continue;
+        }
+
+        numFrames--;
+        if (numFrames > 0 && lows[state] < lows[frames[numFrames - 1].state]) {
+            lows[frames[numFrames - 1].state] = lows[state];
+        }
+        if (lows[state] != indices[state]) {
+            continue;
+        }
+
+        // state is the root of a component.  Its members are at the top of the stack.
+        root = depth;
+        do {
+            root--;
+            components[stack[root]] = numComponents;
+            onStack[stack[root]] = false;
+        } while (stack[root] != state);
+
+        cyclic = (depth - root > 1);
+        info = (trigramInfo){.never = true};
+        if (state == nfa->length) {
+            info = (trigramInfo){.prefixes = {PREFIX(0, 0)}, .num_prefixes = 1};
+        }
+        for (unsigned int k = root; k < depth; k++) {
+            unsigned int member = stack[k];
+
+            if (member == nfa->length) {
+                continue;
+            }
+            count = nfaDecodeState(nfa->program, member, edges);
+            for (unsigned int j = 0; j < count; j++) {
+                unsigned int target = member + edges[j].motion;
+
+                // Everything reachable from the component has already been finished.
+                if (components[target] == numComponents) {
+                    cyclic = true;
+                    continue;
+                }
+                edgeInfo(&edges[j], &stored[components[target]], &other);
+                orInfo(&info, &other);
+            }
+        }
+        if (cyclic && !info.never) {
+            info.prefixes[0] = PREFIX(0, 0);
+            info.num_prefixes = 1;
+        }
+
+        ret = storeInfo(&info, &stored[numComponents]);
+        if (ret != GRR_RET_OK) {
+            goto done;
+        }
+        numComponents++;
+        depth = root;
+    }
+
+    query->never = stored[components[0]].never;
+    if (!query->never && stored[components[0]].num_clauses > 0) {
+        const storedInfo *start = &stored[components[0]];
+
+        query->clauses = malloc(sizeof(*query->clauses) * start->clauses_length);
+        if (!query->clauses) {
+            ret = GRR_RET_OUT_OF_MEMORY;
+            goto done;
+        }
+        memcpy(query->clauses, start->words + start->num_prefixes,
+               sizeof(*query->clauses) * start->clauses_length);
+        query->num_clauses = start->num_clauses;
+    }
+    ret = GRR_RET_OK;
+
+done:
+
+    if (stored) {
+        for (unsigned int k = 0; k < numComponents; k++) {
+            free(stored[k].words);
+        }
+    }
+    free(indices);
+    free(lows);
+    free(components);
+    free(stack);
+    free(onStack);
+    free(frames);
+    free(stored);
+    return ret;
+}
+
+void
+nfaFreeTrigramQuery(nfaTrigramQuery *query) {
+    free(query->clauses);
+}
+
+static void
+loadInfo(const storedInfo *stored, trigramInfo *info) {
+    info->never = stored->never;
+    info->num_prefixes = stored->num_prefixes;
+    memcpy(info->prefixes, stored->words, sizeof(*info->prefixes) * stored->num_prefixes);
+    info->num_clauses = stored->num_clauses;
+    info->clauses_length = stored->clauses_length;
+    memcpy(info->clauses, stored->words + stored->num_prefixes,
+           sizeof(*info->clauses) * stored->clauses_length);
+}
+
+static int
+storeInfo(const trigramInfo *info, storedInfo *stored) {
+    stored->never = info->never;
+    stored->num_prefixes = info->num_prefixes;
+    stored->num_clauses = info->num_clauses;
+    stored->clauses_length = info->clauses_length;
+    stored->words = malloc(sizeof(*stored->words) * (info->num_prefixes + info->clauses_length + 1));
+    if (!stored->words) {
+        return GRR_RET_OUT_OF_MEMORY;
+    }
+    memcpy(stored->words, info->prefixes, sizeof(*info->prefixes) * info->num_prefixes);
+    memcpy(stored->words + info->num_prefixes, info->clauses, sizeof(*info->clauses) * info->clauses_length);
+    return GRR_RET_OK;
+}
+
+/*
+ * Works out the information for the strings which begin by crossing an edge.
+ */
+static void
+edgeInfo(const nfaEdge *edge, const storedInfo *target, trigramInfo *info) {
+    unsigned int numCharacters = 0, numTrigrams = 0;
+    bool complete = true;
+    unsigned char characters[GRR_NFA_NUM_SYMBOLS];
+    uint32_t trigrams[MAX_PREFIXES];
+
+    loadInfo(target, info);
+    if (info->never || edge->flags != 0) {
+        // Anchors and lookaheads don't consume anything.
+        return;
+    }
+
+    // No match in a line contains a line break.
+    for (unsigned int c = 0; c < GRR_NFA_NUM_SYMBOLS; c++) {
+        if (nfaEdgeAccepts(edge, c) && !IS_LINE_BREAK(c)) {
+            characters[numCharacters++] = c;
+        }
+    }
+    if (numCharacters == 0) {
+        *info = (trigramInfo){.never = true};
+        return;
+    }
+    if ((size_t)numCharacters * info->num_prefixes > MAX_PREFIXES) {
+        info->prefixes[0] = PREFIX(0, 0);
+        info->num_prefixes = 1;
+        return;
+    }
+
+    {
+        uint32_t prefixes[MAX_PREFIXES];
+        unsigned int numPrefixes = 0;
+
+        for (unsigned int k = 0; k < numCharacters; k++) {
+            for (unsigned int j = 0; j < info->num_prefixes; j++) {
+                uint32_t prefix = info->prefixes[j], c = characters[k];
+
+                switch (PREFIX_LENGTH(prefix)) {
+                case 2:
+                    trigrams[numTrigrams++] = c << 16 | (prefix & 0xffff);
+                    prefixes[numPrefixes++] = PREFIX(2, c << 8 | (prefix >> 8 & 0xff));
+                    break;
+
+                case 1:
+                    complete = false;
+                    prefixes[numPrefixes++] = PREFIX(2, c << 8 | (prefix & 0xff));
+                    break;
+
+                default:
+                    complete = false;
+                    prefixes[numPrefixes++] = PREFIX(1, c);
+                    break;
+                }
+            }
+        }
+
+        info->num_prefixes = sortUnique(prefixes, numPrefixes);
+        memcpy(info->prefixes, prefixes, sizeof(*prefixes) * info->num_prefixes);
+    }
+
+    // Only if every string has a trigram at its beginning do the trigrams make a clause.
+    if (complete) {
+        numTrigrams = sortUnique(trigrams, numTrigrams);
+        if (numTrigrams <= MAX_CLAUSE) {
+            addClause(info, trigrams, numTrigrams);
+            dropSubsumedClauses(info);
+        }
+    }
+}
+
+/*
+ * Combines the information of two sets of strings into that of their union.
+ */
+static void
+orInfo(trigramInfo *info, const trigramInfo *other) {
+    trigramInfo combined;
+
+    if (other->never) {
+        return;
+    }
+    if (info->never) {
+        *info = *other;
+        return;
+    }
+
+    if (info->num_prefixes + other->num_prefixes > MAX_PREFIXES) {
+        info->prefixes[0] = PREFIX(0, 0);
+        info->num_prefixes = 1;
+    } else {
+        memcpy(info->prefixes + info->num_prefixes, other->prefixes,
+               sizeof(*other->prefixes) * other->num_prefixes);
+        info->num_prefixes = sortUnique(info->prefixes, info->num_prefixes + other->num_prefixes);
+    }
+
+    // A string in the union satisfies a clause from each side and so it satisfies their union.
+    combined.num_clauses = combined.clauses_length = 0;
+    for (unsigned int k = 0, idx1 = 0; k < info->num_clauses; k++, idx1 += info->clauses[idx1] + 1) {
+        for (unsigned int j = 0, idx2 = 0; j < other->num_clauses; j++, idx2 += other->clauses[idx2] + 1) {
+            uint32_t merged[2 * MAX_CLAUSE];
+            unsigned int length1 = info->clauses[idx1], length2 = other->clauses[idx2], length;
+
+            if (length1 + length2 > 2 * MAX_CLAUSE) {
+                continue;
+            }
+            memcpy(merged, info->clauses + idx1 + 1, sizeof(*merged) * length1);
+            memcpy(merged + length1, other->clauses + idx2 + 1, sizeof(*merged) * length2);
+            length = sortUnique(merged, length1 + length2);
+            if (length <= MAX_CLAUSE) {
+                addClause(&combined, merged, length);
+            }
+        }
+    }
+    dropSubsumedClauses(&combined);
+
+    info->num_clauses = combined.num_clauses;
+    info->clauses_length = combined.clauses_length;
+    memcpy(info->clauses, combined.clauses, sizeof(*info->clauses) * combined.clauses_length);
+}
+
+static void
+addClause(trigramInfo *info, const uint32_t *clause, unsigned int length) {
+    if (info->num_clauses == MAX_CLAUSES) {
+        return;
+    }
+
+    info->clauses[info->clauses_length] = length;
+    memcpy(info->clauses + info->clauses_length + 1, clause, sizeof(*clause) * length);
+    info->clauses_length += length + 1;
+    info->num_clauses++;
+}
+
+/*
+ * Removes the clauses which are implied by others, i.e., those containing every trigram of another clause.
+ */
+static void
+dropSubsumedClauses(trigramInfo *info) {
+    unsigned int kept = 0, keptLength = 0;
+    unsigned int offsets[MAX_CLAUSES];
+    bool dropped[MAX_CLAUSES] = {false};
+
+    for (unsigned int k = 0, idx = 0; k < info->num_clauses; k++, idx += info->clauses[idx] + 1) {
+        offsets[k] = idx;
+    }
+    for (unsigned int k = 0; k < info->num_clauses; k++) {
+        for (unsigned int j = 0; j < info->num_clauses; j++) {
+            const uint32_t *clause1 = info->clauses + offsets[j], *clause2 = info->clauses + offsets[k];
+
+            // Of two identical clauses, the first is kept.
+            if (j != k && !dropped[j] && isSubset(clause1, clause2) && (j < k || *clause1 != *clause2)) {
+                dropped[k] = true;
+                break;
+            }
+        }
+    }
+
+    for (unsigned int k = 0; k < info->num_clauses; k++) {
+        unsigned int length = info->clauses[offsets[k]] + 1;
+
+        if (dropped[k]) {
+            continue;
+        }
+        memmove(info->clauses + keptLength, info->clauses + offsets[k], sizeof(*info->clauses) * length);
+        keptLength += length;
+        kept++;
+    }
+    info->num_clauses = kept;
+    info->clauses_length = keptLength;
+}
+
+/*
+ * Determines if every trigram of the first clause is in the second.
+ */
+static bool
+isSubset(const uint32_t *clause1, const uint32_t *clause2) {
+    unsigned int idx2 = 1;
+
+    if (*clause1 > *clause2) {
+        return false;
+    }
+
+    for (unsigned int idx1 = 1; idx1 <= *clause1; idx1++) {
+        while (idx2 <= *clause2 && clause2[idx2] < clause1[idx1]) {
+            idx2++;
+        }
+        if (idx2 > *clause2 || clause2[idx2] != clause1[idx1]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static unsigned int
+sortUnique(uint32_t *values, unsigned int length) {
+    unsigned int kept = 0;
+
+    qsort(values, length, sizeof(*values), compareWords);
+    for (unsigned int k = 0; k < length; k++) {
+        if (kept == 0 || values[kept - 1] != values[k]) {
+            values[kept++] = values[k];
+        }
+    }
+
+    return kept;
+}
+
+static int
+compareWords(const void *item1, const void *item2) {
+    uint32_t word1 = *(const uint32_t *)item1, word2 = *(const uint32_t *)item2;
+
+    return (word1 > word2) - (word1 < word2);
+}
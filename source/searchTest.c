@@ -1,17 +1,1135 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "nfa.h"
 
+typedef struct regressionCase {
+    const char *regex;
+    const char *string;
+    int expected;
+    size_t start;
+    size_t end;
+} regressionCase;
+
+static const regressionCase regressions[] = {
+    {"a{0}b{0}", "ab", GRR_RET_NOT_FOUND, 0, 0},
+    {"xa{0}b{0}y", "axyb", GRR_RET_OK, 1, 3},
+    {"(a{0}|b)1", "a1", GRR_RET_OK, 1, 2},
+    {"(a{0}|b)1", "ab1", GRR_RET_OK, 1, 3},
+    {"(|a)b", "cab", GRR_RET_OK, 1, 3},
+};
+
+static int
+runRegressions(void) {
+    int failures = 0;
+
+    for (size_t k = 0; k < sizeof(regressions) / sizeof(regressions[0]); k++) {
+        int ret;
+        size_t start = 0, end = 0;
+        grrNfa nfa;
+        const regressionCase *test = &regressions[k];
+
+        ret = grrCompile(test->regex, strlen(test->regex), &nfa);
+        if (ret == GRR_RET_OK) {
+            ret = grrSearch(nfa, test->string, strlen(test->string), &start, &end, NULL, false);
+            grrFreeNfa(nfa);
+        }
+        if (ret != test->expected || (ret == GRR_RET_OK && (start != test->start || end != test->end))) {
+            printf("\"%s\" on \"%s\": expected %i (%zu to %zu) but got %i (%zu to %zu).\n", test->regex,
+                   test->string, test->expected, test->start, test->end, ret, start, end);
+            failures++;
+        }
+    }
+
+    printf("%i of %zu regression cases failed.\n", failures, sizeof(regressions) / sizeof(regressions[0]));
+    return failures ? 1 : 0;
+}
+
+#define DFA_NUM_THREADS 4
+#define DFA_NUM_LINES   4000
+#define DFA_NUM_ROUNDS  20
+
+typedef struct dfaCase {
+    const char *regex;
+    size_t expected;  // The number of lines of the generated buffer which contain a match.
+} dfaCase;
+
+// Searched by the DFA, which is shared by the threads.  All but the last have more states than fit in a
+// shuffle table and so are built lazily.
+static const dfaCase dfaCases[] = {
+    {"[a-c]*a[a-c]{3}[0-9]", 71},
+    {"[0-3]*1[0-3]{3}[xy]", 102},
+    {"a[a-c]{3}[xy]", 40},
+    {"(ab|c)+[0-9]{2}x", 123},
+};
+
+typedef struct dfaCheck {
+    grrNfa nfa;
+    const char *buffer;
+    size_t size;
+    size_t expected;
+    int failures;
+} dfaCheck;
+
+static void *
+countInThread(void *arg) {
+    dfaCheck *check = arg;
+
+    for (int round = 0; round < DFA_NUM_ROUNDS; round++) {
+        size_t count = 0;
+        int ret;
+
+        ret = grrCount(check->nfa, check->buffer, check->size, &count);
+        if (ret != GRR_RET_OK || count != check->expected) {
+            check->failures++;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Runs grrCount from several threads at once on regexes whose lazy DFA is shared.  Each regex is also given
+ * the smallest DFA tables there are so that they're swapped out while the other threads are reading them.
+ */
+static int
+runDfaChecks(void) {
+    int failures = 0;
+    unsigned int seed = 1;
+    size_t size = 0, numCases = 0;
+    char *buffer;
+
+    buffer = malloc(DFA_NUM_LINES * 32);
+    if (!buffer) {
+        printf("Failed to allocate the DFA cases' buffer.\n");
+        return 1;
+    }
+    for (int line = 0; line < DFA_NUM_LINES; line++) {
+        static const char alphabet[] = "abcxy0123";
+
+        for (int length = line % 31; length > 0; length--) {
+            seed = seed * 1103515245 + 12345;
+            buffer[size++] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+        buffer[size++] = '\n';
+    }
+
+    for (size_t k = 0; k < sizeof(dfaCases) / sizeof(dfaCases[0]); k++) {
+        const dfaCase *test = &dfaCases[k];
+
+        for (int small = 0; small < 2; small++) {
+            grrCompileOptions options = {0};
+            dfaCheck checks[DFA_NUM_THREADS];
+            pthread_t threads[DFA_NUM_THREADS];
+            grrNfa nfa;
+            int caseFailures = 0;
+
+            options.dfa_memory = small ? 1 : 0;
+            numCases++;
+            if (grrCompileEx(test->regex, strlen(test->regex), &options, &nfa) != GRR_RET_OK) {
+                printf("\"%s\" failed to compile.\n", test->regex);
+                failures++;
+                continue;
+            }
+
+            for (int t = 0; t < DFA_NUM_THREADS; t++) {
+                checks[t] = (dfaCheck){nfa, buffer, size, test->expected, 0};
+                pthread_create(&threads[t], NULL, countInThread, &checks[t]);
+            }
+            for (int t = 0; t < DFA_NUM_THREADS; t++) {
+                pthread_join(threads[t], NULL);
+                caseFailures += checks[t].failures;
+            }
+            grrFreeNfa(nfa);
+
+            if (caseFailures > 0) {
+                printf("\"%s\"%s: %i of %i counts differed from %zu.\n", test->regex,
+                       small ? " with the smallest DFA tables" : "", caseFailures,
+                       DFA_NUM_THREADS * DFA_NUM_ROUNDS, test->expected);
+                failures++;
+            }
+        }
+    }
+
+    free(buffer);
+    printf("%i of %zu DFA cases failed.\n", failures, numCases);
+    return failures ? 1 : 0;
+}
+
+typedef struct cacheStep {
+    const char *regex;
+    unsigned int flags;
+    int expected;
+    bool hit;  // Whether the regex should be found in the cache.
+} cacheStep;
+
+// Run in order on a cache which holds two regexes.
+static const cacheStep cacheSteps[] = {
+    {"ab", 0, GRR_RET_OK, false},
+    {"ab", 0, GRR_RET_OK, true},
+    {"ab", GRR_COMPILE_CASELESS, GRR_RET_OK, false},
+    {"cd", 0, GRR_RET_OK, false},  // Evicts "ab".
+    {"ab", GRR_COMPILE_CASELESS, GRR_RET_OK, true},
+    {"ab", 0, GRR_RET_OK, false},  // Evicts "cd".
+    {"a(", 0, GRR_RET_BAD_DATA, false},
+    {"a(", 0, GRR_RET_BAD_DATA, false},  // A pattern which failed isn't cached.
+    {"cd", 0, GRR_RET_OK, false},  // Evicts "ab" with GRR_COMPILE_CASELESS.
+};
+
+/*
+ * Compiles patterns through a small cache while holding on to every regex it returns.  A hit must return the
+ * same regex as the last miss for the pattern and a miss a new one.  The evicted regexes must still work once
+ * the cache is gone.
+ */
+static int
+runCacheChecks(void) {
+    int failures = 0;
+    size_t numSteps = sizeof(cacheSteps) / sizeof(cacheSteps[0]);
+    grrNfa held[sizeof(cacheSteps) / sizeof(cacheSteps[0])] = {0};
+    grrCache cache;
+    grrCacheStats stats;
+
+    if (grrCreateCache(2, &cache) != GRR_RET_OK) {
+        printf("Failed to create a cache.\n");
+        return 1;
+    }
+
+    for (size_t k = 0; k < numSteps; k++) {
+        int ret;
+        unsigned long hits;
+        grrNfa previous = NULL;
+        grrCompileOptions options = {0};
+        const cacheStep *step = &cacheSteps[k];
+
+        for (size_t j = 0; j < k; j++) {
+            const cacheStep *earlier = &cacheSteps[j];
+
+            if (held[j] && strcmp(earlier->regex, step->regex) == 0 && earlier->flags == step->flags) {
+                previous = held[j];
+            }
+        }
+
+        grrCacheStatistics(cache, &stats);
+        hits = stats.hits;
+        options.flags = step->flags;
+        ret = grrCacheCompile(cache, step->regex, strlen(step->regex), &options, &held[k]);
+        if (ret != GRR_RET_OK) {
+            held[k] = NULL;
+        }
+        grrCacheStatistics(cache, &stats);
+
+        if (ret != step->expected || (stats.hits > hits) != step->hit ||
+            (ret == GRR_RET_OK && (held[k] == previous) != step->hit)) {
+            printf("Step %zu (\"%s\" with flags %#x): expected %i (%s) but got %i (%s, %s regex).\n", k,
+                   step->regex, step->flags, step->expected, step->hit ? "hit" : "miss", ret,
+                   (stats.hits > hits) ? "hit" : "miss", (held[k] == previous) ? "the same" : "a new");
+            failures++;
+        }
+    }
+
+    grrCacheStatistics(cache, &stats);
+    if (stats.hits != 2 || stats.misses != 7 || stats.evictions != 3 || stats.size != 2) {
+        printf("Expected 2 hits, 7 misses, 3 evictions, and 2 regexes but got %lu, %lu, %lu, and %zu.\n",
+               stats.hits, stats.misses, stats.evictions, stats.size);
+        failures++;
+    }
+    grrFreeCache(cache);
+
+    for (size_t k = 0; k < numSteps; k++) {
+        if (held[k] && grrMatch(held[k], cacheSteps[k].regex, strlen(cacheSteps[k].regex)) != GRR_RET_OK) {
+            printf("The regex from step %zu stopped working once it was evicted.\n", k);
+            failures++;
+        }
+        grrFreeNfa(held[k]);
+    }
+
+    printf("%i of %zu cache checks failed.\n", failures, numSteps + 1);
+    return failures ? 1 : 0;
+}
+
+#define UNSET_SPAN {GRR_SUBMATCH_UNSET, GRR_SUBMATCH_UNSET}
+
+typedef struct captureCase {
+    const char *regex;
+    unsigned int flags;
+    const char *string;
+    size_t numSubmatches;  // How many entries are passed to grrSearchSubmatches.
+    grrSubmatch expected[4];  // The whole match is unset if there isn't one.
+} captureCase;
+
+// The groups are those which a backtracking engine settles on for the longest of the leftmost matches.
+static const captureCase captureCases[] = {
+    {"(a|ab)(c|bcd)(d*)", GRR_COMPILE_CAPTURES, "abcd", 4, {{0, 4}, {0, 1}, {1, 4}, {4, 4}}},
+    {"(a|ab)(b*)", GRR_COMPILE_CAPTURES, "abb", 3, {{0, 3}, {0, 1}, {1, 3}}},
+    {"(a*)(a*)", GRR_COMPILE_CAPTURES, "aaa", 3, {{0, 3}, {0, 3}, {3, 3}}},
+    {"(a|b|ab)+(c?)", GRR_COMPILE_CAPTURES, "xabc", 3, {{1, 4}, {2, 3}, {3, 4}}},
+    {"([a-c]*)([b-d]*)", GRR_COMPILE_CAPTURES, "abcd", 3, {{0, 4}, {0, 3}, {3, 4}}},
+    {"(a*)(b)?c", GRR_COMPILE_CAPTURES, "xaac", 3, {{1, 4}, {1, 3}, UNSET_SPAN}},
+    {"(foo|bar)+", GRR_COMPILE_CAPTURES, "xbarfoo!", 2, {{1, 7}, {4, 7}}},
+    {"(foo|bar)+", 0, "xbarfoo!", 2, {{1, 7}, UNSET_SPAN}},
+    {"([0-9]+)-([0-9]+)", GRR_COMPILE_CAPTURES, "tel 555-1234 x", 3, {{4, 12}, {4, 7}, {8, 12}}},
+    {"(a)|(b)", GRR_COMPILE_CAPTURES, "cb", 4, {{1, 2}, UNSET_SPAN, {1, 2}, UNSET_SPAN}},
+    {"x(y)?z", GRR_COMPILE_CAPTURES, "no match", 2, {UNSET_SPAN}},
+    {"((a)b)+", GRR_COMPILE_CAPTURES, "ababx", 3, {{0, 4}, {2, 4}, {2, 3}}},
+    {"(A+)(b)", GRR_COMPILE_CAPTURES | GRR_COMPILE_CASELESS, "xaaB", 3, {{1, 4}, {1, 3}, {3, 4}}},
+    {"caf(\xc3\xa9|e)", GRR_COMPILE_CAPTURES, "un caf\xc3\xa9", 2, {{3, 8}, {6, 8}}},
+    {"(a|b)*c(d)?", GRR_COMPILE_CAPTURES, "zzabacde", 3, {{2, 7}, {4, 5}, {6, 7}}},
+    {"(x)(y)(z)", GRR_COMPILE_CAPTURES, "wxyz", 4, {{1, 4}, {1, 2}, {2, 3}, {3, 4}}},
+    {"(x)(y)(z)", GRR_COMPILE_CAPTURES, "wxyz", 2, {{1, 4}, {1, 2}}},
+};
+
+/*
+ * Checks where grrSearchSubmatches reports a match's groups and that the match itself is grrSearch's.
+ */
+static int
+runCaptureChecks(void) {
+    int failures = 0;
+
+    for (size_t k = 0; k < sizeof(captureCases) / sizeof(captureCases[0]); k++) {
+        const captureCase *test = &captureCases[k];
+        grrCompileOptions options = {0};
+        grrSubmatch submatches[4];
+        size_t len = strlen(test->string), start = 0, end = 0;
+        int ret, expected, caseFailures = 0;
+        grrNfa nfa;
+
+        options.flags = test->flags;
+        if (grrCompileEx(test->regex, strlen(test->regex), &options, &nfa) != GRR_RET_OK) {
+            printf("\"%s\" failed to compile.\n", test->regex);
+            failures++;
+            continue;
+        }
+
+        expected = (test->expected[0].start == GRR_SUBMATCH_UNSET) ? GRR_RET_NOT_FOUND : GRR_RET_OK;
+        ret = grrSearchSubmatches(nfa, test->string, len, submatches, test->numSubmatches, NULL);
+        if (ret != expected) {
+            printf("\"%s\" on \"%s\": expected %i but got %i.\n", test->regex, test->string, expected, ret);
+            caseFailures++;
+        }
+        else if (ret == GRR_RET_OK) {
+            for (size_t j = 0; j < test->numSubmatches; j++) {
+                if (submatches[j].start != test->expected[j].start ||
+                    submatches[j].end != test->expected[j].end) {
+                    printf("\"%s\" on \"%s\": submatch %zu was %zd to %zd instead of %zd to %zd.\n",
+                           test->regex, test->string, j, (ssize_t)submatches[j].start,
+                           (ssize_t)submatches[j].end, (ssize_t)test->expected[j].start,
+                           (ssize_t)test->expected[j].end);
+                    caseFailures++;
+                }
+            }
+
+            grrSearch(nfa, test->string, len, &start, &end, NULL, false);
+            if (start != submatches[0].start || end != submatches[0].end) {
+                printf("\"%s\" on \"%s\": grrSearch found %zu to %zu.\n", test->regex, test->string, start,
+                       end);
+                caseFailures++;
+            }
+        }
+
+        grrFreeNfa(nfa);
+        failures += (caseFailures > 0);
+    }
+
+    printf("%i of %zu capture cases failed.\n", failures, sizeof(captureCases) / sizeof(captureCases[0]));
+    return failures ? 1 : 0;
+}
+
+#define NUM_SET_PATTERNS (sizeof(setPatterns) / sizeof(setPatterns[0]))
+
+static const char *setPatterns[] = {"foo", "fo+", "^bar", "baz$", "[0-9]+", "a.c", "(ab|cd)e", "q?r"};
+
+static const char *setLines[] = {"foo",     "foobar", "bar baz", "abc 123",   "cde",        "xbaz",
+                                 "nothing", "",       "r",       "fooo ab9c", "abe baz\nfoo"};
+
+/*
+ * Runs every line through a regex set and checks that the set reports what grrSearch and grrFirstMatch do
+ * for each of its regexes.
+ */
+static int
+runSetChecks(void) {
+    int failures = 0;
+    size_t numLines = sizeof(setLines) / sizeof(setLines[0]);
+    grrNfa nfaList[NUM_SET_PATTERNS];
+    grrSet set;
+
+    for (size_t k = 0; k < NUM_SET_PATTERNS; k++) {
+        if (grrCompile(setPatterns[k], strlen(setPatterns[k]), &nfaList[k]) != GRR_RET_OK) {
+            printf("\"%s\" failed to compile.\n", setPatterns[k]);
+            return 1;
+        }
+    }
+    if (grrCreateSet(nfaList, NUM_SET_PATTERNS, &set) != GRR_RET_OK) {
+        printf("Failed to create the set.\n");
+        return 1;
+    }
+
+    for (size_t k = 0; k < numLines; k++) {
+        const char *line = setLines[k];
+        size_t len = strlen(line), numMatches = 0, numFound = 0, processed = 0, setProcessed = 0, score = 0,
+               setScore = 0;
+        unsigned char matched[(NUM_SET_PATTERNS + 7) / 8] = {0};
+        grrSetMatch matches[NUM_SET_PATTERNS];
+        ssize_t first, setFirst;
+        int ret, lineFailures = 0;
+
+        ret = grrSetSearch(set, line, len, matched, NULL);
+        if (grrSetSearchMatches(set, line, len, matches, NUM_SET_PATTERNS, &numMatches, NULL) != ret) {
+            lineFailures++;
+        }
+
+        for (size_t j = 0; j < NUM_SET_PATTERNS; j++) {
+            size_t start = 0, end = 0;
+            bool found;
+
+            found = grrSearch(nfaList[j], line, len, &start, &end, NULL, false) == GRR_RET_OK;
+            if (found != ((matched[j / 8] >> (j % 8)) & 1)) {
+                printf("\"%s\" on \"%s\": the set %s it.\n", setPatterns[j], line,
+                       found ? "missed" : "reported");
+                lineFailures++;
+            }
+            if (found) {
+                if (numFound >= numMatches || matches[numFound].id != j || matches[numFound].start != start ||
+                    matches[numFound].end != end) {
+                    printf("\"%s\" on \"%s\": the set didn't list the match from %zu to %zu.\n",
+                           setPatterns[j], line, start, end);
+                    lineFailures++;
+                }
+                numFound++;
+            }
+        }
+        if (numFound != numMatches || (ret == GRR_RET_OK) != (numFound > 0)) {
+            lineFailures++;
+        }
+
+        first = grrFirstMatch(nfaList, NUM_SET_PATTERNS, line, len, &processed, &score);
+        setFirst = grrSetFirstMatch(set, line, len, &setProcessed, &setScore);
+        if (setFirst != first || (first >= 0 && (setProcessed != processed || setScore != score))) {
+            printf("\"%s\": grrSetFirstMatch returned %zd (%zu of %zu) instead of %zd (%zu of %zu).\n", line,
+                   setFirst, setScore, setProcessed, first, score, processed);
+            lineFailures++;
+        }
+
+        failures += (lineFailures > 0);
+    }
+
+    grrFreeSet(set);
+    for (size_t k = 0; k < NUM_SET_PATTERNS; k++) {
+        grrFreeNfa(nfaList[k]);
+    }
+
+    printf("%i of %zu set cases failed.\n", failures, numLines);
+    return failures ? 1 : 0;
+}
+
+#define INDEX_NUM_LINES  2000
+#define INDEX_BLOCK_SIZE 256
+
+typedef struct indexCase {
+    const char *regex;
+    bool selective;  // Whether the index should rule out some blocks of the generated buffer.
+} indexCase;
+
+static const indexCase indexCases[] = {
+    {"quota", true},   {"refused|quota", true}, {"user=eve.*denied", true}, {"^err", true},
+    {"[0-9]+", false}, {"ok$", false},          {"nothing here", true},     {"0{3}[1-9]", true},
+};
+
+/*
+ * Walks an indexed buffer with grrIndexSearch and checks that it stops at the same lines and spans as
+ * grrSearch run on each line in turn.
+ */
+static int
+compareIndexSearch(grrIndex index, grrNfa nfa, const unsigned char *candidates, const char *buffer,
+                   size_t size, const char *regex) {
+    size_t from = 0, lineStart = 0;
+
+    while (lineStart < size) {
+        const char *newline;
+        size_t lineEnd, next, start = 0, end = 0, indexStart = 0, indexEnd = 0, indexCursor = 0;
+        int ret;
+
+        newline = memchr(buffer + lineStart, '\n', size - lineStart);
+        lineEnd = newline ? (size_t)(newline - buffer) : size;
+        next = newline ? lineEnd + 1 : size;
+        ret = grrSearch(nfa, buffer + lineStart, lineEnd - lineStart, &start, &end, NULL, false);
+        if (ret != GRR_RET_OK) {
+            lineStart = next;
+            continue;
+        }
+
+        ret = grrIndexSearch(index, nfa, candidates, buffer, size, from, &indexStart, &indexEnd,
+                             &indexCursor);
+        if (ret != GRR_RET_OK || indexStart != lineStart + start || indexEnd != lineStart + end ||
+            indexCursor != next) {
+            printf("\"%s\": grrIndexSearch from %zu returned %i (%zu to %zu, next line at %zu) instead of "
+                   "%zu to %zu.\n",
+                   regex, from, ret, indexStart, indexEnd, indexCursor, lineStart + start, lineStart + end);
+            return 1;
+        }
+        from = lineStart = next;
+    }
+
+    if (grrIndexSearch(index, nfa, candidates, buffer, size, from, NULL, NULL, NULL) != GRR_RET_NOT_FOUND) {
+        printf("\"%s\": grrIndexSearch found a match after %zu.\n", regex, from);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Builds an index of a generated log with small blocks, writes it to a file, and reads it back.  Both copies
+ * must count and find the same lines as grrCount and grrSearch do without an index.
+ */
+static int
+runIndexChecks(void) {
+    int failures = 0, fd;
+    unsigned int seed = 1;
+    size_t size = 0, numCases = 0;
+    char *buffer, path[] = "/tmp/searchTestIndexXXXXXX";
+    grrIndex indexes[2] = {NULL, NULL};
+
+    buffer = malloc(INDEX_NUM_LINES * 64);
+    if (!buffer) {
+        printf("Failed to allocate the index cases' buffer.\n");
+        return 1;
+    }
+    for (int line = 0; line < INDEX_NUM_LINES; line++) {
+        static const char *levels[] = {"info", "info", "warn", "err"};
+        static const char *users[] = {"ann", "bob", "eve", "sam", "kim"};
+        static const char *results[] = {"ok", "ok", "ok", "denied", "refused"};
+
+        seed = seed * 1103515245 + 12345;
+        size += sprintf(buffer + size, "%s %05i user=%s %s\n", levels[(seed >> 16) % 4], line,
+                        users[(seed >> 20) % 5], (line % 331 == 7) ? "quota" : results[(seed >> 24) % 5]);
+    }
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Failed to create a file for the index.\n");
+        free(buffer);
+        return 1;
+    }
+    close(fd);
+    if (grrBuildIndex(buffer, size, INDEX_BLOCK_SIZE, &indexes[0]) != GRR_RET_OK ||
+        grrWriteIndex(indexes[0], path) != GRR_RET_OK || grrReadIndex(path, &indexes[1]) != GRR_RET_OK ||
+        grrIndexNumBlocks(indexes[1]) != grrIndexNumBlocks(indexes[0])) {
+        printf("Failed to build, write, and read back the index.\n");
+        failures++;
+        goto done;
+    }
+
+    for (size_t k = 0; k < sizeof(indexCases) / sizeof(indexCases[0]); k++) {
+        const indexCase *test = &indexCases[k];
+        size_t numBlocks = grrIndexNumBlocks(indexes[0]), expected = 0;
+        unsigned char *candidates;
+        grrNfa nfa;
+
+        if (grrCompile(test->regex, strlen(test->regex), &nfa) != GRR_RET_OK) {
+            printf("\"%s\" failed to compile.\n", test->regex);
+            failures++;
+            continue;
+        }
+        candidates = malloc((numBlocks + 7) / 8);
+        if (!candidates || grrCount(nfa, buffer, size, &expected) != GRR_RET_OK) {
+            printf("\"%s\" couldn't be counted without the index.\n", test->regex);
+            failures++;
+            goto next;
+        }
+
+        for (int copy = 0; copy < 2; copy++) {
+            size_t count = 0, numCandidates = 0;
+            int caseFailures = 0;
+
+            numCases++;
+            if (grrIndexCandidates(indexes[copy], nfa, candidates, &numCandidates) != GRR_RET_OK ||
+                (numCandidates < numBlocks) != test->selective) {
+                printf("\"%s\": %zu of %zu blocks were candidates.\n", test->regex, numCandidates, numBlocks);
+                caseFailures++;
+            }
+            if (grrIndexCount(indexes[copy], nfa, buffer, size, &count) != GRR_RET_OK || count != expected) {
+                printf("\"%s\": grrIndexCount found %zu lines instead of %zu.\n", test->regex, count,
+                       expected);
+                caseFailures++;
+            }
+            caseFailures += compareIndexSearch(indexes[copy], nfa, candidates, buffer, size, test->regex);
+            if (grrIndexCount(indexes[copy], nfa, buffer, size - 1, &count) != GRR_RET_BAD_DATA) {
+                printf("\"%s\": grrIndexCount accepted the wrong buffer size.\n", test->regex);
+                caseFailures++;
+            }
+
+            if (caseFailures > 0) {
+                printf("\"%s\" failed with the index which was %s.\n", test->regex, copy ? "read" : "built");
+                failures++;
+            }
+        }
+
+    next:
+        free(candidates);
+        grrFreeNfa(nfa);
+    }
+
+done:
+    grrFreeIndex(indexes[0]);
+    grrFreeIndex(indexes[1]);
+    unlink(path);
+    free(buffer);
+    printf("%i of %zu index cases failed.\n", failures, numCases);
+    return failures ? 1 : 0;
+}
+
+#define NUM_BUDGET_CASES (sizeof(budgetCases) / sizeof(budgetCases[0]))
+
+typedef struct budgetCase {
+    const char *regex;
+    const char *string;
+} budgetCase;
+
+// The regexes are also tried together with grrFirstMatchWithBudget on each string.
+static const budgetCase budgetCases[] = {
+    {"ab", "xxabx"},          {"a*b", "aaaaaaab"},       {"(a|ab)(c|bcd)", "abcdx"},
+    {"^foo", "foobar"},       {"bar$", "foobar"},        {"[0-9]+x", "12 345x 6"},
+    {"a[bc]+d", "abcbcbcbe"}, {"x{3}y", "xxxxy"},        {"caf\xc3\xa9", "caf\xc3\xa9 au lait"},
+};
+
+static const size_t budgetSteps[] = {0, 1, 3, 17};
+
+/*
+ * Runs the budgeted calls with small budgets, adding the same number of steps each time one runs out, and
+ * checks that they end as the calls without a budget do.  Every call must get through at least one byte.
+ */
+static int
+runBudgetChecks(void) {
+    int failures = 0, ret;
+    size_t numChecks = 0, start, end, cursor, processed, score;
+    ssize_t index;
+    grrNfa nfaList[NUM_BUDGET_CASES];
+    grrScratch scratch = NULL;
+    grrBudget budget;
+
+    for (size_t k = 0; k < NUM_BUDGET_CASES; k++) {
+        if (grrCompile(budgetCases[k].regex, strlen(budgetCases[k].regex), &nfaList[k]) != GRR_RET_OK) {
+            printf("\"%s\" failed to compile.\n", budgetCases[k].regex);
+            return 1;
+        }
+    }
+    if (grrCreateScratch(nfaList[0], &scratch) != GRR_RET_OK) {
+        printf("Failed to create the scratch object.\n");
+        failures++;
+        goto done;
+    }
+
+    for (size_t k = 0; k < NUM_BUDGET_CASES; k++) {
+        const budgetCase *test = &budgetCases[k];
+        size_t len = strlen(test->string), expectedStart = 0, expectedEnd = 0, expectedProcessed = 0,
+               expectedScore = 0;
+        int matched, found;
+        ssize_t first;
+
+        matched = grrMatchWithScratch(nfaList[k], scratch, test->string, len);
+        found = grrSearchWithScratch(nfaList[k], scratch, test->string, len, &expectedStart, &expectedEnd,
+                                     NULL, false);
+        first = grrFirstMatchWithScratch(nfaList, NUM_BUDGET_CASES, scratch, test->string, len,
+                                         &expectedProcessed, &expectedScore);
+
+        for (size_t j = 0; j < sizeof(budgetSteps) / sizeof(budgetSteps[0]); j++) {
+            size_t steps = budgetSteps[j], numCalls, lastCursor;
+
+            numChecks += 3;
+            budget = (grrBudget){steps, false};
+            numCalls = 0;
+            lastCursor = 0;
+            while ((ret = grrMatchWithBudget(nfaList[k], scratch, test->string, len, &budget, &cursor)) ==
+                       GRR_RET_BUDGET_EXHAUSTED &&
+                   ++numCalls <= len && cursor > lastCursor) {
+                lastCursor = cursor;
+                budget.steps += steps;
+            }
+            if (ret != matched || budget.suspended) {
+                printf("\"%s\" on \"%s\" with %zu steps at a time: grrMatchWithBudget returned %i after %zu "
+                       "calls instead of %i.\n",
+                       test->regex, test->string, steps, ret, numCalls + 1, matched);
+                failures++;
+            }
+
+            budget = (grrBudget){steps, false};
+            numCalls = 0;
+            lastCursor = 0;
+            start = end = 0;
+            while ((ret = grrSearchWithBudget(nfaList[k], scratch, test->string, len, &budget, &start, &end,
+                                              &cursor)) == GRR_RET_BUDGET_EXHAUSTED &&
+                   ++numCalls <= len && cursor > lastCursor) {
+                lastCursor = cursor;
+                budget.steps += steps;
+            }
+            if (ret != found || budget.suspended ||
+                (ret == GRR_RET_OK && (start != expectedStart || end != expectedEnd))) {
+                printf("\"%s\" on \"%s\" with %zu steps at a time: grrSearchWithBudget returned %i (%zu to "
+                       "%zu) after %zu calls instead of %i (%zu to %zu).\n",
+                       test->regex, test->string, steps, ret, start, end, numCalls + 1, found, expectedStart,
+                       expectedEnd);
+                failures++;
+            }
+
+            budget = (grrBudget){steps, false};
+            numCalls = 0;
+            lastCursor = 0;
+            processed = score = 0;
+            while ((ret = grrFirstMatchWithBudget(nfaList, NUM_BUDGET_CASES, scratch, test->string, len,
+                                                  &budget, &processed, &score, &index)) ==
+                       GRR_RET_BUDGET_EXHAUSTED &&
+                   ++numCalls <= len && processed > lastCursor) {
+                lastCursor = processed;
+                budget.steps += steps;
+            }
+            if (ret != (first >= 0 ? GRR_RET_OK : GRR_RET_NOT_FOUND) || index != first || budget.suspended ||
+                (first >= 0 && (processed != expectedProcessed || score != expectedScore))) {
+                printf("\"%s\" with %zu steps at a time: grrFirstMatchWithBudget returned %i (regex %zd, %zu "
+                       "of %zu) after %zu calls instead of regex %zd (%zu of %zu).\n",
+                       test->string, steps, ret, index, score, processed, numCalls + 1, first, expectedScore,
+                       expectedProcessed);
+                failures++;
+            }
+        }
+    }
+
+    // A suspended call can only be resumed by the same function with the same arguments.
+    numChecks += 2;
+    budget = (grrBudget){2, false};
+    ret = grrSearchWithBudget(nfaList[0], scratch, "xxabx", 5, &budget, &start, &end, &cursor);
+    budget.steps = 100;
+    if (ret != GRR_RET_BUDGET_EXHAUSTED ||
+        grrMatchWithBudget(nfaList[0], scratch, "xxabx", 5, &budget, &cursor) != GRR_RET_BAD_ARGS ||
+        grrSearchWithBudget(nfaList[0], scratch, "xxabx", 5, &budget, &start, &end, &cursor) != GRR_RET_OK ||
+        start != 2 || end != 4) {
+        printf("grrMatchWithBudget resumed a suspended grrSearchWithBudget call.\n");
+        failures++;
+    }
+    budget = (grrBudget){0, false};
+    ret = grrFirstMatchWithBudget(nfaList, NUM_BUDGET_CASES, scratch, "aaaaaaab", 8, &budget, &processed,
+                                  &score, &index);
+    budget.steps = 100;
+    if (ret != GRR_RET_BUDGET_EXHAUSTED ||
+        grrFirstMatchWithBudget(nfaList, 1, scratch, "aaaaaaab", 8, &budget, &processed, &score, &index) !=
+            GRR_RET_BAD_ARGS ||
+        grrFirstMatchWithBudget(nfaList, NUM_BUDGET_CASES, scratch, "aaaaaaab", 8, &budget, &processed,
+                                &score, &index) != GRR_RET_OK ||
+        index != 1 || score != 8) {
+        printf("grrFirstMatchWithBudget resumed a suspended call with fewer regexes.\n");
+        failures++;
+    }
+
+done:
+    grrFreeScratch(scratch);
+    for (size_t k = 0; k < NUM_BUDGET_CASES; k++) {
+        grrFreeNfa(nfaList[k]);
+    }
+
+    printf("%i of %zu budget checks failed.\n", failures, numChecks);
+    return failures ? 1 : 0;
+}
+
+#define RULE_NUM_READERS  4
+#define RULE_NUM_VERSIONS 300
+
+typedef struct ruleCheck {
+    grrRuleSet rules;
+    atomic_bool *done;
+    int failures;
+} ruleCheck;
+
+/*
+ * Version v of the rules is the regexes "v<v>r0" through "v<v>r<n - 1>" where n is v % 3 + 1.  Returns
+ * whether a snapshot holds exactly those, in order, and whether its regex set finds all of them.
+ */
+static bool
+isSnapshotConsistent(const grrRuleSnapshot *snapshot) {
+    char line[64];
+    size_t len = 0;
+    unsigned char matched[1] = {0};
+
+    if (snapshot->num != snapshot->version % 3 + 1) {
+        return false;
+    }
+    for (size_t k = 0; k < snapshot->num; k++) {
+        char *name = line + len;
+        int nameLen;
+
+        nameLen = sprintf(name, "v%lur%zu", snapshot->version, k);
+        if (grrMatch(snapshot->nfa_list[k], name, nameLen) != GRR_RET_OK) {
+            return false;
+        }
+        len += nameLen;
+        line[len++] = ' ';
+    }
+
+    return grrSetSearch(snapshot->set, line, len, matched, NULL) == GRR_RET_OK &&
+           matched[0] == (1 << snapshot->num) - 1;
+}
+
+static int
+publishVersion(grrRuleSet rules, unsigned long version) {
+    grrNfa nfaList[3];
+    size_t num = version % 3 + 1, compiled;
+    int ret = GRR_RET_OK;
+
+    for (compiled = 0; compiled < num; compiled++) {
+        char regex[32];
+        int len;
+
+        len = sprintf(regex, "v%lur%zu", version, compiled);
+        ret = grrCompile(regex, len, &nfaList[compiled]);
+        if (ret != GRR_RET_OK) {
+            goto done;
+        }
+    }
+    ret = grrPublishRules(rules, nfaList, num);
+
+done:
+    // The rule set holds its own references.
+    for (size_t k = 0; k < compiled; k++) {
+        grrFreeNfa(nfaList[k]);
+    }
+    return ret;
+}
+
+static void *
+readRulesInThread(void *arg) {
+    ruleCheck *check = arg;
+    grrRuleReader reader;
+    unsigned long lastVersion = 0;
+
+    if (grrRegisterRuleReader(check->rules, &reader) != GRR_RET_OK) {
+        check->failures++;
+        return NULL;
+    }
+
+    while (!atomic_load(check->done)) {
+        grrRuleSnapshot snapshot;
+
+        if (grrEnterRules(reader, &snapshot) != GRR_RET_OK) {
+            check->failures++;
+            break;
+        }
+        if (snapshot.version < lastVersion || !isSnapshotConsistent(&snapshot)) {
+            check->failures++;
+        }
+        lastVersion = snapshot.version;
+        grrLeaveRules(reader);
+    }
+
+    grrUnregisterRuleReader(reader);
+    return NULL;
+}
+
+/*
+ * Publishes new rules over and over while other threads read them.  Every snapshot a reader gets must be one
+ * whole version, no older than the last one it got, and must stay intact until the reader leaves even though
+ * the publisher has freed its own references to the regexes.
+ */
+static int
+runRuleSetChecks(void) {
+    int failures = 0, numChecks = 0;
+    grrRuleSet rules;
+    grrRuleReader readers[RULE_NUM_READERS + 1];
+    grrRuleSnapshot held;
+    ruleCheck checks[RULE_NUM_READERS - 1];
+    pthread_t threads[RULE_NUM_READERS - 1];
+    atomic_bool done = false;
+
+    if (grrCreateRuleSet(RULE_NUM_READERS, &rules) != GRR_RET_OK) {
+        printf("Failed to create the rule set.\n");
+        return 1;
+    }
+
+    numChecks++;
+    for (int k = 0; k < RULE_NUM_READERS; k++) {
+        if (grrRegisterRuleReader(rules, &readers[k]) != GRR_RET_OK) {
+            printf("Failed to register reader %i.\n", k);
+            failures++;
+        }
+    }
+    if (failures > 0 || grrRegisterRuleReader(rules, &readers[RULE_NUM_READERS]) != GRR_RET_NOT_FOUND) {
+        printf("More than %i readers were registered.\n", RULE_NUM_READERS);
+        grrFreeRuleSet(rules);
+        return 1;
+    }
+    for (int k = 1; k < RULE_NUM_READERS; k++) {
+        grrUnregisterRuleReader(readers[k]);
+    }
+
+    numChecks++;
+    if (grrEnterRules(readers[0], &held) != GRR_RET_NOT_FOUND) {
+        printf("A snapshot was entered before any rules were published.\n");
+        failures++;
+    }
+    if (publishVersion(rules, 1) != GRR_RET_OK || grrEnterRules(readers[0], &held) != GRR_RET_OK) {
+        printf("Failed to publish and enter the first rules.\n");
+        grrUnregisterRuleReader(readers[0]);
+        grrFreeRuleSet(rules);
+        return 1;
+    }
+
+    for (int t = 0; t < RULE_NUM_READERS - 1; t++) {
+        checks[t] = (ruleCheck){rules, &done, 0};
+        pthread_create(&threads[t], NULL, readRulesInThread, &checks[t]);
+    }
+    for (unsigned long version = 2; version <= RULE_NUM_VERSIONS; version++) {
+        if (publishVersion(rules, version) != GRR_RET_OK) {
+            printf("Failed to publish version %lu.\n", version);
+            failures++;
+            break;
+        }
+    }
+    atomic_store(&done, true);
+    for (int t = 0; t < RULE_NUM_READERS - 1; t++) {
+        pthread_join(threads[t], NULL);
+        numChecks++;
+        if (checks[t].failures > 0) {
+            printf("Reader %i got %i inconsistent snapshots.\n", t + 1, checks[t].failures);
+            failures++;
+        }
+    }
+
+    numChecks++;
+    if (held.version != 1 || !isSnapshotConsistent(&held)) {
+        printf("The first snapshot changed while it was held.\n");
+        failures++;
+    }
+    grrLeaveRules(readers[0]);
+
+    numChecks++;
+    if (grrPublishRules(rules, NULL, 0) != GRR_RET_OK || grrEnterRules(readers[0], &held) != GRR_RET_OK ||
+        held.num != 0 || held.set || held.version != RULE_NUM_VERSIONS + 1) {
+        printf("The empty rules weren't published.\n");
+        failures++;
+    }
+    grrLeaveRules(readers[0]);
+
+    grrUnregisterRuleReader(readers[0]);
+    grrFreeRuleSet(rules);
+    printf("%i of %i rule set checks failed.\n", failures, numChecks);
+    return failures ? 1 : 0;
+}
+
+#define SCAN_NUM_LINES 300
+#define SCAN_MAX_FOUND (SCAN_NUM_LINES + 1)
+#define SCAN_STOPPED   (-1)  // Returned by the callback to stop the scan.
+
+typedef struct scanCheck {
+    const char *content;
+    off_t base;  // The offset of content[0] as reported by grrScanFd.
+    grrScanMatch found[SCAN_MAX_FOUND];
+    size_t numFound;
+    size_t stopAfter;  // The callback stops the scan once it has seen this many matches.
+    int failures;
+} scanCheck;
+
+static int
+collectScanMatch(const grrScanMatch *match, void *arg) {
+    scanCheck *check = arg;
+
+    if (check->numFound == SCAN_MAX_FOUND || match->line_offset < check->base ||
+        memcmp(match->line, check->content + (match->line_offset - check->base), match->line_length) != 0) {
+        check->failures++;
+        return GRR_RET_BAD_DATA;
+    }
+
+    check->found[check->numFound++] = *match;
+    return (check->numFound == check->stopAfter) ? SCAN_STOPPED : GRR_RET_OK;
+}
+
+/*
+ * Finds what grrScanFd should report for content, whose first character is at base, by running grrSearch on
+ * each line.
+ */
+static size_t
+expectScanMatches(grrNfa nfa, const char *content, size_t size, off_t base, grrScanMatch *expected) {
+    size_t numExpected = 0, lineNumber = 0;
+
+    for (size_t lineStart = 0; lineStart < size; lineNumber++) {
+        size_t lineEnd = lineStart, start, end;
+
+        while (lineEnd < size && content[lineEnd] != '\n' && content[lineEnd] != '\r') {
+            lineEnd++;
+        }
+        if (grrSearch(nfa, content + lineStart, lineEnd - lineStart, &start, &end, NULL, false) ==
+            GRR_RET_OK) {
+            expected[numExpected++] = (grrScanMatch){content + lineStart, lineEnd - lineStart, lineNumber,
+                                                     base + lineStart, base + lineStart + start,
+                                                     base + lineStart + end};
+        }
+
+        lineStart = lineEnd;
+        if (lineStart < size && content[lineStart] == '\r' && lineStart + 1 < size &&
+            content[lineStart + 1] == '\n') {
+            lineStart++;
+        }
+        lineStart++;
+    }
+
+    return numExpected;
+}
+
+static bool
+areScanMatchesEqual(const grrScanMatch *found, const grrScanMatch *expected, size_t num) {
+    for (size_t k = 0; k < num; k++) {
+        if (found[k].line_length != expected[k].line_length ||
+            found[k].line_number != expected[k].line_number ||
+            found[k].line_offset != expected[k].line_offset || found[k].start != expected[k].start ||
+            found[k].end != expected[k].end) {
+            printf("Match %zu was on line %zu at %lld (%lld to %lld) instead of line %zu at %lld (%lld to "
+                   "%lld).\n",
+                   k, found[k].line_number, (long long)found[k].line_offset, (long long)found[k].start,
+                   (long long)found[k].end, expected[k].line_number, (long long)expected[k].line_offset,
+                   (long long)expected[k].start, (long long)expected[k].end);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Scans a generated file, part of it, and a pipe with read buffers small enough that lines, including "\r\n"
+ * line breaks, straddle reads.  grrScanFd must report the same lines and spans as grrSearch does on each
+ * line.
+ */
+static int
+runScanChecks(void) {
+    static const size_t bufferSizes[] = {7, 16, 61, 0};
+    static const char regex[] = "err(or)? [0-9]+";
+    int failures = 0, numChecks = 0, fd = -1, pipeFds[2], ret;
+    unsigned int seed = 1;
+    size_t size = 0, skipped, numExpected;
+    char *content = NULL, path[] = "/tmp/searchTestScanXXXXXX";
+    grrScanMatch *expected = NULL;
+    scanCheck *check = NULL;
+    grrNfa nfa;
+
+    if (grrCompile(regex, strlen(regex), &nfa) != GRR_RET_OK) {
+        printf("\"%s\" failed to compile.\n", regex);
+        return 1;
+    }
+    content = malloc(SCAN_NUM_LINES * 32 + 128);
+    expected = malloc(sizeof(*expected) * SCAN_MAX_FOUND);
+    check = malloc(sizeof(*check));
+    if (!content || !expected || !check) {
+        printf("Failed to allocate the scan cases' buffers.\n");
+        failures++;
+        goto done;
+    }
+    for (int line = 0; line < SCAN_NUM_LINES; line++) {
+        static const char *formats[] = {"error %u", "warning %u", "ok", "%u err %u", "error"};
+
+        seed = seed * 1103515245 + 12345;
+        if (line == SCAN_NUM_LINES / 2) {
+            // Longer than all of the buffers but the default one.
+            memset(content + size, 'x', 100);
+            size += 100;
+        }
+        size += sprintf(content + size, formats[(seed >> 16) % 5], (seed >> 20) % 1000, (unsigned int)line);
+        size += sprintf(content + size, "%s", (line % 5 == 0) ? "\r\n" : (line % 7 == 0) ? "\r" : "\n");
+    }
+    size += sprintf(content + size, "no line break error 5");
+
+    fd = mkstemp(path);
+    if (fd < 0 || write(fd, content, size) != (ssize_t)size) {
+        printf("Failed to write the file to be scanned.\n");
+        failures++;
+        goto done;
+    }
+
+    numExpected = expectScanMatches(nfa, content, size, 0, expected);
+    for (size_t k = 0; k < sizeof(bufferSizes) / sizeof(bufferSizes[0]); k++) {
+        numChecks++;
+        *check = (scanCheck){.content = content};
+        lseek(fd, 0, SEEK_SET);
+        ret = grrScanFd(nfa, fd, bufferSizes[k], collectScanMatch, check);
+        if (ret != GRR_RET_OK || check->failures > 0 || check->numFound != numExpected ||
+            !areScanMatchesEqual(check->found, expected, numExpected)) {
+            printf("Scanning the file with %zu-byte buffers returned %i with %zu of %zu matches.\n",
+                   bufferSizes[k], ret, check->numFound, numExpected);
+            failures++;
+        }
+    }
+
+    // Offsets are from the beginning of the file but lines are counted from where reading started.
+    numChecks++;
+    skipped = strchr(content, '\n') - content + 1;
+    numExpected = expectScanMatches(nfa, content + skipped, size - skipped, skipped, expected);
+    *check = (scanCheck){.content = content + skipped, .base = skipped};
+    lseek(fd, skipped, SEEK_SET);
+    ret = grrScanFd(nfa, fd, 16, collectScanMatch, check);
+    if (ret != GRR_RET_OK || check->failures > 0 || check->numFound != numExpected ||
+        !areScanMatchesEqual(check->found, expected, numExpected)) {
+        printf("Scanning the file from %zu returned %i with %zu of %zu matches.\n", skipped, ret,
+               check->numFound, numExpected);
+        failures++;
+    }
+
+    // The callback's value stops the scan.
+    numChecks++;
+    *check = (scanCheck){.content = content, .stopAfter = 3};
+    lseek(fd, 0, SEEK_SET);
+    ret = grrScanFd(nfa, fd, 16, collectScanMatch, check);
+    if (ret != SCAN_STOPPED || check->numFound != 3) {
+        printf("The callback didn't stop the scan: it returned %i after %zu matches.\n", ret,
+               check->numFound);
+        failures++;
+    }
+
+    // A pipe can't seek, so its offsets start from 0.  The content fits in the pipe's buffer.
+    numChecks++;
+    numExpected = expectScanMatches(nfa, content, size, 0, expected);
+    *check = (scanCheck){.content = content};
+    if (pipe(pipeFds) != 0) {
+        printf("Failed to create a pipe.\n");
+        failures++;
+        goto done;
+    }
+    ret = (write(pipeFds[1], content, size) == (ssize_t)size) ? GRR_RET_OK : GRR_RET_IO_ERROR;
+    close(pipeFds[1]);
+    if (ret == GRR_RET_OK) {
+        ret = grrScanFd(nfa, pipeFds[0], 16, collectScanMatch, check);
+    }
+    close(pipeFds[0]);
+    if (ret != GRR_RET_OK || check->failures > 0 || check->numFound != numExpected ||
+        !areScanMatchesEqual(check->found, expected, numExpected)) {
+        printf("Scanning a pipe returned %i with %zu of %zu matches.\n", ret, check->numFound, numExpected);
+        failures++;
+    }
+
+done:
+    if (fd >= 0) {
+        close(fd);
+        unlink(path);
+    }
+    free(check);
+    free(expected);
+    free(content);
+    grrFreeNfa(nfa);
+    printf("%i of %i scan checks failed.\n", failures, numChecks);
+    return failures ? 1 : 0;
+}
+
 int
 main(int argc, char **argv) {
     int ret;
     size_t start, end;
     grrNfa nfa;
 
+    if (argc == 2 && strcmp(argv[1], "--check") == 0) {
+        return runRegressions() | runDfaChecks() | runCacheChecks() | runCaptureChecks() | runSetChecks() |
+               runRuleSetChecks() | runIndexChecks() | runScanChecks() | runBudgetChecks();
+    }
     if (argc < 3) {
         fprintf(stderr, "Missing arguments\n");
         fprintf(stderr, "Usage: %s <regex> <string>\n", argv[0]);
+        fprintf(stderr, "       %s --check\n", argv[0]);
         return -1;
     }
 
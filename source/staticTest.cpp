@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+extern "C" {
+#include "nfa.h"
+}
+
+#include "grr.hpp"
+
+// Patterns are parsed while this file is compiled, so these are checked before anything runs.
+static_assert(grr::static_regex<"a[bc]+d">::match("abccd"));
+static_assert(!grr::static_regex<"a[bc]+d">::match("abcde"));
+static_assert(grr::static_regex<"b+">::search("abbc").end == 3);
+
+static constexpr std::string_view inputs[] = {
+    "", "a", "abc", "xabcx", "abbbcd", "ABC", "aBc", "foo bar", "foobar", "barfoo", "bar\nfoo", "xxy", "xxxy",
+    "xxxxy", "ababcde", "cde", "123", "a1b22c", "abcd", "abcdbcd", "\xc3\xa9", "caf\xc3\xa9", "zzz",
+    "  leading", "tail  ", "e", "ab\rcd",
+};
+
+/*
+ * Runs every input through a static regex and through the library with the same pattern and flags.
+ */
+template <grr::fixed_string Pattern, unsigned int Flags = 0>
+static int
+checkPattern(void) {
+    using regex = grr::static_regex<Pattern, Flags>;
+    int failures = 0;
+    grrCompileOptions options = {};
+    grrNfa nfa;
+
+    options.flags = Flags;
+    if (grrCompileEx(regex::pattern().data(), regex::pattern().size(), &options, &nfa) != GRR_RET_OK) {
+        std::printf("\"%s\" failed to compile.\n", regex::pattern().data());
+        return 1;
+    }
+
+    for (std::string_view input : inputs) {
+        bool matched;
+        size_t start = 0, end = 0, cursor = 0;
+        int ret;
+        grr::search_result result;
+
+        matched = grrMatch(nfa, input.data(), input.size()) == GRR_RET_OK;
+        if (regex::match(input) != matched) {
+            std::printf("\"%s\" on \"%.*s\": static_regex::match returned %i but grrMatch returned %i.\n",
+                        regex::pattern().data(), (int)input.size(), input.data(), !matched, matched);
+            failures++;
+        }
+
+        ret = grrSearch(nfa, input.data(), input.size(), &start, &end, &cursor, false);
+        result = regex::search(input);
+        if (result.found != (ret == GRR_RET_OK) || result.cursor != cursor ||
+            (result.found && (result.start != start || result.end != end))) {
+            std::printf("\"%s\" on \"%.*s\": static_regex::search found %i (%zu to %zu, stopped at %zu) but "
+                        "grrSearch found %i (%zu to %zu, stopped at %zu).\n",
+                        regex::pattern().data(), (int)input.size(), input.data(), result.found, result.start,
+                        result.end, result.cursor, ret == GRR_RET_OK, start, end, cursor);
+            failures++;
+        }
+    }
+
+    grrFreeNfa(nfa);
+    return failures;
+}
+
+int
+main(int argc, char **argv) {
+    int failures = 0, numPatterns = 0;
+
+    if (argc != 2 || std::strcmp(argv[1], "--check") != 0) {
+        std::fprintf(stderr, "Usage: %s --check\n", argv[0]);
+        return -1;
+    }
+
+    for (int patternFailures : {
+             checkPattern<"abc">(),
+             checkPattern<"a[bc]+d">(),
+             checkPattern<"(ab|cd)*e">(),
+             checkPattern<"^foo">(),
+             checkPattern<"bar$">(),
+             checkPattern<"^bar$">(),
+             checkPattern<"x{3}y">(),
+             checkPattern<"[^a-c]+">(),
+             checkPattern<"(a|ab)(c|bcd)">(),
+             checkPattern<"[0-9]+">(),
+             checkPattern<"a?b?c?">(),
+             checkPattern<"\xc3\xa9|z+">(),
+             checkPattern<"abc", GRR_COMPILE_CASELESS>(),
+             checkPattern<"[a-b]+c", GRR_COMPILE_CASELESS>(),
+         }) {
+        failures += (patternFailures > 0);
+        numPatterns++;
+    }
+
+    std::printf("%i of %i static_regex patterns failed.\n", failures, numPatterns);
+    return failures ? 1 : 0;
+}